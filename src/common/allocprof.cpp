@@ -0,0 +1,124 @@
+#include <windows.h>
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "allocprof.h"
+
+static std::atomic<bool> enabled(false);
+static std::mutex lock;
+static AllocStats stats;
+static thread_local LPCSTR currentSite = nullptr;
+
+static DWORD Bucket(SIZE_T size) {
+  DWORD bucket = 0;
+  while (size > 1 && bucket < AllocStats::HistogramBuckets - 1) {
+    size >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+static void Record(SIZE_T size) {
+  stats.bytes += size;
+  ++stats.histogram[Bucket(size)];
+  auto &site = stats.sites[currentSite ? currentSite : "(other)"];
+  ++site.allocations;
+  site.bytes += size;
+}
+
+void AllocProfiler::Enable(bool enable) {
+  enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool AllocProfiler::Enabled() {
+  return enabled.load(std::memory_order_relaxed);
+}
+
+void AllocProfiler::Reset() {
+  std::lock_guard<std::mutex> guard(lock);
+  stats = AllocStats();
+}
+
+AllocStats AllocProfiler::Snapshot() {
+  std::lock_guard<std::mutex> guard(lock);
+  return stats;
+}
+
+void AllocProfiler::OnAlloc(SIZE_T size) {
+  if (!Enabled()) return;
+  std::lock_guard<std::mutex> guard(lock);
+  ++stats.allocations;
+  Record(size);
+  stats.liveBytes += size;
+  stats.peakLiveBytes = max(stats.peakLiveBytes, stats.liveBytes);
+}
+
+void AllocProfiler::OnReAlloc(SIZE_T oldSize, SIZE_T newSize) {
+  if (!Enabled()) return;
+  std::lock_guard<std::mutex> guard(lock);
+  ++stats.allocations;
+  ++stats.reallocations;
+  Record(newSize);
+  // The block may have been allocated before profiling started.
+  stats.liveBytes -= min(stats.liveBytes, oldSize);
+  stats.liveBytes += newSize;
+  stats.peakLiveBytes = max(stats.peakLiveBytes, stats.liveBytes);
+}
+
+void AllocProfiler::OnFree(SIZE_T size) {
+  if (!Enabled()) return;
+  std::lock_guard<std::mutex> guard(lock);
+  ++stats.frees;
+  stats.liveBytes -= min(stats.liveBytes, size);
+}
+
+void AllocProfiler::Report(std::wostream &os) {
+  const AllocStats s = Snapshot();
+  os << std::dec
+     << L"Allocations: " << s.allocations
+     << L" (" << s.reallocations << L" reallocations)"
+     << L", frees: " << s.frees
+     << L", bytes: " << s.bytes << L"\r\n"
+     << L"Live: " << s.liveBytes
+     << L" bytes, peak: " << s.peakLiveBytes << L" bytes\r\n";
+
+  std::vector<std::pair<std::string, AllocSiteStats>> sites(s.sites.begin(),
+                                                            s.sites.end());
+  std::sort(sites.begin(), sites.end(), [](const auto &a, const auto &b) {
+    return a.second.bytes > b.second.bytes;
+  });
+  os << std::left << std::setw(32) << L"Site"
+     << std::right << std::setw(12) << L"Allocs"
+     << std::setw(14) << L"Bytes" << L"\r\n";
+  for (const auto &it : sites) {
+    os << std::left << std::setw(32)
+       << std::wstring(it.first.begin(), it.first.end())
+       << std::right << std::setw(12) << it.second.allocations
+       << std::setw(14) << it.second.bytes << L"\r\n";
+  }
+
+  os << L"Size histogram:\r\n";
+  for (DWORD i = 0; i < AllocStats::HistogramBuckets; ++i) {
+    if (s.histogram[i] == 0) continue;
+    os << L"  < " << std::left << std::setw(10) << (ULONGLONG(2) << i)
+       << std::right << std::setw(12) << s.histogram[i] << L"\r\n";
+  }
+}
+
+AllocSite::AllocSite(LPCSTR name) : previous_(currentSite) {
+  currentSite = name;
+}
+
+AllocSite::~AllocSite() {
+  currentSite = previous_;
+}
+
+LPCSTR AllocSite::Current() {
+  return currentSite;
+}
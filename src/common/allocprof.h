@@ -0,0 +1,89 @@
+struct AllocSiteStats {
+  ULONGLONG allocations;
+  ULONGLONG bytes;
+
+  AllocSiteStats() : allocations(0), bytes(0) {}
+};
+
+struct AllocStats {
+  // Bucket i counts requests of [2^i, 2^(i+1)) bytes; bucket 0 also takes
+  // empty ones.
+  static const DWORD HistogramBuckets = 32;
+
+  ULONGLONG allocations;    // reallocations included
+  ULONGLONG reallocations;
+  ULONGLONG frees;
+  ULONGLONG bytes;          // total requested
+  SIZE_T liveBytes;
+  SIZE_T peakLiveBytes;
+  ULONGLONG histogram[HistogramBuckets];
+  std::map<std::string, AllocSiteStats> sites;
+
+  AllocStats()
+    : allocations(0),
+      reallocations(0),
+      frees(0),
+      bytes(0),
+      liveBytes(0),
+      peakLiveBytes(0),
+      histogram()
+  {}
+};
+
+// Opt-in accounting of the allocations made by Blob and the classes that
+// hand out Blobs.  Nothing is recorded until Enable(true), and the hooks
+// cost one relaxed load while it is off.  Allocations are attributed to
+// the innermost AllocSite on the calling thread, or to "(other)".
+class AllocProfiler {
+public:
+  static void Enable(bool enable);
+  static bool Enabled();
+  static void Reset();
+  static AllocStats Snapshot();
+  // Writes totals, the per-site table (largest first) and the histogram.
+  static void Report(std::wostream &os);
+
+  static void OnAlloc(SIZE_T size);
+  static void OnReAlloc(SIZE_T oldSize, SIZE_T newSize);
+  static void OnFree(SIZE_T size);
+};
+
+// Names the call site for allocations made on this thread while it is in
+// scope.  |name| must outlive the scope; a string literal is expected.
+class AllocSite {
+private:
+  LPCSTR previous_;
+
+public:
+  AllocSite(LPCSTR name);
+  ~AllocSite();
+
+  static LPCSTR Current();
+};
+
+// An std::allocator that reports to AllocProfiler, for the containers that
+// Blob uses internally.
+template<class T>
+struct ProfiledAllocator {
+  typedef T value_type;
+
+  ProfiledAllocator() {}
+  template<class U>
+  ProfiledAllocator(const ProfiledAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    T *p = std::allocator<T>().allocate(n);
+    AllocProfiler::OnAlloc(n * sizeof(T));
+    return p;
+  }
+
+  void deallocate(T *p, size_t n) {
+    AllocProfiler::OnFree(n * sizeof(T));
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template<class U>
+  bool operator==(const ProfiledAllocator<U> &) const { return true; }
+  template<class U>
+  bool operator!=(const ProfiledAllocator<U> &) const { return false; }
+};
@@ -0,0 +1,390 @@
+#include <windows.h>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+#include "archive.h"
+
+void Log(LPCWSTR Format, ...);
+
+static_assert(sizeof(KeyArchiveHeader) == KeyArchiveFormat::Alignment,
+              "The first payload must start right after the header");
+static_assert(sizeof(KeyArchiveEntry) == 32, "KeyArchiveEntry layout");
+
+namespace {
+
+constexpr DWORD WriteBufferSize = 64 * 1024;
+
+constexpr std::array<DWORD, 256> MakeCrcTable() {
+  std::array<DWORD, 256> table = {};
+  for (DWORD i = 0; i < 256; ++i) {
+    DWORD c = i;
+    for (int k = 0; k < 8; ++k) {
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+constexpr auto crcTable = MakeCrcTable();
+
+int CompareKey(LPCWSTR a, DWORD alen, DWORD aspec, DWORD atype,
+               LPCWSTR b, DWORD blen, DWORD bspec, DWORD btype) {
+  if (int c = wmemcmp(a, b, min(alen, blen))) return c;
+  if (alen != blen) return alen < blen ? -1 : 1;
+  if (aspec != bspec) return aspec < bspec ? -1 : 1;
+  if (atype != btype) return atype < btype ? -1 : 1;
+  return 0;
+}
+
+}  // namespace
+
+DWORD KeyArchiveFormat::Crc32(LPCBYTE data, DWORD size) {
+  DWORD crc = 0xffffffff;
+  for (DWORD i = 0; i < size; ++i) {
+    crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void KeyArchiveWriter::Release() {
+  if (file_ != INVALID_HANDLE_VALUE) {
+    // Never leave a file behind that looks like an archive but is not.
+    CloseHandle(file_);
+    DeleteFile(filename_.c_str());
+  }
+  file_ = INVALID_HANDLE_VALUE;
+  buffer_.clear();
+  entries_.clear();
+  offset_ = 0;
+}
+
+KeyArchiveWriter::KeyArchiveWriter()
+  : file_(INVALID_HANDLE_VALUE), flags_(0), offset_(0)
+{}
+
+KeyArchiveWriter::~KeyArchiveWriter() {
+  Release();
+}
+
+bool KeyArchiveWriter::Flush() {
+  if (buffer_.empty()) return true;
+  DWORD bytesWritten = 0;
+  if (!WriteFile(file_,
+                 buffer_.data(),
+                 static_cast<DWORD>(buffer_.size()),
+                 &bytesWritten,
+                 nullptr)
+      || bytesWritten != buffer_.size()) {
+    Log(L"WriteFile failed - %08x\n", GetLastError());
+    return false;
+  }
+  buffer_.clear();
+  return true;
+}
+
+bool KeyArchiveWriter::Write(LPCVOID data, DWORD size) {
+  auto p = reinterpret_cast<LPCBYTE>(data);
+  offset_ += size;
+  if (buffer_.size() + size <= WriteBufferSize) {
+    buffer_.insert(buffer_.end(), p, p + size);
+    return buffer_.size() < WriteBufferSize || Flush();
+  }
+
+  // Too large to coalesce; write it through after what is pending.
+  DWORD bytesWritten = 0;
+  if (!Flush()) return false;
+  if (!WriteFile(file_, p, size, &bytesWritten, nullptr)
+      || bytesWritten != size) {
+    Log(L"WriteFile failed - %08x\n", GetLastError());
+    return false;
+  }
+  return true;
+}
+
+bool KeyArchiveWriter::Pad() {
+  static const BYTE zeros[KeyArchiveFormat::Alignment] = {};
+  const DWORD rem = static_cast<DWORD>(offset_ % KeyArchiveFormat::Alignment);
+  return rem == 0 || Write(zeros, KeyArchiveFormat::Alignment - rem);
+}
+
+bool KeyArchiveWriter::Create(LPCWSTR filename, DWORD flags) {
+  Release();
+  file_ = CreateFile(filename,
+                     GENERIC_WRITE,
+                     0,
+                     nullptr,
+                     CREATE_ALWAYS,
+                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                     nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+  filename_ = filename;
+  flags_ = flags;
+  buffer_.reserve(WriteBufferSize);
+
+  // Placeholder, rewritten by Finish().
+  const KeyArchiveHeader header = {};
+  return Write(&header, sizeof(header));
+}
+
+bool KeyArchiveWriter::Add(LPCWSTR container,
+                           DWORD keySpec,
+                           DWORD blobType,
+                           LPCBYTE blob,
+                           DWORD size) {
+  if (file_ == INVALID_HANDLE_VALUE || !container || (!blob && size)) {
+    return false;
+  }
+  if (!Pad()) return false;
+
+  PendingEntry pending;
+  pending.entry = {};
+  pending.entry.offset = offset_;
+  pending.entry.size = size;
+  pending.entry.checksum = (flags_ & KeyArchiveFormat::FlagChecksums)
+                           ? KeyArchiveFormat::Crc32(blob, size) : 0;
+  pending.entry.keySpec = keySpec;
+  pending.entry.blobType = blobType;
+  pending.container = container;
+  if (!Write(blob, size)) return false;
+  entries_.push_back(std::move(pending));
+  return true;
+}
+
+bool KeyArchiveWriter::Finish() {
+  if (file_ == INVALID_HANDLE_VALUE || !Pad()) return false;
+
+  std::sort(entries_.begin(),
+            entries_.end(),
+            [](const PendingEntry &a, const PendingEntry &b) {
+              return CompareKey(a.container.c_str(),
+                                static_cast<DWORD>(a.container.size()),
+                                a.entry.keySpec,
+                                a.entry.blobType,
+                                b.container.c_str(),
+                                static_cast<DWORD>(b.container.size()),
+                                b.entry.keySpec,
+                                b.entry.blobType) < 0;
+            });
+
+  // Entries of the same container share one copy of its name.
+  std::vector<WCHAR> strings;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    auto &it = entries_[i];
+    if (i > 0 && it.container == entries_[i - 1].container) {
+      it.entry.name = entries_[i - 1].entry.name;
+    }
+    else {
+      it.entry.name = static_cast<DWORD>(strings.size());
+      strings.insert(strings.end(), it.container.begin(), it.container.end());
+      strings.push_back(0);
+    }
+    it.entry.nameLength = static_cast<DWORD>(it.container.size());
+  }
+
+  KeyArchiveHeader header = {};
+  header.magic = KeyArchiveFormat::Magic;
+  header.version = KeyArchiveFormat::Version;
+  header.flags = flags_;
+  header.entryCount = static_cast<DWORD>(entries_.size());
+  header.indexOffset = offset_;
+  header.stringsOffset = offset_ + entries_.size() * sizeof(KeyArchiveEntry);
+  header.stringsSize = static_cast<DWORD>(strings.size());
+
+  for (const auto &it : entries_) {
+    if (!Write(&it.entry, sizeof(it.entry))) return false;
+  }
+  if (!Write(strings.data(),
+             static_cast<DWORD>(strings.size() * sizeof(WCHAR)))
+      || !Flush()) {
+    return false;
+  }
+
+  LARGE_INTEGER start = {};
+  DWORD bytesWritten = 0;
+  if (!SetFilePointerEx(file_, start, nullptr, FILE_BEGIN)
+      || !WriteFile(file_, &header, sizeof(header), &bytesWritten, nullptr)
+      || bytesWritten != sizeof(header)) {
+    Log(L"Failed to write the archive header - %08x\n", GetLastError());
+    return false;
+  }
+  CloseHandle(file_);
+  file_ = INVALID_HANDLE_VALUE;
+  return true;
+}
+
+DWORD KeyArchiveWriter::Size() const {
+  return static_cast<DWORD>(entries_.size());
+}
+
+void KeyArchive::Release() {
+  if (view_) {
+    UnmapViewOfFile(view_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+  }
+  file_ = INVALID_HANDLE_VALUE;
+  mapping_ = nullptr;
+  view_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  entries_ = nullptr;
+  strings_ = nullptr;
+}
+
+KeyArchive::KeyArchive()
+  : file_(INVALID_HANDLE_VALUE),
+    mapping_(nullptr),
+    view_(nullptr),
+    size_(0),
+    header_(nullptr),
+    entries_(nullptr),
+    strings_(nullptr)
+{}
+
+KeyArchive::~KeyArchive() {
+  Release();
+}
+
+bool KeyArchive::Open(LPCWSTR filename) {
+  Release();
+  file_ = CreateFile(filename,
+                     GENERIC_READ,
+                     FILE_SHARE_READ,
+                     nullptr,
+                     OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL,
+                     nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+
+  LARGE_INTEGER size = {};
+  if (!GetFileSizeEx(file_, &size)
+      || ULONGLONG(size.QuadPart) < sizeof(KeyArchiveHeader)) {
+    Log(L"%s is not a key archive\n", filename);
+    Release();
+    return false;
+  }
+  size_ = size.QuadPart;
+
+  mapping_ = CreateFileMapping(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping_) {
+    Log(L"CreateFileMapping failed - %08x\n", GetLastError());
+    Release();
+    return false;
+  }
+  view_ = reinterpret_cast<LPCBYTE>(
+    MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (!view_) {
+    Log(L"MapViewOfFile failed - %08x\n", GetLastError());
+    Release();
+    return false;
+  }
+
+  // Every offset is checked against what is left of the file, so a hostile
+  // header cannot wrap a sum past the end of the view.
+  const auto header = reinterpret_cast<const KeyArchiveHeader*>(view_);
+  const ULONGLONG indexSize =
+    ULONGLONG(header->entryCount) * sizeof(KeyArchiveEntry);
+  const ULONGLONG stringsBytes =
+    ULONGLONG(header->stringsSize) * sizeof(WCHAR);
+  if (header->magic != KeyArchiveFormat::Magic
+      || header->version != KeyArchiveFormat::Version
+      || header->indexOffset < sizeof(KeyArchiveHeader)
+      || header->indexOffset % KeyArchiveFormat::Alignment != 0
+      || header->indexOffset > size_
+      || indexSize > size_ - header->indexOffset
+      || header->stringsOffset != header->indexOffset + indexSize
+      || stringsBytes > size_ - header->stringsOffset) {
+    Log(L"%s is not a key archive\n", filename);
+    Release();
+    return false;
+  }
+
+  header_ = header;
+  entries_ = reinterpret_cast<const KeyArchiveEntry*>(view_
+                                                      + header->indexOffset);
+  strings_ = reinterpret_cast<LPCWSTR>(view_ + header->stringsOffset);
+  return true;
+}
+
+void KeyArchive::Close() {
+  Release();
+}
+
+DWORD KeyArchive::Size() const {
+  return header_ ? header_->entryCount : 0;
+}
+
+const KeyArchiveEntry *KeyArchive::EntryAt(DWORD index) const {
+  if (!header_ || index >= header_->entryCount) return nullptr;
+
+  const auto e = &entries_[index];
+  if (e->offset < sizeof(KeyArchiveHeader)
+      || e->size > header_->indexOffset
+      || e->offset > header_->indexOffset - e->size
+      || ULONGLONG(e->name) + e->nameLength >= header_->stringsSize
+      || strings_[e->name + e->nameLength] != 0) {
+    Log(L"Archive entry %u is corrupted\n", index);
+    return nullptr;
+  }
+  return e;
+}
+
+bool KeyArchive::Get(DWORD index, Item &item) const {
+  const auto e = EntryAt(index);
+  if (!e) return false;
+  item.container = strings_ + e->name;
+  item.keySpec = e->keySpec;
+  item.blobType = e->blobType;
+  item.data = view_ + e->offset;
+  item.size = e->size;
+  return true;
+}
+
+bool KeyArchive::Find(LPCWSTR container,
+                      DWORD keySpec,
+                      DWORD blobType,
+                      DWORD &index) const {
+  const DWORD length = static_cast<DWORD>(wcslen(container));
+  DWORD lo = 0, hi = Size();
+  while (lo < hi) {
+    const DWORD mid = lo + (hi - lo) / 2;
+    const auto e = EntryAt(mid);
+    if (!e) return false;
+    const int c = CompareKey(strings_ + e->name, e->nameLength,
+                             e->keySpec, e->blobType,
+                             container, length, keySpec, blobType);
+    if (c < 0) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  const auto e = EntryAt(lo);
+  if (!e || CompareKey(strings_ + e->name, e->nameLength,
+                       e->keySpec, e->blobType,
+                       container, length, keySpec, blobType) != 0) {
+    return false;
+  }
+  index = lo;
+  return true;
+}
+
+bool KeyArchive::Verify(DWORD index) const {
+  const auto e = EntryAt(index);
+  if (!e) return false;
+  return !(header_->flags & KeyArchiveFormat::FlagChecksums)
+         || KeyArchiveFormat::Crc32(view_ + e->offset, e->size) == e->checksum;
+}
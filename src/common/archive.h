@@ -0,0 +1,113 @@
+// On-disk layout of a key archive:
+//
+//   KeyArchiveHeader
+//   payloads, each starting on a KeyArchiveFormat::Alignment boundary
+//   KeyArchiveEntry[entryCount], sorted by (container, keySpec, blobType)
+//   container names, NUL-terminated WCHAR strings
+//
+// The index comes last so that the writer can stream payloads without
+// knowing how many there will be; only the header is patched at the end.
+struct KeyArchiveHeader {
+  DWORD magic;
+  DWORD version;
+  DWORD flags;
+  DWORD entryCount;
+  ULONGLONG indexOffset;
+  ULONGLONG stringsOffset;
+  DWORD stringsSize;  // in WCHARs
+  DWORD reserved[7];
+};
+
+struct KeyArchiveEntry {
+  ULONGLONG offset;
+  DWORD size;
+  DWORD checksum;  // CRC-32 of the payload if FlagChecksums is set
+  DWORD name;      // offset into the string table, in WCHARs
+  DWORD nameLength;
+  DWORD keySpec;
+  DWORD blobType;
+};
+
+struct KeyArchiveFormat {
+  static constexpr DWORD Magic = 0x41505343;  // 'CSPA'
+  static constexpr DWORD Version = 1;
+  static constexpr DWORD Alignment = 64;
+  static constexpr DWORD FlagChecksums = 1;
+
+  static DWORD Crc32(LPCBYTE data, DWORD size);
+};
+
+// Writes an archive in one sequential pass.  Nothing is readable until
+// Finish() succeeds; a writer destroyed before that deletes the file.
+class KeyArchiveWriter {
+private:
+  struct PendingEntry {
+    KeyArchiveEntry entry;
+    std::wstring container;
+  };
+
+  HANDLE file_;
+  std::wstring filename_;
+  DWORD flags_;
+  ULONGLONG offset_;
+  std::vector<BYTE> buffer_;
+  std::vector<PendingEntry> entries_;
+
+  void Release();
+  bool Write(LPCVOID data, DWORD size);
+  bool Pad();
+  bool Flush();
+
+public:
+  KeyArchiveWriter();
+  ~KeyArchiveWriter();
+
+  bool Create(LPCWSTR filename, DWORD flags);
+  bool Add(LPCWSTR container,
+           DWORD keySpec,
+           DWORD blobType,
+           LPCBYTE blob,
+           DWORD size);
+  bool Finish();
+  DWORD Size() const;
+};
+
+// Read-only view of an archive.  The file is mapped as a whole and only the
+// header is checked on Open; each entry is bounds-checked when it is used.
+class KeyArchive {
+public:
+  struct Item {
+    LPCWSTR container;
+    DWORD keySpec;
+    DWORD blobType;
+    LPCBYTE data;  // points into the mapping
+    DWORD size;
+  };
+
+private:
+  HANDLE file_;
+  HANDLE mapping_;
+  LPCBYTE view_;
+  ULONGLONG size_;
+  const KeyArchiveHeader *header_;
+  const KeyArchiveEntry *entries_;
+  LPCWSTR strings_;
+
+  void Release();
+  const KeyArchiveEntry *EntryAt(DWORD index) const;
+
+public:
+  KeyArchive();
+  ~KeyArchive();
+
+  bool Open(LPCWSTR filename);
+  void Close();
+  DWORD Size() const;
+  bool Get(DWORD index, Item &item) const;
+  bool Find(LPCWSTR container,
+            DWORD keySpec,
+            DWORD blobType,
+            DWORD &index) const;
+  // True if the payload matches its checksum, or the archive has none.
+  bool Verify(DWORD index) const;
+};
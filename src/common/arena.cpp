@@ -0,0 +1,258 @@
+#include <windows.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "arena.h"
+
+void Log(LPCWSTR Format, ...);
+
+// Sized for CryptoAPI RSA key blobs, rounded up to 16 bytes: a
+// PUBLICKEYBLOB is 20 + n/8 bytes and a PRIVATEKEYBLOB 20 + 9n/16, so
+// 288 holds a 2048-bit public key, 608 a 1024-bit private key and 1184,
+// 1760 and 2336 the 2048, 3072 and 4096-bit private keys.
+const DWORD SecureArena::SlotSizes[ClassCount] = {
+  288, 608, 1184, 1760, 2336, 4096, 16384,
+};
+
+SecureArena &SecureArena::Default() {
+  static SecureArena arena(/*slabSize*/64 * 1024);
+  return arena;
+}
+
+// Takes back what LockPages added to the minimum working set.
+static void ShrinkWorkingSet(SIZE_T grown) {
+  SIZE_T minimum, maximum;
+  if (grown
+      && GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum)
+      && !SetProcessWorkingSetSize(GetCurrentProcess(),
+                                   minimum - min(minimum, grown),
+                                   maximum)) {
+    Log(L"SetProcessWorkingSetSize failed - %08x\n", GetLastError());
+  }
+}
+
+// |grown| receives how far the minimum working set was raised.
+static bool LockPages(LPVOID p, SIZE_T size, SIZE_T &grown) {
+  grown = 0;
+  if (VirtualLock(p, size)) return true;
+
+  // The default minimum working set allows only a few dozen locked pages.
+  // Grow it by what we need and try once more.
+  SIZE_T minimum, maximum;
+  if (GetLastError() == ERROR_WORKING_SET_QUOTA
+      && GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum)
+      && SetProcessWorkingSetSize(GetCurrentProcess(),
+                                  minimum + size,
+                                  max(maximum, minimum + size))) {
+    if (VirtualLock(p, size)) {
+      grown = size;
+      return true;
+    }
+    const DWORD gle = GetLastError();
+    ShrinkWorkingSet(size);
+    SetLastError(gle);
+  }
+  Log(L"VirtualLock failed - %08x\n", GetLastError());
+  return false;
+}
+
+static bool GuardPage(LPVOID p, SIZE_T page) {
+  DWORD oldProtect;
+  if (!VirtualProtect(p, page, PAGE_NOACCESS, &oldProtect)) {
+    Log(L"VirtualProtect failed - %08x\n", GetLastError());
+    return false;
+  }
+  return true;
+}
+
+SecureArena::SecureArena(SIZE_T slabSize)
+  : page_(0),
+    slabSize_(0),
+    stats_() {
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  page_ = si.dwPageSize;
+  slabSize_ = (max(slabSize, SIZE_T(SlotSizes[ClassCount - 1])) + page_ - 1)
+              / page_ * page_;
+}
+
+SecureArena::~SecureArena() {
+  while (!slabs_.empty()) {
+    DeleteSlab(&slabs_.begin()->second);
+  }
+}
+
+SecureArena::Slab *SecureArena::NewSlab(DWORD sizeClass,
+                                        SIZE_T size,
+                                        DWORD slotSize) {
+  const SIZE_T regionSize = page_ + size + page_;
+  auto region = reinterpret_cast<LPBYTE>(VirtualAlloc(nullptr,
+                                                      regionSize,
+                                                      MEM_RESERVE | MEM_COMMIT,
+                                                      PAGE_READWRITE));
+  if (!region) {
+    Log(L"VirtualAlloc failed - %08x\n", GetLastError());
+    return nullptr;
+  }
+  // Without its guard pages an overrun would reach the next slab unseen,
+  // and an unlocked slab could be paged out with key material in it.
+  SIZE_T grown = 0;
+  if (!GuardPage(region, page_)
+      || !GuardPage(region + page_ + size, page_)
+      || !LockPages(region + page_, size, grown)) {
+    const DWORD gle = GetLastError();
+    VirtualFree(region, 0, MEM_RELEASE);
+    SetLastError(gle);
+    return nullptr;
+  }
+
+  Slab &slab = slabs_[region + page_];
+  slab.region = region;
+  slab.regionSize = regionSize;
+  slab.base = region + page_;
+  slab.size = size;
+  slab.sizeClass = sizeClass;
+  slab.slotSize = slotSize;
+  slab.grown = grown;
+  const DWORD slots = static_cast<DWORD>(size / slotSize);
+  slab.used.assign(slots, false);
+  for (DWORD j = slots; j > 0; --j) {
+    slab.freeSlots.push_back(j - 1);
+  }
+  if (sizeClass < ClassCount) {
+    classes_[sizeClass].push_back(&slab);
+  }
+  stats_.reserved += regionSize;
+  stats_.locked += size;
+  return &slab;
+}
+
+void SecureArena::DeleteSlab(Slab *slab) {
+  SecureZeroMemory(slab->base, slab->size);
+  VirtualUnlock(slab->base, slab->size);
+  ShrinkWorkingSet(slab->grown);
+  stats_.locked -= slab->size;
+  stats_.reserved -= slab->regionSize;
+  if (slab->sizeClass < ClassCount) {
+    auto &slabs = classes_[slab->sizeClass];
+    slabs.erase(std::find(slabs.begin(), slabs.end(), slab));
+  }
+  LPBYTE region = slab->region;
+  slabs_.erase(slab->base);
+  VirtualFree(region, 0, MEM_RELEASE);
+}
+
+SecureArena::Slab *SecureArena::FindSlab(LPCVOID p) {
+  auto b = reinterpret_cast<LPCBYTE>(p);
+  auto it = slabs_.upper_bound(b);
+  if (it == slabs_.begin()) return nullptr;
+  --it;
+  Slab &slab = it->second;
+  return b < slab.base + slab.size ? &slab : nullptr;
+}
+
+LPVOID SecureArena::Alloc(SIZE_T size) {
+  std::lock_guard<std::mutex> guard(lock_);
+  Slab *found = nullptr;
+  if (size > 0 && size <= SlotSizes[ClassCount - 1]) {
+    DWORD sizeClass = 0;
+    while (size > SlotSizes[sizeClass]) ++sizeClass;
+    for (auto slab : classes_[sizeClass]) {
+      if (!slab->freeSlots.empty()) {
+        found = slab;
+        break;
+      }
+    }
+    if (!found) {
+      found = NewSlab(sizeClass, slabSize_, SlotSizes[sizeClass]);
+    }
+  }
+  else if (size > 0 && size <= MAXDWORD - page_) {
+    const SIZE_T pages = (size + page_ - 1) / page_ * page_;
+    found = NewSlab(ClassCount, pages, static_cast<DWORD>(pages));
+  }
+  else {
+    SetLastError(ERROR_INVALID_PARAMETER);
+  }
+
+  if (!found) {
+    ++stats_.failures;
+    return nullptr;
+  }
+  const DWORD slot = found->freeSlots.back();
+  found->freeSlots.pop_back();
+  found->used[slot] = true;
+  ++stats_.allocations;
+  stats_.inUse += found->slotSize;
+  stats_.peakInUse = max(stats_.peakInUse, stats_.inUse);
+  return found->base + slot * found->slotSize;
+}
+
+LPVOID SecureArena::ReAlloc(LPVOID p, SIZE_T size) {
+  if (!p) return Alloc(size);
+
+  SIZE_T oldSize = 0;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (auto slab = FindSlab(p)) {
+      oldSize = slab->slotSize;
+    }
+  }
+  if (oldSize == 0) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return nullptr;
+  }
+  if (size <= oldSize) return p;
+
+  LPVOID q = Alloc(size);
+  if (q) {
+    memcpy(q, p, oldSize);
+    Free(p);
+  }
+  return q;
+}
+
+void SecureArena::Free(LPVOID p) {
+  if (!p) return;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  auto slab = FindSlab(p);
+  if (!slab) {
+    Log(L"SecureArena::Free: %p is not in the arena\n", p);
+    return;
+  }
+  const auto offset = reinterpret_cast<LPBYTE>(p) - slab->base;
+  const DWORD slot = static_cast<DWORD>(offset / slab->slotSize);
+  if (offset % slab->slotSize != 0 || !slab->used[slot]) {
+    Log(L"SecureArena::Free: invalid pointer %p\n", p);
+    return;
+  }
+  SecureZeroMemory(p, slab->slotSize);
+  slab->used[slot] = false;
+  slab->freeSlots.push_back(slot);
+  stats_.inUse -= slab->slotSize;
+
+  // Oversized allocations and empty slabs beyond the first of their class
+  // are given back.
+  if (slab->freeSlots.size() == slab->used.size()
+      && (slab->sizeClass == ClassCount
+          || classes_[slab->sizeClass].front() != slab)) {
+    DeleteSlab(slab);
+  }
+}
+
+bool SecureArena::Owns(LPCVOID p) {
+  std::lock_guard<std::mutex> guard(lock_);
+  return FindSlab(p) != nullptr;
+}
+
+SIZE_T SecureArena::MaxAllocation() const {
+  return SlotSizes[ClassCount - 1];
+}
+
+SecureArenaStats SecureArena::Stats() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return stats_;
+}
@@ -0,0 +1,62 @@
+struct SecureArenaStats {
+  SIZE_T reserved;
+  SIZE_T locked;
+  SIZE_T inUse;
+  SIZE_T peakInUse;
+  ULONGLONG allocations;
+  ULONGLONG failures;
+};
+
+// A page-aligned pool for private key material, carved into slabs of
+// fixed-size slots.  Each slab is committed and locked in RAM on its own,
+// surrounded by PAGE_NOACCESS guard pages, and slots are zeroed when freed.
+// A size class gets another slab when its slabs are full, and a request
+// larger than the largest slot gets locked, guarded pages of its own.
+//
+//   | guard | slab (1184B slots) | guard |   | guard | 9000B | guard |
+class SecureArena {
+private:
+  static const DWORD ClassCount = 7;
+  static const DWORD SlotSizes[ClassCount];
+
+  struct Slab {
+    LPBYTE region;  // from VirtualAlloc, starting with a guard page
+    SIZE_T regionSize;
+    LPBYTE base;
+    SIZE_T size;
+    DWORD sizeClass;  // ClassCount for an oversized allocation
+    DWORD slotSize;
+    SIZE_T grown;  // added to the minimum working set to lock it
+    std::vector<DWORD> freeSlots;
+    std::vector<bool> used;
+  };
+
+  SIZE_T page_;
+  SIZE_T slabSize_;
+  // By base address.
+  std::map<LPCBYTE, Slab> slabs_;
+  std::vector<Slab *> classes_[ClassCount];
+  std::mutex lock_;
+  SecureArenaStats stats_;
+
+  Slab *NewSlab(DWORD sizeClass, SIZE_T size, DWORD slotSize);
+  void DeleteSlab(Slab *slab);
+  Slab *FindSlab(LPCVOID p);
+
+public:
+  // A process-wide arena created on first use.
+  static SecureArena &Default();
+
+  // |slabSize| is rounded up to whole pages and to the largest slot.
+  SecureArena(SIZE_T slabSize);
+  ~SecureArena();
+
+  // Fails only if no pages can be committed, guarded or locked.
+  LPVOID Alloc(SIZE_T size);
+  LPVOID ReAlloc(LPVOID p, SIZE_T size);
+  void Free(LPVOID p);
+  bool Owns(LPCVOID p);
+  // The largest slot.  Larger allocations take whole pages.
+  SIZE_T MaxAllocation() const;
+  SecureArenaStats Stats();
+};
@@ -0,0 +1,236 @@
+// Coroutine types over executor.h: awaitable provider operations, lazily
+// started tasks, and the glue to start or wait for them from plain code.
+
+// Awaitable that runs |fn| on a strand and resumes the awaiting coroutine
+// on the strand's executor.  GetLastError() after co_await returns the
+// error set by |fn|.
+template<class T>
+class Operation {
+private:
+  Strand &strand_;
+  std::function<T()> fn_;
+  T result_;
+  DWORD lastError_;
+
+public:
+  Operation(Strand &strand, std::function<T()> &&fn)
+    : strand_(strand), fn_(std::move(fn)), result_(), lastError_(0)
+  {}
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> awaiter) {
+    strand_.Post([this, awaiter]() {
+      result_ = fn_();
+      lastError_ = GetLastError();
+      strand_.GetExecutor().Post([awaiter]() { awaiter.resume(); });
+    });
+  }
+
+  T await_resume() {
+    SetLastError(lastError_);
+    return std::move(result_);
+  }
+};
+
+template<class T>
+class Task;
+
+namespace detail {
+
+template<class T>
+struct TaskPromiseBase {
+  std::coroutine_handle<> continuation_;
+
+  std::suspend_always initial_suspend() noexcept {
+    return {};
+  }
+
+  auto final_suspend() noexcept {
+    struct FinalAwaiter {
+      bool await_ready() noexcept {
+        return false;
+      }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<typename Task<T>::promise_type> self) noexcept {
+        auto next = self.promise().continuation_;
+        return next ? next : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    return FinalAwaiter{};
+  }
+
+  void unhandled_exception() {
+    std::terminate();
+  }
+};
+
+}
+
+// Lazily started coroutine.  It runs when awaited, or when passed to
+// Spawn or SyncWait.
+template<class T>
+class Task {
+public:
+  struct promise_type : detail::TaskPromiseBase<T> {
+    T value_;
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    void return_value(T value) {
+      value_ = std::move(value);
+    }
+  };
+
+private:
+  std::coroutine_handle<promise_type> coro_;
+
+public:
+  explicit Task(std::coroutine_handle<promise_type> coro) : coro_(coro) {}
+  Task(Task &&other) : coro_(other.coro_) {
+    other.coro_ = nullptr;
+  }
+  ~Task() {
+    if (coro_) coro_.destroy();
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    coro_.promise().continuation_ = awaiter;
+    return coro_;
+  }
+
+  T await_resume() {
+    return std::move(coro_.promise().value_);
+  }
+};
+
+template<>
+class Task<void> {
+public:
+  struct promise_type : detail::TaskPromiseBase<void> {
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    void return_void() {}
+  };
+
+private:
+  std::coroutine_handle<promise_type> coro_;
+
+public:
+  explicit Task(std::coroutine_handle<promise_type> coro) : coro_(coro) {}
+  Task(Task &&other) : coro_(other.coro_) {
+    other.coro_ = nullptr;
+  }
+  ~Task() {
+    if (coro_) coro_.destroy();
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    coro_.promise().continuation_ = awaiter;
+    return coro_;
+  }
+
+  void await_resume() {}
+};
+
+namespace detail {
+
+// Eagerly started, self-destroying coroutine used to drive a Task from
+// non-coroutine code.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+};
+
+inline Detached RunDetached(Executor &executor, Task<void> task) {
+  struct Switch {
+    Executor &executor_;
+    bool await_ready() const noexcept {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> awaiter) {
+      executor_.Post([awaiter]() { awaiter.resume(); });
+    }
+    void await_resume() {}
+  };
+  co_await Switch{executor};
+  co_await task;
+}
+
+template<class T, class F>
+Detached RunAndSignal(Task<T> task, F signal) {
+  if constexpr (std::is_void_v<T>) {
+    co_await task;
+    signal();
+  }
+  else {
+    signal(co_await task);
+  }
+}
+
+}
+
+// Starts |task| on |executor| without waiting for it.
+inline void Spawn(Executor &executor, Task<void> &&task) {
+  detail::RunDetached(executor, std::move(task));
+}
+
+// Runs |task| to completion and returns its result.  Must not be called
+// from an executor thread.
+template<class T>
+T SyncWait(Task<T> &&task) {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool done = false;
+  std::optional<T> result;
+  detail::RunAndSignal(std::move(task), [&](T &&value) {
+    std::lock_guard<std::mutex> guard(lock);
+    result.emplace(std::move(value));
+    done = true;
+    cv.notify_one();
+  });
+  std::unique_lock<std::mutex> wait(lock);
+  cv.wait(wait, [&]() { return done; });
+  return std::move(*result);
+}
+
+inline void SyncWait(Task<void> &&task) {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool done = false;
+  detail::RunAndSignal(std::move(task), [&]() {
+    std::lock_guard<std::mutex> guard(lock);
+    done = true;
+    cv.notify_one();
+  });
+  std::unique_lock<std::mutex> wait(lock);
+  cv.wait(wait, [&]() { return done; });
+}
@@ -0,0 +1,443 @@
+#include <windows.h>
+#include <algorithm>
+#include <vector>
+#include "bignum.h"
+
+BigNum::BigNum() {}
+
+BigNum::BigNum(DWORD value) {
+  if (value) limbs_.push_back(value);
+}
+
+void BigNum::Trim() {
+  while (!limbs_.empty() && limbs_.back() == 0) limbs_.pop_back();
+}
+
+BigNum BigNum::FromLittleEndian(LPCBYTE data, size_t size) {
+  BigNum r;
+  r.limbs_.assign((size + 3) / 4, 0);
+  for (size_t i = 0; i < size; ++i) {
+    r.limbs_[i / 4] |= DWORD(data[i]) << (8 * (i % 4));
+  }
+  r.Trim();
+  return r;
+}
+
+BigNum BigNum::FromBigEndian(LPCBYTE data, size_t size) {
+  BigNum r;
+  r.limbs_.assign((size + 3) / 4, 0);
+  for (size_t i = 0; i < size; ++i) {
+    r.limbs_[i / 4] |= DWORD(data[size - 1 - i]) << (8 * (i % 4));
+  }
+  r.Trim();
+  return r;
+}
+
+bool BigNum::ToLittleEndian(LPBYTE out, size_t size) const {
+  if (Bytes() > size) return false;
+  for (size_t i = 0; i < size; ++i) {
+    out[i] = i / 4 < limbs_.size()
+             ? static_cast<BYTE>(limbs_[i / 4] >> (8 * (i % 4)))
+             : 0;
+  }
+  return true;
+}
+
+bool BigNum::ToBigEndian(LPBYTE out, size_t size) const {
+  if (!ToLittleEndian(out, size)) return false;
+  std::reverse(out, out + size);
+  return true;
+}
+
+bool BigNum::IsZero() const {
+  return limbs_.empty();
+}
+
+bool BigNum::IsOdd() const {
+  return !limbs_.empty() && (limbs_[0] & 1);
+}
+
+DWORD BigNum::Bits() const {
+  if (limbs_.empty()) return 0;
+  DWORD top = limbs_.back(), bits = 0;
+  while (top) {
+    ++bits;
+    top >>= 1;
+  }
+  return static_cast<DWORD>((limbs_.size() - 1) * 32 + bits);
+}
+
+DWORD BigNum::Bytes() const {
+  return (Bits() + 7) / 8;
+}
+
+bool BigNum::Bit(DWORD index) const {
+  return index / 32 < limbs_.size() && ((limbs_[index / 32] >> (index % 32)) & 1);
+}
+
+size_t BigNum::LimbCount() const {
+  return limbs_.size();
+}
+
+const DWORD *BigNum::Limbs() const {
+  return limbs_.data();
+}
+
+DWORD BigNum::ModWord(DWORD divisor) const {
+  ULONGLONG r = 0;
+  for (size_t i = limbs_.size(); i > 0; --i) {
+    r = ((r << 32) | limbs_[i - 1]) % divisor;
+  }
+  return static_cast<DWORD>(r);
+}
+
+int BigNum::Compare(const BigNum &a, const BigNum &b) {
+  if (a.limbs_.size() != b.limbs_.size()) {
+    return a.limbs_.size() < b.limbs_.size() ? -1 : 1;
+  }
+  for (size_t i = a.limbs_.size(); i > 0; --i) {
+    if (a.limbs_[i - 1] != b.limbs_[i - 1]) {
+      return a.limbs_[i - 1] < b.limbs_[i - 1] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+BigNum BigNum::Add(const BigNum &a, const BigNum &b) {
+  const auto &x = a.limbs_.size() >= b.limbs_.size() ? a.limbs_ : b.limbs_;
+  const auto &y = a.limbs_.size() >= b.limbs_.size() ? b.limbs_ : a.limbs_;
+  BigNum r;
+  r.limbs_.resize(x.size() + 1);
+  ULONGLONG carry = 0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    carry += ULONGLONG(x[i]) + (i < y.size() ? y[i] : 0);
+    r.limbs_[i] = static_cast<DWORD>(carry);
+    carry >>= 32;
+  }
+  r.limbs_[x.size()] = static_cast<DWORD>(carry);
+  r.Trim();
+  return r;
+}
+
+BigNum BigNum::Sub(const BigNum &a, const BigNum &b) {
+  BigNum r;
+  r.limbs_.resize(a.limbs_.size());
+  LONGLONG borrow = 0;
+  for (size_t i = 0; i < a.limbs_.size(); ++i) {
+    LONGLONG t = LONGLONG(a.limbs_[i])
+                 - (i < b.limbs_.size() ? b.limbs_[i] : 0)
+                 - borrow;
+    borrow = t < 0;
+    r.limbs_[i] = static_cast<DWORD>(t);
+  }
+  r.Trim();
+  return r;
+}
+
+BigNum BigNum::Mul(const BigNum &a, const BigNum &b) {
+  BigNum r;
+  if (a.IsZero() || b.IsZero()) return r;
+  r.limbs_.assign(a.limbs_.size() + b.limbs_.size(), 0);
+  for (size_t i = 0; i < a.limbs_.size(); ++i) {
+    ULONGLONG carry = 0;
+    for (size_t j = 0; j < b.limbs_.size(); ++j) {
+      carry += ULONGLONG(a.limbs_[i]) * b.limbs_[j] + r.limbs_[i + j];
+      r.limbs_[i + j] = static_cast<DWORD>(carry);
+      carry >>= 32;
+    }
+    r.limbs_[i + b.limbs_.size()] = static_cast<DWORD>(carry);
+  }
+  r.Trim();
+  return r;
+}
+
+BigNum BigNum::ShiftLeft(const BigNum &a, DWORD bits) {
+  BigNum r;
+  if (a.IsZero()) return r;
+  const DWORD words = bits / 32, shift = bits % 32;
+  r.limbs_.assign(a.limbs_.size() + words + 1, 0);
+  for (size_t i = 0; i < a.limbs_.size(); ++i) {
+    const ULONGLONG v = ULONGLONG(a.limbs_[i]) << shift;
+    r.limbs_[i + words] |= static_cast<DWORD>(v);
+    r.limbs_[i + words + 1] |= static_cast<DWORD>(v >> 32);
+  }
+  r.Trim();
+  return r;
+}
+
+BigNum BigNum::ShiftRight(const BigNum &a, DWORD bits) {
+  BigNum r;
+  const DWORD words = bits / 32, shift = bits % 32;
+  if (words >= a.limbs_.size()) return r;
+  r.limbs_.assign(a.limbs_.size() - words, 0);
+  for (size_t i = 0; i < r.limbs_.size(); ++i) {
+    ULONGLONG v = a.limbs_[i + words];
+    if (i + words + 1 < a.limbs_.size()) {
+      v |= ULONGLONG(a.limbs_[i + words + 1]) << 32;
+    }
+    r.limbs_[i] = static_cast<DWORD>(v >> shift);
+  }
+  r.Trim();
+  return r;
+}
+
+void BigNum::DivMod(const BigNum &a,
+                    const BigNum &b,
+                    BigNum *quotient,
+                    BigNum *remainder) {
+  if (b.IsZero()) return;
+  if (Compare(a, b) < 0) {
+    if (remainder) *remainder = a;
+    if (quotient) *quotient = BigNum();
+    return;
+  }
+
+  const size_t n = b.limbs_.size();
+  const size_t m = a.limbs_.size() - n;
+  BigNum q;
+  q.limbs_.assign(m + 1, 0);
+
+  if (n == 1) {
+    ULONGLONG r = 0;
+    for (size_t i = a.limbs_.size(); i > 0; --i) {
+      r = (r << 32) | a.limbs_[i - 1];
+      q.limbs_[i - 1] = static_cast<DWORD>(r / b.limbs_[0]);
+      r %= b.limbs_[0];
+    }
+    q.Trim();
+    if (quotient) *quotient = std::move(q);
+    if (remainder) *remainder = BigNum(static_cast<DWORD>(r));
+    return;
+  }
+
+  // Knuth, TAOCP vol. 2, 4.3.1, Algorithm D.  Normalize so that the top
+  // limb of the divisor has its high bit set.
+  DWORD s = 0;
+  for (DWORD top = b.limbs_.back(); !(top & 0x80000000); top <<= 1) ++s;
+  std::vector<DWORD> v(n), u(a.limbs_.size() + 1);
+  for (size_t i = n; i > 0; --i) {
+    v[i - 1] = (b.limbs_[i - 1] << s)
+               | (s && i > 1 ? b.limbs_[i - 2] >> (32 - s) : 0);
+  }
+  u[a.limbs_.size()] = s ? a.limbs_.back() >> (32 - s) : 0;
+  for (size_t i = a.limbs_.size(); i > 0; --i) {
+    u[i - 1] = (a.limbs_[i - 1] << s)
+               | (s && i > 1 ? a.limbs_[i - 2] >> (32 - s) : 0);
+  }
+
+  const ULONGLONG base = 0x100000000ull;
+  for (size_t j = m + 1; j > 0; --j) {
+    const size_t k = j - 1;
+    const ULONGLONG num = (ULONGLONG(u[k + n]) << 32) | u[k + n - 1];
+    ULONGLONG qhat = num / v[n - 1];
+    ULONGLONG rhat = num % v[n - 1];
+    while (qhat >= base
+           || qhat * v[n - 2] > ((rhat << 32) | u[k + n - 2])) {
+      --qhat;
+      rhat += v[n - 1];
+      if (rhat >= base) break;
+    }
+
+    LONGLONG borrow = 0;
+    for (size_t i = 0; i < n; ++i) {
+      const ULONGLONG p = qhat * v[i];
+      const LONGLONG t = LONGLONG(u[i + k]) - borrow
+                         - LONGLONG(p & 0xffffffff);
+      u[i + k] = static_cast<DWORD>(t);
+      borrow = LONGLONG(p >> 32) - (t >> 32);
+    }
+    const LONGLONG t = LONGLONG(u[k + n]) - borrow;
+    u[k + n] = static_cast<DWORD>(t);
+
+    if (t < 0) {
+      // qhat was one too large; add the divisor back.
+      --qhat;
+      ULONGLONG carry = 0;
+      for (size_t i = 0; i < n; ++i) {
+        carry += ULONGLONG(u[i + k]) + v[i];
+        u[i + k] = static_cast<DWORD>(carry);
+        carry >>= 32;
+      }
+      u[k + n] += static_cast<DWORD>(carry);
+    }
+    q.limbs_[k] = static_cast<DWORD>(qhat);
+  }
+
+  if (remainder) {
+    BigNum r;
+    r.limbs_.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      r.limbs_[i] = (u[i] >> s) | (s ? u[i + 1] << (32 - s) : 0);
+    }
+    r.Trim();
+    *remainder = std::move(r);
+  }
+  if (quotient) {
+    q.Trim();
+    *quotient = std::move(q);
+  }
+}
+
+BigNum BigNum::Mod(const BigNum &a, const BigNum &m) {
+  BigNum r;
+  DivMod(a, m, nullptr, &r);
+  return r;
+}
+
+BigNum BigNum::ModExp(const BigNum &base,
+                      const BigNum &exponent,
+                      const BigNum &modulus) {
+  if (modulus.IsOdd()) {
+    return Montgomery(modulus).Exp(base, exponent);
+  }
+
+  BigNum result(1), b = Mod(base, modulus);
+  for (DWORD i = exponent.Bits(); i > 0; --i) {
+    result = Mod(Mul(result, result), modulus);
+    if (exponent.Bit(i - 1)) {
+      result = Mod(Mul(result, b), modulus);
+    }
+  }
+  return Mod(result, modulus);
+}
+
+BigNum BigNum::ModInverse(const BigNum &a, const BigNum &m) {
+  // Extended Euclid, keeping the coefficient reduced modulo |m| so that it
+  // never goes negative.
+  BigNum r0 = m, r1 = Mod(a, m);
+  BigNum t0, t1(1);
+  while (!r1.IsZero()) {
+    BigNum q, r;
+    DivMod(r0, r1, &q, &r);
+    r0 = std::move(r1);
+    r1 = std::move(r);
+
+    const BigNum x = Mod(Mul(q, t1), m);
+    BigNum t = Compare(t0, x) >= 0 ? Sub(t0, x) : Sub(Add(t0, m), x);
+    t0 = std::move(t1);
+    t1 = std::move(t);
+  }
+  return r0 == BigNum(1) ? t0 : BigNum();
+}
+
+Montgomery::Montgomery(const BigNum &modulus)
+  : modulus_(modulus),
+    n_(modulus.Limbs(), modulus.Limbs() + modulus.LimbCount()),
+    n0inv_(0) {
+  // Newton iteration for n[0]^-1 mod 2^32; each step doubles the correct
+  // low bits.
+  DWORD inv = 1;
+  for (int i = 0; i < 5; ++i) {
+    inv *= 2 - n_[0] * inv;
+  }
+  n0inv_ = 0 - inv;
+  r2_ = BigNum::Mod(BigNum::ShiftLeft(BigNum(1),
+                                      static_cast<DWORD>(64 * n_.size())),
+                    modulus);
+}
+
+const BigNum &Montgomery::Modulus() const {
+  return modulus_;
+}
+
+void Montgomery::ToLimbs(const BigNum &a, std::vector<DWORD> &out) const {
+  out.assign(n_.size(), 0);
+  std::copy(a.Limbs(), a.Limbs() + min(a.LimbCount(), n_.size()), out.begin());
+}
+
+void Montgomery::Multiply(const DWORD *a,
+                          const DWORD *b,
+                          DWORD *out,
+                          DWORD *t) const {
+  // Coarsely integrated operand scanning (CIOS).
+  const size_t s = n_.size();
+  std::fill(t, t + s + 2, 0);
+  for (size_t i = 0; i < s; ++i) {
+    ULONGLONG c = 0;
+    for (size_t j = 0; j < s; ++j) {
+      c += ULONGLONG(a[j]) * b[i] + t[j];
+      t[j] = static_cast<DWORD>(c);
+      c >>= 32;
+    }
+    c += t[s];
+    t[s] = static_cast<DWORD>(c);
+    t[s + 1] = static_cast<DWORD>(c >> 32);
+
+    const DWORD m = t[0] * n0inv_;
+    c = (ULONGLONG(m) * n_[0] + t[0]) >> 32;
+    for (size_t j = 1; j < s; ++j) {
+      c += ULONGLONG(m) * n_[j] + t[j];
+      t[j - 1] = static_cast<DWORD>(c);
+      c >>= 32;
+    }
+    c += t[s];
+    t[s - 1] = static_cast<DWORD>(c);
+    t[s] = t[s + 1] + static_cast<DWORD>(c >> 32);
+  }
+
+  // The result is below 2n; subtract n once if needed.
+  bool subtract = t[s] != 0;
+  if (!subtract) {
+    subtract = true;
+    for (size_t i = s; i > 0; --i) {
+      if (t[i - 1] != n_[i - 1]) {
+        subtract = t[i - 1] > n_[i - 1];
+        break;
+      }
+    }
+  }
+  if (subtract) {
+    LONGLONG borrow = 0;
+    for (size_t i = 0; i < s; ++i) {
+      const LONGLONG d = LONGLONG(t[i]) - n_[i] - borrow;
+      borrow = d < 0;
+      out[i] = static_cast<DWORD>(d);
+    }
+  }
+  else {
+    std::copy(t, t + s, out);
+  }
+}
+
+BigNum Montgomery::Exp(const BigNum &base, const BigNum &exponent) const {
+  const size_t s = n_.size();
+  std::vector<DWORD> scratch(s + 2), r2, x;
+  ToLimbs(r2_, r2);
+  ToLimbs(BigNum::Mod(base, modulus_), x);
+
+  // Fixed 4-bit window: table[i] = base^i in Montgomery form.
+  std::vector<std::vector<DWORD>> table(16, std::vector<DWORD>(s));
+  std::vector<DWORD> one(s, 0);
+  one[0] = 1;
+  Multiply(one.data(), r2.data(), table[0].data(), scratch.data());
+  Multiply(x.data(), r2.data(), table[1].data(), scratch.data());
+  for (int i = 2; i < 16; ++i) {
+    Multiply(table[i - 1].data(), table[1].data(), table[i].data(),
+             scratch.data());
+  }
+
+  std::vector<DWORD> result = table[0];
+  const DWORD bits = exponent.Bits();
+  for (DWORD pos = (bits + 3) / 4; pos > 0; --pos) {
+    for (int i = 0; i < 4; ++i) {
+      Multiply(result.data(), result.data(), result.data(), scratch.data());
+    }
+    DWORD window = 0;
+    for (int i = 3; i >= 0; --i) {
+      window = (window << 1) | (exponent.Bit((pos - 1) * 4 + i) ? 1 : 0);
+    }
+    if (window) {
+      Multiply(result.data(), table[window].data(), result.data(),
+               scratch.data());
+    }
+  }
+
+  Multiply(result.data(), one.data(), result.data(), scratch.data());
+  std::vector<BYTE> bytes(s * 4);
+  for (size_t i = 0; i < s; ++i) {
+    for (int k = 0; k < 4; ++k) {
+      bytes[i * 4 + k] = static_cast<BYTE>(result[i] >> (8 * k));
+    }
+  }
+  return BigNum::FromLittleEndian(bytes.data(), bytes.size());
+}
@@ -0,0 +1,83 @@
+// Unsigned multi-precision integer for the software RSA backend.  Limbs are
+// 32-bit, least significant first, without leading zero limbs.
+//
+// Nothing here is constant-time.  It exists to emulate a provider in tests
+// and benchmarks, not to protect real keys.
+class BigNum {
+private:
+  std::vector<DWORD> limbs_;
+
+  void Trim();
+
+public:
+  BigNum();
+  BigNum(DWORD value);
+
+  static BigNum FromLittleEndian(LPCBYTE data, size_t size);
+  static BigNum FromBigEndian(LPCBYTE data, size_t size);
+  // Writes exactly |size| bytes, zero-padded.  False if the value does not
+  // fit.
+  bool ToLittleEndian(LPBYTE out, size_t size) const;
+  bool ToBigEndian(LPBYTE out, size_t size) const;
+
+  bool IsZero() const;
+  bool IsOdd() const;
+  DWORD Bits() const;
+  DWORD Bytes() const;
+  bool Bit(DWORD index) const;
+  size_t LimbCount() const;
+  const DWORD *Limbs() const;
+  // Remainder of a division by a single limb, for sieving.
+  DWORD ModWord(DWORD divisor) const;
+
+  static int Compare(const BigNum &a, const BigNum &b);
+  static BigNum Add(const BigNum &a, const BigNum &b);
+  // Requires a >= b.
+  static BigNum Sub(const BigNum &a, const BigNum &b);
+  static BigNum Mul(const BigNum &a, const BigNum &b);
+  // Either output may be null.  Division by zero leaves both unchanged.
+  static void DivMod(const BigNum &a,
+                     const BigNum &b,
+                     BigNum *quotient,
+                     BigNum *remainder);
+  static BigNum Mod(const BigNum &a, const BigNum &m);
+  static BigNum ShiftLeft(const BigNum &a, DWORD bits);
+  static BigNum ShiftRight(const BigNum &a, DWORD bits);
+  static BigNum ModExp(const BigNum &base,
+                       const BigNum &exponent,
+                       const BigNum &modulus);
+  // Zero if |a| has no inverse modulo |m|.
+  static BigNum ModInverse(const BigNum &a, const BigNum &m);
+
+  friend bool operator==(const BigNum &a, const BigNum &b) {
+    return a.limbs_ == b.limbs_;
+  }
+  friend bool operator!=(const BigNum &a, const BigNum &b) {
+    return a.limbs_ != b.limbs_;
+  }
+  friend bool operator<(const BigNum &a, const BigNum &b) {
+    return Compare(a, b) < 0;
+  }
+};
+
+// Montgomery arithmetic for one odd modulus.  Build it once per modulus and
+// reuse it for every exponentiation with that modulus.
+class Montgomery {
+private:
+  BigNum modulus_;
+  std::vector<DWORD> n_;
+  DWORD n0inv_;  // -n^-1 mod 2^32
+  BigNum r2_;    // R^2 mod n
+
+  // |scratch| holds n_.size() + 2 limbs.  |out| may alias |a| or |b|.
+  void Multiply(const DWORD *a,
+                const DWORD *b,
+                DWORD *out,
+                DWORD *scratch) const;
+  void ToLimbs(const BigNum &a, std::vector<DWORD> &out) const;
+
+public:
+  Montgomery(const BigNum &modulus);
+  const BigNum &Modulus() const;
+  BigNum Exp(const BigNum &base, const BigNum &exponent) const;
+};
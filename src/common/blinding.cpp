@@ -0,0 +1,113 @@
+#include <windows.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "executor.h"
+#include "bignum.h"
+#include "random.h"
+#include "rsa.h"
+#include "blinding.h"
+
+RsaBlindingPool::RsaBlindingPool(Executor &executor,
+                                 std::shared_ptr<const RsaKey> key,
+                                 const RsaBlindingPoolConfig &config)
+  : executor_(executor),
+    state_(std::make_shared<State>(key, config)) {
+  state_->pairs_.reserve(config.capacity);
+  state_->refilling_ = true;
+  std::shared_ptr<State> state = state_;
+  executor_.Post([state]() { Refill(state); });
+}
+
+RsaBlindingPool::~RsaBlindingPool() {
+  std::lock_guard<std::mutex> guard(state_->lock_);
+  state_->stopping_ = true;
+}
+
+bool RsaBlindingPool::NewPair(const State &state, RsaBlinding &pair) {
+  const RsaKey &key = *state.key_;
+  if (state.config_.random) {
+    return key.NewBlinding(state.config_.random, pair);
+  }
+  RandomGenerator &random = RandomGenerator::ThreadLocal();
+  bool ok = true;
+  return key.NewBlinding(
+           [&random, &ok](LPBYTE data, DWORD size) {
+             ok = random.Generate(data, size) && ok;
+           },
+           pair)
+         && ok;
+}
+
+void RsaBlindingPool::Refill(std::shared_ptr<State> state) {
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> guard(state->lock_);
+      if (state->stopping_
+          || state->pairs_.size() >= state->config_.capacity) {
+        state->refilling_ = false;
+        return;
+      }
+    }
+    RsaBlinding pair;
+    if (!NewPair(*state, pair)) {
+      std::lock_guard<std::mutex> guard(state->lock_);
+      state->refilling_ = false;
+      return;
+    }
+    std::lock_guard<std::mutex> guard(state->lock_);
+    state->pairs_.push_back(std::move(pair));
+  }
+}
+
+bool RsaBlindingPool::NeedsRefill() {
+  if (state_->refilling_
+      || state_->pairs_.size() >= state_->config_.refillBelow) {
+    return false;
+  }
+  state_->refilling_ = true;
+  return true;
+}
+
+DWORD RsaBlindingPool::Available() {
+  std::lock_guard<std::mutex> guard(state_->lock_);
+  return static_cast<DWORD>(state_->pairs_.size());
+}
+
+bool RsaBlindingPool::Take(RsaBlinding &pair) {
+  bool taken = false;
+  bool refill = false;
+  {
+    std::lock_guard<std::mutex> guard(state_->lock_);
+    if (!state_->pairs_.empty()) {
+      pair = std::move(state_->pairs_.back());
+      state_->pairs_.pop_back();
+      taken = true;
+    }
+    refill = NeedsRefill();
+  }
+  if (refill) {
+    std::shared_ptr<State> state = state_;
+    executor_.Post([state]() { Refill(state); });
+  }
+  return taken || NewPair(*state_, pair);
+}
+
+bool RsaBlindingPool::Sign(ALG_ID hashAlgo,
+                           LPCBYTE digest,
+                           DWORD digestSize,
+                           DWORD flags,
+                           LPBYTE signature) {
+  RsaBlinding pair;
+  return Take(pair)
+         && state_->key_->Sign(hashAlgo,
+                               digest,
+                               digestSize,
+                               flags,
+                               signature,
+                               pair);
+}
@@ -0,0 +1,63 @@
+class Executor;
+
+struct RsaBlindingPoolConfig {
+  DWORD capacity;     // pairs kept ready
+  DWORD refillBelow;  // a refill is posted once fewer than this are left
+  // Where r comes from, called from any thread; empty for the calling
+  // thread's RandomGenerator.
+  RsaKey::RandomSource random;
+
+  RsaBlindingPoolConfig() : capacity(64), refillBelow(16) {}
+};
+
+// Blinding pairs for one RSA key, computed ahead of time on an Executor.
+//
+// A pair costs a public exponentiation and a modular inverse, a few
+// percent of an RSA-2048 signature but all of it on the signing path
+// unless done beforehand.  Sign() takes a ready pair, or computes one in
+// place when the pool has run dry, and posts a refill when the pool runs
+// low.  The random r of each pair comes from the refilling thread's
+// RandomGenerator unless the config names a source.  If r cannot be drawn
+// the refill stops and Sign() fails.
+//
+// The executor must outlive the pool.  A refill that is running when the
+// pool is destroyed stops after the pair it is working on.
+class RsaBlindingPool {
+private:
+  struct State {
+    const std::shared_ptr<const RsaKey> key_;
+    const RsaBlindingPoolConfig config_;
+    std::mutex lock_;
+    std::vector<RsaBlinding> pairs_;
+    bool refilling_;
+    bool stopping_;
+
+    State(std::shared_ptr<const RsaKey> key,
+          const RsaBlindingPoolConfig &config)
+      : key_(key), config_(config), refilling_(false), stopping_(false)
+    {}
+  };
+
+  Executor &executor_;
+  std::shared_ptr<State> state_;
+
+  static bool NewPair(const State &state, RsaBlinding &pair);
+  static void Refill(std::shared_ptr<State> state);
+  // Called with state_->lock_ held.  Returns whether to post a refill.
+  bool NeedsRefill();
+
+public:
+  RsaBlindingPool(Executor &executor,
+                  std::shared_ptr<const RsaKey> key,
+                  const RsaBlindingPoolConfig &config);
+  ~RsaBlindingPool();
+
+  DWORD Available();
+  bool Take(RsaBlinding &pair);
+  // RsaKey::Sign with a pair from the pool.
+  bool Sign(ALG_ID hashAlgo,
+            LPCBYTE digest,
+            DWORD digestSize,
+            DWORD flags,
+            LPBYTE signature);
+};
@@ -5,14 +5,29 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "allocprof.h"
+#include "arena.h"
 #include "blob.h"
 
 void Log(LPCWSTR Format, ...);
 
 template<class ST, class CH>
 class bstream {
+public:
+  typedef std::basic_string<char,
+                            std::char_traits<char>,
+                            ProfiledAllocator<char>> string_type;
+
 private:
-  std::stringstream ss_;
+  std::basic_stringstream<char,
+                          std::char_traits<char>,
+                          ProfiledAllocator<char>> ss_;
   int half_char;
 
   void add_char(CH c) {
@@ -48,7 +63,7 @@ public:
     add_char(ch);
   }
 
-  std::string get() const {
+  string_type get() const {
     return ss_.str();
   }
 
@@ -60,30 +75,36 @@ public:
 
 void Blob::Release() {
   if (buffer_) {
-    HeapFree(heap_, 0, buffer_);
+    AllocProfiler::OnFree(size_);
+    if (arena_)
+      arena_->Free(buffer_);
+    else
+      HeapFree(heap_, 0, buffer_);
     buffer_ = nullptr;
     size_ = 0;
   }
 }
 
-Blob Blob::FromBase64String(LPCWSTR base64) {
+Blob Blob::FromBase64String(std::string_view base64) {
+  AllocSite site("Blob::FromBase64String");
   Blob blob;
   DWORD decodedLength = 0;
-  if (CryptStringToBinary(base64,
-                          0,
-                          CRYPT_STRING_BASE64,
-                          nullptr,
-                          &decodedLength,
-                          nullptr,
-                          nullptr)
+  if (base64.empty()) return blob;
+  if (CryptStringToBinaryA(base64.data(),
+                           static_cast<DWORD>(base64.size()),
+                           CRYPT_STRING_BASE64,
+                           nullptr,
+                           &decodedLength,
+                           nullptr,
+                           nullptr)
       && blob.Alloc(decodedLength)) {
-    if (!CryptStringToBinary(base64,
-                             0,
-                             CRYPT_STRING_BASE64,
-                             blob,
-                             &decodedLength,
-                             nullptr,
-                             nullptr)) {
+    if (!CryptStringToBinaryA(base64.data(),
+                              static_cast<DWORD>(base64.size()),
+                              CRYPT_STRING_BASE64,
+                              blob,
+                              &decodedLength,
+                              nullptr,
+                              nullptr)) {
       Log(L"CryptStringToBinary failed - %08x\n", GetLastError());
       blob.Release();
     }
@@ -91,15 +112,21 @@ Blob Blob::FromBase64String(LPCWSTR base64) {
   return blob;
 }
 
-Blob Blob::FromHexString(LPCWSTR hexstr) {
-  Blob blob;
-  if (!hexstr) return blob;
-
-  bstream<std::wstring, wchar_t> bs;
-  auto p = hexstr;
-  while (*p) {
-    bs << *(p++);
+Blob Blob::FromBase64String(LPCWSTR base64) {
+  AllocSite site("Blob::FromBase64String");
+  // Anything outside ASCII is not Base64; '?' keeps it that way.
+  std::string narrow;
+  for (auto p = base64; p && *p; ++p) {
+    narrow += *p < 0x80 ? static_cast<char>(*p) : '?';
   }
+  return FromBase64String(std::string_view(narrow));
+}
+
+template<class CH>
+static Blob ParseHex(std::basic_string_view<CH> hexstr) {
+  Blob blob;
+  bstream<std::basic_string_view<CH>, CH> bs;
+  bs << hexstr;
 
   auto bstr = bs.get();
   if (blob.Alloc(static_cast<int>(bstr.size()))) {
@@ -108,7 +135,19 @@ Blob Blob::FromHexString(LPCWSTR hexstr) {
   return blob;
 }
 
+Blob Blob::FromHexString(std::string_view hexstr) {
+  AllocSite site("Blob::FromHexString");
+  return ParseHex(hexstr);
+}
+
+Blob Blob::FromHexString(LPCWSTR hexstr) {
+  AllocSite site("Blob::FromHexString");
+  if (!hexstr) return Blob();
+  return ParseHex(std::wstring_view(hexstr));
+}
+
 Blob Blob::AsUTF8(LPCWSTR plaintext) {
+  AllocSite site("Blob::AsUTF8");
   Blob blob;
   size_t len = 0;
   HRESULT hr = StringCchLength(plaintext, STRSAFE_MAX_CCH, &len);
@@ -142,24 +181,35 @@ Blob Blob::AsUTF8(LPCWSTR plaintext) {
 
 Blob::Blob()
   : heap_(GetProcessHeap()),
+    arena_(nullptr),
     buffer_(nullptr),
     size_(0)
 {}
 
 Blob::Blob(DWORD size)
   : heap_(GetProcessHeap()),
+    arena_(nullptr),
     buffer_(nullptr),
     size_(0)
 {
   Alloc(size);
 }
 
+Blob::Blob(SecureArena &arena)
+  : heap_(GetProcessHeap()),
+    arena_(&arena),
+    buffer_(nullptr),
+    size_(0)
+{}
+
 Blob::Blob(Blob &&other)
   : heap_(GetProcessHeap()),
+    arena_(nullptr),
     buffer_(nullptr),
     size_(0) {
   std::swap(buffer_, other.buffer_);
   std::swap(heap_, other.heap_);
+  std::swap(arena_, other.arena_);
   std::swap(size_, other.size_);
 }
 
@@ -179,6 +229,7 @@ Blob &Blob::operator=(Blob &&other) {
   if (this != &other) {
     Release();
     heap_ = other.heap_;
+    arena_ = other.arena_;
     buffer_ = other.buffer_;
     size_ = other.size_;
     other.buffer_ = nullptr;
@@ -191,19 +242,41 @@ DWORD Blob::Size() const {
   return size_;
 }
 
+bool Blob::IsSecure() const {
+  return arena_ != nullptr;
+}
+
 bool Blob::Alloc(DWORD size) {
-  if (buffer_) {
-    buffer_ = HeapReAlloc(GetProcessHeap(), 0, buffer_, size);
-    if (buffer_) {
+  if (arena_) {
+    if (auto p = arena_->ReAlloc(buffer_, size)) {
+      if (buffer_)
+        AllocProfiler::OnReAlloc(size_, size);
+      else
+        AllocProfiler::OnAlloc(size);
+      buffer_ = p;
+      size_ = size;
+    }
+    else {
+      Log(L"SecureArena::ReAlloc(%u) failed - %08x\n", size, GetLastError());
+      return false;
+    }
+  }
+  else if (buffer_) {
+    // On failure the old block is still ours and keeps its contents.
+    if (auto p = HeapReAlloc(GetProcessHeap(), 0, buffer_, size)) {
+      AllocProfiler::OnReAlloc(size_, size);
+      buffer_ = p;
       size_ = size;
     }
     else {
       Log(L"HeapReAlloc failed - %08x\n", GetLastError());
+      return false;
     }
   }
   else if (size > 0) {
     buffer_ = HeapAlloc(GetProcessHeap(), 0, size);
     if (buffer_) {
+      AllocProfiler::OnAlloc(size);
       size_ = size;
     }
     else {
@@ -213,10 +286,11 @@ bool Blob::Alloc(DWORD size) {
   return buffer_ != nullptr;
 }
 
-void Blob::Dump(std::wostream &os, size_t width, size_t ellipsis) const {
+void Blob::Dump(std::ostream &os, size_t width, size_t ellipsis) const {
+  AllocSite site("Blob::Dump");
   if (auto p = reinterpret_cast<LPCBYTE>(buffer_)) {
-    os << L"Total: " << size_ << L" (=0x"
-       << std::hex << size_ << L") bytes\r\n";
+    os << "Total: " << size_ << " (=0x"
+       << std::hex << size_ << ") bytes\r\n";
 
     size_t bytesLeft = min(size_, ellipsis);
     int lineCount = 0;
@@ -224,25 +298,35 @@ void Blob::Dump(std::wostream &os, size_t width, size_t ellipsis) const {
       size_t i;
       for (i = 0; bytesLeft && i < width; ++i) {
         if (i == 0)
-          os << std::hex << std::setfill(L'0') << std::setw(4)
-             << (lineCount * width) << L':';
+          os << std::hex << std::setfill('0') << std::setw(4)
+             << (lineCount * width) << ':';
 
+        // A narrow stream would print a BYTE as a character.
+        const int value = *(p++);
         if (i > 0 && i % 8 == 0)
-          os << L"  " << std::hex << std::setfill(L'0') << std::setw(2) << *(p++);
+          os << "  " << std::hex << std::setfill('0') << std::setw(2) << value;
         else
-          os << L' ' << std::hex << std::setfill(L'0') << std::setw(2) << *(p++);
+          os << ' ' << std::hex << std::setfill('0') << std::setw(2) << value;
 
         --bytesLeft;
       }
       ++lineCount;
-      if (i == width) os << L"\r\n";
+      if (i == width) os << "\r\n";
     }
 
     if (size_ > ellipsis)
-      os << L" ...\r\n";
+      os << " ...\r\n";
   }
 }
 
+void Blob::Dump(std::wostream &os, size_t width, size_t ellipsis) const {
+  AllocSite site("Blob::Dump");
+  std::ostringstream narrow;
+  Dump(narrow, width, ellipsis);
+  const std::string text = narrow.str();
+  os << std::wstring(text.begin(), text.end());
+}
+
 bool Blob::Save(LPCWSTR filename) const {
   bool ret = false;
   if (auto p = reinterpret_cast<LPCBYTE>(buffer_)) {
@@ -250,12 +334,13 @@ bool Blob::Save(LPCWSTR filename) const {
                              GENERIC_WRITE,
                              FILE_SHARE_READ,
                              nullptr,
-                             OPEN_ALWAYS,
+                             CREATE_ALWAYS,
                              FILE_ATTRIBUTE_NORMAL,
                              nullptr);
     if (file != INVALID_HANDLE_VALUE) {
       DWORD bytesWritten = 0;
-      ret = !!WriteFile(file, p, size_, &bytesWritten, nullptr);
+      ret = WriteFile(file, p, size_, &bytesWritten, nullptr)
+            && bytesWritten == size_;
       if (!ret) {
         Log(L"WriteFile failed - %08x\n", GetLastError());
       }
@@ -268,27 +353,39 @@ bool Blob::Save(LPCWSTR filename) const {
   return ret;
 }
 
-std::wstring Blob::ToBase64String() const {
-  std::wstring ret;
+bool Blob::ToBase64String(std::string &base64) const {
+  AllocSite site("Blob::ToBase64String");
+  base64.clear();
   DWORD characters = 0;
-  if (CryptBinaryToString(reinterpret_cast<LPCBYTE>(buffer_),
-                          size_,
-                          CRYPT_STRING_BASE64,
-                          nullptr,
-                          &characters)
-      && characters > 0) {
-    if (auto buf = new WCHAR[characters]) {
-      if (CryptBinaryToString(reinterpret_cast<LPCBYTE>(buffer_),
-                              size_,
-                              CRYPT_STRING_BASE64,
-                              buf,
-                              &characters)) {
-        ret = buf;
-      }
-      delete[] buf;
-    }
+  if (!CryptBinaryToStringA(reinterpret_cast<LPCBYTE>(buffer_),
+                            size_,
+                            CRYPT_STRING_BASE64,
+                            nullptr,
+                            &characters)
+      || characters == 0) {
+    return false;
   }
-  return ret;
+  // |characters| counts the terminating null, which std::string keeps on
+  // its own.
+  base64.resize(characters);
+  if (!CryptBinaryToStringA(reinterpret_cast<LPCBYTE>(buffer_),
+                            size_,
+                            CRYPT_STRING_BASE64,
+                            &base64[0],
+                            &characters)) {
+    Log(L"CryptBinaryToString failed - %08x\n", GetLastError());
+    base64.clear();
+    return false;
+  }
+  base64.resize(characters);
+  return true;
+}
+
+std::wstring Blob::ToBase64String() const {
+  AllocSite site("Blob::ToBase64String");
+  std::string narrow;
+  ToBase64String(narrow);
+  return std::wstring(narrow.begin(), narrow.end());
 }
 
 void Blob::Reverse() {
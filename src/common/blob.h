@@ -1,18 +1,28 @@
+class SecureArena;
+
 class Blob {
 private:
   HANDLE heap_;
+  SecureArena *arena_;
   LPVOID buffer_;
   DWORD size_;
 
   void Release();
 
 public:
+  // Encoded text is ASCII, so the narrow overloads are the real ones and
+  // the wide ones convert at the boundary for the GUI.
+  static Blob FromBase64String(std::string_view base64);
   static Blob FromBase64String(LPCWSTR base64);
+  static Blob FromHexString(std::string_view hexstr);
   static Blob FromHexString(LPCWSTR hexstr);
   static Blob AsUTF8(LPCWSTR plaintext);
 
   Blob();
   Blob(DWORD size);
+  // Allocates from |arena| instead of the process heap.  The buffer is
+  // zeroed when the blob is released.
+  Blob(SecureArena &arena);
   Blob(Blob &&other);
   ~Blob();
 
@@ -20,9 +30,13 @@ public:
   operator LPCBYTE() const;
   Blob &operator=(Blob &&other);
   DWORD Size() const;
+  bool IsSecure() const;
   bool Alloc(DWORD size);
+  void Dump(std::ostream &os, size_t width, size_t ellipsis) const;
   void Dump(std::wostream &os, size_t width, size_t ellipsis) const;
   bool Save(LPCWSTR filename) const;
+  // Replaces the contents of |base64|, reusing its buffer.
+  bool ToBase64String(std::string &base64) const;
   std::wstring ToBase64String() const;
   void Reverse();
 };
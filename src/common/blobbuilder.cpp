@@ -0,0 +1,163 @@
+#include <windows.h>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "blob.h"
+#include "blobbuilder.h"
+
+static const DWORD MinCapacity = 64;
+
+BlobBuilder::BlobBuilder()
+  : arena_(nullptr),
+    used_(0),
+    size_(0)
+{}
+
+BlobBuilder::BlobBuilder(SecureArena &arena)
+  : arena_(&arena),
+    buffer_(arena),
+    used_(0),
+    size_(0)
+{}
+
+DWORD BlobBuilder::Size() const {
+  return size_;
+}
+
+DWORD BlobBuilder::Capacity() const {
+  return buffer_.Size();
+}
+
+bool BlobBuilder::IsContiguous() const {
+  for (const auto &segment : segments_) {
+    if (segment.external) return false;
+  }
+  return true;
+}
+
+bool BlobBuilder::Grow(DWORD more) {
+  if (more > MAXDWORD - size_) {
+    SetLastError(ERROR_ARITHMETIC_OVERFLOW);
+    return false;
+  }
+  const DWORD needed = used_ + more;
+  if (needed <= Capacity()) return true;
+
+  DWORD capacity = max(Capacity(), MinCapacity);
+  while (capacity < needed) {
+    capacity = capacity > MAXDWORD / 2 ? needed : capacity * 2;
+  }
+  // Near the limit of the heap or the arena, settle for what is needed.
+  return buffer_.Alloc(capacity)
+         || (capacity > needed && buffer_.Alloc(needed));
+}
+
+bool BlobBuilder::Add(LPCBYTE external, DWORD offset, DWORD size) {
+  if (!segments_.empty()) {
+    auto &last = segments_.back();
+    const bool adjacent =
+      external
+        ? last.external && last.external + last.size == external
+        : !last.external && last.offset + last.size == offset;
+    if (adjacent) {
+      last.size += size;
+      size_ += size;
+      return true;
+    }
+  }
+  segments_.push_back({external, offset, size});
+  size_ += size;
+  return true;
+}
+
+bool BlobBuilder::Reserve(DWORD capacity) {
+  return capacity <= Capacity() || buffer_.Alloc(capacity);
+}
+
+bool BlobBuilder::Append(LPCBYTE data, DWORD size) {
+  if (size == 0) return true;
+  if (!data) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return false;
+  }
+  // |data| may be a part already copied in, which Grow() would move.
+  const LPCBYTE base = buffer_;
+  const bool inside =
+    base && data >= base && data < base + buffer_.Size();
+  const DWORD offset = inside ? static_cast<DWORD>(data - base) : 0;
+  if (!Grow(size)) return false;
+  if (inside) data = LPCBYTE(buffer_) + offset;
+
+  memmove(LPBYTE(buffer_) + used_, data, size);
+  Add(nullptr, used_, size);
+  used_ += size;
+  return true;
+}
+
+bool BlobBuilder::Append(const BlobView &view) {
+  return Append(view.data, view.size);
+}
+
+LPBYTE BlobBuilder::Extend(DWORD size) {
+  if (size == 0 || !Grow(size)) return nullptr;
+
+  LPBYTE p = LPBYTE(buffer_) + used_;
+  Add(nullptr, used_, size);
+  used_ += size;
+  return p;
+}
+
+bool BlobBuilder::Reference(const BlobView &view) {
+  if (view.size == 0) return true;
+  if (!view.data) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return false;
+  }
+  if (view.size > MAXDWORD - size_) {
+    SetLastError(ERROR_ARITHMETIC_OVERFLOW);
+    return false;
+  }
+  return Add(view.data, 0, view.size);
+}
+
+std::vector<BlobView> BlobBuilder::Segments() const {
+  std::vector<BlobView> views;
+  views.reserve(segments_.size());
+  LPCBYTE base = buffer_;
+  for (const auto &segment : segments_) {
+    views.emplace_back(segment.external ? segment.external
+                                        : base + segment.offset,
+                       segment.size);
+  }
+  return views;
+}
+
+Blob BlobBuilder::Finish() {
+  Blob result;
+  if (size_ > 0) {
+    if (IsContiguous() && buffer_.Alloc(used_)) {
+      // Shrinking keeps the block where it is, so nothing is copied.
+      result = std::move(buffer_);
+      buffer_ = arena_ ? Blob(*arena_) : Blob();
+    }
+    else {
+      if (arena_) result = Blob(*arena_);
+      if (result.Alloc(size_)) {
+        LPBYTE p = result;
+        for (const auto &view : Segments()) {
+          memcpy(p, view.data, view.size);
+          p += view.size;
+        }
+      }
+    }
+  }
+  Clear();
+  return result;
+}
+
+void BlobBuilder::Clear() {
+  used_ = 0;
+  size_ = 0;
+  segments_.clear();
+}
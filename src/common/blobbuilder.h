@@ -0,0 +1,69 @@
+// A read-only range of bytes owned by someone else.
+struct BlobView {
+  LPCBYTE data;
+  DWORD size;
+
+  BlobView() : data(nullptr), size(0) {}
+  BlobView(LPCBYTE p, DWORD n) : data(p), size(n) {}
+  BlobView(const Blob &blob) : data(blob), size(blob.Size()) {}
+};
+
+// Assembles a Blob from parts.
+//
+// Append() copies into a buffer that at least doubles when it runs out,
+// so appending in a loop stays linear, and Finish() hands that buffer over
+// as the Blob without copying it again.  Reference() adds a part without
+// copying it; the caller keeps the memory alive until the builder is
+// finished or cleared.  Segments() lists the parts in order so that they
+// can go to HashBase::AddData or AsyncFileWriter::Write without staging,
+// and Finish() on a builder with references copies each part once.
+class BlobBuilder {
+private:
+  struct Segment {
+    LPCBYTE external;  // nullptr for a range of buffer_
+    DWORD offset;
+    DWORD size;
+  };
+
+  SecureArena *arena_;
+  Blob buffer_;  // its size is the capacity
+  DWORD used_;
+  DWORD size_;
+  std::vector<Segment> segments_;
+
+  bool Grow(DWORD more);
+  bool Add(LPCBYTE external, DWORD offset, DWORD size);
+
+public:
+  BlobBuilder();
+  // Keeps the copied parts and the result in |arena|.  A buffer larger
+  // than the arena's biggest slot gets locked pages of its own, so the
+  // arena does not cap how much can be built.
+  BlobBuilder(SecureArena &arena);
+
+  DWORD Size() const;
+  DWORD Capacity() const;
+  // True unless Reference() was used.
+  bool IsContiguous() const;
+
+  bool Reserve(DWORD capacity);
+  // |data| may point into the builder itself, e.g. at a part from
+  // Segments(); it is read after the buffer grows.
+  bool Append(LPCBYTE data, DWORD size);
+  bool Append(const BlobView &view);
+  template<class T>
+  bool AppendValue(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only plain values can be appended");
+    return Append(reinterpret_cast<LPCBYTE>(&value), sizeof(T));
+  }
+  // Appends |size| bytes for the caller to fill.  The pointer is valid
+  // until the next call that adds to the builder.
+  LPBYTE Extend(DWORD size);
+  bool Reference(const BlobView &view);
+
+  std::vector<BlobView> Segments() const;
+  // Returns everything added so far and leaves the builder empty.
+  Blob Finish();
+  void Clear();
+};
@@ -0,0 +1,380 @@
+#include <windows.h>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "blob.h"
+#include "blobbuilder.h"
+#include "der.h"
+#include "digest.h"
+#include "hash.h"
+#include "key.h"
+#include "keyconv.h"
+#include "provider.h"
+#include "cms.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+constexpr BYTE OidSignedData[] = {
+  0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x02,
+};
+constexpr BYTE OidData[] = {
+  0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x01,
+};
+constexpr BYTE OidContentType[] = {
+  0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x03,
+};
+constexpr BYTE OidMessageDigest[] = {
+  0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x04,
+};
+constexpr BYTE OidSigningTime[] = {
+  0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x05,
+};
+
+// The attribute ::= SEQUENCE { type, SET { value } } with |value| already
+// encoded.  Attributes are sorted before they are written, so each is
+// encoded on its own; an empty Blob means out of memory.
+Blob Attribute(LPCBYTE type, DWORD typeSize, const BlobView &value) {
+  BlobBuilder out;
+  if (!Der::AppendHeader(out,
+                         Der::Sequence,
+                         typeSize + Der::TlvSize(value.size))
+      || !out.Append(type, typeSize)
+      || !Der::AppendTlv(out, Der::Set, value.data, value.size)) {
+    return Blob();
+  }
+  return out.Finish();
+}
+
+LPBYTE PutDigits(LPBYTE p, DWORD value, int digits) {
+  for (DWORD scale = digits == 4 ? 1000 : 10; scale > 0; scale /= 10) {
+    *p++ = static_cast<BYTE>('0' + value / scale % 10);
+  }
+  return p;
+}
+
+// UTCTime through 2049 and GeneralizedTime after, as RFC 5652 requires.
+bool AppendSigningTime(BlobBuilder &out, const SYSTEMTIME &now) {
+  const bool utc = now.wYear >= 1950 && now.wYear < 2050;
+  const DWORD length = utc ? 13 : 15;
+  if (!Der::AppendHeader(out,
+                         utc ? Der::UtcTime : Der::GeneralizedTime,
+                         length)) {
+    return false;
+  }
+  LPBYTE p = out.Extend(length);
+  if (!p) return false;
+  p = PutDigits(p, utc ? now.wYear % 100 : now.wYear, utc ? 2 : 4);
+  p = PutDigits(p, now.wMonth, 2);
+  p = PutDigits(p, now.wDay, 2);
+  p = PutDigits(p, now.wHour, 2);
+  p = PutDigits(p, now.wMinute, 2);
+  p = PutDigits(p, now.wSecond, 2);
+  *p = 'Z';
+  return true;
+}
+
+// DER orders a SET OF by the encodings of its elements.
+bool EncodingLess(const Blob &a, const Blob &b) {
+  return std::lexicographical_compare(LPCBYTE(a), LPCBYTE(a) + a.Size(),
+                                      LPCBYTE(b), LPCBYTE(b) + b.Size());
+}
+
+}  // namespace
+
+CmsSigner::CmsSigner(const CmsSignerConfig &config)
+  : config_(config),
+    algorithm_(HashAlgorithm::Find(config.hashAlgo)),
+    provider_(NULL),
+    contentSize_(0),
+    keyId_{}
+{}
+
+bool CmsSigner::IdentifyByCertificate() {
+  // Certificate ::= SEQUENCE { tbsCertificate, ... } and
+  // TBSCertificate ::= SEQUENCE { [0] version OPTIONAL, serialNumber,
+  // signature, issuer, ... }
+  LPCBYTE p = certificate_;
+  DWORD size = certificate_.Size();
+  BYTE tag = 0;
+  DWORD header = 0, length = 0;
+  for (int level = 0; level < 2; ++level) {
+    if (!Der::ReadHeader(p, size, tag, header, length)
+        || tag != Der::Sequence) {
+      return false;
+    }
+    p += header;
+    size = length;
+  }
+
+  if (!Der::ReadHeader(p, size, tag, header, length)) return false;
+  if (tag == Der::Context0) {
+    p += header + length;
+    size -= header + length;
+    if (!Der::ReadHeader(p, size, tag, header, length)) return false;
+  }
+  if (tag != Der::Integer) return false;
+  serial_ = BlobView(p, header + length);
+  p += header + length;
+  size -= header + length;
+
+  if (!Der::ReadHeader(p, size, tag, header, length)
+      || tag != Der::Sequence) {
+    return false;
+  }
+  p += header + length;
+  size -= header + length;
+
+  if (!Der::ReadHeader(p, size, tag, header, length)
+      || tag != Der::Sequence) {
+    return false;
+  }
+  issuer_ = BlobView(p, header + length);
+  return true;
+}
+
+bool CmsSigner::IdentifyByKey() {
+  HCRYPTKEY handle = NULL;
+  if (!CryptoProvider::Current().GetUserKey(provider_,
+                                            config_.keySpec,
+                                            &handle)) {
+    Log(L"CryptGetUserKey() failed - %08x\n", GetLastError());
+    return false;
+  }
+  Key key(handle);
+  const Blob blob = key.Export(PUBLICKEYBLOB);
+  RsaBlobView rsa;
+  if (!rsa.Parse(blob, blob.Size())) {
+    Log(L"CmsSigner: the key is not an RSA key\n");
+    return false;
+  }
+
+  KeyConverterConfig pkcs1;
+  pkcs1.format = KeyConverterConfig::Pkcs1;
+  BlobBuilder publicKey;
+  if (!KeyConverter(pkcs1).Convert(rsa, nullptr, publicKey)) return false;
+  Sha1 sha1;
+  for (const auto &it : publicKey.Segments()) {
+    sha1.Update(it.data, it.size);
+  }
+  sha1.Final(keyId_);
+  return true;
+}
+
+bool CmsSigner::Begin(HCRYPTPROV provider, LPCBYTE certificate, DWORD size) {
+  if (!algorithm_) {
+    Log(L"CmsSigner: unsupported hash algorithm %08x\n", config_.hashAlgo);
+    return false;
+  }
+  provider_ = provider;
+  contentSize_ = 0;
+  certificate_ = Blob();
+  issuer_ = BlobView();
+  serial_ = BlobView();
+  if (certificate) {
+    if (!certificate_.Alloc(size)) return false;
+    memcpy(certificate_, certificate, size);
+    if (!IdentifyByCertificate()) {
+      Log(L"CmsSigner: the certificate is not DER X.509\n");
+      return false;
+    }
+  }
+  else if (!IdentifyByKey()) {
+    return false;
+  }
+  return content_.Create(provider, config_.hashAlgo);
+}
+
+bool CmsSigner::Update(LPCBYTE data, DWORD size) {
+  if (!content_.AddData(data, size)) return false;
+  contentSize_ += size;
+  return true;
+}
+
+ULONGLONG CmsSigner::ContentSize() const {
+  return contentSize_;
+}
+
+bool CmsSigner::Finish(const Sink &sink) {
+  if (!algorithm_) {
+    // Begin() has already said so.
+    SetLastError(NTE_BAD_ALGID);
+    return false;
+  }
+  const Blob digest = content_.GetHashValue();
+  if (digest.Size() != algorithm_->digestSize) return false;
+
+  std::vector<Blob> attributes;
+  BlobBuilder value;
+  if (!Der::AppendTlv(value, Der::OctetString, digest, digest.Size())) {
+    Log(L"CmsSigner: out of memory\n");
+    return false;
+  }
+  attributes.push_back(Attribute(OidContentType,
+                                 sizeof(OidContentType),
+                                 BlobView(OidData, sizeof(OidData))));
+  attributes.push_back(Attribute(OidMessageDigest,
+                                 sizeof(OidMessageDigest),
+                                 value.Finish()));
+  if (config_.signingTime) {
+    SYSTEMTIME now;
+    GetSystemTime(&now);
+    if (!AppendSigningTime(value, now)) {
+      Log(L"CmsSigner: out of memory\n");
+      return false;
+    }
+    attributes.push_back(Attribute(OidSigningTime,
+                                   sizeof(OidSigningTime),
+                                   value.Finish()));
+  }
+  DWORD attrsSize = 0;
+  for (const auto &it : attributes) {
+    if (it.Size() == 0) {
+      Log(L"CmsSigner: out of memory\n");
+      return false;
+    }
+    attrsSize += it.Size();
+  }
+  std::sort(attributes.begin(), attributes.end(), EncodingLess);
+
+  // The signature covers the attributes with their SET tag, though they
+  // are sent as [0] IMPLICIT, so the SET header goes in front of them and
+  // is skipped in the output.
+  BlobBuilder signedAttrs;
+  bool ok = Der::AppendHeader(signedAttrs, Der::Set, attrsSize);
+  for (const auto &it : attributes) {
+    ok = ok && signedAttrs.Append(it);
+  }
+  if (!ok) {
+    Log(L"CmsSigner: out of memory\n");
+    return false;
+  }
+  const Blob attrs = signedAttrs.Finish();
+  const LPCBYTE attrsValue = LPCBYTE(attrs) + Der::HeaderSize(attrsSize);
+  Hash hash;
+  if (!hash.Create(provider_, config_.hashAlgo)
+      || !hash.AddData(attrs, attrs.Size())) {
+    return false;
+  }
+  Blob signature = hash.Sign(config_.keySpec);
+  if (signature.Size() == 0) return false;
+  // CryptSignHash is little-endian; CMS wants the big-endian octets.
+  signature.Reverse();
+
+  // AlgorithmIdentifier of the digest, taken from its DigestInfo prefix.
+  const LPCBYTE digestAlgo = algorithm_->digestInfo + 2;
+  const DWORD digestAlgoSize = Der::TlvSize(digestAlgo[1]);
+
+  const bool byCertificate = certificate_.Size() > 0;
+  const BYTE version = byCertificate ? 1 : 3;
+  const DWORD sidSize = byCertificate
+    ? Der::TlvSize(issuer_.size + serial_.size)
+    : Der::TlvSize(KeyIdSize);
+  const DWORD signerInfoSize = Der::TlvSize(1)
+                               + sidSize
+                               + digestAlgoSize
+                               + Der::TlvSize(attrsSize)
+                               + sizeof(Der::RsaEncryption)
+                               + Der::TlvSize(signature.Size());
+  const DWORD signedDataSize = Der::TlvSize(1)
+                               + Der::TlvSize(digestAlgoSize)
+                               + Der::TlvSize(sizeof(OidData))
+                               + (byCertificate
+                                  ? Der::TlvSize(certificate_.Size())
+                                  : 0)
+                               + Der::TlvSize(Der::TlvSize(signerInfoSize));
+  const DWORD contentInfoSize = sizeof(OidSignedData)
+                                + Der::TlvSize(Der::TlvSize(signedDataSize));
+
+  BlobBuilder out;
+  ok = Der::AppendHeader(out, Der::Sequence, contentInfoSize)
+            && out.Append(OidSignedData, sizeof(OidSignedData))
+            && Der::AppendHeader(out,
+                                 Der::Context0,
+                                 Der::TlvSize(signedDataSize))
+            && Der::AppendHeader(out, Der::Sequence, signedDataSize)
+            && Der::AppendTlv(out, Der::Integer, &version, 1)
+            && Der::AppendTlv(out, Der::Set, digestAlgo, digestAlgoSize)
+            && Der::AppendTlv(out, Der::Sequence, OidData, sizeof(OidData));
+  if (ok && byCertificate) {
+    ok = Der::AppendHeader(out, Der::Context0, certificate_.Size())
+         && out.Reference(certificate_);
+  }
+  ok = ok
+       && Der::AppendHeader(out, Der::Set, Der::TlvSize(signerInfoSize))
+       && Der::AppendHeader(out, Der::Sequence, signerInfoSize)
+       && Der::AppendTlv(out, Der::Integer, &version, 1);
+  if (ok && byCertificate) {
+    ok = Der::AppendHeader(out, Der::Sequence, issuer_.size + serial_.size)
+         && out.Reference(issuer_)
+         && out.Reference(serial_);
+  }
+  else if (ok) {
+    ok = Der::AppendTlv(out, Der::Context0Primitive, keyId_, KeyIdSize);
+  }
+  ok = ok
+       && out.Append(digestAlgo, digestAlgoSize)
+       && Der::AppendTlv(out, Der::Context0, attrsValue, attrsSize)
+       && out.Append(Der::RsaEncryption, sizeof(Der::RsaEncryption))
+       && Der::AppendTlv(out, Der::OctetString, signature, signature.Size());
+  if (!ok) {
+    Log(L"CmsSigner: out of memory\n");
+    return false;
+  }
+
+  const auto segments = out.Segments();
+  if (!config_.pem) {
+    for (const auto &it : segments) {
+      if (!sink(it.data, it.size)) return false;
+    }
+    return true;
+  }
+  PemWriter pem(sink, "PKCS7");
+  if (!pem.Begin()) return false;
+  for (const auto &it : segments) {
+    if (!pem.Write(it.data, it.size)) return false;
+  }
+  return pem.End();
+}
+
+bool CmsSigner::SignFile(HCRYPTPROV provider,
+                         LPCBYTE certificate,
+                         DWORD certificateSize,
+                         LPCWSTR filename,
+                         const Sink &sink) {
+  if (!Begin(provider, certificate, certificateSize)) return false;
+
+  HANDLE file = CreateFile(filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+  bool ret = false;
+  Blob buffer;
+  if (buffer.Alloc(ReadSize)) {
+    for (;;) {
+      DWORD bytesRead = 0;
+      if (!ReadFile(file, buffer, ReadSize, &bytesRead, nullptr)) {
+        Log(L"ReadFile failed - %08x\n", GetLastError());
+        break;
+      }
+      if (bytesRead == 0) {
+        ret = true;
+        break;
+      }
+      if (!Update(buffer, bytesRead)) break;
+    }
+  }
+  CloseHandle(file);
+  return ret && Finish(sink);
+}
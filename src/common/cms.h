@@ -0,0 +1,66 @@
+struct CmsSignerConfig {
+  ALG_ID hashAlgo;
+  DWORD keySpec;
+  bool signingTime;  // adds the signingTime attribute
+  bool pem;          // "-----BEGIN PKCS7-----" armour instead of DER
+
+  CmsSignerConfig()
+    : hashAlgo(CALG_SHA_256), keySpec(AT_SIGNATURE), signingTime(true),
+      pem(false)
+  {}
+};
+
+// Produces a detached CMS SignedData (RFC 5652) for content of any size.
+//
+// The content is hashed as it is passed to Update() and never kept, so a
+// file is read once, front to back, in ReadSize chunks.  Finish() puts the
+// content digest into the signed attributes, signs their DER with the
+// provider's key through Hash and HashBase::Sign, and hands the encoding
+// to the sink in order as it is produced; the certificate goes out from
+// the copy Begin() made without being assembled into a larger buffer.
+// Memory use therefore depends on the certificate and the key size only.
+//
+// With a certificate the signer is identified by its issuer and serial
+// number (version 1).  Without one it is identified by the SHA-1 of its
+// RSAPublicKey, the subject key identifier RFC 5280 suggests (version 3),
+// and the output carries no certificates.
+class CmsSigner {
+public:
+  // Returns false to stop the output.
+  typedef std::function<bool(LPCBYTE data, DWORD size)> Sink;
+
+  static constexpr DWORD ReadSize = 1024 * 1024;
+  static constexpr DWORD KeyIdSize = 20;
+
+private:
+  const CmsSignerConfig config_;
+  const HashAlgorithm *algorithm_;
+  HCRYPTPROV provider_;
+  Hash content_;
+  ULONGLONG contentSize_;
+  Blob certificate_;
+  BlobView issuer_;  // in certificate_
+  BlobView serial_;  // in certificate_
+  BYTE keyId_[KeyIdSize];
+
+  bool IdentifyByCertificate();
+  bool IdentifyByKey();
+
+public:
+  CmsSigner(const CmsSignerConfig &config);
+
+  // |certificate| is the signer's DER X.509 certificate, or nullptr.
+  bool Begin(HCRYPTPROV provider, LPCBYTE certificate, DWORD size);
+  bool Update(LPCBYTE data, DWORD size);
+  // Signs what Update() was given and writes the SignedData to |sink|.
+  // Begin() must be called again before the next signature.
+  bool Finish(const Sink &sink);
+  ULONGLONG ContentSize() const;
+
+  // Begin(), Update() with the whole of |filename|, then Finish().
+  bool SignFile(HCRYPTPROV provider,
+                LPCBYTE certificate,
+                DWORD certificateSize,
+                LPCWSTR filename,
+                const Sink &sink);
+};
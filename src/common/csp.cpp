@@ -1,11 +1,24 @@
 #include <windows.h>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "executor.h"
+#include "async.h"
 #include "csp.h"
+#include "provider.h"
 
 void Log(LPCWSTR Format, ...);
 
 void CSP::Release() {
   if (provider_) {
-    CryptReleaseContext(provider_, 0);
+    CryptoProvider::Current().ReleaseContext(provider_, 0);
   }
   provider_ = NULL;
 }
@@ -30,11 +43,11 @@ bool CSP::Acquire(LPCWSTR containerName,
                   DWORD providerType,
                   DWORD flags) {
   Release();
-  bool ret = !!CryptAcquireContext(&provider_,
-                                   containerName,
-                                   providerName,
-                                   providerType,
-                                   flags);
+  bool ret = !!CryptoProvider::Current().AcquireContext(&provider_,
+                                                        containerName,
+                                                        providerName,
+                                                        providerType,
+                                                        flags);
   if (!ret) {
     Log(L"CryptAcquireContext(%08x) failed - %08x\n",
         flags,
@@ -45,8 +58,40 @@ bool CSP::Acquire(LPCWSTR containerName,
 
 HCRYPTKEY CSP::GetUserKey(DWORD keySpec) {
   HCRYPTKEY key = NULL;
-  if (!CryptGetUserKey(provider_, keySpec, &key)) {
+  if (!CryptoProvider::Current().GetUserKey(provider_, keySpec, &key)) {
     Log(L"CryptGetUserKey() failed - %08x\n", GetLastError());
   }
   return key;
 }
+
+HCRYPTKEY CSP::GenKey(ALG_ID algo, DWORD flags) {
+  HCRYPTKEY key = NULL;
+  if (!CryptoProvider::Current().GenKey(provider_, algo, flags, &key)) {
+    Log(L"CryptGenKey(%08x) failed - %08x\n", algo, GetLastError());
+    key = NULL;
+  }
+  return key;
+}
+
+Operation<bool> CSP::AcquireAsync(Strand &strand,
+                                  LPCWSTR containerName,
+                                  LPCWSTR providerName,
+                                  DWORD providerType,
+                                  DWORD flags) {
+  // The caller's strings may be gone by the time the strand runs this.
+  std::optional<std::wstring> container, provider;
+  if (containerName) container = containerName;
+  if (providerName) provider = providerName;
+  return Operation<bool>(strand,
+                         [this, container, provider, providerType, flags]() {
+                           return Acquire(container ? container->c_str() : nullptr,
+                                          provider ? provider->c_str() : nullptr,
+                                          providerType,
+                                          flags);
+                         });
+}
+
+Operation<HCRYPTKEY> CSP::GetUserKeyAsync(Strand &strand, DWORD keySpec) {
+  return Operation<HCRYPTKEY>(strand,
+                              [this, keySpec]() { return GetUserKey(keySpec); });
+}
@@ -1,3 +1,7 @@
+class Strand;
+template<class T>
+class Operation;
+
 class CSP {
 private:
   HCRYPTPROV provider_;
@@ -14,4 +18,13 @@ public:
                DWORD providerType,
                DWORD flags);
   HCRYPTKEY GetUserKey(DWORD keySpec);
+  // |flags| takes CRYPT_EXPORTABLE and the key size in the upper 16 bits.
+  HCRYPTKEY GenKey(ALG_ID algo, DWORD flags);
+
+  Operation<bool> AcquireAsync(Strand &strand,
+                               LPCWSTR containerName,
+                               LPCWSTR providerName,
+                               DWORD providerType,
+                               DWORD flags);
+  Operation<HCRYPTKEY> GetUserKeyAsync(Strand &strand, DWORD keySpec);
 };
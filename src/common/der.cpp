@@ -0,0 +1,158 @@
+#include <windows.h>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "blob.h"
+#include "blobbuilder.h"
+#include "der.h"
+
+namespace {
+
+constexpr char Base64Digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The significant bytes of a little-endian value.
+DWORD Significant(const BlobView &le) {
+  DWORD size = le.size;
+  while (size > 0 && le.data[size - 1] == 0) --size;
+  return size;
+}
+
+}  // namespace
+
+DWORD Der::HeaderSize(DWORD length) {
+  DWORD size = 2;
+  if (length >= 0x80) {
+    for (DWORD n = length; n; n >>= 8) ++size;
+  }
+  return size;
+}
+
+DWORD Der::TlvSize(DWORD length) {
+  return HeaderSize(length) + length;
+}
+
+DWORD Der::IntegerSize(const BlobView &le) {
+  const DWORD size = Significant(le);
+  if (size == 0) return 3;
+  return TlvSize(size + ((le.data[size - 1] & 0x80) ? 1 : 0));
+}
+
+bool Der::AppendHeader(BlobBuilder &out, BYTE tag, DWORD length) {
+  const DWORD size = HeaderSize(length);
+  LPBYTE p = out.Extend(size);
+  if (!p) return false;
+  p[0] = tag;
+  if (size == 2) {
+    p[1] = static_cast<BYTE>(length);
+    return true;
+  }
+  p[1] = static_cast<BYTE>(0x80 | (size - 2));
+  for (DWORD i = size - 1; i >= 2; --i, length >>= 8) {
+    p[i] = static_cast<BYTE>(length);
+  }
+  return true;
+}
+
+bool Der::AppendTlv(BlobBuilder &out,
+                    BYTE tag,
+                    LPCBYTE value,
+                    DWORD length) {
+  return AppendHeader(out, tag, length) && out.Append(value, length);
+}
+
+bool Der::AppendInteger(BlobBuilder &out, const BlobView &le) {
+  const DWORD size = Significant(le);
+  // A set top bit would make the value negative.
+  const bool pad = size == 0 || (le.data[size - 1] & 0x80);
+  const DWORD length = size + (pad ? 1 : 0);
+  if (!AppendHeader(out, Integer, length)) return false;
+  LPBYTE p = out.Extend(length);
+  if (!p) return false;
+  if (pad) *p++ = 0;
+  for (DWORD i = size; i > 0; --i) {
+    *p++ = le.data[i - 1];
+  }
+  return true;
+}
+
+bool Der::ReadHeader(LPCBYTE p,
+                     DWORD size,
+                     BYTE &tag,
+                     DWORD &header,
+                     DWORD &length) {
+  if (size < 2) return false;
+  tag = p[0];
+  header = 2;
+  length = p[1];
+  if (length & 0x80) {
+    const DWORD count = length & 0x7f;
+    if (count == 0 || count > sizeof(DWORD) || size < 2 + count) {
+      return false;
+    }
+    length = 0;
+    for (DWORD i = 0; i < count; ++i) {
+      length = (length << 8) | p[2 + i];
+    }
+    header += count;
+  }
+  return length <= size - header;
+}
+
+PemWriter::PemWriter(const Sink &sink, LPCSTR label)
+  : sink_(sink), label_(label), used_(0)
+{}
+
+bool PemWriter::Line(LPCBYTE data, DWORD size) {
+  char line[LineBytes / 3 * 4 + 2];
+  DWORD n = 0;
+  for (DWORD i = 0; i < size; i += 3) {
+    const DWORD left = size - i;
+    const DWORD v = (data[i] << 16)
+                    | (left > 1 ? data[i + 1] << 8 : 0)
+                    | (left > 2 ? data[i + 2] : 0);
+    line[n++] = Base64Digits[v >> 18];
+    line[n++] = Base64Digits[(v >> 12) & 0x3f];
+    line[n++] = left > 1 ? Base64Digits[(v >> 6) & 0x3f] : '=';
+    line[n++] = left > 2 ? Base64Digits[v & 0x3f] : '=';
+  }
+  line[n++] = '\r';
+  line[n++] = '\n';
+  return sink_(reinterpret_cast<LPCBYTE>(line), n);
+}
+
+bool PemWriter::Armour(LPCSTR prefix) {
+  constexpr char suffix[] = "-----\r\n";
+  return sink_(reinterpret_cast<LPCBYTE>(prefix),
+               static_cast<DWORD>(strlen(prefix)))
+         && sink_(reinterpret_cast<LPCBYTE>(label_),
+                  static_cast<DWORD>(strlen(label_)))
+         && sink_(reinterpret_cast<LPCBYTE>(suffix), sizeof(suffix) - 1);
+}
+
+bool PemWriter::Begin() {
+  used_ = 0;
+  return Armour("-----BEGIN ");
+}
+
+bool PemWriter::Write(LPCBYTE data, DWORD size) {
+  while (size > 0) {
+    const DWORD n = min(size, LineBytes - used_);
+    memcpy(pending_ + used_, data, n);
+    used_ += n;
+    data += n;
+    size -= n;
+    if (used_ == LineBytes) {
+      if (!Line(pending_, used_)) return false;
+      used_ = 0;
+    }
+  }
+  return true;
+}
+
+bool PemWriter::End() {
+  if (used_ > 0 && !Line(pending_, used_)) return false;
+  used_ = 0;
+  return Armour("-----END ");
+}
@@ -0,0 +1,72 @@
+// ASN.1 DER written straight into a BlobBuilder.  Callers work out the
+// lengths first, so each value is written once, in order, without
+// encoding the inner values into buffers of their own.
+struct Der {
+  static constexpr BYTE Integer = 0x02;
+  static constexpr BYTE BitString = 0x03;
+  static constexpr BYTE OctetString = 0x04;
+  static constexpr BYTE UtcTime = 0x17;
+  static constexpr BYTE GeneralizedTime = 0x18;
+  static constexpr BYTE Sequence = 0x30;
+  static constexpr BYTE Set = 0x31;
+  static constexpr BYTE Context0 = 0xa0;           // [0] constructed
+  static constexpr BYTE Context0Primitive = 0x80;  // [0] primitive
+
+  // AlgorithmIdentifier of rsaEncryption with NULL parameters, used for
+  // RSA keys and, in CMS, for PKCS#1 v1.5 signatures whatever the digest.
+  static constexpr BYTE RsaEncryption[] = {
+    0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01,
+    0x01, 0x05, 0x00,
+  };
+
+  // Bytes of the identifier and length octets of a value of |length|.
+  static DWORD HeaderSize(DWORD length);
+  static DWORD TlvSize(DWORD length);
+  // Size of the INTEGER of the unsigned little-endian value |le|.
+  static DWORD IntegerSize(const BlobView &le);
+
+  static bool AppendHeader(BlobBuilder &out, BYTE tag, DWORD length);
+  static bool AppendTlv(BlobBuilder &out,
+                        BYTE tag,
+                        LPCBYTE value,
+                        DWORD length);
+  // Writes the INTEGER of the unsigned little-endian value |le|, reversing
+  // its bytes as they are copied.
+  static bool AppendInteger(BlobBuilder &out, const BlobView &le);
+
+  // Reads the header of the value at |p|.  Only the definite lengths DER
+  // allows are accepted, and the value must fit into |size|.
+  static bool ReadHeader(LPCBYTE p,
+                         DWORD size,
+                         BYTE &tag,
+                         DWORD &header,
+                         DWORD &length);
+};
+
+// Base64 in lines of 64 characters between "-----BEGIN <label>-----" and
+// "-----END <label>-----".  Input is buffered up to a line only, so output
+// of any size is encoded as it is produced.
+class PemWriter {
+public:
+  // Returns false to stop the output.
+  typedef std::function<bool(LPCBYTE data, DWORD size)> Sink;
+
+private:
+  static constexpr DWORD LineBytes = 48;
+
+  const Sink &sink_;
+  LPCSTR label_;
+  BYTE pending_[LineBytes];
+  DWORD used_;
+
+  bool Line(LPCBYTE data, DWORD size);
+  bool Armour(LPCSTR prefix);
+
+public:
+  // Both must outlive the writer.
+  PemWriter(const Sink &sink, LPCSTR label);
+
+  bool Begin();
+  bool Write(LPCBYTE data, DWORD size);
+  bool End();
+};
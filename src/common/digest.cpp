@@ -0,0 +1,258 @@
+#include <windows.h>
+#include <memory>
+#include "digest.h"
+
+namespace {
+
+inline DWORD Rotl(DWORD x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+inline DWORD Rotr(DWORD x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+inline DWORD LoadBE(LPCBYTE p) {
+  return (DWORD(p[0]) << 24) | (DWORD(p[1]) << 16) | (DWORD(p[2]) << 8)
+         | DWORD(p[3]);
+}
+
+inline DWORD LoadLE(LPCBYTE p) {
+  return DWORD(p[0]) | (DWORD(p[1]) << 8) | (DWORD(p[2]) << 16)
+         | (DWORD(p[3]) << 24);
+}
+
+inline void StoreBE(LPBYTE p, DWORD v) {
+  p[0] = static_cast<BYTE>(v >> 24);
+  p[1] = static_cast<BYTE>(v >> 16);
+  p[2] = static_cast<BYTE>(v >> 8);
+  p[3] = static_cast<BYTE>(v);
+}
+
+inline void StoreLE(LPBYTE p, DWORD v) {
+  p[0] = static_cast<BYTE>(v);
+  p[1] = static_cast<BYTE>(v >> 8);
+  p[2] = static_cast<BYTE>(v >> 16);
+  p[3] = static_cast<BYTE>(v >> 24);
+}
+
+constexpr DWORD md5K[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+  0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+  0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+  0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+  0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+  0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+constexpr int md5R[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+constexpr DWORD sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+}  // namespace
+
+std::unique_ptr<Digester> Digester::Create(ALG_ID algo) {
+  switch (algo) {
+  case CALG_MD5: return std::make_unique<Md5>();
+  case CALG_SHA1: return std::make_unique<Sha1>();
+  case CALG_SHA_256: return std::make_unique<Sha256>();
+  }
+  return nullptr;
+}
+
+Md5::Md5() {
+  Reset();
+}
+
+void Md5::Reset() {
+  state_[0] = 0x67452301;
+  state_[1] = 0xefcdab89;
+  state_[2] = 0x98badcfe;
+  state_[3] = 0x10325476;
+  used_ = 0;
+  length_ = 0;
+}
+
+void Md5::Compress(LPCBYTE block) {
+  DWORD m[16];
+  for (int i = 0; i < 16; ++i) m[i] = LoadLE(block + 4 * i);
+
+  DWORD a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  for (int i = 0; i < 64; ++i) {
+    DWORD f;
+    int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    }
+    else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) & 15;
+    }
+    else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    }
+    else {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+    const DWORD t = d;
+    d = c;
+    c = b;
+    b = b + Rotl(a + f + md5K[i] + m[g], md5R[i]);
+    a = t;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+}
+
+void Md5::Final(LPBYTE digest) {
+  Pad();
+  for (int i = 0; i < 4; ++i) StoreLE(digest + 4 * i, state_[i]);
+}
+
+Sha1::Sha1() {
+  Reset();
+}
+
+void Sha1::Reset() {
+  state_[0] = 0x67452301;
+  state_[1] = 0xefcdab89;
+  state_[2] = 0x98badcfe;
+  state_[3] = 0x10325476;
+  state_[4] = 0xc3d2e1f0;
+  used_ = 0;
+  length_ = 0;
+}
+
+void Sha1::Compress(LPCBYTE block) {
+  DWORD w[80];
+  for (int i = 0; i < 16; ++i) w[i] = LoadBE(block + 4 * i);
+  for (int i = 16; i < 80; ++i) {
+    w[i] = Rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  DWORD a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+        e = state_[4];
+  for (int i = 0; i < 80; ++i) {
+    DWORD f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    }
+    else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    }
+    else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    }
+    else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    const DWORD t = Rotl(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = Rotl(b, 30);
+    b = a;
+    a = t;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+}
+
+void Sha1::Final(LPBYTE digest) {
+  Pad();
+  for (int i = 0; i < 5; ++i) StoreBE(digest + 4 * i, state_[i]);
+}
+
+Sha256::Sha256() {
+  Reset();
+}
+
+void Sha256::Reset() {
+  state_[0] = 0x6a09e667;
+  state_[1] = 0xbb67ae85;
+  state_[2] = 0x3c6ef372;
+  state_[3] = 0xa54ff53a;
+  state_[4] = 0x510e527f;
+  state_[5] = 0x9b05688c;
+  state_[6] = 0x1f83d9ab;
+  state_[7] = 0x5be0cd19;
+  used_ = 0;
+  length_ = 0;
+}
+
+void Sha256::Compress(LPCBYTE block) {
+  DWORD w[64];
+  for (int i = 0; i < 16; ++i) w[i] = LoadBE(block + 4 * i);
+  for (int i = 16; i < 64; ++i) {
+    const DWORD s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18)
+                     ^ (w[i - 15] >> 3);
+    const DWORD s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19)
+                     ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  DWORD a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+        e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    const DWORD s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+    const DWORD ch = (e & f) ^ (~e & g);
+    const DWORD t1 = h + s1 + ch + sha256K[i] + w[i];
+    const DWORD s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+    const DWORD maj = (a & b) ^ (a & c) ^ (b & c);
+    const DWORD t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+
+void Sha256::Final(LPBYTE digest) {
+  Pad();
+  for (int i = 0; i < 8; ++i) StoreBE(digest + 4 * i, state_[i]);
+}
@@ -0,0 +1,103 @@
+// Portable message digests for the software provider.  These do not touch
+// CryptoAPI, so they work the same on every platform.
+class Digester {
+public:
+  virtual ~Digester() {}
+  virtual void Update(LPCBYTE data, size_t size) = 0;
+  // Writes DigestSize() bytes.  The object must be Reset() before reuse.
+  virtual void Final(LPBYTE digest) = 0;
+  virtual void Reset() = 0;
+  virtual DWORD DigestSize() const = 0;
+  virtual ALG_ID Algorithm() const = 0;
+
+  // nullptr if |algo| is not MD5, SHA1 or SHA256.
+  static std::unique_ptr<Digester> Create(ALG_ID algo);
+};
+
+// Shared 64-byte block buffering of the MD4 family.  |BigEndian| selects
+// how the message length is appended.
+template<class Derived, bool BigEndian>
+class BlockDigester : public Digester {
+protected:
+  BYTE block_[64];
+  DWORD used_;
+  ULONGLONG length_;
+
+  void Pad() {
+    const ULONGLONG bits = length_ * 8;
+    block_[used_++] = 0x80;
+    if (used_ > 56) {
+      memset(block_ + used_, 0, 64 - used_);
+      static_cast<Derived*>(this)->Compress(block_);
+      used_ = 0;
+    }
+    memset(block_ + used_, 0, 56 - used_);
+    for (int i = 0; i < 8; ++i) {
+      block_[56 + i] = static_cast<BYTE>(bits >> (BigEndian ? 56 - 8 * i
+                                                            : 8 * i));
+    }
+    static_cast<Derived*>(this)->Compress(block_);
+    used_ = 0;
+  }
+
+public:
+  BlockDigester() : used_(0), length_(0) {}
+
+  void Update(LPCBYTE data, size_t size) override {
+    length_ += size;
+    if (used_) {
+      const size_t n = min(size, size_t(64 - used_));
+      memcpy(block_ + used_, data, n);
+      used_ += static_cast<DWORD>(n);
+      data += n;
+      size -= n;
+      if (used_ < 64) return;
+      static_cast<Derived*>(this)->Compress(block_);
+      used_ = 0;
+    }
+    for (; size >= 64; data += 64, size -= 64) {
+      static_cast<Derived*>(this)->Compress(data);
+    }
+    memcpy(block_, data, size);
+    used_ = static_cast<DWORD>(size);
+  }
+};
+
+class Md5 : public BlockDigester<Md5, false> {
+private:
+  DWORD state_[4];
+
+public:
+  Md5();
+  void Compress(LPCBYTE block);
+  void Final(LPBYTE digest) override;
+  void Reset() override;
+  DWORD DigestSize() const override { return 16; }
+  ALG_ID Algorithm() const override { return CALG_MD5; }
+};
+
+class Sha1 : public BlockDigester<Sha1, true> {
+private:
+  DWORD state_[5];
+
+public:
+  Sha1();
+  void Compress(LPCBYTE block);
+  void Final(LPBYTE digest) override;
+  void Reset() override;
+  DWORD DigestSize() const override { return 20; }
+  ALG_ID Algorithm() const override { return CALG_SHA1; }
+};
+
+class Sha256 : public BlockDigester<Sha256, true> {
+private:
+  DWORD state_[8];
+
+public:
+  Sha256();
+  void Compress(LPCBYTE block);
+  void Final(LPBYTE digest) override;
+  void Reset() override;
+  DWORD DigestSize() const override { return 32; }
+  ALG_ID Algorithm() const override { return CALG_SHA_256; }
+};
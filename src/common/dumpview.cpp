@@ -0,0 +1,273 @@
+#include <windows.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define DUMPVIEW_SSE2
+#endif
+#include "dumpview.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+constexpr char HexDigits[] = "0123456789abcdef";
+
+// First occurrence of a non-empty |pattern| in [begin, end).  Candidates are positions
+// where both the first and the last byte of the pattern match, found 16 at
+// a time; only those are compared in full.
+LPCBYTE Search(LPCBYTE begin, LPCBYTE end, LPCBYTE pattern, DWORD size) {
+  if (SIZE_T(end - begin) < size) return nullptr;
+  const BYTE first = pattern[0], last = pattern[size - 1];
+  LPCBYTE p = begin;
+#ifdef DUMPVIEW_SSE2
+  const __m128i vfirst = _mm_set1_epi8(static_cast<char>(first));
+  const __m128i vlast = _mm_set1_epi8(static_cast<char>(last));
+  for (; SIZE_T(end - p) >= 16 + size - 1; p += 16) {
+    const __m128i head =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i tail =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + size - 1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, vfirst),
+                                               _mm_cmpeq_epi8(tail, vlast)));
+    while (mask) {
+      unsigned long bit;
+#ifdef _MSC_VER
+      _BitScanForward(&bit, mask);
+#else
+      bit = __builtin_ctz(mask);
+#endif
+      if (memcmp(p + bit, pattern, size) == 0) return p + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; SIZE_T(end - p) >= size; ++p) {
+    if (p[0] == first && p[size - 1] == last
+        && memcmp(p, pattern, size) == 0) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+DumpView::DumpView(DWORD windowSize)
+  : file_(INVALID_HANDLE_VALUE),
+    mapping_(nullptr),
+    data_(nullptr),
+    size_(0),
+    windowSize_(windowSize),
+    granularity_(0),
+    view_(nullptr),
+    viewOffset_(0),
+    viewSize_(0) {
+  SYSTEM_INFO info = {};
+  GetSystemInfo(&info);
+  granularity_ = max(info.dwAllocationGranularity, DWORD(1));
+  windowSize_ = max(windowSize_, granularity_);
+  windowSize_ += (granularity_ - windowSize_ % granularity_) % granularity_;
+}
+
+DumpView::~DumpView() {
+  Release();
+}
+
+void DumpView::Release() {
+  if (view_) {
+    UnmapViewOfFile(view_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+  }
+  file_ = INVALID_HANDLE_VALUE;
+  mapping_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+  view_ = nullptr;
+  viewOffset_ = 0;
+  viewSize_ = 0;
+}
+
+void DumpView::Attach(LPCBYTE data, ULONGLONG size) {
+  Release();
+  data_ = data;
+  size_ = data ? size : 0;
+}
+
+bool DumpView::Open(LPCWSTR filename) {
+  Release();
+  file_ = CreateFile(filename,
+                     GENERIC_READ,
+                     FILE_SHARE_READ,
+                     nullptr,
+                     OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL,
+                     nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+
+  LARGE_INTEGER size = {};
+  if (!GetFileSizeEx(file_, &size)) {
+    Log(L"GetFileSizeEx failed - %08x\n", GetLastError());
+    Release();
+    return false;
+  }
+  // An empty file cannot be mapped, and there is nothing to show anyway.
+  if (size.QuadPart == 0) return true;
+
+  mapping_ = CreateFileMapping(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping_) {
+    Log(L"CreateFileMapping failed - %08x\n", GetLastError());
+    Release();
+    return false;
+  }
+  size_ = size.QuadPart;
+  return true;
+}
+
+void DumpView::Close() {
+  Release();
+}
+
+ULONGLONG DumpView::Size() const {
+  return size_;
+}
+
+ULONGLONG DumpView::LineCount(size_t width) const {
+  return width ? (size_ + width - 1) / width : 0;
+}
+
+LPCBYTE DumpView::Map(ULONGLONG offset, SIZE_T length) const {
+  if (!mapping_) return data_ + offset;
+  if (view_
+      && offset >= viewOffset_
+      && offset + length <= viewOffset_ + viewSize_) {
+    return view_ + (offset - viewOffset_);
+  }
+
+  if (view_) {
+    UnmapViewOfFile(view_);
+    view_ = nullptr;
+  }
+  const ULONGLONG start = offset - offset % granularity_;
+  const ULONGLONG end = min(size_, max(offset + length, start + windowSize_));
+  view_ = reinterpret_cast<LPCBYTE>(
+    MapViewOfFile(mapping_,
+                  FILE_MAP_READ,
+                  static_cast<DWORD>(start >> 32),
+                  static_cast<DWORD>(start),
+                  static_cast<SIZE_T>(end - start)));
+  if (!view_) {
+    Log(L"MapViewOfFile failed - %08x\n", GetLastError());
+    return nullptr;
+  }
+  viewOffset_ = start;
+  viewSize_ = static_cast<SIZE_T>(end - start);
+  return view_ + (offset - start);
+}
+
+bool DumpView::Render(std::ostream &os,
+                      size_t width,
+                      ULONGLONG firstLine,
+                      size_t lines,
+                      bool ascii) const {
+  if (width == 0 || firstLine >= LineCount(width)) return true;
+  const ULONGLONG offset = firstLine * width;
+  const SIZE_T length =
+    static_cast<SIZE_T>(min(ULONGLONG(lines) * width, size_ - offset));
+  LPCBYTE p = Map(offset, length);
+  if (!p) return false;
+
+  int digits = 4;
+  while (digits < 16 && ((size_ - 1) >> (4 * digits))) ++digits;
+
+  // ' xx' per byte, one more space every 8 bytes, two before the ASCII
+  // column.
+  std::string line;
+  line.reserve(digits + 1 + width * 3 + width / 8 + (ascii ? width + 2 : 0));
+  for (SIZE_T done = 0; done < length; done += width) {
+    const size_t count = min(width, size_t(length - done));
+    const ULONGLONG lineOffset = offset + done;
+    line.clear();
+    for (int i = digits; i > 0; --i) {
+      line += HexDigits[(lineOffset >> (4 * (i - 1))) & 0xf];
+    }
+    line += ':';
+    for (size_t i = 0; i < width; ++i) {
+      // A short last line is only padded to keep the ASCII column aligned.
+      if (i >= count && !ascii) break;
+      if (i > 0 && i % 8 == 0) line += ' ';
+      if (i < count) {
+        line += ' ';
+        line += HexDigits[p[done + i] >> 4];
+        line += HexDigits[p[done + i] & 0xf];
+      }
+      else {
+        line += "   ";
+      }
+    }
+    if (ascii) {
+      line += "  ";
+      for (size_t i = 0; i < count; ++i) {
+        const BYTE c = p[done + i];
+        line += (c >= 0x20 && c < 0x7f) ? static_cast<char>(c) : '.';
+      }
+    }
+    line += "\r\n";
+    os.write(line.data(), line.size());
+  }
+  return true;
+}
+
+bool DumpView::Render(std::wostream &os,
+                      size_t width,
+                      ULONGLONG firstLine,
+                      size_t lines,
+                      bool ascii) const {
+  std::ostringstream narrow;
+  if (!Render(narrow, width, firstLine, lines, ascii)) return false;
+  const std::string text = narrow.str();
+  os << std::wstring(text.begin(), text.end());
+  return true;
+}
+
+bool DumpView::Find(LPCBYTE pattern,
+                    DWORD size,
+                    ULONGLONG from,
+                    ULONGLONG &offset) const {
+  if (from > size_ || size > size_ - from) return false;
+  if (size == 0) {
+    offset = from;
+    return true;
+  }
+
+  // Consecutive windows overlap by size - 1 bytes so that a match across
+  // their boundary is not missed.
+  for (ULONGLONG pos = from;;) {
+    const ULONGLONG remaining = size_ - pos;
+    const SIZE_T chunk = static_cast<SIZE_T>(
+      mapping_ ? min(remaining, ULONGLONG(max(windowSize_, size)))
+               : remaining);
+    LPCBYTE p = Map(pos, chunk);
+    if (!p) return false;
+    if (LPCBYTE hit = Search(p, p + chunk, pattern, size)) {
+      offset = pos + (hit - p);
+      return true;
+    }
+    if (chunk == remaining) return false;
+    pos += chunk - (size - 1);
+  }
+}
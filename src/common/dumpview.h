@@ -0,0 +1,59 @@
+// Random-access hex dump of a buffer or of a file of any size.
+//
+// Blob::Dump formats from the first byte up to a cutoff.  DumpView renders
+// any range of lines and finds byte patterns without touching what lies
+// before them.  A file is mapped through a single window of |windowSize|
+// bytes that moves to wherever the last request was, so memory use stays
+// the same however large the file is.  Moving the window is why Render and
+// Find are not thread-safe even though they are const.
+class DumpView {
+public:
+  static constexpr DWORD DefaultWindowSize = 4 * 1024 * 1024;
+
+private:
+  HANDLE file_;
+  HANDLE mapping_;
+  LPCBYTE data_;  // attached memory, not owned
+  ULONGLONG size_;
+  DWORD windowSize_;
+  DWORD granularity_;
+  mutable LPCBYTE view_;
+  mutable ULONGLONG viewOffset_;
+  mutable SIZE_T viewSize_;
+
+  void Release();
+  // Bytes [offset, offset + length), which must lie inside the data.
+  LPCBYTE Map(ULONGLONG offset, SIZE_T length) const;
+
+public:
+  // |windowSize| is rounded up to the allocation granularity.
+  DumpView(DWORD windowSize = DefaultWindowSize);
+  ~DumpView();
+
+  // Views memory the caller keeps alive, such as a Blob.
+  void Attach(LPCBYTE data, ULONGLONG size);
+  bool Open(LPCWSTR filename);
+  void Close();
+  ULONGLONG Size() const;
+  ULONGLONG LineCount(size_t width) const;
+
+  // Writes lines [firstLine, firstLine + lines) of |width| bytes each in the
+  // layout of Blob::Dump, offsets padded to the same number of digits on
+  // every line, and every line ending with CRLF.  With |ascii| the printable
+  // characters follow in a column of their own.
+  bool Render(std::ostream &os,
+              size_t width,
+              ULONGLONG firstLine,
+              size_t lines,
+              bool ascii) const;
+  bool Render(std::wostream &os,
+              size_t width,
+              ULONGLONG firstLine,
+              size_t lines,
+              bool ascii) const;
+  // Finds the first occurrence of |pattern| at or after |from|.
+  bool Find(LPCBYTE pattern,
+            DWORD size,
+            ULONGLONG from,
+            ULONGLONG &offset) const;
+};
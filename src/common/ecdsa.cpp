@@ -0,0 +1,720 @@
+#include <windows.h>
+#include <array>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "digest.h"
+#include "ecdsa.h"
+
+namespace {
+
+typedef EcdsaP256Key::Scalar Limbs;
+
+constexpr DWORD PublicMagic = 0x31534345;   // 'ECS1'
+constexpr DWORD PrivateMagic = 0x32534345;  // 'ECS2'
+
+constexpr Limbs FieldPrime = {
+  0xffffffff, 0xffffffff, 0xffffffff, 0x00000000,
+  0x00000000, 0x00000000, 0x00000001, 0xffffffff,
+};
+constexpr Limbs GroupOrder = {
+  0xfc632551, 0xf3b9cac2, 0xa7179e84, 0xbce6faad,
+  0xffffffff, 0xffffffff, 0x00000000, 0xffffffff,
+};
+constexpr Limbs CurveB = {
+  0x27d2604b, 0x3bce3c3e, 0xcc53b0f6, 0x651d06b0,
+  0x769886bc, 0xb3ebbd55, 0xaa3a93e7, 0x5ac635d8,
+};
+constexpr Limbs BaseX = {
+  0xd898c296, 0xf4a13945, 0x2deb33a0, 0x77037d81,
+  0x63a440f2, 0xf8bce6e5, 0xe12c4247, 0x6b17d1f2,
+};
+constexpr Limbs BaseY = {
+  0x37bf51f5, 0xcbb64068, 0x6b315ece, 0x2bce3357,
+  0x7c0f9e16, 0x8ee7eb4a, 0xfe1a7f9b, 0x4fe342e2,
+};
+
+// k*G adds one of 2^CombTeeth table entries per column, and the columns
+// are CombSpacing bits apart.
+constexpr DWORD CombTeeth = 6;
+constexpr DWORD CombSpacing = 43;  // ceil(256 / CombTeeth)
+constexpr DWORD CombSize = 1 << CombTeeth;
+
+// Verification walks both scalars four bits at a time.
+constexpr DWORD WindowBits = 4;
+constexpr DWORD WindowSize = 1 << WindowBits;
+
+// All ones if |mask| is 1, zero if it is 0.
+inline DWORD Expand(DWORD bit) {
+  return 0 - bit;
+}
+
+// All ones if a == b.
+inline DWORD EqualMask(DWORD a, DWORD b) {
+  return static_cast<DWORD>((static_cast<ULONGLONG>(a ^ b) - 1) >> 32);
+}
+
+void Select(DWORD mask, const Limbs &a, const Limbs &b, Limbs &r) {
+  for (int i = 0; i < 8; ++i) {
+    r[i] = (a[i] & mask) | (b[i] & ~mask);
+  }
+}
+
+// r = a - b, returning the borrow.
+DWORD SubBorrow(const Limbs &a, const Limbs &b, Limbs &r) {
+  DWORD borrow = 0;
+  for (int i = 0; i < 8; ++i) {
+    const ULONGLONG t = static_cast<ULONGLONG>(a[i]) - b[i] - borrow;
+    r[i] = static_cast<DWORD>(t);
+    borrow = static_cast<DWORD>(t >> 32) & 1;
+  }
+  return borrow;
+}
+
+bool IsZero(const Limbs &a) {
+  DWORD any = 0;
+  for (auto limb : a) any |= limb;
+  return any == 0;
+}
+
+void LoadBigEndian(LPCBYTE in, Limbs &r) {
+  for (int i = 0; i < 8; ++i) {
+    LPCBYTE p = in + 28 - 4 * i;
+    r[i] = (DWORD(p[0]) << 24) | (DWORD(p[1]) << 16)
+           | (DWORD(p[2]) << 8) | p[3];
+  }
+}
+
+void StoreBigEndian(const Limbs &a, LPBYTE out) {
+  for (int i = 0; i < 8; ++i) {
+    LPBYTE p = out + 28 - 4 * i;
+    p[0] = static_cast<BYTE>(a[i] >> 24);
+    p[1] = static_cast<BYTE>(a[i] >> 16);
+    p[2] = static_cast<BYTE>(a[i] >> 8);
+    p[3] = static_cast<BYTE>(a[i]);
+  }
+}
+
+// Arithmetic modulo an odd 256-bit |m| in Montgomery form, R = 2^256.
+struct Modulus {
+  Limbs m;
+  DWORD m0inv;  // -m^-1 mod 2^32
+  Limbs one;    // R mod m
+  Limbs r2;     // R^2 mod m
+
+  Modulus(const Limbs &modulus) : m(modulus) {
+    DWORD inv = 1;
+    for (int i = 0; i < 5; ++i) inv *= 2 - m[0] * inv;
+    m0inv = 0 - inv;
+    Limbs x = {1};
+    for (int i = 0; i < 256; ++i) Add(x, x, x);
+    one = x;
+    for (int i = 0; i < 256; ++i) Add(x, x, x);
+    r2 = x;
+  }
+
+  // a, b < m.  r may alias either.
+  void Add(const Limbs &a, const Limbs &b, Limbs &r) const {
+    Limbs sum, diff;
+    ULONGLONG carry = 0;
+    for (int i = 0; i < 8; ++i) {
+      carry += static_cast<ULONGLONG>(a[i]) + b[i];
+      sum[i] = static_cast<DWORD>(carry);
+      carry >>= 32;
+    }
+    const DWORD borrow = SubBorrow(sum, m, diff);
+    // The sum is below m only if it did not carry out and m - sum borrowed.
+    Select(Expand(borrow & ~static_cast<DWORD>(carry) & 1), sum, diff, r);
+  }
+
+  void Sub(const Limbs &a, const Limbs &b, Limbs &r) const {
+    Limbs diff;
+    const DWORD mask = Expand(SubBorrow(a, b, diff));
+    ULONGLONG carry = 0;
+    for (int i = 0; i < 8; ++i) {
+      carry += static_cast<ULONGLONG>(diff[i]) + (m[i] & mask);
+      r[i] = static_cast<DWORD>(carry);
+      carry >>= 32;
+    }
+  }
+
+  // Coarsely integrated operand scanning.  r may alias a or b.
+  void Mul(const Limbs &a, const Limbs &b, Limbs &r) const {
+    DWORD t[10] = {};
+    for (int i = 0; i < 8; ++i) {
+      ULONGLONG c = 0;
+      for (int j = 0; j < 8; ++j) {
+        c += static_cast<ULONGLONG>(a[j]) * b[i] + t[j];
+        t[j] = static_cast<DWORD>(c);
+        c >>= 32;
+      }
+      c += t[8];
+      t[8] = static_cast<DWORD>(c);
+      t[9] = static_cast<DWORD>(c >> 32);
+
+      const DWORD q = t[0] * m0inv;
+      c = (static_cast<ULONGLONG>(q) * m[0] + t[0]) >> 32;
+      for (int j = 1; j < 8; ++j) {
+        c += static_cast<ULONGLONG>(q) * m[j] + t[j];
+        t[j - 1] = static_cast<DWORD>(c);
+        c >>= 32;
+      }
+      c += t[8];
+      t[7] = static_cast<DWORD>(c);
+      t[8] = t[9] + static_cast<DWORD>(c >> 32);
+    }
+
+    // t < 2m; subtract m unless that goes below zero.
+    Limbs low, diff;
+    for (int i = 0; i < 8; ++i) low[i] = t[i];
+    const DWORD borrow = SubBorrow(low, m, diff);
+    const DWORD keep = static_cast<DWORD>(
+      (static_cast<ULONGLONG>(t[8]) - borrow) >> 63);
+    Select(Expand(keep), low, diff, r);
+  }
+
+  void ToMont(const Limbs &a, Limbs &r) const {
+    Mul(a, r2, r);
+  }
+
+  void FromMont(const Limbs &a, Limbs &r) const {
+    const Limbs plain = {1};
+    Mul(a, plain, r);
+  }
+
+  // a^(m-2) by Fermat.  The exponent is public, so the square-and-multiply
+  // pattern does not depend on |a|.
+  void Invert(const Limbs &a, Limbs &r) const {
+    Limbs e;
+    const Limbs two = {2};
+    SubBorrow(m, two, e);
+    Limbs x = one;
+    for (int i = 255; i >= 0; --i) {
+      Mul(x, x, x);
+      if ((e[i / 32] >> (i % 32)) & 1) Mul(x, a, x);
+    }
+    r = x;
+  }
+
+  // Brings a < 2^256 into [0, m), for moduli above 2^255.
+  void Reduce(const Limbs &a, Limbs &r) const {
+    Limbs diff;
+    const DWORD borrow = SubBorrow(a, m, diff);
+    Select(Expand(borrow), a, diff, r);
+  }
+};
+
+// Homogeneous projective coordinates in Montgomery form: (X:Y:Z) is the
+// affine point (X/Z, Y/Z).  The point at infinity is (0:1:0).
+struct Point {
+  Limbs x, y, z;
+};
+
+class Curve {
+private:
+  Point comb_[CombSize];
+  Point window_[WindowSize];  // 0..15 times G
+
+public:
+  const Modulus field;
+  const Modulus order;
+  Limbs b;
+  Point g;
+  Point infinity;
+
+  Curve() : field(FieldPrime), order(GroupOrder) {
+    field.ToMont(CurveB, b);
+    field.ToMont(BaseX, g.x);
+    field.ToMont(BaseY, g.y);
+    g.z = field.one;
+    infinity.x = Limbs();
+    infinity.y = field.one;
+    infinity.z = Limbs();
+
+    // comb_[j] = sum of 2^(CombSpacing * t) * G over the bits t of j.
+    Point tooth = g;
+    comb_[0] = infinity;
+    for (DWORD t = 0; t < CombTeeth; ++t) {
+      for (DWORD j = 0; j < (1u << t); ++j) {
+        Add(comb_[j], tooth, comb_[j | (1u << t)]);
+      }
+      for (DWORD i = 0; i < CombSpacing; ++i) Double(tooth, tooth);
+    }
+
+    window_[0] = infinity;
+    for (DWORD i = 1; i < WindowSize; ++i) {
+      Add(window_[i - 1], g, window_[i]);
+    }
+  }
+
+  // Complete addition for a = -3 (Renes, Costello and Batina, algorithm
+  // 4).  It is correct for every pair of inputs, including P == Q and the
+  // point at infinity, so it has no data-dependent branches.
+  void Add(const Point &p, const Point &q, Point &r) const {
+    const Modulus &f = field;
+    Limbs t0, t1, t2, t3, t4, x3, y3, z3;
+    f.Mul(p.x, q.x, t0);
+    f.Mul(p.y, q.y, t1);
+    f.Mul(p.z, q.z, t2);
+    f.Add(p.x, p.y, t3);
+    f.Add(q.x, q.y, t4);
+    f.Mul(t3, t4, t3);
+    f.Add(t0, t1, t4);
+    f.Sub(t3, t4, t3);
+    f.Add(p.y, p.z, t4);
+    f.Add(q.y, q.z, x3);
+    f.Mul(t4, x3, t4);
+    f.Add(t1, t2, x3);
+    f.Sub(t4, x3, t4);
+    f.Add(p.x, p.z, x3);
+    f.Add(q.x, q.z, y3);
+    f.Mul(x3, y3, x3);
+    f.Add(t0, t2, y3);
+    f.Sub(x3, y3, y3);
+    f.Mul(b, t2, z3);
+    f.Sub(y3, z3, x3);
+    f.Add(x3, x3, z3);
+    f.Add(x3, z3, x3);
+    f.Sub(t1, x3, z3);
+    f.Add(t1, x3, x3);
+    f.Mul(b, y3, y3);
+    f.Add(t2, t2, t1);
+    f.Add(t1, t2, t2);
+    f.Sub(y3, t2, y3);
+    f.Sub(y3, t0, y3);
+    f.Add(y3, y3, t1);
+    f.Add(t1, y3, y3);
+    f.Add(t0, t0, t1);
+    f.Add(t1, t0, t0);
+    f.Sub(t0, t2, t0);
+    f.Mul(t4, y3, t1);
+    f.Mul(t0, y3, t2);
+    f.Mul(x3, z3, y3);
+    f.Add(y3, t2, y3);
+    f.Mul(t3, x3, x3);
+    f.Sub(x3, t1, x3);
+    f.Mul(t4, z3, z3);
+    f.Mul(t3, t0, t1);
+    f.Add(z3, t1, z3);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+  }
+
+  // Complete doubling for a = -3 (algorithm 6 of the same paper).
+  void Double(const Point &p, Point &r) const {
+    const Modulus &f = field;
+    Limbs t0, t1, t2, t3, x3, y3, z3;
+    f.Mul(p.x, p.x, t0);
+    f.Mul(p.y, p.y, t1);
+    f.Mul(p.z, p.z, t2);
+    f.Mul(p.x, p.y, t3);
+    f.Add(t3, t3, t3);
+    f.Mul(p.x, p.z, z3);
+    f.Add(z3, z3, z3);
+    f.Mul(b, t2, y3);
+    f.Sub(y3, z3, y3);
+    f.Add(y3, y3, x3);
+    f.Add(x3, y3, y3);
+    f.Sub(t1, y3, x3);
+    f.Add(t1, y3, y3);
+    f.Mul(x3, y3, y3);
+    f.Mul(x3, t3, x3);
+    f.Add(t2, t2, t3);
+    f.Add(t2, t3, t2);
+    f.Mul(b, z3, z3);
+    f.Sub(z3, t2, z3);
+    f.Sub(z3, t0, z3);
+    f.Add(z3, z3, t3);
+    f.Add(z3, t3, z3);
+    f.Add(t0, t0, t3);
+    f.Add(t3, t0, t0);
+    f.Sub(t0, t2, t0);
+    f.Mul(t0, z3, t0);
+    f.Add(y3, t0, y3);
+    f.Mul(p.y, p.z, t0);
+    f.Add(t0, t0, t0);
+    f.Mul(t0, z3, z3);
+    f.Sub(x3, z3, x3);
+    f.Mul(t0, t1, z3);
+    f.Add(z3, z3, z3);
+    f.Add(z3, z3, z3);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+  }
+
+  // k*G for a secret k < n.  Every column reads the whole comb table.
+  void MulBase(const Limbs &k, Point &r) const {
+    Point acc = infinity;
+    for (int column = CombSpacing - 1; column >= 0; --column) {
+      Double(acc, acc);
+      DWORD index = 0;
+      for (DWORD t = 0; t < CombTeeth; ++t) {
+        const DWORD bit = column + t * CombSpacing;
+        if (bit < 256) index |= ((k[bit / 32] >> (bit % 32)) & 1) << t;
+      }
+      Point entry = {};
+      for (DWORD j = 0; j < CombSize; ++j) {
+        const DWORD mask = EqualMask(j, index);
+        Select(mask, comb_[j].x, entry.x, entry.x);
+        Select(mask, comb_[j].y, entry.y, entry.y);
+        Select(mask, comb_[j].z, entry.z, entry.z);
+      }
+      Add(acc, entry, acc);
+    }
+    r = acc;
+  }
+
+  // u1*G + u2*Q for public scalars, interleaving the two windows so that
+  // both share one chain of doublings.
+  void MulBaseAndPoint(const Limbs &u1,
+                       const Limbs &u2,
+                       const Point &q,
+                       Point &r) const {
+    Point table[WindowSize];
+    table[0] = infinity;
+    for (DWORD i = 1; i < WindowSize; ++i) {
+      Add(table[i - 1], q, table[i]);
+    }
+
+    Point acc = infinity;
+    for (int window = 256 / WindowBits - 1; window >= 0; --window) {
+      for (DWORD i = 0; i < WindowBits; ++i) Double(acc, acc);
+      const DWORD shift = window * WindowBits;
+      const DWORD a = (u1[shift / 32] >> (shift % 32)) & (WindowSize - 1);
+      const DWORD c = (u2[shift / 32] >> (shift % 32)) & (WindowSize - 1);
+      if (a) Add(acc, window_[a], acc);
+      if (c) Add(acc, table[c], acc);
+    }
+    r = acc;
+  }
+
+  // Plain affine coordinates.  False for the point at infinity.
+  bool ToAffine(const Point &p, Limbs &x, Limbs &y) const {
+    Limbs zinv, t;
+    field.Invert(p.z, zinv);
+    field.Mul(p.x, zinv, t);
+    field.FromMont(t, x);
+    field.Mul(p.y, zinv, t);
+    field.FromMont(t, y);
+    return !IsZero(p.z);
+  }
+
+  // y^2 = x^3 - 3x + b for plain x, y < p.
+  bool OnCurve(const Limbs &x, const Limbs &y, Point &p) const {
+    Limbs diff;
+    if (!SubBorrow(x, FieldPrime, diff) || !SubBorrow(y, FieldPrime, diff)) {
+      return false;
+    }
+    Limbs mx, my, lhs, rhs, t;
+    field.ToMont(x, mx);
+    field.ToMont(y, my);
+    field.Mul(my, my, lhs);
+    field.Mul(mx, mx, rhs);
+    field.Mul(rhs, mx, rhs);
+    field.Add(mx, mx, t);
+    field.Add(t, mx, t);
+    field.Sub(rhs, t, rhs);
+    field.Add(rhs, b, rhs);
+    if (lhs != rhs) return false;
+    p.x = mx;
+    p.y = my;
+    p.z = field.one;
+    return true;
+  }
+};
+
+const Curve &P256() {
+  static const Curve curve;
+  return curve;
+}
+
+// HMAC-SHA256 with a 32-byte key over the concatenation of |parts|.
+void Hmac(const BYTE (&key)[32],
+          std::initializer_list<std::pair<LPCBYTE, DWORD>> parts,
+          BYTE (&mac)[32]) {
+  BYTE pad[64], inner[32];
+  Sha256 sha;
+  memset(pad, 0x36, sizeof(pad));
+  for (int i = 0; i < 32; ++i) pad[i] ^= key[i];
+  sha.Update(pad, sizeof(pad));
+  for (const auto &part : parts) sha.Update(part.first, part.second);
+  sha.Final(inner);
+
+  sha.Reset();
+  memset(pad, 0x5c, sizeof(pad));
+  for (int i = 0; i < 32; ++i) pad[i] ^= key[i];
+  sha.Update(pad, sizeof(pad));
+  sha.Update(inner, sizeof(inner));
+  sha.Final(mac);
+  SecureZeroMemory(pad, sizeof(pad));
+}
+
+// The HMAC_DRBG of RFC 6979 section 3.2, for qlen = hlen = 256.
+class NonceGenerator {
+private:
+  BYTE k_[32];
+  BYTE v_[32];
+
+public:
+  NonceGenerator(const BYTE (&x)[32], const BYTE (&h)[32]) {
+    const BYTE zero = 0, one = 1;
+    memset(v_, 1, sizeof(v_));
+    memset(k_, 0, sizeof(k_));
+    Hmac(k_, {{v_, 32}, {&zero, 1}, {x, 32}, {h, 32}}, k_);
+    Hmac(k_, {{v_, 32}}, v_);
+    Hmac(k_, {{v_, 32}, {&one, 1}, {x, 32}, {h, 32}}, k_);
+    Hmac(k_, {{v_, 32}}, v_);
+  }
+
+  ~NonceGenerator() {
+    SecureZeroMemory(k_, sizeof(k_));
+    SecureZeroMemory(v_, sizeof(v_));
+  }
+
+  void Next(Limbs &k) {
+    Hmac(k_, {{v_, 32}}, v_);
+    LoadBigEndian(v_, k);
+  }
+
+  // Called when a candidate is out of range or gives r or s of zero.
+  void Reject() {
+    const BYTE zero = 0;
+    Hmac(k_, {{v_, 32}, {&zero, 1}}, k_);
+    Hmac(k_, {{v_, 32}}, v_);
+  }
+};
+
+// bits2int of the digest, reduced modulo n.
+void DigestToScalar(LPCBYTE digest, DWORD digestSize, Limbs &e) {
+  BYTE padded[32] = {};
+  const DWORD used = min(digestSize, DWORD(32));
+  memcpy(padded + 32 - used, digest, used);
+  Limbs raw;
+  LoadBigEndian(padded, raw);
+  P256().order.Reduce(raw, e);
+}
+
+bool InRange(const Limbs &k) {
+  Limbs diff;
+  return !IsZero(k) && SubBorrow(k, GroupOrder, diff);
+}
+
+}  // namespace
+
+EcdsaP256Key::EcdsaP256Key()
+  : d_(), x_(), y_(), hasPublic_(false), hasPrivate_(false)
+{}
+
+EcdsaP256Key::~EcdsaP256Key() {
+  SecureZeroMemory(d_.data(), sizeof(d_));
+}
+
+bool EcdsaP256Key::Generate(const RandomSource &random) {
+  const Curve &curve = P256();
+  BYTE bytes[CoordinateSize];
+  Limbs d;
+  do {
+    random(bytes, sizeof(bytes));
+    LoadBigEndian(bytes, d);
+  } while (!InRange(d));
+  SecureZeroMemory(bytes, sizeof(bytes));
+
+  Point q;
+  curve.MulBase(d, q);
+  curve.ToAffine(q, x_, y_);
+  d_ = d;
+  SecureZeroMemory(d.data(), sizeof(d));
+  hasPublic_ = true;
+  hasPrivate_ = true;
+  return true;
+}
+
+bool EcdsaP256Key::FromBlob(LPCBYTE blob, DWORD size) {
+  if (!blob || size < 8) {
+    SetLastError(NTE_BAD_DATA);
+    return false;
+  }
+  DWORD magic, keySize;
+  memcpy(&magic, blob, sizeof(magic));
+  memcpy(&keySize, blob + 4, sizeof(keySize));
+  const bool isPrivate = magic == PrivateMagic;
+  if ((magic != PublicMagic && !isPrivate)
+      || keySize != CoordinateSize
+      || size != (isPrivate ? PrivateBlobSize : PublicBlobSize)) {
+    SetLastError(NTE_BAD_DATA);
+    return false;
+  }
+
+  Limbs x, y, d = {};
+  Point q;
+  LoadBigEndian(blob + 8, x);
+  LoadBigEndian(blob + 8 + CoordinateSize, y);
+  if (!P256().OnCurve(x, y, q)) {
+    SetLastError(NTE_BAD_KEY);
+    return false;
+  }
+  if (isPrivate) {
+    LoadBigEndian(blob + 8 + 2 * CoordinateSize, d);
+    Point check;
+    Limbs cx, cy;
+    if (!InRange(d)) {
+      SetLastError(NTE_BAD_KEY);
+      return false;
+    }
+    // The public half must belong to d.
+    P256().MulBase(d, check);
+    P256().ToAffine(check, cx, cy);
+    if (cx != x || cy != y) {
+      SecureZeroMemory(d.data(), sizeof(d));
+      SetLastError(NTE_BAD_KEY);
+      return false;
+    }
+  }
+
+  x_ = x;
+  y_ = y;
+  d_ = d;
+  SecureZeroMemory(d.data(), sizeof(d));
+  hasPublic_ = true;
+  hasPrivate_ = isPrivate;
+  return true;
+}
+
+bool EcdsaP256Key::ToBlob(DWORD blobType, LPBYTE blob, LPDWORD size) const {
+  if (!size
+      || !hasPublic_
+      || (blobType != PUBLICKEYBLOB && blobType != PRIVATEKEYBLOB)
+      || (blobType == PRIVATEKEYBLOB && !hasPrivate_)) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return false;
+  }
+  const DWORD required =
+    blobType == PRIVATEKEYBLOB ? PrivateBlobSize : PublicBlobSize;
+  if (!blob) {
+    *size = required;
+    return true;
+  }
+  if (*size < required) {
+    *size = required;
+    SetLastError(ERROR_MORE_DATA);
+    return false;
+  }
+
+  const DWORD magic = blobType == PRIVATEKEYBLOB ? PrivateMagic : PublicMagic;
+  const DWORD keySize = CoordinateSize;
+  memcpy(blob, &magic, sizeof(magic));
+  memcpy(blob + 4, &keySize, sizeof(keySize));
+  StoreBigEndian(x_, blob + 8);
+  StoreBigEndian(y_, blob + 8 + CoordinateSize);
+  if (blobType == PRIVATEKEYBLOB) {
+    StoreBigEndian(d_, blob + 8 + 2 * CoordinateSize);
+  }
+  *size = required;
+  return true;
+}
+
+bool EcdsaP256Key::HasPrivate() const {
+  return hasPrivate_;
+}
+
+bool EcdsaP256Key::Sign(LPCBYTE digest,
+                        DWORD digestSize,
+                        LPBYTE signature) const {
+  if (!hasPrivate_) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return false;
+  }
+  if (!digest || digestSize == 0) {
+    SetLastError(NTE_BAD_HASH);
+    return false;
+  }
+
+  const Curve &curve = P256();
+  const Modulus &n = curve.order;
+  Limbs e;
+  DigestToScalar(digest, digestSize, e);
+  BYTE x[32], h[32];
+  StoreBigEndian(d_, x);
+  StoreBigEndian(e, h);
+  NonceGenerator nonces(x, h);
+  SecureZeroMemory(x, sizeof(x));
+
+  Limbs k, r, s, rx, ry, t, u;
+  for (;; nonces.Reject()) {
+    nonces.Next(k);
+    if (!InRange(k)) continue;
+
+    Point kg;
+    curve.MulBase(k, kg);
+    curve.ToAffine(kg, rx, ry);
+    n.Reduce(rx, r);
+    if (IsZero(r)) continue;
+
+    // s = k^-1 * (e + r * d) mod n, all in Montgomery form.
+    n.ToMont(k, t);
+    n.Invert(t, t);
+    n.ToMont(r, u);
+    n.ToMont(d_, s);
+    n.Mul(u, s, s);
+    n.ToMont(e, u);
+    n.Add(u, s, s);
+    n.Mul(t, s, s);
+    n.FromMont(s, s);
+    if (!IsZero(s)) break;
+  }
+  SecureZeroMemory(k.data(), sizeof(k));
+  SecureZeroMemory(t.data(), sizeof(t));
+
+  StoreBigEndian(r, signature);
+  StoreBigEndian(s, signature + CoordinateSize);
+  return true;
+}
+
+bool EcdsaP256Key::Verify(LPCBYTE digest,
+                          DWORD digestSize,
+                          LPCBYTE signature,
+                          DWORD signatureSize) const {
+  if (!hasPublic_) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return false;
+  }
+  if (!digest || digestSize == 0) {
+    SetLastError(NTE_BAD_HASH);
+    return false;
+  }
+
+  const Curve &curve = P256();
+  const Modulus &n = curve.order;
+  Limbs r, s, e, w, u1, u2, x, y, v;
+  Point q, sum;
+  bool valid = signature && signatureSize == SignatureSize;
+  if (valid) {
+    LoadBigEndian(signature, r);
+    LoadBigEndian(signature + CoordinateSize, s);
+    valid = InRange(r) && InRange(s);
+  }
+  if (valid) {
+    DigestToScalar(digest, digestSize, e);
+    // u1 = e / s and u2 = r / s.  Montgomery factors cancel in w * e.
+    n.ToMont(s, w);
+    n.Invert(w, w);
+    n.Mul(w, e, u1);
+    n.Mul(w, r, u2);
+
+    curve.OnCurve(x_, y_, q);
+    curve.MulBaseAndPoint(u1, u2, q, sum);
+    valid = curve.ToAffine(sum, x, y);
+    n.Reduce(x, v);
+    valid = valid && v == r;
+  }
+  if (!valid) {
+    SetLastError(NTE_BAD_SIGNATURE);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,50 @@
+// ECDSA over NIST P-256 for in-process signing.
+//
+// Keys use the layout of a CNG BCRYPT_ECCKEY_BLOB: a magic ('ECS1' for a
+// public key, 'ECS2' for a private one) and the coordinate size, followed
+// by X, Y and, for a private key, d, each 32 bytes big-endian.  Signatures
+// are r || s, big-endian, as BCryptSignHash writes them.
+//
+// Unlike BigNum, the arithmetic on secrets is constant-time: fixed-size
+// limbs, complete point formulas with no exceptional cases, and table
+// lookups that read every entry.  Signing computes k*G from a comb table
+// of the base point built once per process, with the nonce derived from
+// the key and the digest as in RFC 6979.  Verification only handles public
+// data and uses a 4-bit window over both scalars at once.
+class EcdsaP256Key {
+public:
+  typedef std::array<DWORD, 8> Scalar;  // little-endian limbs
+  typedef std::function<void(LPBYTE, DWORD)> RandomSource;
+
+  static constexpr DWORD CoordinateSize = 32;
+  static constexpr DWORD SignatureSize = 64;
+  static constexpr DWORD PublicBlobSize = 8 + 2 * CoordinateSize;
+  static constexpr DWORD PrivateBlobSize = 8 + 3 * CoordinateSize;
+
+private:
+  Scalar d_;
+  Scalar x_, y_;
+  bool hasPublic_;
+  bool hasPrivate_;
+
+public:
+  EcdsaP256Key();
+  ~EcdsaP256Key();
+
+  bool Generate(const RandomSource &random);
+  // Rejects points that are not on the curve.
+  bool FromBlob(LPCBYTE blob, DWORD size);
+  // |blobType| is PUBLICKEYBLOB or PRIVATEKEYBLOB.  With |blob| null only
+  // the required size is returned.
+  bool ToBlob(DWORD blobType, LPBYTE blob, LPDWORD size) const;
+
+  bool HasPrivate() const;
+
+  // A digest longer than 32 bytes is cut to its leftmost 256 bits, as
+  // FIPS 186-4 requires.  |signature| receives SignatureSize bytes.
+  bool Sign(LPCBYTE digest, DWORD digestSize, LPBYTE signature) const;
+  bool Verify(LPCBYTE digest,
+              DWORD digestSize,
+              LPCBYTE signature,
+              DWORD signatureSize) const;
+};
@@ -0,0 +1,93 @@
+#include <windows.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "executor.h"
+
+Executor::Executor(DWORD threads) : stopping_(false) {
+  if (threads == 0) {
+    threads = max(1u, std::thread::hardware_concurrency());
+  }
+  for (DWORD i = 0; i < threads; ++i) {
+    threads_.push_back(std::thread(&Executor::Worker, this));
+  }
+}
+
+Executor::~Executor() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  for (auto &it : threads_) {
+    it.join();
+  }
+}
+
+void Executor::Post(std::function<void()> &&fn) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    queue_.push_back(std::move(fn));
+  }
+  ready_.notify_one();
+}
+
+void Executor::Worker() {
+  std::unique_lock<std::mutex> lock(lock_);
+  for (;;) {
+    ready_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) break;
+    auto fn = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    fn();
+    lock.lock();
+  }
+}
+
+Strand::Strand(Executor &executor)
+  : state_(std::make_shared<State>(executor))
+{}
+
+Executor &Strand::GetExecutor() {
+  return state_->executor_;
+}
+
+void Strand::Post(std::function<void()> &&fn) {
+  bool schedule = false;
+  {
+    std::lock_guard<std::mutex> guard(state_->lock_);
+    state_->queue_.push_back(std::move(fn));
+    if (!state_->running_) {
+      state_->running_ = schedule = true;
+    }
+  }
+  if (schedule) {
+    auto state = state_;
+    state->executor_.Post([state]() { Drain(state); });
+  }
+}
+
+void Strand::Drain(std::shared_ptr<State> state) {
+  // Run a bounded number of items, then yield the thread so that one busy
+  // handle cannot starve the others sharing the executor.
+  const int maxItems = 16;
+  for (int i = 0; i < maxItems; ++i) {
+    std::function<void()> fn;
+    {
+      std::lock_guard<std::mutex> guard(state->lock_);
+      if (state->queue_.empty()) {
+        state->running_ = false;
+        return;
+      }
+      fn = std::move(state->queue_.front());
+      state->queue_.pop_front();
+    }
+    fn();
+  }
+  state->executor_.Post([state]() { Drain(state); });
+}
@@ -0,0 +1,42 @@
+// A fixed-size thread pool.  Blocking provider calls run here, so the
+// number of threads bounds how many of them are in progress at once no
+// matter how many coroutines are waiting.
+class Executor {
+private:
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<std::function<void()>> queue_;
+  std::vector<std::thread> threads_;
+  bool stopping_;
+
+  void Worker();
+
+public:
+  Executor(DWORD threads = 0);
+  ~Executor();
+  void Post(std::function<void()> &&fn);
+};
+
+// Runs posted functions one at a time, in order, on an Executor.  Use one
+// strand per provider handle; CAPI handles must not be used from two
+// threads at once.  The queue is shared with the executor, so a Strand may
+// be destroyed while its last item is still finishing.
+class Strand {
+private:
+  struct State {
+    Executor &executor_;
+    std::mutex lock_;
+    std::deque<std::function<void()>> queue_;
+    bool running_;
+
+    State(Executor &executor) : executor_(executor), running_(false) {}
+  };
+  std::shared_ptr<State> state_;
+
+  static void Drain(std::shared_ptr<State> state);
+
+public:
+  Strand(Executor &executor);
+  Executor &GetExecutor();
+  void Post(std::function<void()> &&fn);
+};
@@ -0,0 +1,343 @@
+#include <windows.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "blob.h"
+#include "blobbuilder.h"
+#include "filewriter.h"
+
+void Log(LPCWSTR Format, ...);
+
+AsyncFileWriter::AsyncFileWriter(const AsyncFileWriterConfig &config)
+  : config_(config),
+    port_(nullptr),
+    inFlight_(0),
+    pending_(0),
+    completing_(0),
+    stopping_(true)
+{}
+
+AsyncFileWriter::~AsyncFileWriter() {
+  Stop();
+}
+
+void AsyncFileWriter::Release() {
+  if (port_) {
+    CloseHandle(port_);
+  }
+  port_ = nullptr;
+  for (auto it : buffers_) {
+    VirtualFree(it, 0, MEM_RELEASE);
+  }
+  buffers_.clear();
+}
+
+bool AsyncFileWriter::Start() {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (port_) return true;
+
+  port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+  if (!port_) {
+    Log(L"CreateIoCompletionPort failed - %08x\n", GetLastError());
+    return false;
+  }
+  stopping_ = false;
+  submitter_ = std::thread(&AsyncFileWriter::Submitter, this);
+  completer_ = std::thread(&AsyncFileWriter::Completer, this);
+  return true;
+}
+
+void AsyncFileWriter::Stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!port_) return;
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  submitter_.join();
+
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    changed_.wait(lock, [this]() { return pending_ == 0; });
+  }
+  // Nothing is in flight, so this is the last packet on the port.
+  PostQueuedCompletionStatus(port_, 0, 0, nullptr);
+  completer_.join();
+
+  std::lock_guard<std::mutex> guard(lock_);
+  Release();
+}
+
+void AsyncFileWriter::Submitter() {
+  std::vector<Request*> batch;
+  batch.reserve(config_.maxInFlight);
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      // |pending_| also counts writes that are still being copied into
+      // their buffer, so do not exit until those are queued and issued.
+      changed_.wait(lock, [this]() {
+        return (!queue_.empty() && inFlight_ < config_.maxInFlight)
+               || (stopping_ && pending_ == inFlight_);
+      });
+      if (queue_.empty()) return;
+
+      while (!queue_.empty() && inFlight_ < config_.maxInFlight) {
+        batch.push_back(queue_.front());
+        queue_.pop_front();
+        ++inFlight_;
+      }
+    }
+
+    for (auto it : batch) {
+      Issue(it);
+    }
+    batch.clear();
+  }
+}
+
+void AsyncFileWriter::Issue(Request *request) {
+  request->file = CreateFile(request->filename.c_str(),
+                             GENERIC_WRITE,
+                             0,
+                             nullptr,
+                             CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL
+                               | FILE_FLAG_OVERLAPPED
+                               | FILE_FLAG_SEQUENTIAL_SCAN,
+                             nullptr);
+  if (request->file == INVALID_HANDLE_VALUE) {
+    const auto gle = GetLastError();
+    Log(L"CreateFile(%s) failed - %08x\n", request->filename.c_str(), gle);
+    Complete(request, gle);
+    return;
+  }
+
+  if (!CreateIoCompletionPort(request->file, port_, 0, 0)) {
+    const auto gle = GetLastError();
+    Log(L"CreateIoCompletionPort failed - %08x\n", gle);
+    Complete(request, gle);
+    return;
+  }
+
+  if (!WriteFile(request->file,
+                 request->buffer,
+                 request->size,
+                 nullptr,
+                 &request->overlapped)) {
+    const auto gle = GetLastError();
+    if (gle != ERROR_IO_PENDING) {
+      // A failed call does not queue a packet, so complete it here.
+      Log(L"WriteFile failed - %08x\n", gle);
+      Complete(request, gle);
+    }
+  }
+}
+
+void AsyncFileWriter::Completer() {
+  std::vector<OVERLAPPED_ENTRY> entries(max(config_.maxBatch, DWORD(1)));
+  for (;;) {
+    ULONG removed = 0;
+    if (!GetQueuedCompletionStatusEx(port_,
+                                     entries.data(),
+                                     static_cast<ULONG>(entries.size()),
+                                     &removed,
+                                     INFINITE,
+                                     FALSE)) {
+      Log(L"GetQueuedCompletionStatusEx failed - %08x\n", GetLastError());
+      return;
+    }
+
+    for (ULONG i = 0; i < removed; ++i) {
+      const auto overlapped = entries[i].lpOverlapped;
+      if (!overlapped) return;
+
+      auto request = reinterpret_cast<Request*>(overlapped);
+      DWORD transferred = 0;
+      DWORD status = ERROR_SUCCESS;
+      if (!GetOverlappedResult(request->file, overlapped, &transferred, FALSE)) {
+        status = GetLastError();
+      }
+      else if (transferred != request->size) {
+        status = ERROR_WRITE_FAULT;
+      }
+      Complete(request, status);
+    }
+  }
+}
+
+void AsyncFileWriter::Complete(Request *request, DWORD status) {
+  if (request->file != INVALID_HANDLE_VALUE) {
+    CloseHandle(request->file);
+    if (status != ERROR_SUCCESS) {
+      DeleteFile(request->filename.c_str());
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (request->pooled) {
+      buffers_.push_back(request->buffer);
+    }
+    else {
+      VirtualFree(request->buffer, 0, MEM_RELEASE);
+    }
+    if (status == ERROR_SUCCESS) {
+      ++metrics_.completed;
+      metrics_.bytesWritten += request->size;
+    }
+    else {
+      ++metrics_.failed;
+    }
+    --inFlight_;
+    --pending_;
+    ++completing_;
+  }
+  // Free the slot before running the completion, which may itself call
+  // Write() and would otherwise wait forever at |maxPending|.
+  changed_.notify_all();
+  if (request->completion) {
+    request->completion(status);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    --completing_;
+  }
+  changed_.notify_all();
+  delete request;
+}
+
+bool AsyncFileWriter::Submit(LPCWSTR filename,
+                             const BlobView *parts,
+                             size_t count,
+                             Completion completion) {
+  if (!filename) return false;
+  DWORD size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if ((!parts[i].data && parts[i].size)
+        || parts[i].size > MAXDWORD - size) {
+      return false;
+    }
+    size += parts[i].size;
+  }
+
+  const bool pooled = size <= config_.bufferSize;
+  LPBYTE buffer = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    changed_.wait(lock, [this]() {
+      return stopping_ || pending_ < config_.maxPending;
+    });
+    if (stopping_) return false;
+
+    ++pending_;
+    ++metrics_.submitted;
+    if (pooled && !buffers_.empty()) {
+      buffer = buffers_.back();
+      buffers_.pop_back();
+    }
+    else if (pooled) {
+      // Each pending write holds at most one buffer, so the pool never
+      // grows beyond |maxPending|.
+      ++metrics_.buffersAllocated;
+    }
+  }
+
+  if (!buffer) {
+    buffer = reinterpret_cast<LPBYTE>(
+      VirtualAlloc(nullptr,
+                   pooled ? config_.bufferSize : size,
+                   MEM_COMMIT | MEM_RESERVE,
+                   PAGE_READWRITE));
+    if (!buffer) {
+      Log(L"VirtualAlloc failed - %08x\n", GetLastError());
+      {
+        std::lock_guard<std::mutex> guard(lock_);
+        --pending_;
+        --metrics_.submitted;
+        if (pooled) --metrics_.buffersAllocated;
+      }
+      changed_.notify_all();
+      return false;
+    }
+  }
+  LPBYTE p = buffer;
+  for (size_t i = 0; i < count; ++i) {
+    CopyMemory(p, parts[i].data, parts[i].size);
+    p += parts[i].size;
+  }
+
+  auto request = new Request();
+  request->file = INVALID_HANDLE_VALUE;
+  request->filename = filename;
+  request->buffer = buffer;
+  request->size = size;
+  request->pooled = pooled;
+  request->completion = std::move(completion);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    queue_.push_back(request);
+  }
+  changed_.notify_all();
+  return true;
+}
+
+bool AsyncFileWriter::Write(LPCWSTR filename,
+                            LPCBYTE data,
+                            DWORD size,
+                            Completion completion) {
+  const BlobView part(data, size);
+  return Submit(filename, &part, 1, std::move(completion));
+}
+
+bool AsyncFileWriter::Write(LPCWSTR filename,
+                            const BlobBuilder &parts,
+                            Completion completion) {
+  const auto views = parts.Segments();
+  return Submit(filename, views.data(), views.size(), std::move(completion));
+}
+
+std::future<DWORD> AsyncFileWriter::Write(LPCWSTR filename,
+                                          LPCBYTE data,
+                                          DWORD size) {
+  auto promise = std::make_shared<std::promise<DWORD>>();
+  auto future = promise->get_future();
+  if (!Write(filename,
+             data,
+             size,
+             [promise](DWORD status) { promise->set_value(status); })) {
+    promise->set_value(ERROR_OPERATION_ABORTED);
+  }
+  return future;
+}
+
+std::future<DWORD> AsyncFileWriter::Write(LPCWSTR filename,
+                                          const BlobBuilder &parts) {
+  auto promise = std::make_shared<std::promise<DWORD>>();
+  auto future = promise->get_future();
+  if (!Write(filename,
+             parts,
+             [promise](DWORD status) { promise->set_value(status); })) {
+    promise->set_value(ERROR_OPERATION_ABORTED);
+  }
+  return future;
+}
+
+void AsyncFileWriter::Flush() {
+  std::unique_lock<std::mutex> lock(lock_);
+  changed_.wait(lock, [this]() {
+    return pending_ == 0 && completing_ == 0;
+  });
+}
+
+AsyncFileWriterMetrics AsyncFileWriter::GetMetrics() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return metrics_;
+}
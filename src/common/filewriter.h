@@ -0,0 +1,103 @@
+struct AsyncFileWriterConfig {
+  DWORD maxInFlight;  // overlapped writes outstanding at once
+  DWORD maxPending;   // queued + in flight; Write() blocks beyond this
+  DWORD bufferSize;   // size of each pooled buffer
+  DWORD maxBatch;     // completions dequeued per wakeup
+
+  AsyncFileWriterConfig()
+    : maxInFlight(64), maxPending(256), bufferSize(64 * 1024), maxBatch(32)
+  {}
+};
+
+struct AsyncFileWriterMetrics {
+  ULONGLONG submitted;
+  ULONGLONG completed;
+  ULONGLONG failed;
+  ULONGLONG bytesWritten;
+  DWORD buffersAllocated;
+
+  AsyncFileWriterMetrics()
+    : submitted(0), completed(0), failed(0), bytesWritten(0),
+      buffersAllocated(0)
+  {}
+};
+
+struct BlobView;
+class BlobBuilder;
+
+// Writes whole files with overlapped I/O on one completion port.
+//
+// Write() copies the data into a pooled buffer and returns; a submitter
+// thread opens the files and issues the writes in batches of up to
+// |maxInFlight|, and a completion thread drains the port with
+// GetQueuedCompletionStatusEx.  Buffers up to |bufferSize| are reused, so
+// steady-state writing does not allocate.  A file whose write fails is
+// deleted before its completion runs.
+class AsyncFileWriter {
+public:
+  // Called on a writer thread with ERROR_SUCCESS or the error.  The write
+  // no longer counts against |maxPending|, so it may call Write() again,
+  // but it must not call Flush() or Stop().
+  typedef std::function<void(DWORD status)> Completion;
+
+private:
+  struct Request {
+    OVERLAPPED overlapped;  // must stay first
+    HANDLE file;
+    std::wstring filename;
+    LPBYTE buffer;
+    DWORD size;
+    bool pooled;
+    Completion completion;
+  };
+
+  const AsyncFileWriterConfig config_;
+  HANDLE port_;
+  std::mutex lock_;
+  std::condition_variable changed_;
+  std::deque<Request*> queue_;
+  std::vector<LPBYTE> buffers_;  // free pooled buffers
+  DWORD inFlight_;
+  DWORD pending_;
+  DWORD completing_;  // completions still running
+  AsyncFileWriterMetrics metrics_;
+  std::thread submitter_;
+  std::thread completer_;
+  bool stopping_;
+
+  void Submitter();
+  void Completer();
+  void Issue(Request *request);
+  void Complete(Request *request, DWORD status);
+  void Release();
+  bool Submit(LPCWSTR filename,
+              const BlobView *parts,
+              size_t count,
+              Completion completion);
+
+public:
+  AsyncFileWriter(const AsyncFileWriterConfig &config);
+  ~AsyncFileWriter();
+
+  bool Start();
+  // Finishes every queued write, then stops the threads.
+  void Stop();
+
+  // Returns false without calling |completion| if the writer is not
+  // running.  Blocks while |maxPending| writes are outstanding.
+  bool Write(LPCWSTR filename,
+             LPCBYTE data,
+             DWORD size,
+             Completion completion);
+  std::future<DWORD> Write(LPCWSTR filename, LPCBYTE data, DWORD size);
+  // Gathers the segments of |parts| straight into the write buffer.
+  bool Write(LPCWSTR filename,
+             const BlobBuilder &parts,
+             Completion completion);
+  std::future<DWORD> Write(LPCWSTR filename, const BlobBuilder &parts);
+
+  // Waits until every write submitted so far has completed and its
+  // completion has returned.
+  void Flush();
+  AsyncFileWriterMetrics GetMetrics();
+};
@@ -1,102 +1,146 @@
 #include <windows.h>
+#include <array>
+#include <coroutine>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "allocprof.h"
+#include "executor.h"
+#include "async.h"
 #include "blob.h"
+#include "blobbuilder.h"
+#include "ecdsa.h"
 #include "hash.h"
+#include "provider.h"
 
 void Log(LPCWSTR Format, ...);
 
-void Hash::Release() {
+static constexpr HashAlgorithm knownAlgorithms[] = {
+  HashAlgorithm::Of<MD5Traits>(),
+  HashAlgorithm::Of<SHA1Traits>(),
+  HashAlgorithm::Of<SHA256Traits>(),
+};
+
+const HashAlgorithm *HashAlgorithm::Find(ALG_ID id) {
+  for (const auto &it : knownAlgorithms) {
+    if (it.id == id) return &it;
+  }
+  return nullptr;
+}
+
+const HashAlgorithm *HashAlgorithm::Begin() {
+  return knownAlgorithms;
+}
+
+const HashAlgorithm *HashAlgorithm::End() {
+  return knownAlgorithms + ARRAYSIZE(knownAlgorithms);
+}
+
+void HashBase::Release() {
   if (hash_) {
-    CryptDestroyHash(hash_);
+    CryptoProvider::Current().DestroyHash(hash_);
   }
   hash_ = NULL;
 }
 
-Hash::Hash() : hash_(NULL) {}
+HashBase::HashBase() : hash_(NULL) {}
 
-Hash::Hash(HCRYPTHASH hash) : hash_(NULL) {
-  Attach(hash);
-}
+HashBase::HashBase(HCRYPTHASH hash) : hash_(hash) {}
 
-Hash::~Hash() {
+HashBase::~HashBase() {
   Release();
 }
 
-Hash::operator HCRYPTHASH() {
+HashBase::operator HCRYPTHASH() {
   return hash_;
 }
 
-void Hash::Attach(HCRYPTHASH hash) {
+bool HashBase::CreateInternal(HCRYPTPROV provider, ALG_ID algo) {
   Release();
-  hash_ = hash;
+  bool ret = !!CryptoProvider::Current().CreateHash(provider,
+                                                    algo,
+                                                    /*hKey*/0,
+                                                    /*dwFlags*/0,
+                                                    &hash_);
+  if (!ret) {
+    Log(L"CryptCreateHash(%08x) failed - %08x\n", algo, GetLastError());
+    hash_ = NULL;
+  }
+  return ret;
 }
 
-bool Hash::AddData(LPCBYTE data, DWORD dataLength) {
-  bool ret = !!CryptHashData(hash_, data, dataLength, 0);
+bool HashBase::SetValueInternal(LPCBYTE digest) {
+  bool ret = !!CryptoProvider::Current().SetHashParam(hash_,
+                                                      HP_HASHVAL,
+                                                      digest,
+                                                      0);
   if (!ret) {
-    Log(L"CryptHashData failed - %08x\n", GetLastError());
+    Log(L"CryptSetHashParam failed - %08x\n", GetLastError());
   }
   return ret;
 }
 
-bool Hash::SetHashValue(LPCBYTE data, DWORD dataLength) {
-  bool ret = false;
-  DWORD hashSize = 0;
-  DWORD size = sizeof(hashSize);
-  if (CryptGetHashParam(hash_,
-                        HP_HASHSIZE,
-                        reinterpret_cast<LPBYTE>(&hashSize),
-                        &size,
-                        0)) {
-    if (hashSize == dataLength) {
-      ret = !!CryptSetHashParam(hash_, HP_HASHVAL, data, 0);
-      if (!ret) {
-        Log(L"CryptSetHashParam failed - %08x\n", GetLastError());
-      }
-    }
-    else {
-      SetLastError(ERROR_INVALID_DATA);
-      Log(L"Hash size does not match\n", GetLastError());
-    }
-  }
-  else {
+bool HashBase::GetValueInternal(LPBYTE digest, DWORD digestSize) const {
+  DWORD len = digestSize;
+  bool ret = hash_
+             && CryptoProvider::Current().GetHashParam(hash_,
+                                                       HP_HASHVAL,
+                                                       digest,
+                                                       &len,
+                                                       0)
+             && len == digestSize;
+  if (!ret) {
     Log(L"CryptGetHashParam failed - %08x\n", GetLastError());
   }
   return ret;
 }
 
-Blob Hash::GetHashValue() const {
-  Blob blob;
-  DWORD hashLen = 0;
-  if (hash_
-      && CryptGetHashParam(hash_, HP_HASHVAL, nullptr, &hashLen, 0)
-      && blob.Alloc(hashLen)) {
-    if (!CryptGetHashParam(hash_, HP_HASHVAL, blob, &hashLen, 0)) {
-      Log(L"CryptGetHashParam failed - %08x\n", GetLastError());
-    }
+bool HashBase::AddData(LPCBYTE data, DWORD dataLength) {
+  bool ret = !!CryptoProvider::Current().HashData(hash_, data, dataLength, 0);
+  if (!ret) {
+    Log(L"CryptHashData failed - %08x\n", GetLastError());
   }
-  return blob;
+  return ret;
+}
+
+bool HashBase::AddData(const BlobBuilder &parts) {
+  for (const auto &view : parts.Segments()) {
+    if (!AddData(view.data, view.size)) return false;
+  }
+  return true;
 }
 
-Blob Hash::Sign(DWORD keyType) {
+Blob HashBase::Sign(DWORD keyType) {
+  AllocSite site("HashBase::Sign");
   Blob blob;
   DWORD len = 0;
-  if(CryptSignHash(hash_,
-                   keyType,
-                   nullptr,
-                   0,
-                   nullptr,
-                   &len))
+  if(CryptoProvider::Current().SignHash(hash_,
+                                        keyType,
+                                        0,
+                                        nullptr,
+                                        &len))
   {
     if (blob.Alloc(len)) {
-      if(!CryptSignHash(hash_,
-                        keyType,
-                        nullptr,
-                        0,
-                        blob,
-                        &len))
+      if(!CryptoProvider::Current().SignHash(hash_,
+                                             keyType,
+                                             0,
+                                             blob,
+                                             &len))
       {
-        Log(L"CryptSignHash#2 failed - %08x\n", GetLastError());
+        const DWORD gle = GetLastError();
+        Log(L"CryptSignHash#2 failed - %08x\n", gle);
+        // Don't hand back the unsigned buffer as a signature.
+        blob = Blob();
+        SetLastError(gle);
       }
     }
   }
@@ -107,17 +151,148 @@ Blob Hash::Sign(DWORD keyType) {
   return blob;
 }
 
+bool HashBase::Verify(LPCBYTE signature,
+                      DWORD signatureLength,
+                      HCRYPTKEY publicKey) {
+  bool ret = !!CryptoProvider::Current().VerifySignature(hash_,
+                                                         signature,
+                                                         signatureLength,
+                                                         publicKey,
+                                                         0);
+  if (!ret) {
+    Log(L"CryptVerifySignature failed - %08x\n", GetLastError());
+  }
+  return ret;
+}
+
+Operation<Blob> HashBase::SignAsync(Strand &strand, DWORD keyType) {
+  return Operation<Blob>(strand,
+                         [this, keyType]() { return Sign(keyType); });
+}
+
+Operation<bool> HashBase::VerifyAsync(Strand &strand,
+                                      LPCBYTE signature,
+                                      DWORD signatureLength,
+                                      HCRYPTKEY publicKey) {
+  return Operation<bool>(strand,
+                         [this, signature, signatureLength, publicKey]() {
+                           return Verify(signature, signatureLength, publicKey);
+                         });
+}
+
+void Hash::Resolve() {
+  algo_ = 0;
+  digestSize_ = 0;
+  if (!hash_) return;
+
+  DWORD size = sizeof(algo_);
+  if (!CryptoProvider::Current().GetHashParam(hash_,
+                                              HP_ALGID,
+                                              reinterpret_cast<LPBYTE>(&algo_),
+                                              &size,
+                                              0)) {
+    Log(L"CryptGetHashParam failed - %08x\n", GetLastError());
+    return;
+  }
+
+  if (auto known = HashAlgorithm::Find(algo_)) {
+    digestSize_ = known->digestSize;
+    return;
+  }
+
+  // Not in the traits table.  Ask the provider once here instead of
+  // every time a hash value is set.
+  size = sizeof(digestSize_);
+  if (!CryptoProvider::Current().GetHashParam(
+        hash_,
+        HP_HASHSIZE,
+        reinterpret_cast<LPBYTE>(&digestSize_),
+        &size,
+        0)) {
+    Log(L"CryptGetHashParam failed - %08x\n", GetLastError());
+    digestSize_ = 0;
+  }
+}
+
+Hash::Hash() : algo_(0), digestSize_(0) {}
+
+Hash::Hash(HCRYPTHASH hash) : algo_(0), digestSize_(0) {
+  Attach(hash);
+}
+
+void Hash::Attach(HCRYPTHASH hash) {
+  Release();
+  hash_ = hash;
+  Resolve();
+}
+
+bool Hash::Create(HCRYPTPROV provider, ALG_ID algo) {
+  if (!CreateInternal(provider, algo)) {
+    algo_ = 0;
+    digestSize_ = 0;
+    return false;
+  }
+  if (auto known = HashAlgorithm::Find(algo)) {
+    algo_ = algo;
+    digestSize_ = known->digestSize;
+  }
+  else {
+    Resolve();
+  }
+  return true;
+}
+
+ALG_ID Hash::Algorithm() const {
+  return algo_;
+}
+
+DWORD Hash::DigestSize() const {
+  return digestSize_;
+}
+
+bool Hash::SetHashValue(LPCBYTE data, DWORD dataLength) {
+  if (!digestSize_ || dataLength != digestSize_) {
+    SetLastError(ERROR_INVALID_DATA);
+    Log(L"Hash size does not match\n");
+    return false;
+  }
+  return SetValueInternal(data);
+}
+
+Blob Hash::GetHashValue() const {
+  AllocSite site("Hash::GetHashValue");
+  Blob blob;
+  if (digestSize_ && blob.Alloc(digestSize_)) {
+    if (!GetValueInternal(blob, digestSize_)) {
+      blob = Blob();
+    }
+  }
+  return blob;
+}
+
+Blob Hash::Sign(const EcdsaP256Key &key) {
+  AllocSite site("Hash::Sign");
+  const Blob digest = GetHashValue();
+  Blob signature;
+  if (digest.Size() > 0 && signature.Alloc(EcdsaP256Key::SignatureSize)) {
+    if (!key.Sign(digest, digest.Size(), signature)) {
+      const DWORD gle = GetLastError();
+      Log(L"EcdsaP256Key::Sign failed - %08x\n", gle);
+      signature = Blob();
+      SetLastError(gle);
+    }
+  }
+  return signature;
+}
+
 bool Hash::Verify(LPCBYTE signature,
                   DWORD signatureLength,
-                  HCRYPTKEY publicKey) {
-  bool ret = !!CryptVerifySignature(hash_,
-                                    signature,
-                                    signatureLength,
-                                    publicKey,
-                                    nullptr,
-                                    0);
+                  const EcdsaP256Key &key) {
+  const Blob digest = GetHashValue();
+  bool ret = digest.Size() > 0
+             && key.Verify(digest, digest.Size(), signature, signatureLength);
   if (!ret) {
-    Log(L"CryptVerifySignature failed - %08x\n", GetLastError());
+    Log(L"EcdsaP256Key::Verify failed - %08x\n", GetLastError());
   }
   return ret;
 }
@@ -1,20 +1,181 @@
-class Hash {
-private:
+struct MD5Traits {
+  static constexpr ALG_ID Id = CALG_MD5;
+  static constexpr DWORD DigestSize = 16;
+  static constexpr DWORD BlockSize = 64;
+  static constexpr BYTE DigestInfo[] = {
+    0x30, 0x20, 0x30, 0x0c, 0x06, 0x08, 0x2a, 0x86, 0x48, 0x86,
+    0xf7, 0x0d, 0x02, 0x05, 0x05, 0x00, 0x04, 0x10,
+  };
+  static constexpr LPCWSTR Name = L"MD5";
+};
+
+struct SHA1Traits {
+  static constexpr ALG_ID Id = CALG_SHA1;
+  static constexpr DWORD DigestSize = 20;
+  static constexpr DWORD BlockSize = 64;
+  static constexpr BYTE DigestInfo[] = {
+    0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02,
+    0x1a, 0x05, 0x00, 0x04, 0x14,
+  };
+  static constexpr LPCWSTR Name = L"SHA1";
+};
+
+struct SHA256Traits {
+  static constexpr ALG_ID Id = CALG_SHA_256;
+  static constexpr DWORD DigestSize = 32;
+  static constexpr DWORD BlockSize = 64;
+  static constexpr BYTE DigestInfo[] = {
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20,
+  };
+  static constexpr LPCWSTR Name = L"SHA256";
+};
+
+// Runtime view of the traits above, used where the algorithm is only
+// known at runtime (e.g. selected in the GUI).
+struct HashAlgorithm {
+  ALG_ID id;
+  DWORD digestSize;
+  DWORD blockSize;
+  LPCBYTE digestInfo;
+  DWORD digestInfoSize;
+  LPCWSTR name;
+
+  template<class Algo>
+  static constexpr HashAlgorithm Of() {
+    return { Algo::Id,
+             Algo::DigestSize,
+             Algo::BlockSize,
+             Algo::DigestInfo,
+             static_cast<DWORD>(sizeof(Algo::DigestInfo)),
+             Algo::Name };
+  }
+
+  static const HashAlgorithm *Find(ALG_ID id);
+  static const HashAlgorithm *Begin();
+  static const HashAlgorithm *End();
+};
+
+template<class Algo>
+using Digest = std::array<BYTE, Algo::DigestSize>;
+
+class BlobBuilder;
+class EcdsaP256Key;
+class Strand;
+template<class T>
+class Operation;
+
+// Owns an HCRYPTHASH.  The digest length checks live in the derived
+// classes so that this part does not need to know the algorithm.
+class HashBase {
+protected:
   HCRYPTHASH hash_;
 
   void Release();
+  bool CreateInternal(HCRYPTPROV provider, ALG_ID algo);
+  bool SetValueInternal(LPCBYTE digest);
+  bool GetValueInternal(LPBYTE digest, DWORD digestSize) const;
+
+public:
+  HashBase();
+  HashBase(HCRYPTHASH hash);
+  virtual ~HashBase();
+  operator HCRYPTHASH();
+  bool AddData(LPCBYTE data, DWORD dataLength);
+  // Hashes the segments of |parts| in order without joining them.
+  bool AddData(const BlobBuilder &parts);
+  Blob Sign(DWORD keyType);
+  bool Verify(LPCBYTE signature,
+              DWORD signatureLength,
+              HCRYPTKEY publicKey);
+
+  Operation<Blob> SignAsync(Strand &strand, DWORD keyType);
+  Operation<bool> VerifyAsync(Strand &strand,
+                              LPCBYTE signature,
+                              DWORD signatureLength,
+                              HCRYPTKEY publicKey);
+};
+
+template<class Algo>
+class BasicHash : public HashBase {
+public:
+  typedef Algo Traits;
+  typedef ::Digest<Algo> Digest;
+
+  bool Create(HCRYPTPROV provider) {
+    return CreateInternal(provider, Algo::Id);
+  }
+
+  bool SetHashValue(const Digest &digest) {
+    return SetValueInternal(digest.data());
+  }
+
+  template<size_t N>
+  bool SetHashValue(const BYTE (&digest)[N]) {
+    static_assert(N == Algo::DigestSize,
+                  "Digest length does not match the algorithm");
+    return SetValueInternal(digest);
+  }
+
+  bool GetHashValue(Digest &digest) const {
+    return GetValueInternal(digest.data(), Algo::DigestSize);
+  }
+};
+
+template<class Algo>
+class Signer {
+private:
+  HCRYPTPROV provider_;
+  DWORD keySpec_;
+
+public:
+  Signer(HCRYPTPROV provider, DWORD keySpec)
+    : provider_(provider), keySpec_(keySpec)
+  {}
+
+  Blob Sign(const Digest<Algo> &digest) const {
+    BasicHash<Algo> hash;
+    return hash.Create(provider_) && hash.SetHashValue(digest)
+           ? hash.Sign(keySpec_)
+           : Blob();
+  }
+
+  bool Verify(const Digest<Algo> &digest,
+              LPCBYTE signature,
+              DWORD signatureLength,
+              HCRYPTKEY publicKey) const {
+    BasicHash<Algo> hash;
+    return hash.Create(provider_)
+           && hash.SetHashValue(digest)
+           && hash.Verify(signature, signatureLength, publicKey);
+  }
+};
+
+// Type-erased hash for algorithms chosen at runtime.  The digest size comes
+// from the traits table, so SetHashValue does not ask the provider for it.
+class Hash : public HashBase {
+private:
+  ALG_ID algo_;
+  DWORD digestSize_;
+
+  void Resolve();
 
 public:
   Hash();
   Hash(HCRYPTHASH hash);
-  ~Hash();
-  operator HCRYPTHASH();
   void Attach(HCRYPTHASH hash);
-  bool AddData(LPCBYTE data, DWORD dataLength);
+  bool Create(HCRYPTPROV provider, ALG_ID algo);
+  ALG_ID Algorithm() const;
+  DWORD DigestSize() const;
   bool SetHashValue(LPCBYTE data, DWORD dataLength);
   Blob GetHashValue() const;
-  Blob Sign(DWORD keyType);
+
+  // Signs or verifies the digest with an in-process P-256 key instead of
+  // a key of the provider.  Both finish the hash.
+  using HashBase::Sign;
+  using HashBase::Verify;
+  Blob Sign(const EcdsaP256Key &key);
   bool Verify(LPCBYTE signature,
               DWORD signatureLength,
-              HCRYPTKEY publicKey);
+              const EcdsaP256Key &key);
 };
@@ -1,13 +1,29 @@
 #include <windows.h>
+#include <coroutine>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "allocprof.h"
+#include "executor.h"
+#include "async.h"
 #include "blob.h"
+#include "blobbuilder.h"
 #include "key.h"
+#include "provider.h"
 
 void Log(LPCWSTR Format, ...);
 
 void Key::Release() {
   if (key_) {
-    CryptDestroyKey(key_);
+    CryptoProvider::Current().DestroyKey(key_);
   }
   key_ = NULL;
 }
@@ -28,27 +44,65 @@ void Key::Attach(HCRYPTKEY key) {
   key_ = key;
 }
 
+bool Key::Import(HCRYPTPROV provider,
+                 LPCBYTE blob,
+                 DWORD size,
+                 DWORD flags) {
+  HCRYPTKEY key = NULL;
+  if (!CryptoProvider::Current().ImportKey(provider,
+                                           blob,
+                                           size,
+                                           NULL,
+                                           flags,
+                                           &key)) {
+    Log(L"CryptImportKey failed - %08x\n", GetLastError());
+    return false;
+  }
+  Attach(key);
+  return true;
+}
+
+bool Key::Import(HCRYPTPROV provider, const Blob &blob, DWORD flags) {
+  return Import(provider, blob, blob.Size(), flags);
+}
+
+bool Key::Import(HCRYPTPROV provider, const BlobView &blob, DWORD flags) {
+  return Import(provider, blob.data, blob.size, flags);
+}
+
 Key::operator HCRYPTKEY() {
   return key_;
 }
 
 Blob Key::Export(DWORD blobType) {
   Blob blob;
+  ExportTo(blobType, blob);
+  return blob;
+}
+
+Blob Key::Export(DWORD blobType, SecureArena &arena) {
+  Blob blob(arena);
+  ExportTo(blobType, blob);
+  return blob;
+}
+
+void Key::ExportTo(DWORD blobType, Blob &blob) {
+  AllocSite site("Key::Export");
   if (key_) {
     DWORD len = 0;
-    if (CryptExportKey(key_,
-      NULL,
-      blobType,
-      0,
-      nullptr,
-      &len)) {
+    if (CryptoProvider::Current().ExportKey(key_,
+                                            NULL,
+                                            blobType,
+                                            0,
+                                            nullptr,
+                                            &len)) {
       if (blob.Alloc(len)) {
-        if (CryptExportKey(key_,
-                           NULL,
-                           blobType,
-                           0,
-                           blob,
-                           &len)) {
+        if (CryptoProvider::Current().ExportKey(key_,
+                                                NULL,
+                                                blobType,
+                                                0,
+                                                blob,
+                                                &len)) {
           SetLastError(0);
         }
         else {
@@ -60,5 +114,9 @@ Blob Key::Export(DWORD blobType) {
       Log(L"CryptExportKey failed - %08x\n", GetLastError());
     }
   }
-  return blob;
+}
+
+Operation<Blob> Key::ExportAsync(Strand &strand, DWORD blobType) {
+  return Operation<Blob>(strand,
+                         [this, blobType]() { return Export(blobType); });
 }
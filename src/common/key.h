@@ -1,8 +1,14 @@
+struct BlobView;
+class Strand;
+template<class T>
+class Operation;
+
 class Key {
 private:
   HCRYPTKEY key_;
 
   void Release();
+  void ExportTo(DWORD blobType, Blob &blob);
 
 public:
   Key();
@@ -10,6 +16,13 @@ public:
   ~Key();
 
   void Attach(HCRYPTKEY key);
+  // Imports a key blob into |provider| in place of the key held, which is
+  // kept if the import fails.  |flags| are those of CryptImportKey.
+  bool Import(HCRYPTPROV provider, LPCBYTE blob, DWORD size, DWORD flags = 0);
+  bool Import(HCRYPTPROV provider, const Blob &blob, DWORD flags = 0);
+  bool Import(HCRYPTPROV provider, const BlobView &blob, DWORD flags = 0);
   operator HCRYPTKEY();
   Blob Export(DWORD blobType);
+  Blob Export(DWORD blobType, SecureArena &arena);
+  Operation<Blob> ExportAsync(Strand &strand, DWORD blobType);
 };
@@ -0,0 +1,114 @@
+#include <windows.h>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "blob.h"
+#include "blobbuilder.h"
+#include "csp.h"
+#include "digest.h"
+#include "hash.h"
+#include "key.h"
+#include "keyindex.h"
+#include "keycache.h"
+
+size_t PublicKeyCache::FingerprintHash::operator()(
+    const KeyFingerprint &fingerprint) const {
+  // A hash output already, so its first bytes are as good as any hash.
+  size_t h = 0;
+  memcpy(&h, fingerprint.data(), sizeof(h));
+  return h;
+}
+
+void PublicKeyCache::Fingerprint(LPCBYTE blob,
+                                 DWORD size,
+                                 KeyFingerprint &fingerprint) {
+  Sha256 sha;
+  sha.Update(blob, size);
+  sha.Final(fingerprint.data());
+}
+
+PublicKeyCache::PublicKeyCache(HCRYPTPROV provider,
+                               const PublicKeyCacheConfig &config)
+  : provider_(provider),
+    maxEntries_(max(config.maxEntries, 1u)),
+    hits_(0),
+    misses_(0),
+    evictions_(0)
+{}
+
+std::shared_ptr<Key> PublicKeyCache::Get(LPCBYTE blob, DWORD size) {
+  if (!blob
+      || size < sizeof(PUBLICKEYSTRUC)
+      || reinterpret_cast<const PUBLICKEYSTRUC*>(blob)->bType
+           != PUBLICKEYBLOB) {
+    SetLastError(NTE_BAD_TYPE);
+    return nullptr;
+  }
+
+  KeyFingerprint fingerprint;
+  Fingerprint(blob, size, fingerprint);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = map_.find(fingerprint);
+    if (it != map_.end()) {
+      ++hits_;
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->key;
+    }
+    ++misses_;
+  }
+
+  // Imported without the lock held.  Two threads missing on the same key
+  // both import it, and the second keeps the first one's handle.
+  auto key = std::make_shared<Key>();
+  if (!key->Import(provider_, blob, size)) return nullptr;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = map_.find(fingerprint);
+  if (it != map_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->key;
+  }
+  lru_.push_front(Entry{fingerprint, key});
+  map_.emplace(fingerprint, lru_.begin());
+  while (lru_.size() > maxEntries_) {
+    map_.erase(lru_.back().fingerprint);
+    lru_.pop_back();
+    ++evictions_;
+  }
+  return key;
+}
+
+std::shared_ptr<Key> PublicKeyCache::Get(const BlobView &blob) {
+  return Get(blob.data, blob.size);
+}
+
+bool PublicKeyCache::Verify(HashBase &hash,
+                            LPCBYTE signature,
+                            DWORD signatureLength,
+                            const BlobView &blob) {
+  std::shared_ptr<Key> key = Get(blob);
+  return key && hash.Verify(signature, signatureLength, *key);
+}
+
+void PublicKeyCache::Clear() {
+  std::lock_guard<std::mutex> guard(lock_);
+  map_.clear();
+  lru_.clear();
+}
+
+PublicKeyCacheMetrics PublicKeyCache::GetMetrics() {
+  std::lock_guard<std::mutex> guard(lock_);
+  PublicKeyCacheMetrics metrics;
+  metrics.hits = hits_;
+  metrics.misses = misses_;
+  metrics.evictions = evictions_;
+  metrics.entries = static_cast<DWORD>(lru_.size());
+  return metrics;
+}
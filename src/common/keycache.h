@@ -0,0 +1,74 @@
+struct PublicKeyCacheConfig {
+  DWORD maxEntries;
+
+  PublicKeyCacheConfig() : maxEntries(1024) {}
+};
+
+struct PublicKeyCacheMetrics {
+  ULONGLONG hits;
+  ULONGLONG misses;
+  ULONGLONG evictions;
+  DWORD entries;
+
+  PublicKeyCacheMetrics() : hits(0), misses(0), evictions(0), entries(0) {}
+
+  double HitRate() const {
+    return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0;
+  }
+};
+
+// Imported public keys by the SHA-256 of their PUBLICKEYBLOB.
+//
+// Verifying against a saved blob means a CryptImportKey per signature,
+// and on SoftProvider the blob is parsed and a Montgomery context built
+// each time.  The cache keeps the imported handle instead, so a key seen
+// before costs a hash of its blob and a lookup.  The blob bytes are the
+// key, with no parsing, so the same key saved as CALG_RSA_SIGN and as
+// CALG_RSA_KEYX is imported twice.  Only PUBLICKEYBLOBs are accepted.
+//
+// Entries are shared with callers: a key evicted while a verification is
+// using it is destroyed when that caller lets go of it.  The cache is
+// thread-safe; the handles it returns follow the rules of |provider|.
+class PublicKeyCache {
+private:
+  struct Entry {
+    KeyFingerprint fingerprint;
+    std::shared_ptr<Key> key;
+  };
+
+  struct FingerprintHash {
+    size_t operator()(const KeyFingerprint &fingerprint) const;
+  };
+
+  const HCRYPTPROV provider_;
+  const DWORD maxEntries_;
+  std::mutex lock_;
+  std::list<Entry> lru_;  // most recently used first
+  std::unordered_map<KeyFingerprint,
+                     std::list<Entry>::iterator,
+                     FingerprintHash> map_;
+  ULONGLONG hits_;
+  ULONGLONG misses_;
+  ULONGLONG evictions_;
+
+public:
+  static void Fingerprint(LPCBYTE blob,
+                          DWORD size,
+                          KeyFingerprint &fingerprint);
+
+  // |provider| must outlive the cache, and is best a CRYPT_VERIFYCONTEXT.
+  PublicKeyCache(HCRYPTPROV provider, const PublicKeyCacheConfig &config);
+
+  // The key imported from |blob|, importing it on a miss.  nullptr if the
+  // import fails, or with NTE_BAD_TYPE if |blob| is not a PUBLICKEYBLOB.
+  std::shared_ptr<Key> Get(LPCBYTE blob, DWORD size);
+  std::shared_ptr<Key> Get(const BlobView &blob);
+  // Verifies |signature| over |hash| with the key in |blob|.
+  bool Verify(HashBase &hash,
+              LPCBYTE signature,
+              DWORD signatureLength,
+              const BlobView &blob);
+
+  void Clear();
+  PublicKeyCacheMetrics GetMetrics();
+};
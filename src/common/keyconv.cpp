@@ -0,0 +1,330 @@
+#include <windows.h>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "archive.h"
+#include "blob.h"
+#include "blobbuilder.h"
+#include "der.h"
+#include "keyconv.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+constexpr DWORD RSA1Magic = 0x31415352;  // 'RSA1'
+constexpr DWORD RSA2Magic = 0x32415352;  // 'RSA2'
+constexpr DWORD HeaderSize = sizeof(BLOBHEADER) + sizeof(RSAPUBKEY);
+
+constexpr BYTE Zero = 0;
+
+constexpr char Base64UrlDigits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+bool AppendText(BlobBuilder &out, const char *text) {
+  return out.Append(reinterpret_cast<LPCBYTE>(text),
+                    static_cast<DWORD>(strlen(text)));
+}
+
+// base64url without padding of the unsigned little-endian value |le|,
+// read from its last byte to its first.  Leading zeros are dropped, as
+// RFC 7518 asks of every RSA member.
+bool AppendBase64Url(BlobBuilder &out, const BlobView &le) {
+  DWORD size = le.size;
+  while (size > 1 && le.data[size - 1] == 0) --size;
+  LPBYTE p = out.Extend((size * 4 + 2) / 3);
+  if (!p) return false;
+  for (DWORD i = 0; i < size; i += 3) {
+    const DWORD left = size - i;
+    const DWORD v = (le.data[size - 1 - i] << 16)
+                    | (left > 1 ? le.data[size - 2 - i] << 8 : 0)
+                    | (left > 2 ? le.data[size - 3 - i] : 0);
+    *p++ = Base64UrlDigits[v >> 18];
+    *p++ = Base64UrlDigits[(v >> 12) & 0x3f];
+    if (left > 1) *p++ = Base64UrlDigits[(v >> 6) & 0x3f];
+    if (left > 2) *p++ = Base64UrlDigits[v & 0x3f];
+  }
+  return true;
+}
+
+bool AppendMember(BlobBuilder &out, const char *name, const BlobView &le) {
+  return AppendText(out, ",\"")
+         && AppendText(out, name)
+         && AppendText(out, "\":\"")
+         && AppendBase64Url(out, le)
+         && AppendText(out, "\"");
+}
+
+// A JSON string of |text|, which is UTF-16.
+bool AppendJsonString(BlobBuilder &out, LPCWSTR text) {
+  const int size =
+    WideCharToMultiByte(CP_UTF8, 0, text, -1, nullptr, 0, nullptr, nullptr);
+  if (size <= 0) {
+    Log(L"WideCharToMultiByte failed - %08x\n", GetLastError());
+    return false;
+  }
+  std::string utf8(size, 0);
+  WideCharToMultiByte(CP_UTF8, 0, text, -1, &utf8[0], size, nullptr, nullptr);
+  utf8.resize(size - 1);
+
+  if (!AppendText(out, "\"")) return false;
+  for (const char c : utf8) {
+    char escaped[8] = {c, 0};
+    if (c == '"' || c == '\\') {
+      escaped[0] = '\\';
+      escaped[1] = c;
+      escaped[2] = 0;
+    }
+    else if (static_cast<BYTE>(c) < 0x20) {
+      static constexpr char hex[] = "0123456789abcdef";
+      memcpy(escaped, "\\u00", 4);
+      escaped[4] = hex[c >> 4];
+      escaped[5] = hex[c & 0xf];
+      escaped[6] = 0;
+    }
+    if (!AppendText(out, escaped)) return false;
+  }
+  return AppendText(out, "\"");
+}
+
+}  // namespace
+
+bool RsaBlobView::Parse(LPCBYTE blob, DWORD size) {
+  if (!blob || size < HeaderSize) {
+    SetLastError(NTE_BAD_LEN);
+    return false;
+  }
+  const auto header = reinterpret_cast<const BLOBHEADER*>(blob);
+  const auto rsa = reinterpret_cast<const RSAPUBKEY*>(header + 1);
+  const bool isPrivate = header->bType == PRIVATEKEYBLOB;
+  if ((header->bType != PUBLICKEYBLOB && !isPrivate)
+      || rsa->magic != (isPrivate ? RSA2Magic : RSA1Magic)
+      || rsa->bitlen == 0 || rsa->bitlen > 16384) {
+    SetLastError(NTE_BAD_TYPE);
+    return false;
+  }
+
+  const DWORD full = (rsa->bitlen + 7) / 8, half = (rsa->bitlen + 15) / 16;
+  const DWORD expected = HeaderSize + (isPrivate ? full * 2 + half * 5 : full);
+  if (size < expected) {
+    SetLastError(NTE_BAD_LEN);
+    return false;
+  }
+
+  LPCBYTE p = blob + HeaderSize;
+  auto next = [&p](DWORD bytes) {
+    const BlobView view(p, bytes);
+    p += bytes;
+    return view;
+  };
+  blobType = header->bType;
+  bits = rsa->bitlen;
+  publicExponent = rsa->pubexp;
+  modulus = next(full);
+  if (isPrivate) {
+    prime1 = next(half);
+    prime2 = next(half);
+    exponent1 = next(half);
+    exponent2 = next(half);
+    coefficient = next(half);
+    privateExponent = next(full);
+  }
+  else {
+    prime1 = prime2 = exponent1 = exponent2 = coefficient = privateExponent =
+      BlobView();
+  }
+  return true;
+}
+
+bool RsaBlobView::IsPrivate() const {
+  return blobType == PRIVATEKEYBLOB;
+}
+
+KeyConverter::KeyConverter(const KeyConverterConfig &config)
+  : config_(config)
+{}
+
+bool KeyConverter::WantsPrivate(const RsaBlobView &key) const {
+  return key.IsPrivate()
+         && !config_.publicOnly
+         && config_.format != KeyConverterConfig::Spki;
+}
+
+bool KeyConverter::AppendDer(const RsaBlobView &key, BlobBuilder &out) const {
+  // CAPI keeps the public exponent as a DWORD, which is little-endian too.
+  const BYTE exponentBytes[] = {
+    static_cast<BYTE>(key.publicExponent),
+    static_cast<BYTE>(key.publicExponent >> 8),
+    static_cast<BYTE>(key.publicExponent >> 16),
+    static_cast<BYTE>(key.publicExponent >> 24),
+  };
+  const BlobView exponent(exponentBytes, sizeof(exponentBytes));
+  const BlobView zero(&Zero, 1);
+
+  if (WantsPrivate(key)) {
+    // RSAPrivateKey ::= SEQUENCE { version, n, e, d, p, q, dp, dq, qinv }
+    const BlobView fields[] = {
+      zero, key.modulus, exponent, key.privateExponent, key.prime1,
+      key.prime2, key.exponent1, key.exponent2, key.coefficient,
+    };
+    DWORD privateSize = 0;
+    for (const auto &it : fields) {
+      privateSize += Der::IntegerSize(it);
+    }
+    bool ok = true;
+    if (config_.format == KeyConverterConfig::Pkcs8) {
+      // PrivateKeyInfo ::= SEQUENCE { version, algorithm, OCTET STRING }
+      const DWORD octets = Der::TlvSize(privateSize);
+      ok = Der::AppendHeader(out,
+                             Der::Sequence,
+                             Der::IntegerSize(zero)
+                               + sizeof(Der::RsaEncryption)
+                               + Der::TlvSize(octets))
+           && Der::AppendInteger(out, zero)
+           && out.Append(Der::RsaEncryption, sizeof(Der::RsaEncryption))
+           && Der::AppendHeader(out, Der::OctetString, octets);
+    }
+    ok = ok && Der::AppendHeader(out, Der::Sequence, privateSize);
+    for (const auto &it : fields) {
+      ok = ok && Der::AppendInteger(out, it);
+    }
+    return ok;
+  }
+
+  if (config_.format == KeyConverterConfig::Pkcs8) {
+    SetLastError(NTE_BAD_KEY);
+    return false;
+  }
+
+  // RSAPublicKey ::= SEQUENCE { n, e }
+  const DWORD publicSize =
+    Der::IntegerSize(key.modulus) + Der::IntegerSize(exponent);
+  bool ok = true;
+  if (config_.format == KeyConverterConfig::Spki) {
+    // SubjectPublicKeyInfo ::= SEQUENCE { algorithm, BIT STRING }, the bit
+    // string starting with the number of unused bits.
+    const DWORD bits = 1 + Der::TlvSize(publicSize);
+    ok = Der::AppendHeader(out,
+                           Der::Sequence,
+                           sizeof(Der::RsaEncryption) + Der::TlvSize(bits))
+         && out.Append(Der::RsaEncryption, sizeof(Der::RsaEncryption))
+         && Der::AppendHeader(out, Der::BitString, bits)
+         && out.Append(&Zero, 1);
+  }
+  return ok
+         && Der::AppendHeader(out, Der::Sequence, publicSize)
+         && Der::AppendInteger(out, key.modulus)
+         && Der::AppendInteger(out, exponent);
+}
+
+bool KeyConverter::AppendJwk(const RsaBlobView &key,
+                             LPCWSTR keyId,
+                             BlobBuilder &out) const {
+  const BYTE exponentBytes[] = {
+    static_cast<BYTE>(key.publicExponent),
+    static_cast<BYTE>(key.publicExponent >> 8),
+    static_cast<BYTE>(key.publicExponent >> 16),
+    static_cast<BYTE>(key.publicExponent >> 24),
+  };
+  bool ok = AppendText(out, "{\"kty\":\"RSA\"");
+  if (keyId) {
+    ok = ok && AppendText(out, ",\"kid\":") && AppendJsonString(out, keyId);
+  }
+  ok = ok
+       && AppendMember(out, "n", key.modulus)
+       && AppendMember(out,
+                       "e",
+                       BlobView(exponentBytes, sizeof(exponentBytes)));
+  if (ok && WantsPrivate(key)) {
+    ok = AppendMember(out, "d", key.privateExponent)
+         && AppendMember(out, "p", key.prime1)
+         && AppendMember(out, "q", key.prime2)
+         && AppendMember(out, "dp", key.exponent1)
+         && AppendMember(out, "dq", key.exponent2)
+         && AppendMember(out, "qi", key.coefficient);
+  }
+  return ok && AppendText(out, "}");
+}
+
+bool KeyConverter::Convert(LPCBYTE blob,
+                           DWORD size,
+                           LPCWSTR keyId,
+                           BlobBuilder &out) {
+  RsaBlobView key;
+  return key.Parse(blob, size) && Convert(key, keyId, out);
+}
+
+bool KeyConverter::Convert(const RsaBlobView &key,
+                           LPCWSTR keyId,
+                           BlobBuilder &out) {
+  if (config_.format == KeyConverterConfig::Pkcs8 && !WantsPrivate(key)) {
+    SetLastError(NTE_BAD_KEY);
+    return false;
+  }
+  if (config_.format == KeyConverterConfig::Jwk) {
+    return AppendJwk(key, keyId, out);
+  }
+  if (!config_.pem) {
+    return AppendDer(key, out);
+  }
+
+  scratch_.Clear();
+  if (!AppendDer(key, scratch_)) return false;
+  const LPCSTR label =
+    config_.format == KeyConverterConfig::Spki ? "PUBLIC KEY"
+    : config_.format == KeyConverterConfig::Pkcs8 ? "PRIVATE KEY"
+    : WantsPrivate(key) ? "RSA PRIVATE KEY"
+    : "RSA PUBLIC KEY";
+  const PemWriter::Sink sink = [&out](LPCBYTE data, DWORD size) {
+    return out.Append(data, size);
+  };
+  PemWriter pem(sink, label);
+  if (!pem.Begin()) return false;
+  for (const auto &it : scratch_.Segments()) {
+    if (!pem.Write(it.data, it.size)) return false;
+  }
+  return pem.End();
+}
+
+bool KeyConverter::Convert(const KeyArchive &archive,
+                           BlobBuilder &out,
+                           DWORD &converted,
+                           DWORD &skipped) {
+  const bool jwk = config_.format == KeyConverterConfig::Jwk;
+  const bool privateWanted = config_.format != KeyConverterConfig::Spki
+                             && !config_.publicOnly;
+  converted = skipped = 0;
+  if (jwk && !AppendText(out, "{\"keys\":[")) return false;
+
+  std::wstring keyId;
+  for (DWORD i = 0; i < archive.Size(); ++i) {
+    KeyArchive::Item item;
+    RsaBlobView key;
+    if (!archive.Get(i, item) || !key.Parse(item.data, item.size)) {
+      ++skipped;
+      continue;
+    }
+    // The other blob of the same key is converted instead.
+    const DWORD other =
+      item.blobType == PRIVATEKEYBLOB ? PUBLICKEYBLOB : PRIVATEKEYBLOB;
+    DWORD index = 0;
+    if (archive.Find(item.container, item.keySpec, other, index)
+        && (other == PRIVATEKEYBLOB) == privateWanted) {
+      continue;
+    }
+    if (config_.format == KeyConverterConfig::Pkcs8 && !WantsPrivate(key)) {
+      ++skipped;
+      continue;
+    }
+
+    keyId = item.container;
+    keyId += item.keySpec == AT_SIGNATURE ? L"/sig" : L"/exchange";
+    if ((jwk && converted > 0 && !AppendText(out, ","))
+        || !Convert(key, keyId.c_str(), out)) {
+      return false;
+    }
+    ++converted;
+  }
+  return !jwk || AppendText(out, "]}");
+}
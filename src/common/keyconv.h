@@ -0,0 +1,77 @@
+// The fields of an RSA PUBLICKEYBLOB or PRIVATEKEYBLOB, read in place.
+// Each integer is a view into the blob and stays little-endian, as CAPI
+// stores it; the private fields are empty for a PUBLICKEYBLOB.
+struct RsaBlobView {
+  DWORD blobType;
+  DWORD bits;
+  DWORD publicExponent;
+  BlobView modulus;
+  BlobView prime1;
+  BlobView prime2;
+  BlobView exponent1;
+  BlobView exponent2;
+  BlobView coefficient;
+  BlobView privateExponent;
+
+  RsaBlobView() : blobType(0), bits(0), publicExponent(0) {}
+
+  // Fails with NTE_BAD_TYPE for anything but RSA1/RSA2 blobs, and with
+  // NTE_BAD_LEN if |size| is too short for the key length the header gives.
+  bool Parse(LPCBYTE blob, DWORD size);
+  bool IsPrivate() const;
+};
+
+struct KeyConverterConfig {
+  enum Format {
+    Spki,   // SubjectPublicKeyInfo, "PUBLIC KEY"
+    Pkcs1,  // RSAPublicKey or RSAPrivateKey, "RSA ... KEY"
+    Pkcs8,  // PrivateKeyInfo, "PRIVATE KEY"; private blobs only
+    Jwk,    // RFC 7517 JSON Web Key
+  };
+
+  Format format;
+  bool pem;         // PEM armour around the DER formats
+  bool publicOnly;  // only the public half of private blobs
+
+  KeyConverterConfig() : format(Spki), pem(false), publicOnly(false) {}
+};
+
+class KeyArchive;
+
+// Turns CAPI key blobs into the encodings other software reads.
+//
+// The blob is parsed in place and each field is written straight into
+// the caller's BlobBuilder, its bytes reversed into big-endian order as
+// it is copied, so there are no intermediate integers.  The base64url of
+// a JWK is read from the blob the same way.  PEM is encoded from a scratch
+// builder holding the DER, which is reused from one key to the next, so a
+// large inventory is converted without growing it again.
+class KeyConverter {
+private:
+  const KeyConverterConfig config_;
+  BlobBuilder scratch_;
+
+  bool WantsPrivate(const RsaBlobView &key) const;
+  bool AppendDer(const RsaBlobView &key, BlobBuilder &out) const;
+  bool AppendJwk(const RsaBlobView &key,
+                 LPCWSTR keyId,
+                 BlobBuilder &out) const;
+
+public:
+  KeyConverter(const KeyConverterConfig &config);
+
+  // Appends one key to |out|.  |keyId| becomes the "kid" of a JWK and may
+  // be nullptr; the other formats ignore it.
+  bool Convert(LPCBYTE blob, DWORD size, LPCWSTR keyId, BlobBuilder &out);
+  bool Convert(const RsaBlobView &key, LPCWSTR keyId, BlobBuilder &out);
+
+  // Appends every RSA key of |archive|: one PEM after another, a JWK Set
+  // whose "kid"s are "<container>/<sig|exchange>", or the DER values one
+  // after another.  A key archived as both blob types is converted once,
+  // from the private blob if the format includes the private key.  Blobs
+  // that cannot be converted are counted in |skipped|.
+  bool Convert(const KeyArchive &archive,
+               BlobBuilder &out,
+               DWORD &converted,
+               DWORD &skipped);
+};
@@ -0,0 +1,550 @@
+#include <windows.h>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "blob.h"
+#include "csp.h"
+#include "key.h"
+#include "hash.h"
+#include "keyindex.h"
+#include "provider.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+constexpr DWORD RSA1Magic = 0x31415352;  // 'RSA1'
+constexpr DWORD RSA2Magic = 0x32415352;  // 'RSA2'
+
+struct KeyIndexFileHeader {
+  DWORD magic;
+  DWORD version;
+  DWORD entries;
+  DWORD slots;
+  DWORD containers;
+  DWORD strings;
+};
+
+constexpr DWORD KeyIndexMagic = 0x4b505343;  // 'CSPK'
+constexpr DWORD KeyIndexVersion = 1;
+
+// The key spec of an entry RemoveKeys has dropped.
+constexpr DWORD RemovedKeySpec = 0;
+
+void AppendBigEndian(std::vector<BYTE> &out, LPCBYTE le, DWORD size) {
+  while (size > 0 && le[size - 1] == 0) --size;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<BYTE>(size >> shift));
+  }
+  for (DWORD i = size; i > 0; --i) {
+    out.push_back(le[i - 1]);
+  }
+}
+
+bool WriteAll(HANDLE file, LPCVOID data, size_t size) {
+  DWORD bytesWritten = 0;
+  if (!WriteFile(file, data, static_cast<DWORD>(size), &bytesWritten, nullptr)
+      || bytesWritten != size) {
+    Log(L"WriteFile failed - %08x\n", GetLastError());
+    return false;
+  }
+  return true;
+}
+
+bool ReadAll(HANDLE file, LPVOID data, size_t size) {
+  DWORD bytesRead = 0;
+  if (!ReadFile(file, data, static_cast<DWORD>(size), &bytesRead, nullptr)
+      || bytesRead != size) {
+    Log(L"ReadFile failed - %08x\n", GetLastError());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool KeyIndex::Normalize(LPCBYTE blob, DWORD size, std::vector<BYTE> &out) {
+  const DWORD headerSize = sizeof(PUBLICKEYSTRUC) + sizeof(RSAPUBKEY);
+  if (!blob || size < headerSize) return false;
+
+  const auto header = reinterpret_cast<const PUBLICKEYSTRUC*>(blob);
+  const auto rsa = reinterpret_cast<const RSAPUBKEY*>(header + 1);
+  if ((header->bType != PUBLICKEYBLOB && header->bType != PRIVATEKEYBLOB)
+      || (rsa->magic != RSA1Magic && rsa->magic != RSA2Magic)) {
+    return false;
+  }
+
+  const DWORD modulusSize = (rsa->bitlen + 7) / 8;
+  if (modulusSize == 0 || size - headerSize < modulusSize) return false;
+
+  const BYTE exponent[] = {
+    static_cast<BYTE>(rsa->pubexp),
+    static_cast<BYTE>(rsa->pubexp >> 8),
+    static_cast<BYTE>(rsa->pubexp >> 16),
+    static_cast<BYTE>(rsa->pubexp >> 24),
+  };
+  out.clear();
+  out.reserve(modulusSize + 16);
+  AppendBigEndian(out, blob + headerSize, modulusSize);
+  AppendBigEndian(out, exponent, sizeof(exponent));
+  return true;
+}
+
+KeyIndex::KeyIndex() : removed_(0) {}
+
+void KeyIndex::Clear() {
+  entries_.clear();
+  slots_.clear();
+  containers_.clear();
+  strings_.clear();
+  removed_ = 0;
+}
+
+DWORD KeyIndex::Size() const {
+  return static_cast<DWORD>(entries_.size()) - removed_;
+}
+
+DWORD KeyIndex::ContainerCount() const {
+  return static_cast<DWORD>(containers_.size());
+}
+
+KeyIndex::ContainerInfo KeyIndex::GetContainer(DWORD container) const {
+  if (container >= containers_.size()) return {};
+  const auto &c = containers_[container];
+  return { &strings_[c.name], &strings_[c.provider], c.providerType, c.flags };
+}
+
+bool KeyIndex::Fingerprint(LPCBYTE blob,
+                           DWORD size,
+                           KeyFingerprint &fingerprint) {
+  std::vector<BYTE> normalized;
+  if (!Normalize(blob, size, normalized)) {
+    SetLastError(NTE_BAD_KEY);
+    return false;
+  }
+  if (!hashProvider_
+      && !hashProvider_.Acquire(nullptr,
+                                nullptr,
+                                PROV_RSA_AES,
+                                CRYPT_VERIFYCONTEXT)) {
+    return false;
+  }
+  BasicHash<SHA256Traits> hash;
+  return hash.Create(hashProvider_)
+         && hash.AddData(normalized.data(),
+                         static_cast<DWORD>(normalized.size()))
+         && hash.GetHashValue(fingerprint);
+}
+
+DWORD KeyIndex::Intern(LPCWSTR s) {
+  const auto offset = static_cast<DWORD>(strings_.size());
+  if (s) {
+    strings_.insert(strings_.end(), s, s + wcslen(s));
+  }
+  strings_.push_back(0);
+  return offset;
+}
+
+DWORD *KeyIndex::FindSlot(const KeyFingerprint &fingerprint) {
+  return const_cast<DWORD*>(
+    static_cast<const KeyIndex*>(this)->FindSlot(fingerprint));
+}
+
+const DWORD *KeyIndex::FindSlot(const KeyFingerprint &fingerprint) const {
+  if (slots_.empty()) return nullptr;
+
+  // The digest is already uniform, so its first bytes are the hash.
+  DWORD h;
+  CopyMemory(&h, fingerprint.data(), sizeof(h));
+  const size_t mask = slots_.size() - 1;
+  size_t i = h & mask;
+  for (size_t probes = 0; probes < slots_.size(); ++probes) {
+    const DWORD &slot = slots_[i];
+    if (slot == 0 || entries_[slot - 1].fingerprint == fingerprint) {
+      return &slot;
+    }
+    i = (i + 1) & mask;
+  }
+  // Only a full table gets here, which Add and Load do not allow.
+  return nullptr;
+}
+
+void KeyIndex::Rehash(size_t slotCount) {
+  size_t size = 16;
+  while (size < slotCount) size <<= 1;
+  slots_.assign(size, 0);
+  for (DWORD i = 0; i < entries_.size(); ++i) {
+    // Only chain heads own a slot, and every chain starts at the entry
+    // added first, which is the lowest index.
+    DWORD *slot = FindSlot(entries_[i].fingerprint);
+    if (*slot == 0) *slot = i + 1;
+  }
+}
+
+DWORD KeyIndex::AddContainer(LPCWSTR name,
+                             LPCWSTR provider,
+                             DWORD providerType,
+                             DWORD flags) {
+  Container c;
+  c.name = Intern(name);
+  c.provider = Intern(provider);
+  c.providerType = providerType;
+  c.flags = flags;
+  containers_.push_back(c);
+  return static_cast<DWORD>(containers_.size() - 1);
+}
+
+DWORD KeyIndex::FindContainer(LPCWSTR name,
+                              LPCWSTR provider,
+                              DWORD providerType,
+                              DWORD flags) const {
+  for (DWORD i = 0; i < containers_.size(); ++i) {
+    const auto &c = containers_[i];
+    if (c.providerType == providerType
+        && c.flags == flags
+        && wcscmp(&strings_[c.name], name ? name : L"") == 0
+        && wcscmp(&strings_[c.provider], provider ? provider : L"") == 0) {
+      return i;
+    }
+  }
+  return NoContainer;
+}
+
+void KeyIndex::Add(const KeyFingerprint &fingerprint,
+                   DWORD container,
+                   DWORD keySpec) {
+  if ((entries_.size() + 1) * 2 > slots_.size()) {
+    Rehash(max(slots_.size() * 2, size_t(16)));
+  }
+
+  const auto index = static_cast<DWORD>(entries_.size());
+  entries_.push_back({fingerprint, container, keySpec, 0});
+
+  DWORD *slot = FindSlot(fingerprint);
+  if (*slot == 0) {
+    *slot = index + 1;
+    return;
+  }
+  DWORD tail = *slot - 1;
+  while (entries_[tail].next) tail = entries_[tail].next - 1;
+  entries_[tail].next = index + 1;
+}
+
+bool KeyIndex::AddBlob(LPCBYTE blob,
+                       DWORD size,
+                       DWORD container,
+                       DWORD keySpec) {
+  KeyFingerprint fingerprint;
+  if (!Fingerprint(blob, size, fingerprint)) return false;
+  Add(fingerprint, container, keySpec);
+  return true;
+}
+
+bool KeyIndex::Scan(LPCWSTR providerName, DWORD providerType, DWORD flags) {
+  CSP enumerator;
+  if (!enumerator.Acquire(nullptr,
+                          providerName,
+                          providerType,
+                          flags | CRYPT_VERIFYCONTEXT)) {
+    return false;
+  }
+
+  DWORD maxLength = 0;
+  if (!CryptoProvider::Current().GetProvParam(enumerator,
+                                              PP_ENUMCONTAINERS,
+                                              nullptr,
+                                              &maxLength,
+                                              CRYPT_FIRST)) {
+    const auto gle = GetLastError();
+    if (gle == ERROR_NO_MORE_ITEMS) return true;
+    Log(L"CryptGetProvParam(PP_ENUMCONTAINERS) failed - %08x\n", gle);
+    return false;
+  }
+
+  // Collect every name before opening any container; acquiring a keyset
+  // in the middle of an enumeration restarts it on some providers.
+  Blob nameA;
+  if (!nameA.Alloc(maxLength + 1)) return false;
+  std::vector<std::wstring> names;
+  DWORD bufferSize = maxLength + 1;
+  DWORD enumFlags = CRYPT_FIRST;
+  while (CryptoProvider::Current().GetProvParam(enumerator,
+                                                PP_ENUMCONTAINERS,
+                                                nameA,
+                                                &bufferSize,
+                                                enumFlags)) {
+    const auto s = reinterpret_cast<LPCSTR>(LPBYTE(nameA));
+    const int chars = MultiByteToWideChar(CP_ACP, 0, s, -1, nullptr, 0);
+    if (chars > 0) {
+      std::wstring name(chars - 1, L'\0');
+      MultiByteToWideChar(CP_ACP, 0, s, -1, &name[0], chars);
+      names.push_back(std::move(name));
+    }
+    bufferSize = maxLength + 1;
+    enumFlags = CRYPT_NEXT;
+  }
+
+  for (const auto &name : names) {
+    IndexKeys(name.c_str(), providerName, providerType, flags, NoContainer);
+  }
+  return true;
+}
+
+bool KeyIndex::IndexKeys(LPCWSTR name,
+                         LPCWSTR providerName,
+                         DWORD providerType,
+                         DWORD flags,
+                         DWORD container) {
+  flags &= CRYPT_MACHINE_KEYSET;
+  CSP csp;
+  if (!csp.Acquire(name, providerName, providerType, flags | CRYPT_SILENT))
+    return false;
+
+  if (container == NoContainer) {
+    container = AddContainer(name, providerName, providerType, flags);
+  }
+  for (DWORD keySpec : { AT_KEYEXCHANGE, AT_SIGNATURE }) {
+    Key key(csp.GetUserKey(keySpec));
+    if (!key) continue;
+    Blob blob = key.Export(PUBLICKEYBLOB);
+    if (GetLastError() == ERROR_SUCCESS) {
+      AddBlob(blob, blob.Size(), container, keySpec);
+    }
+  }
+  return true;
+}
+
+bool KeyIndex::ScanContainer(LPCWSTR name,
+                             LPCWSTR providerName,
+                             DWORD providerType,
+                             DWORD flags) {
+  const DWORD container = FindContainer(name,
+                                        providerName,
+                                        providerType,
+                                        flags & CRYPT_MACHINE_KEYSET);
+  if (container != NoContainer) {
+    RemoveKeys(container);
+  }
+  return IndexKeys(name, providerName, providerType, flags, container);
+}
+
+bool KeyIndex::RemoveKeys(DWORD container) {
+  // Entries are only marked, so no slot or chain has to change; Find and
+  // Duplicates skip them.
+  bool found = false;
+  for (auto &e : entries_) {
+    if (e.container == container && e.keySpec != RemovedKeySpec) {
+      e.keySpec = RemovedKeySpec;
+      ++removed_;
+      found = true;
+    }
+  }
+  if (removed_ * 2 > entries_.size()) {
+    Compact();
+  }
+  return found;
+}
+
+void KeyIndex::Compact() {
+  // Entries and chains only ever grow at the end, so the simplest way to
+  // take entries out from the middle is to add the rest again.
+  std::vector<Entry> kept;
+  kept.reserve(entries_.size() - removed_);
+  for (const auto &e : entries_) {
+    if (e.keySpec != RemovedKeySpec) kept.push_back(e);
+  }
+  entries_.clear();
+  removed_ = 0;
+  std::fill(slots_.begin(), slots_.end(), 0);
+  for (const auto &e : kept) {
+    Add(e.fingerprint, e.container, e.keySpec);
+  }
+}
+
+bool KeyIndex::Find(const KeyFingerprint &fingerprint,
+                    std::vector<Match> &matches) const {
+  const DWORD *slot = FindSlot(fingerprint);
+  if (!slot || *slot == 0) return false;
+  bool found = false;
+  for (DWORD i = *slot; i; i = entries_[i - 1].next) {
+    const auto &e = entries_[i - 1];
+    if (e.keySpec == RemovedKeySpec) continue;
+    matches.push_back({e.container, e.keySpec});
+    found = true;
+  }
+  return found;
+}
+
+bool KeyIndex::FindBlob(LPCBYTE blob,
+                        DWORD size,
+                        std::vector<Match> &matches) {
+  KeyFingerprint fingerprint;
+  return Fingerprint(blob, size, fingerprint) && Find(fingerprint, matches);
+}
+
+bool KeyIndex::FindCertificate(LPCBYTE encoded,
+                               DWORD size,
+                               std::vector<Match> &matches) {
+  PCCERT_CONTEXT cert =
+    CertCreateCertificateContext(X509_ASN_ENCODING | PKCS_7_ASN_ENCODING,
+                                 encoded,
+                                 size);
+  if (!cert) {
+    Log(L"CertCreateCertificateContext failed - %08x\n", GetLastError());
+    return false;
+  }
+
+  bool ret = false;
+  const auto &publicKey = cert->pCertInfo->SubjectPublicKeyInfo.PublicKey;
+  LPBYTE blob = nullptr;
+  DWORD blobSize = 0;
+  if (CryptDecodeObjectEx(X509_ASN_ENCODING,
+                          RSA_CSP_PUBLICKEYBLOB,
+                          publicKey.pbData,
+                          publicKey.cbData,
+                          CRYPT_DECODE_ALLOC_FLAG,
+                          nullptr,
+                          &blob,
+                          &blobSize)) {
+    ret = FindBlob(blob, blobSize, matches);
+    LocalFree(blob);
+  }
+  else {
+    Log(L"CryptDecodeObjectEx failed - %08x\n", GetLastError());
+  }
+  CertFreeCertificateContext(cert);
+  return ret;
+}
+
+void KeyIndex::Duplicates(std::vector<std::vector<Match>> &groups) const {
+  for (DWORD slot : slots_) {
+    if (slot == 0 || entries_[slot - 1].next == 0) continue;
+    std::vector<Match> group;
+    for (DWORD i = slot; i; i = entries_[i - 1].next) {
+      const auto &e = entries_[i - 1];
+      if (e.keySpec != RemovedKeySpec) {
+        group.push_back({e.container, e.keySpec});
+      }
+    }
+    if (group.size() > 1) groups.push_back(std::move(group));
+  }
+}
+
+bool KeyIndex::Validate() const {
+  // A loaded table is trusted for lookups, so every index in it is checked
+  // once here instead of on each probe.
+  const DWORD entries = static_cast<DWORD>(entries_.size());
+  bool free = false;
+  for (DWORD slot : slots_) {
+    if (slot > entries) return false;
+    free = free || slot == 0;
+  }
+  // A probe for a missing key ends at an empty slot.
+  if (!slots_.empty() && !free) return false;
+  for (DWORD i = 0; i < entries; ++i) {
+    // Chains only point forward, which also rules out cycles.
+    const auto &e = entries_[i];
+    if ((e.next && (e.next <= i + 1 || e.next > entries))
+        || e.container >= containers_.size()) {
+      return false;
+    }
+  }
+  for (const auto &c : containers_) {
+    if (c.name >= strings_.size() || c.provider >= strings_.size())
+      return false;
+  }
+  return strings_.empty() || strings_.back() == 0;
+}
+
+bool KeyIndex::Save(LPCWSTR filename) const {
+  HANDLE file = CreateFile(filename,
+                           GENERIC_WRITE,
+                           0,
+                           nullptr,
+                           CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+
+  // The table is written as it is in memory so that Load does not rehash.
+  KeyIndexFileHeader header = {
+    KeyIndexMagic,
+    KeyIndexVersion,
+    static_cast<DWORD>(entries_.size()),
+    static_cast<DWORD>(slots_.size()),
+    static_cast<DWORD>(containers_.size()),
+    static_cast<DWORD>(strings_.size()),
+  };
+  bool ret = WriteAll(file, &header, sizeof(header))
+    && WriteAll(file, entries_.data(), entries_.size() * sizeof(Entry))
+    && WriteAll(file, slots_.data(), slots_.size() * sizeof(DWORD))
+    && WriteAll(file, containers_.data(), containers_.size() * sizeof(Container))
+    && WriteAll(file, strings_.data(), strings_.size() * sizeof(WCHAR));
+  CloseHandle(file);
+  return ret;
+}
+
+bool KeyIndex::Load(LPCWSTR filename) {
+  HANDLE file = CreateFile(filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+
+  bool ret = false;
+  LARGE_INTEGER fileSize = {};
+  KeyIndexFileHeader header;
+  if (GetFileSizeEx(file, &fileSize)
+      && ReadAll(file, &header, sizeof(header))) {
+    const ULONGLONG expected = sizeof(header)
+      + ULONGLONG(header.entries) * sizeof(Entry)
+      + ULONGLONG(header.slots) * sizeof(DWORD)
+      + ULONGLONG(header.containers) * sizeof(Container)
+      + ULONGLONG(header.strings) * sizeof(WCHAR);
+    if (header.magic != KeyIndexMagic
+        || header.version != KeyIndexVersion
+        || ULONGLONG(fileSize.QuadPart) != expected
+        || (header.slots & (header.slots - 1)) != 0
+        || ULONGLONG(header.entries) * 2 > header.slots) {
+      Log(L"%s is not a valid key index\n", filename);
+    }
+    else {
+      Clear();
+      entries_.resize(header.entries);
+      slots_.resize(header.slots);
+      containers_.resize(header.containers);
+      strings_.resize(header.strings);
+      ret = ReadAll(file, entries_.data(), entries_.size() * sizeof(Entry))
+        && ReadAll(file, slots_.data(), slots_.size() * sizeof(DWORD))
+        && ReadAll(file, containers_.data(),
+                   containers_.size() * sizeof(Container))
+        && ReadAll(file, strings_.data(), strings_.size() * sizeof(WCHAR));
+      ret = ret && Validate();
+      if (!ret) {
+        Log(L"%s is not a valid key index\n", filename);
+        Clear();
+      }
+      removed_ = static_cast<DWORD>(
+        std::count_if(entries_.begin(),
+                      entries_.end(),
+                      [](const Entry &e) {
+                        return e.keySpec == RemovedKeySpec;
+                      }));
+    }
+  }
+  CloseHandle(file);
+  return ret;
+}
@@ -0,0 +1,121 @@
+typedef Digest<SHA256Traits> KeyFingerprint;
+
+// Maps public key fingerprints to the containers holding them.
+//
+// A fingerprint is SHA-256 over the modulus and public exponent only, both
+// big-endian with leading zeros stripped and each prefixed by its length,
+// so the same key matches whether it came from a PUBLICKEYBLOB, a
+// PRIVATEKEYBLOB or a certificate, and regardless of AT_SIGNATURE or
+// AT_KEYEXCHANGE.  Fingerprints are uniformly distributed, so the table is
+// probed with their first bytes directly; keys held by more than one
+// container hang off the same slot as a chain.  Removed keys stay in their
+// chains, marked, until they make up half of the entries.
+class KeyIndex {
+public:
+  static constexpr DWORD NoContainer = ~0u;
+
+  struct Match {
+    DWORD container;
+    DWORD keySpec;
+  };
+
+  struct ContainerInfo {
+    LPCWSTR name;
+    LPCWSTR provider;
+    DWORD providerType;
+    DWORD flags;
+  };
+
+private:
+  struct Entry {
+    KeyFingerprint fingerprint;
+    DWORD container;
+    DWORD keySpec;
+    DWORD next;  // next entry with the same fingerprint + 1
+  };
+
+  struct Container {
+    DWORD name;      // offsets into |strings_|
+    DWORD provider;
+    DWORD providerType;
+    DWORD flags;
+  };
+
+  std::vector<Entry> entries_;
+  std::vector<DWORD> slots_;  // open addressing, entry index + 1
+  std::vector<Container> containers_;
+  std::vector<WCHAR> strings_;
+  CSP hashProvider_;
+  DWORD removed_;  // entries dropped by RemoveKeys still in |entries_|
+
+  DWORD Intern(LPCWSTR s);
+  DWORD *FindSlot(const KeyFingerprint &fingerprint);
+  const DWORD *FindSlot(const KeyFingerprint &fingerprint) const;
+  void Rehash(size_t slotCount);
+  void Compact();
+  bool Validate() const;
+  // Opens the container and indexes both key specs under |container|, or
+  // under a new container if it is NoContainer.
+  bool IndexKeys(LPCWSTR name,
+                 LPCWSTR providerName,
+                 DWORD providerType,
+                 DWORD flags,
+                 DWORD container);
+
+public:
+  // Extracts the normalized key material hashed into a fingerprint from an
+  // RSA PUBLICKEYBLOB or PRIVATEKEYBLOB.
+  static bool Normalize(LPCBYTE blob, DWORD size, std::vector<BYTE> &out);
+
+  KeyIndex();
+
+  void Clear();
+  DWORD Size() const;
+  DWORD ContainerCount() const;
+  ContainerInfo GetContainer(DWORD container) const;
+
+  bool Fingerprint(LPCBYTE blob, DWORD size, KeyFingerprint &fingerprint);
+
+  DWORD AddContainer(LPCWSTR name,
+                     LPCWSTR provider,
+                     DWORD providerType,
+                     DWORD flags);
+  // Returns NoContainer if there is no such container.
+  DWORD FindContainer(LPCWSTR name,
+                      LPCWSTR provider,
+                      DWORD providerType,
+                      DWORD flags) const;
+  // |keySpec| is AT_KEYEXCHANGE or AT_SIGNATURE.
+  void Add(const KeyFingerprint &fingerprint, DWORD container, DWORD keySpec);
+  bool AddBlob(LPCBYTE blob, DWORD size, DWORD container, DWORD keySpec);
+
+  // Opens every container of the provider and indexes both key specs.
+  // |flags| may carry CRYPT_MACHINE_KEYSET.
+  bool Scan(LPCWSTR providerName, DWORD providerType, DWORD flags);
+
+  // Brings one container up to date after it was created, changed or
+  // deleted.  A container already in the index keeps its number; its keys
+  // are dropped and indexed again if it can still be opened.
+  bool ScanContainer(LPCWSTR name,
+                     LPCWSTR providerName,
+                     DWORD providerType,
+                     DWORD flags);
+  // Drops the keys of |container|, which stays in the index with none.
+  // Returns false if it held none.
+  bool RemoveKeys(DWORD container);
+
+  // The Find functions append every container holding the key and return
+  // false if there is none.
+  bool Find(const KeyFingerprint &fingerprint,
+            std::vector<Match> &matches) const;
+  bool FindBlob(LPCBYTE blob, DWORD size, std::vector<Match> &matches);
+  bool FindCertificate(LPCBYTE encoded,
+                       DWORD size,
+                       std::vector<Match> &matches);
+
+  // One group per key held by more than one container.
+  void Duplicates(std::vector<std::vector<Match>> &groups) const;
+
+  bool Save(LPCWSTR filename) const;
+  bool Load(LPCWSTR filename);
+};
@@ -0,0 +1,378 @@
+#include <windows.h>
+#include <sddl.h>
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "bignum.h"
+#include "digest.h"
+#include "provider.h"
+#include "rsa.h"
+#include "softprov.h"
+#include "keywatch.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+// The start of a key file of the Microsoft RSA providers.  The container
+// name follows, in the ANSI code page and null-terminated, then the key and
+// flag sections whose lengths the header gives.
+struct CapiKeyFileHeader {
+  DWORD version;
+  DWORD reserved;
+  DWORD nameLength;
+  DWORD signaturePublicLength;
+  DWORD signaturePrivateLength;
+  DWORD exchangePublicLength;
+  DWORD exchangePrivateLength;
+  DWORD hashLength;
+  DWORD signatureFlagsLength;
+  DWORD exchangeFlagsLength;
+};
+
+// Longer than any name PP_ENUMCONTAINERS returns.
+constexpr DWORD MaxContainerName = 1024;
+
+std::wstring FileNameOf(const std::wstring &path) {
+  const auto slash = path.find_last_of(L"\\/");
+  return slash == std::wstring::npos ? path : path.substr(slash + 1);
+}
+
+void Merge(std::map<std::wstring, ContainerChange::Action> &changes,
+           const std::wstring &name,
+           ContainerChange::Action action) {
+  auto it = changes.find(name);
+  if (it == changes.end()) {
+    changes[name] = action;
+    return;
+  }
+  // Only the net effect is reported: a container that appeared and is
+  // still there is new however often it changed since.
+  auto &previous = it->second;
+  if (previous == ContainerChange::Added) {
+    if (action == ContainerChange::Removed) changes.erase(it);
+  }
+  else if (previous == ContainerChange::Removed) {
+    if (action != ContainerChange::Removed) {
+      previous = ContainerChange::Modified;
+    }
+  }
+  else if (action == ContainerChange::Removed) {
+    previous = action;
+  }
+}
+
+}  // namespace
+
+bool KeyStoreWatcher::CapiKeyDirectory(bool machine,
+                                       std::wstring &directory) {
+  WCHAR buffer[MAX_PATH];
+  if (machine) {
+    if (!ExpandEnvironmentStrings(
+           L"%ALLUSERSPROFILE%\\Microsoft\\Crypto\\RSA\\MachineKeys",
+           buffer,
+           MAX_PATH)) {
+      Log(L"ExpandEnvironmentStrings failed - %08x\n", GetLastError());
+      return false;
+    }
+    directory = buffer;
+    return true;
+  }
+
+  // The user's keys are in a subdirectory named after the user's SID.
+  HANDLE token = nullptr;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) {
+    Log(L"OpenProcessToken failed - %08x\n", GetLastError());
+    return false;
+  }
+  bool ret = false;
+  DWORD size = 0;
+  GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+  std::vector<BYTE> user(size);
+  LPWSTR sid = nullptr;
+  if (size == 0
+      || !GetTokenInformation(token, TokenUser, user.data(), size, &size)) {
+    Log(L"GetTokenInformation failed - %08x\n", GetLastError());
+  }
+  else if (!ConvertSidToStringSid(
+             reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid,
+             &sid)) {
+    Log(L"ConvertSidToStringSid failed - %08x\n", GetLastError());
+  }
+  else if (!ExpandEnvironmentStrings(L"%APPDATA%\\Microsoft\\Crypto\\RSA\\",
+                                     buffer,
+                                     MAX_PATH)) {
+    Log(L"ExpandEnvironmentStrings failed - %08x\n", GetLastError());
+  }
+  else {
+    directory = std::wstring(buffer) + sid;
+    ret = true;
+  }
+  if (sid) {
+    LocalFree(sid);
+  }
+  CloseHandle(token);
+  return ret;
+}
+
+bool KeyStoreWatcher::CapiContainerName(const std::wstring &path,
+                                        std::wstring &name) {
+  // Key files of other users in the machine store cannot be opened, which
+  // also keeps them out of PP_ENUMCONTAINERS.
+  HANDLE file = CreateFile(path.c_str(),
+                           GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE
+                             | FILE_SHARE_DELETE,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+
+  bool ret = false;
+  CapiKeyFileHeader header;
+  DWORD bytesRead = 0;
+  if (ReadFile(file, &header, sizeof(header), &bytesRead, nullptr)
+      && bytesRead == sizeof(header)
+      && header.nameLength > 1
+      && header.nameLength <= MaxContainerName) {
+    std::vector<char> ansi(header.nameLength);
+    if (ReadFile(file, ansi.data(), header.nameLength, &bytesRead, nullptr)
+        && bytesRead == header.nameLength
+        && ansi.back() == 0) {
+      const int chars =
+        MultiByteToWideChar(CP_ACP, 0, ansi.data(), -1, nullptr, 0);
+      if (chars > 1) {
+        name.resize(chars);
+        MultiByteToWideChar(CP_ACP, 0, ansi.data(), -1, &name[0], chars);
+        name.resize(chars - 1);
+        ret = true;
+      }
+    }
+  }
+  CloseHandle(file);
+  return ret;
+}
+
+KeyStoreWatcher::Resolver KeyStoreWatcher::SoftResolver(bool machine) {
+  return [machine](const std::wstring &path, std::wstring &name) {
+    bool isMachine = false;
+    return SoftProvider::ContainerOfFile(FileNameOf(path).c_str(),
+                                         isMachine,
+                                         name)
+           && isMachine == machine;
+  };
+}
+
+KeyStoreWatcher::KeyStoreWatcher()
+  : directory_(INVALID_HANDLE_VALUE),
+    event_(nullptr),
+    overlapped_{},
+    buffer_(BufferSize / sizeof(DWORD))
+{}
+
+KeyStoreWatcher::~KeyStoreWatcher() {
+  Release();
+}
+
+void KeyStoreWatcher::Release() {
+  if (directory_ != INVALID_HANDLE_VALUE) {
+    // The buffer must outlive a pending read, so wait for the cancellation.
+    DWORD bytes = 0;
+    if (CancelIoEx(directory_, &overlapped_)
+        || GetLastError() != ERROR_NOT_FOUND) {
+      GetOverlappedResult(directory_, &overlapped_, &bytes, TRUE);
+    }
+    CloseHandle(directory_);
+  }
+  if (event_) {
+    CloseHandle(event_);
+  }
+  directory_ = INVALID_HANDLE_VALUE;
+  event_ = nullptr;
+  overlapped_ = {};
+  files_.clear();
+}
+
+bool KeyStoreWatcher::Open(LPCWSTR directory, const Resolver &resolver) {
+  Release();
+  path_ = directory;
+  resolver_ = resolver;
+
+  directory_ = CreateFile(directory,
+                          FILE_LIST_DIRECTORY,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE
+                            | FILE_SHARE_DELETE,
+                          nullptr,
+                          OPEN_EXISTING,
+                          FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+                          nullptr);
+  if (directory_ == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", directory, GetLastError());
+    return false;
+  }
+  event_ = CreateEvent(nullptr, /*bManualReset*/FALSE, FALSE, nullptr);
+  if (!event_) {
+    Log(L"CreateEvent failed - %08x\n", GetLastError());
+    Release();
+    return false;
+  }
+
+  // Listing the directory after the watch starts means a file created in
+  // between is seen twice rather than not at all.
+  if (!Arm()) {
+    Release();
+    return false;
+  }
+  std::map<std::wstring, ContainerChange::Action> ignored;
+  Rescan(ignored);
+  return true;
+}
+
+void KeyStoreWatcher::Close() {
+  Release();
+}
+
+bool KeyStoreWatcher::IsOpen() const {
+  return directory_ != INVALID_HANDLE_VALUE;
+}
+
+HANDLE KeyStoreWatcher::Event() const {
+  return event_;
+}
+
+void KeyStoreWatcher::Containers(std::vector<std::wstring> &names) const {
+  std::set<std::wstring> unique;
+  for (const auto &it : files_) {
+    unique.insert(it.second);
+  }
+  names.assign(unique.begin(), unique.end());
+}
+
+bool KeyStoreWatcher::Arm() {
+  overlapped_ = {};
+  overlapped_.hEvent = event_;
+  if (!ReadDirectoryChangesW(directory_,
+                             buffer_.data(),
+                             BufferSize,
+                             /*bWatchSubtree*/FALSE,
+                             FILE_NOTIFY_CHANGE_FILE_NAME
+                               | FILE_NOTIFY_CHANGE_LAST_WRITE
+                               | FILE_NOTIFY_CHANGE_SIZE,
+                             nullptr,
+                             &overlapped_,
+                             nullptr)) {
+    Log(L"ReadDirectoryChangesW failed - %08x\n", GetLastError());
+    return false;
+  }
+  return true;
+}
+
+void KeyStoreWatcher::Apply(
+    const std::wstring &file,
+    DWORD action,
+    std::map<std::wstring, ContainerChange::Action> &changes) {
+  auto it = files_.find(file);
+  switch (action) {
+  case FILE_ACTION_REMOVED:
+  case FILE_ACTION_RENAMED_OLD_NAME:
+    if (it != files_.end()) {
+      Merge(changes, it->second, ContainerChange::Removed);
+      files_.erase(it);
+    }
+    break;
+  default:
+    if (it != files_.end()) {
+      Merge(changes, it->second, ContainerChange::Modified);
+      break;
+    }
+    // A file the provider has only begun to write does not resolve yet;
+    // the write that completes it brings another notification.
+    std::wstring name;
+    if (resolver_(path_ + L"\\" + file, name)) {
+      files_[file] = name;
+      Merge(changes, name, ContainerChange::Added);
+    }
+    break;
+  }
+}
+
+void KeyStoreWatcher::Rescan(
+    std::map<std::wstring, ContainerChange::Action> &changes) {
+  std::set<std::wstring> present;
+  WIN32_FIND_DATA data;
+  HANDLE find = FindFirstFile((path_ + L"\\*").c_str(), &data);
+  if (find != INVALID_HANDLE_VALUE) {
+    do {
+      if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        present.insert(data.cFileName);
+      }
+    } while (FindNextFile(find, &data));
+    FindClose(find);
+  }
+
+  for (auto it = files_.begin(); it != files_.end();) {
+    if (present.count(it->first)) {
+      ++it;
+      continue;
+    }
+    Merge(changes, it->second, ContainerChange::Removed);
+    it = files_.erase(it);
+  }
+  // Without the lost notifications there is no telling which of the
+  // remaining files changed, so all of them are reported.
+  for (const auto &file : present) {
+    Apply(file, FILE_ACTION_MODIFIED, changes);
+  }
+}
+
+bool KeyStoreWatcher::Read(std::vector<ContainerChange> &changes) {
+  if (!IsOpen()) return false;
+
+  std::map<std::wstring, ContainerChange::Action> pending;
+  while (HasOverlappedIoCompleted(&overlapped_)) {
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(directory_, &overlapped_, &bytes, FALSE)) {
+      const auto gle = GetLastError();
+      if (gle != ERROR_NOTIFY_ENUM_DIR) {
+        Log(L"ReadDirectoryChangesW failed - %08x\n", gle);
+        Release();
+        return false;
+      }
+      bytes = 0;
+    }
+
+    if (bytes == 0) {
+      // The notifications did not fit into the buffer.
+      Rescan(pending);
+    }
+    else {
+      auto p = reinterpret_cast<LPCBYTE>(buffer_.data());
+      for (;;) {
+        const auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+        Apply(std::wstring(info->FileName,
+                           info->FileNameLength / sizeof(WCHAR)),
+              info->Action,
+              pending);
+        if (info->NextEntryOffset == 0) break;
+        p += info->NextEntryOffset;
+      }
+    }
+
+    // Notifications arriving in between are queued for the next read.
+    if (!Arm()) {
+      Release();
+      return false;
+    }
+  }
+
+  for (const auto &it : pending) {
+    changes.push_back({it.second, it.first});
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+struct ContainerChange {
+  enum Action {
+    Added,
+    Removed,
+    Modified,
+  };
+  Action action;
+  std::wstring name;
+};
+
+// Follows the directory a provider keeps its key files in and turns file
+// notifications into per-container changes, so a container list or a
+// KeyIndex can be patched instead of enumerated again.
+//
+// Providers name key files in their own way, so a resolver maps a file to
+// the container it holds.  CAPI names RSA key files after a hash of the
+// container name and keeps the name itself in the file header, which
+// CapiContainerName reads; SoftProvider encodes the name in the file name.
+// Resolved names are remembered so that a deleted file still maps to its
+// container.  If the notification buffer overflows the directory is listed
+// again and compared with what is remembered, so no change is lost.
+//
+// Open, Read and Close must be called on the same thread.
+class KeyStoreWatcher {
+public:
+  // Returns false for files that do not hold a container, or not yet.
+  typedef std::function<bool(const std::wstring &path, std::wstring &name)>
+    Resolver;
+
+  static constexpr DWORD BufferSize = 64 * 1024;
+
+private:
+  HANDLE directory_;
+  HANDLE event_;
+  OVERLAPPED overlapped_;
+  std::vector<DWORD> buffer_;  // FILE_NOTIFY_INFORMATION is DWORD-aligned
+  std::wstring path_;
+  Resolver resolver_;
+  std::map<std::wstring, std::wstring> files_;  // file -> container
+
+  void Release();
+  bool Arm();
+  void Rescan(std::map<std::wstring, ContainerChange::Action> &changes);
+  void Apply(const std::wstring &file,
+             DWORD action,
+             std::map<std::wstring, ContainerChange::Action> &changes);
+
+public:
+  // The directory the Microsoft RSA providers keep the user's or the
+  // machine's key files in.
+  static bool CapiKeyDirectory(bool machine, std::wstring &directory);
+  static bool CapiContainerName(const std::wstring &path, std::wstring &name);
+  // Files of |directory|'s SoftProvider holding keysets of one scope.
+  static Resolver SoftResolver(bool machine);
+
+  KeyStoreWatcher();
+  ~KeyStoreWatcher();
+
+  // Starts watching and resolves every file already in |directory|.  With
+  // CapiContainerName that reads every key file, so a UI opens it on a
+  // thread other than its own.
+  bool Open(LPCWSTR directory, const Resolver &resolver);
+  void Close();
+  bool IsOpen() const;
+
+  // An auto-reset event signalled when notifications arrive.
+  HANDLE Event() const;
+  // The containers resolved so far, sorted.
+  void Containers(std::vector<std::wstring> &names) const;
+
+  // Appends the changes that arrived since the last call without waiting,
+  // one per container in name order.  A container that came and went in
+  // between is not reported.  Returns false if the directory can no longer
+  // be watched.
+  bool Read(std::vector<ContainerChange> &changes);
+};
@@ -0,0 +1,285 @@
+#include <windows.h>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "provider.h"
+#include "latency.h"
+
+LatencyProfile LatencyProfile::SmartCard() {
+  LatencyProfile profile;
+  profile.latency[LatencyAcquire] = LatencyDistribution(150000, 0.3);
+  profile.latency[LatencyRelease] = LatencyDistribution(1000, 0);
+  profile.latency[LatencyKeyAccess] = LatencyDistribution(30000, 0.2);
+  profile.latency[LatencySign] = LatencyDistribution(150000, 0.25);
+  profile.latency[LatencyRandom] = LatencyDistribution(5000, 0.1);
+  // Hashing and verification run on the host, not on the card.
+  profile.sessions = 1;
+  return profile;
+}
+
+LatencyProfile LatencyProfile::NetworkHsm() {
+  LatencyProfile profile;
+  profile.latency[LatencyAcquire] = LatencyDistribution(40000, 0.5);
+  profile.latency[LatencyRelease] = LatencyDistribution(2000, 0.5);
+  profile.latency[LatencyKeyAccess] = LatencyDistribution(15000, 0.5);
+  profile.latency[LatencySign] = LatencyDistribution(20000, 0.6);
+  profile.latency[LatencyVerify] = LatencyDistribution(2000, 0.5);
+  profile.latency[LatencyRandom] = LatencyDistribution(2000, 0.5);
+  profile.sessions = 8;
+  return profile;
+}
+
+LatencyProfile LatencyProfile::FlakyCard() {
+  LatencyProfile profile = SmartCard();
+  profile.faults.push_back({ 1u << LatencyKeyAccess,
+                             static_cast<DWORD>(NTE_NO_KEY),
+                             0.01 });
+  profile.faults.push_back({ (1u << LatencyAcquire) | (1u << LatencySign),
+                             static_cast<DWORD>(SCARD_W_REMOVED_CARD),
+                             0.01 });
+  return profile;
+}
+
+LatencyProvider::LatencyProvider(CryptoProvider &inner,
+                                 const LatencyProfile &profile)
+  : inner_(inner),
+    profile_(profile),
+    active_(0),
+    random_(profile.seed)
+{}
+
+LatencyMetrics LatencyProvider::GetMetrics() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return metrics_;
+}
+
+DWORD LatencyProvider::Enter(LatencyOperation operation, bool &session) {
+  const auto &distribution = profile_.latency[operation];
+  const auto start = std::chrono::steady_clock::now();
+  DWORD error = ERROR_SUCCESS;
+  DWORD micros = 0;
+  session = distribution.medianMicros != 0;
+  {
+    std::unique_lock<std::mutex> guard(lock_);
+    if (session) {
+      sessionFree_.wait(guard, [this]() {
+        return profile_.sessions == 0 || active_ < profile_.sessions;
+      });
+      ++active_;
+      metrics_.maxConcurrency = max(metrics_.maxConcurrency, active_);
+      metrics_.waitMicros +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+    ++metrics_.calls[operation];
+
+    if (session) {
+      std::normal_distribution<double> normal;
+      micros = static_cast<DWORD>(
+        distribution.medianMicros
+        * std::exp(distribution.sigma * normal(random_)));
+    }
+    std::uniform_real_distribution<double> uniform;
+    for (const auto &fault : profile_.faults) {
+      if ((fault.operations & (1u << operation))
+          && uniform(random_) < fault.probability) {
+        error = fault.error;
+        ++metrics_.faults;
+        break;
+      }
+    }
+    metrics_.delayMicros += micros;
+  }
+
+  // The token stays busy for the whole service time, failed calls included.
+  if (micros) {
+    std::this_thread::sleep_for(std::chrono::microseconds(micros));
+  }
+  return error;
+}
+
+void LatencyProvider::Leave() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    --active_;
+  }
+  sessionFree_.notify_one();
+}
+
+template<class Call>
+BOOL LatencyProvider::Invoke(LatencyOperation operation, Call call) {
+  bool session = false;
+  const DWORD error = Enter(operation, session);
+  BOOL ret = FALSE;
+  if (error == ERROR_SUCCESS) {
+    ret = call();
+  }
+  const DWORD gle = GetLastError();
+  if (session) {
+    Leave();
+  }
+  SetLastError(error == ERROR_SUCCESS ? gle : error);
+  return ret;
+}
+
+BOOL LatencyProvider::AcquireContext(HCRYPTPROV *prov,
+                                     LPCWSTR containerName,
+                                     LPCWSTR providerName,
+                                     DWORD providerType,
+                                     DWORD flags) {
+  return Invoke(LatencyAcquire, [&]() {
+    return inner_.AcquireContext(prov,
+                                 containerName,
+                                 providerName,
+                                 providerType,
+                                 flags);
+  });
+}
+
+BOOL LatencyProvider::ReleaseContext(HCRYPTPROV prov, DWORD flags) {
+  return Invoke(LatencyRelease, [&]() {
+    return inner_.ReleaseContext(prov, flags);
+  });
+}
+
+BOOL LatencyProvider::GetProvParam(HCRYPTPROV prov,
+                                   DWORD param,
+                                   LPBYTE data,
+                                   LPDWORD dataLength,
+                                   DWORD flags) {
+  return Invoke(LatencyKeyAccess, [&]() {
+    return inner_.GetProvParam(prov, param, data, dataLength, flags);
+  });
+}
+
+BOOL LatencyProvider::GenRandom(HCRYPTPROV prov,
+                                DWORD length,
+                                LPBYTE buffer) {
+  return Invoke(LatencyRandom, [&]() {
+    return inner_.GenRandom(prov, length, buffer);
+  });
+}
+
+BOOL LatencyProvider::GenKey(HCRYPTPROV prov,
+                             ALG_ID algo,
+                             DWORD flags,
+                             HCRYPTKEY *key) {
+  return Invoke(LatencyKeyAccess, [&]() {
+    return inner_.GenKey(prov, algo, flags, key);
+  });
+}
+
+BOOL LatencyProvider::GetUserKey(HCRYPTPROV prov,
+                                 DWORD keySpec,
+                                 HCRYPTKEY *key) {
+  return Invoke(LatencyKeyAccess, [&]() {
+    return inner_.GetUserKey(prov, keySpec, key);
+  });
+}
+
+BOOL LatencyProvider::ImportKey(HCRYPTPROV prov,
+                                LPCBYTE data,
+                                DWORD dataLength,
+                                HCRYPTKEY pubKey,
+                                DWORD flags,
+                                HCRYPTKEY *key) {
+  return Invoke(LatencyKeyAccess, [&]() {
+    return inner_.ImportKey(prov, data, dataLength, pubKey, flags, key);
+  });
+}
+
+BOOL LatencyProvider::ExportKey(HCRYPTKEY key,
+                                HCRYPTKEY expKey,
+                                DWORD blobType,
+                                DWORD flags,
+                                LPBYTE data,
+                                LPDWORD dataLength) {
+  // Size queries are answered by the host-side CSP without a round trip.
+  if (!data) {
+    return inner_.ExportKey(key, expKey, blobType, flags, data, dataLength);
+  }
+  return Invoke(LatencyKeyAccess, [&]() {
+    return inner_.ExportKey(key, expKey, blobType, flags, data, dataLength);
+  });
+}
+
+BOOL LatencyProvider::DestroyKey(HCRYPTKEY key) {
+  return Invoke(LatencyRelease, [&]() {
+    return inner_.DestroyKey(key);
+  });
+}
+
+BOOL LatencyProvider::CreateHash(HCRYPTPROV prov,
+                                 ALG_ID algo,
+                                 HCRYPTKEY key,
+                                 DWORD flags,
+                                 HCRYPTHASH *hash) {
+  return Invoke(LatencyHash, [&]() {
+    return inner_.CreateHash(prov, algo, key, flags, hash);
+  });
+}
+
+BOOL LatencyProvider::HashData(HCRYPTHASH hash,
+                               LPCBYTE data,
+                               DWORD dataLength,
+                               DWORD flags) {
+  return Invoke(LatencyHash, [&]() {
+    return inner_.HashData(hash, data, dataLength, flags);
+  });
+}
+
+BOOL LatencyProvider::GetHashParam(HCRYPTHASH hash,
+                                   DWORD param,
+                                   LPBYTE data,
+                                   LPDWORD dataLength,
+                                   DWORD flags) {
+  return Invoke(LatencyHash, [&]() {
+    return inner_.GetHashParam(hash, param, data, dataLength, flags);
+  });
+}
+
+BOOL LatencyProvider::SetHashParam(HCRYPTHASH hash,
+                                   DWORD param,
+                                   LPCBYTE data,
+                                   DWORD flags) {
+  return Invoke(LatencyHash, [&]() {
+    return inner_.SetHashParam(hash, param, data, flags);
+  });
+}
+
+BOOL LatencyProvider::DestroyHash(HCRYPTHASH hash) {
+  return Invoke(LatencyRelease, [&]() {
+    return inner_.DestroyHash(hash);
+  });
+}
+
+BOOL LatencyProvider::SignHash(HCRYPTHASH hash,
+                               DWORD keySpec,
+                               DWORD flags,
+                               LPBYTE signature,
+                               LPDWORD signatureLength) {
+  if (!signature) {
+    return inner_.SignHash(hash, keySpec, flags, signature, signatureLength);
+  }
+  return Invoke(LatencySign, [&]() {
+    return inner_.SignHash(hash, keySpec, flags, signature, signatureLength);
+  });
+}
+
+BOOL LatencyProvider::VerifySignature(HCRYPTHASH hash,
+                                      LPCBYTE signature,
+                                      DWORD signatureLength,
+                                      HCRYPTKEY pubKey,
+                                      DWORD flags) {
+  return Invoke(LatencyVerify, [&]() {
+    return inner_.VerifySignature(hash,
+                                  signature,
+                                  signatureLength,
+                                  pubKey,
+                                  flags);
+  });
+}
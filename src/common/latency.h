@@ -0,0 +1,152 @@
+// Operations a LatencyProfile can slow down or fail, grouped the way a token
+// sees them.
+enum LatencyOperation {
+  LatencyAcquire,    // AcquireContext
+  LatencyRelease,    // ReleaseContext, DestroyKey, DestroyHash
+  LatencyKeyAccess,  // GenKey, GetUserKey, ImportKey, ExportKey, GetProvParam
+  LatencyHash,       // CreateHash, HashData, Get/SetHashParam
+  LatencySign,       // SignHash
+  LatencyVerify,     // VerifySignature
+  LatencyRandom,     // GenRandom
+  LatencyOperationCount,
+};
+
+// Log-normal service time: half of the calls take less than |median|, and
+// |sigma| sets how heavy the tail is (0 makes every call take |median|).
+struct LatencyDistribution {
+  DWORD medianMicros;
+  double sigma;
+
+  LatencyDistribution() : medianMicros(0), sigma(0) {}
+  LatencyDistribution(DWORD median, double spread)
+    : medianMicros(median), sigma(spread)
+  {}
+};
+
+// Fails a fraction of the calls to the operations in |operations|, a mask of
+// 1 << LatencyOperation, with |error| after the usual service time.
+struct LatencyFault {
+  DWORD operations;
+  DWORD error;
+  double probability;
+};
+
+struct LatencyProfile {
+  LatencyDistribution latency[LatencyOperationCount];
+  DWORD sessions;  // calls the token serves at once; 0 for no limit
+  std::vector<LatencyFault> faults;
+  ULONGLONG seed;
+
+  LatencyProfile() : sessions(0), seed(0) {}
+
+  // A USB smart card: one session, 100-300 ms per private key operation.
+  static LatencyProfile SmartCard();
+  // A network HSM: a few sessions, ~20 ms round trips with a long tail.
+  static LatencyProfile NetworkHsm();
+  // SmartCard() with 1% NTE_NO_KEY on key access and 1% card removals.
+  static LatencyProfile FlakyCard();
+};
+
+struct LatencyMetrics {
+  ULONGLONG calls[LatencyOperationCount];
+  ULONGLONG faults;
+  ULONGLONG delayMicros;    // injected service time
+  ULONGLONG waitMicros;     // time spent waiting for a free session
+  DWORD maxConcurrency;
+
+  LatencyMetrics()
+    : calls(), faults(0), delayMicros(0), waitMicros(0), maxConcurrency(0)
+  {}
+};
+
+// Wraps another CryptoProvider and makes it behave like a slow token: a call
+// waits for a free session, holds it for a sampled service time, and then
+// either fails with an injected error or forwards to |inner|.  Operations
+// with no service time run on the host and do not take a session.  Size
+// queries (a null output buffer) are always forwarded directly.  Handles
+// are the inner provider's.
+class LatencyProvider : public CryptoProvider {
+private:
+  CryptoProvider &inner_;
+  const LatencyProfile profile_;
+
+  std::mutex lock_;
+  std::condition_variable sessionFree_;
+  DWORD active_;
+  std::mt19937_64 random_;
+  LatencyMetrics metrics_;
+
+  // Takes a session and sleeps, unless |operation| has no service time.
+  // Returns the injected error, or ERROR_SUCCESS if the call should go
+  // through.  |session| tells whether Leave() must be called.
+  DWORD Enter(LatencyOperation operation, bool &session);
+  void Leave();
+
+  template<class Call>
+  BOOL Invoke(LatencyOperation operation, Call call);
+
+public:
+  LatencyProvider(CryptoProvider &inner, const LatencyProfile &profile);
+
+  LatencyMetrics GetMetrics();
+
+  BOOL AcquireContext(HCRYPTPROV *prov,
+                      LPCWSTR containerName,
+                      LPCWSTR providerName,
+                      DWORD providerType,
+                      DWORD flags) override;
+  BOOL ReleaseContext(HCRYPTPROV prov, DWORD flags) override;
+  BOOL GetProvParam(HCRYPTPROV prov,
+                    DWORD param,
+                    LPBYTE data,
+                    LPDWORD dataLength,
+                    DWORD flags) override;
+  BOOL GenRandom(HCRYPTPROV prov, DWORD length, LPBYTE buffer) override;
+  BOOL GenKey(HCRYPTPROV prov,
+              ALG_ID algo,
+              DWORD flags,
+              HCRYPTKEY *key) override;
+  BOOL GetUserKey(HCRYPTPROV prov, DWORD keySpec, HCRYPTKEY *key) override;
+  BOOL ImportKey(HCRYPTPROV prov,
+                 LPCBYTE data,
+                 DWORD dataLength,
+                 HCRYPTKEY pubKey,
+                 DWORD flags,
+                 HCRYPTKEY *key) override;
+  BOOL ExportKey(HCRYPTKEY key,
+                 HCRYPTKEY expKey,
+                 DWORD blobType,
+                 DWORD flags,
+                 LPBYTE data,
+                 LPDWORD dataLength) override;
+  BOOL DestroyKey(HCRYPTKEY key) override;
+  BOOL CreateHash(HCRYPTPROV prov,
+                  ALG_ID algo,
+                  HCRYPTKEY key,
+                  DWORD flags,
+                  HCRYPTHASH *hash) override;
+  BOOL HashData(HCRYPTHASH hash,
+                LPCBYTE data,
+                DWORD dataLength,
+                DWORD flags) override;
+  BOOL GetHashParam(HCRYPTHASH hash,
+                    DWORD param,
+                    LPBYTE data,
+                    LPDWORD dataLength,
+                    DWORD flags) override;
+  BOOL SetHashParam(HCRYPTHASH hash,
+                    DWORD param,
+                    LPCBYTE data,
+                    DWORD flags) override;
+  BOOL DestroyHash(HCRYPTHASH hash) override;
+  BOOL SignHash(HCRYPTHASH hash,
+                DWORD keySpec,
+                DWORD flags,
+                LPBYTE signature,
+                LPDWORD signatureLength) override;
+  BOOL VerifySignature(HCRYPTHASH hash,
+                       LPCBYTE signature,
+                       DWORD signatureLength,
+                       HCRYPTKEY pubKey,
+                       DWORD flags) override;
+};
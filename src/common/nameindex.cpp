@@ -0,0 +1,340 @@
+#include <windows.h>
+#include <algorithm>
+#include <execution>
+#include <vector>
+#include <wchar.h>
+#if (defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)) \
+    && WCHAR_MAX == 0xffff
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define NAMEINDEX_SSE2
+#endif
+#include "nameindex.h"
+
+static inline WCHAR Fold(WCHAR c) {
+  return (c >= L'A' && c <= L'Z') ? static_cast<WCHAR>(c + (L'a' - L'A')) : c;
+}
+
+static int CompareFolded(LPCWSTR a, DWORD alen, LPCWSTR b, DWORD blen) {
+  const DWORD n = min(alen, blen);
+  for (DWORD i = 0; i < n; ++i) {
+    const WCHAR x = Fold(a[i]), y = Fold(b[i]);
+    if (x != y) return x < y ? -1 : 1;
+  }
+  return alen == blen ? 0 : alen < blen ? -1 : 1;
+}
+
+// The sort order: case-folded first, then exact so that names differing
+// only in case still have a fixed order.
+static int CompareNames(LPCWSTR a, DWORD alen, LPCWSTR b, DWORD blen) {
+  const int c = CompareFolded(a, alen, b, blen);
+  return c ? c : wcsncmp(a, b, alen);
+}
+
+static bool EqualFolded(LPCWSTR a, LPCWSTR b, DWORD length) {
+  for (DWORD i = 0; i < length; ++i) {
+    if (Fold(a[i]) != Fold(b[i])) return false;
+  }
+  return true;
+}
+
+NameIndex::NameIndex() : used_(0), garbage_(0), sorted_(true) {}
+
+void NameIndex::Clear() {
+  buffer_.clear();
+  entries_.clear();
+  slots_.clear();
+  byOffset_.clear();
+  used_ = 0;
+  garbage_ = 0;
+  sorted_ = true;
+}
+
+void NameIndex::Reserve(size_t names, size_t chars) {
+  buffer_.reserve(chars + names);
+  entries_.reserve(names);
+  if (names * 2 > slots_.size()) {
+    Rehash(names * 2);
+  }
+}
+
+DWORD NameIndex::HashOf(LPCWSTR s, DWORD length) {
+  // FNV-1a
+  DWORD h = 2166136261u;
+  for (DWORD i = 0; i < length; ++i) {
+    h = (h ^ s[i]) * 16777619u;
+  }
+  return h;
+}
+
+DWORD *NameIndex::FindSlot(LPCWSTR s, DWORD length) {
+  const size_t mask = slots_.size() - 1;
+  for (size_t i = HashOf(s, length) & mask;; i = (i + 1) & mask) {
+    DWORD &slot = slots_[i];
+    if (slot == 0) return &slot;
+
+    LPCWSTR candidate = &buffer_[slot - 1];
+    if (wcsncmp(candidate, s, length) == 0 && candidate[length] == 0) {
+      return &slot;
+    }
+  }
+}
+
+void NameIndex::Rehash(size_t slotCount) {
+  size_t size = 16;
+  while (size < slotCount) size <<= 1;
+  slots_.assign(size, 0);
+  for (const auto &it : entries_) {
+    *FindSlot(&buffer_[it.offset], it.length) = it.offset + 1;
+  }
+}
+
+bool NameIndex::Intern(DWORD offset, DWORD length) {
+  // |buffer_| already holds the candidate at |offset|.  Keep it only if it
+  // is new; otherwise roll the buffer back.
+  if ((used_ + 1) * 2 > slots_.size()) {
+    Rehash(max(slots_.size() * 2, size_t(16)));
+  }
+  DWORD *slot = FindSlot(&buffer_[offset], length);
+  if (*slot) {
+    buffer_.resize(offset);
+    return false;
+  }
+  *slot = offset + 1;
+  ++used_;
+  entries_.push_back({offset, length});
+  sorted_ = false;
+  return true;
+}
+
+bool NameIndex::Add(LPCWSTR name, DWORD length) {
+  const auto offset = static_cast<DWORD>(buffer_.size());
+  buffer_.insert(buffer_.end(), name, name + length);
+  buffer_.push_back(0);
+  return Intern(offset, length);
+}
+
+bool NameIndex::AddMultiByte(LPCSTR name, UINT codePage) {
+  // Convert straight into the buffer instead of through a stack copy.
+  const int chars = MultiByteToWideChar(codePage, 0, name, -1, nullptr, 0);
+  if (chars <= 0) return false;
+
+  const auto offset = static_cast<DWORD>(buffer_.size());
+  buffer_.resize(offset + chars);
+  if (MultiByteToWideChar(codePage,
+                          0,
+                          name,
+                          -1,
+                          &buffer_[offset],
+                          chars) != chars) {
+    buffer_.resize(offset);
+    return false;
+  }
+  return Intern(offset, static_cast<DWORD>(chars - 1));
+}
+
+void NameIndex::Sort() {
+  if (sorted_) return;
+
+  const WCHAR *base = buffer_.data();
+  std::sort(std::execution::par,
+            entries_.begin(),
+            entries_.end(),
+            [base](const Entry &a, const Entry &b) {
+              return CompareNames(base + a.offset, a.length,
+                                  base + b.offset, b.length) < 0;
+            });
+  byOffset_.resize(entries_.size());
+  for (DWORD i = 0; i < entries_.size(); ++i) {
+    byOffset_[i] = std::make_pair(entries_[i].offset, i);
+  }
+  std::sort(byOffset_.begin(), byOffset_.end());
+  sorted_ = true;
+}
+
+bool NameIndex::Find(LPCWSTR name, DWORD length, DWORD &index) const {
+  const WCHAR *base = buffer_.data();
+  auto it = std::lower_bound(
+    entries_.begin(), entries_.end(), name,
+    [base, length](const Entry &e, LPCWSTR p) {
+      return CompareNames(base + e.offset, e.length, p, length) < 0;
+    });
+  index = static_cast<DWORD>(it - entries_.begin());
+  return it != entries_.end()
+         && CompareNames(base + it->offset, it->length, name, length) == 0;
+}
+
+bool NameIndex::Insert(LPCWSTR name, DWORD length, DWORD &index) {
+  Sort();
+  if (!Add(name, length)) {
+    Find(name, length, index);
+    return false;
+  }
+
+  // Add appended the entry; rotate it into place instead of sorting again.
+  const WCHAR *base = buffer_.data();
+  const Entry added = entries_.back();
+  auto it = std::upper_bound(
+    entries_.begin(), entries_.end() - 1, added,
+    [base](const Entry &a, const Entry &b) {
+      return CompareNames(base + a.offset, a.length,
+                          base + b.offset, b.length) < 0;
+    });
+  std::rotate(it, entries_.end() - 1, entries_.end());
+  index = static_cast<DWORD>(it - entries_.begin());
+  // The new name is last in the buffer and shifts the names after it.
+  for (auto &position : byOffset_) {
+    if (position.second >= index) ++position.second;
+  }
+  byOffset_.push_back(std::make_pair(added.offset, index));
+  sorted_ = true;
+  return true;
+}
+
+bool NameIndex::Remove(DWORD index) {
+  if (!sorted_ || index >= entries_.size()) return false;
+
+  const Entry removed = entries_[index];
+  DWORD *slot = FindSlot(&buffer_[removed.offset], removed.length);
+
+  // Backward-shift deletion: pull later entries of the probe sequence into
+  // the hole, so lookups never need tombstones.
+  const size_t mask = slots_.size() - 1;
+  size_t hole = slot - slots_.data();
+  for (size_t i = (hole + 1) & mask; slots_[i]; i = (i + 1) & mask) {
+    LPCWSTR s = &buffer_[slots_[i] - 1];
+    const size_t home = HashOf(s, static_cast<DWORD>(wcslen(s))) & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      slots_[hole] = slots_[i];
+      hole = i;
+    }
+  }
+  slots_[hole] = 0;
+
+  // Zeroed chars never match a pattern, so FindSubstring can still scan
+  // the buffer as a whole.
+  std::fill(buffer_.begin() + removed.offset,
+            buffer_.begin() + removed.offset + removed.length,
+            L'\0');
+  garbage_ += removed.length + 1;
+  entries_.erase(entries_.begin() + index);
+  byOffset_.erase(std::lower_bound(byOffset_.begin(),
+                                   byOffset_.end(),
+                                   std::make_pair(removed.offset, DWORD(0))));
+  for (auto &position : byOffset_) {
+    if (position.second > index) --position.second;
+  }
+  --used_;
+  if (garbage_ * 2 > buffer_.size()) {
+    Compact();
+  }
+  return true;
+}
+
+void NameIndex::Compact() {
+  std::vector<WCHAR> buffer;
+  buffer.reserve(buffer_.size() - garbage_);
+  for (auto &it : entries_) {
+    const auto offset = static_cast<DWORD>(buffer.size());
+    buffer.insert(buffer.end(),
+                  buffer_.begin() + it.offset,
+                  buffer_.begin() + it.offset + it.length + 1);
+    it.offset = offset;
+  }
+  buffer_.swap(buffer);
+  garbage_ = 0;
+  // Copied in sorted order, so offsets now ascend with position.
+  for (DWORD i = 0; i < entries_.size(); ++i) {
+    byOffset_[i] = std::make_pair(entries_[i].offset, i);
+  }
+  Rehash(slots_.size());
+}
+
+DWORD NameIndex::Size() const {
+  return static_cast<DWORD>(entries_.size());
+}
+
+LPCWSTR NameIndex::Get(DWORD index) const {
+  return index < entries_.size() ? &buffer_[entries_[index].offset] : nullptr;
+}
+
+DWORD NameIndex::Length(DWORD index) const {
+  return index < entries_.size() ? entries_[index].length : 0;
+}
+
+size_t NameIndex::MemoryUsage() const {
+  return buffer_.capacity() * sizeof(WCHAR)
+         + entries_.capacity() * sizeof(Entry)
+         + slots_.capacity() * sizeof(DWORD);
+}
+
+void NameIndex::FindSubstring(LPCWSTR pattern,
+                              std::vector<DWORD> &matches) const {
+  const DWORD length = static_cast<DWORD>(wcslen(pattern));
+  if (length == 0) {
+    for (DWORD i = 0; i < Size(); ++i) matches.push_back(i);
+    return;
+  }
+
+  if (!sorted_) return;
+
+  std::vector<bool> hit(entries_.size(), false);
+  const WCHAR *base = buffer_.data();
+  const size_t total = buffer_.size();
+  const WCHAR lo = Fold(pattern[0]);
+  const WCHAR hi = (lo >= L'a' && lo <= L'z')
+                   ? static_cast<WCHAR>(lo - (L'a' - L'A'))
+                   : lo;
+  size_t cursor = 0;  // index into byOffset_ for the current position
+
+  auto check = [&](size_t pos) {
+    if (pos + length > total || !EqualFolded(base + pos, pattern, length))
+      return;
+    while (cursor + 1 < byOffset_.size()
+           && byOffset_[cursor + 1].first <= pos) {
+      ++cursor;
+    }
+    hit[byOffset_[cursor].second] = true;
+  };
+
+  size_t pos = 0;
+#ifdef NAMEINDEX_SSE2
+  const __m128i vlo = _mm_set1_epi16(static_cast<short>(lo));
+  const __m128i vhi = _mm_set1_epi16(static_cast<short>(hi));
+  for (; pos + 8 <= total; pos += 8) {
+    const __m128i chunk =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + pos));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(chunk, vlo),
+                                              _mm_cmpeq_epi16(chunk, vhi)));
+    while (mask) {
+      unsigned long bit;
+#ifdef _MSC_VER
+      _BitScanForward(&bit, mask);
+#else
+      bit = __builtin_ctz(mask);
+#endif
+      check(pos + bit / 2);
+      mask &= ~(3 << bit);
+    }
+  }
+#endif
+  for (; pos < total; ++pos) {
+    if (base[pos] == lo || base[pos] == hi) check(pos);
+  }
+
+  for (DWORD i = 0; i < hit.size(); ++i) {
+    if (hit[i]) matches.push_back(i);
+  }
+}
+
+bool NameIndex::Contains(DWORD index, LPCWSTR pattern) const {
+  if (index >= entries_.size()) return false;
+  const DWORD length = static_cast<DWORD>(wcslen(pattern));
+  const auto &entry = entries_[index];
+  for (DWORD i = 0; i + length <= entry.length; ++i) {
+    if (EqualFolded(&buffer_[entry.offset + i], pattern, length)) return true;
+  }
+  return false;
+}
@@ -0,0 +1,60 @@
+// A set of interned strings stored back to back in one buffer.  Entries are
+// referred to by their position in sorted order once Sort() is called.
+//
+// Sorting and matching fold ASCII case, and a substring filter is one SIMD
+// scan over the whole buffer.
+// Insert and Remove keep a sorted index sorted so that a list built from
+// it can be patched in place; removed names are zeroed out and their space
+// reclaimed once it makes up half of the buffer.
+class NameIndex {
+private:
+  struct Entry {
+    DWORD offset;
+    DWORD length;
+  };
+
+  std::vector<WCHAR> buffer_;
+  std::vector<Entry> entries_;
+  std::vector<DWORD> slots_;  // open addressing, entry offset + 1
+  // (offset, sorted position) by ascending offset, for FindSubstring to
+  // map a hit in |buffer_| back to its entry.  Kept while sorted.
+  std::vector<std::pair<DWORD, DWORD>> byOffset_;
+  DWORD used_;
+  DWORD garbage_;  // chars of removed names still in |buffer_|
+  bool sorted_;
+
+  static DWORD HashOf(LPCWSTR s, DWORD length);
+  DWORD *FindSlot(LPCWSTR s, DWORD length);
+  void Rehash(size_t slotCount);
+  bool Intern(DWORD offset, DWORD length);
+  void Compact();
+
+public:
+  NameIndex();
+
+  void Clear();
+  void Reserve(size_t names, size_t chars);
+
+  // Both return false if |name| was already in the index.
+  bool Add(LPCWSTR name, DWORD length);
+  bool AddMultiByte(LPCSTR name, UINT codePage);
+
+  void Sort();
+
+  // These require a sorted index and take sorted positions.  Insert
+  // returns false if |name| was already there, with |index| pointing at it.
+  bool Find(LPCWSTR name, DWORD length, DWORD &index) const;
+  bool Insert(LPCWSTR name, DWORD length, DWORD &index);
+  bool Remove(DWORD index);
+
+  DWORD Size() const;
+  LPCWSTR Get(DWORD index) const;
+  DWORD Length(DWORD index) const;
+  size_t MemoryUsage() const;
+
+  // Appends the indices of entries containing |pattern| in sorted order.
+  // An empty pattern matches everything.  Requires a sorted index.
+  void FindSubstring(LPCWSTR pattern, std::vector<DWORD> &matches) const;
+  // The FindSubstring test for a single entry.
+  bool Contains(DWORD index, LPCWSTR pattern) const;
+};
@@ -0,0 +1,146 @@
+#include <windows.h>
+#include <atomic>
+#include "provider.h"
+
+namespace {
+
+CapiProvider &Native() {
+  static CapiProvider capi;
+  return capi;
+}
+
+std::atomic<CryptoProvider*> installed(nullptr);
+
+}  // namespace
+
+CryptoProvider &CryptoProvider::Current() {
+  CryptoProvider *provider = installed.load(std::memory_order_acquire);
+  return provider ? *provider : Native();
+}
+
+CryptoProvider *CryptoProvider::Install(CryptoProvider *provider) {
+  return installed.exchange(provider, std::memory_order_acq_rel);
+}
+
+BOOL CapiProvider::AcquireContext(HCRYPTPROV *prov,
+                                  LPCWSTR containerName,
+                                  LPCWSTR providerName,
+                                  DWORD providerType,
+                                  DWORD flags) {
+  return CryptAcquireContext(prov,
+                             containerName,
+                             providerName,
+                             providerType,
+                             flags);
+}
+
+BOOL CapiProvider::ReleaseContext(HCRYPTPROV prov, DWORD flags) {
+  return CryptReleaseContext(prov, flags);
+}
+
+BOOL CapiProvider::GetProvParam(HCRYPTPROV prov,
+                                DWORD param,
+                                LPBYTE data,
+                                LPDWORD dataLength,
+                                DWORD flags) {
+  return CryptGetProvParam(prov, param, data, dataLength, flags);
+}
+
+BOOL CapiProvider::GenRandom(HCRYPTPROV prov, DWORD length, LPBYTE buffer) {
+  return CryptGenRandom(prov, length, buffer);
+}
+
+BOOL CapiProvider::GenKey(HCRYPTPROV prov,
+                          ALG_ID algo,
+                          DWORD flags,
+                          HCRYPTKEY *key) {
+  return CryptGenKey(prov, algo, flags, key);
+}
+
+BOOL CapiProvider::GetUserKey(HCRYPTPROV prov,
+                              DWORD keySpec,
+                              HCRYPTKEY *key) {
+  return CryptGetUserKey(prov, keySpec, key);
+}
+
+BOOL CapiProvider::ImportKey(HCRYPTPROV prov,
+                             LPCBYTE data,
+                             DWORD dataLength,
+                             HCRYPTKEY pubKey,
+                             DWORD flags,
+                             HCRYPTKEY *key) {
+  return CryptImportKey(prov, data, dataLength, pubKey, flags, key);
+}
+
+BOOL CapiProvider::ExportKey(HCRYPTKEY key,
+                             HCRYPTKEY expKey,
+                             DWORD blobType,
+                             DWORD flags,
+                             LPBYTE data,
+                             LPDWORD dataLength) {
+  return CryptExportKey(key, expKey, blobType, flags, data, dataLength);
+}
+
+BOOL CapiProvider::DestroyKey(HCRYPTKEY key) {
+  return CryptDestroyKey(key);
+}
+
+BOOL CapiProvider::CreateHash(HCRYPTPROV prov,
+                              ALG_ID algo,
+                              HCRYPTKEY key,
+                              DWORD flags,
+                              HCRYPTHASH *hash) {
+  return CryptCreateHash(prov, algo, key, flags, hash);
+}
+
+BOOL CapiProvider::HashData(HCRYPTHASH hash,
+                            LPCBYTE data,
+                            DWORD dataLength,
+                            DWORD flags) {
+  return CryptHashData(hash, data, dataLength, flags);
+}
+
+BOOL CapiProvider::GetHashParam(HCRYPTHASH hash,
+                                DWORD param,
+                                LPBYTE data,
+                                LPDWORD dataLength,
+                                DWORD flags) {
+  return CryptGetHashParam(hash, param, data, dataLength, flags);
+}
+
+BOOL CapiProvider::SetHashParam(HCRYPTHASH hash,
+                                DWORD param,
+                                LPCBYTE data,
+                                DWORD flags) {
+  return CryptSetHashParam(hash, param, data, flags);
+}
+
+BOOL CapiProvider::DestroyHash(HCRYPTHASH hash) {
+  return CryptDestroyHash(hash);
+}
+
+BOOL CapiProvider::SignHash(HCRYPTHASH hash,
+                            DWORD keySpec,
+                            DWORD flags,
+                            LPBYTE signature,
+                            LPDWORD signatureLength) {
+  return CryptSignHash(hash,
+                       keySpec,
+                       nullptr,
+                       flags,
+                       signature,
+                       signatureLength);
+}
+
+BOOL CapiProvider::VerifySignature(HCRYPTHASH hash,
+                                   LPCBYTE signature,
+                                   DWORD signatureLength,
+                                   HCRYPTKEY pubKey,
+                                   DWORD flags) {
+  return CryptVerifySignature(hash,
+                              signature,
+                              signatureLength,
+                              pubKey,
+                              nullptr,
+                              flags);
+}
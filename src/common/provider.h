@@ -0,0 +1,142 @@
+// The CryptoAPI entry points used by CSP, Key and Hash, behind an interface
+// so that a software backend can stand in for a real CSP.  Every method has
+// the contract of the Crypt* function of the same name: it returns FALSE
+// and sets the last error on failure.
+class CryptoProvider {
+public:
+  virtual ~CryptoProvider() {}
+
+  virtual BOOL AcquireContext(HCRYPTPROV *prov,
+                              LPCWSTR containerName,
+                              LPCWSTR providerName,
+                              DWORD providerType,
+                              DWORD flags) = 0;
+  virtual BOOL ReleaseContext(HCRYPTPROV prov, DWORD flags) = 0;
+  virtual BOOL GetProvParam(HCRYPTPROV prov,
+                            DWORD param,
+                            LPBYTE data,
+                            LPDWORD dataLength,
+                            DWORD flags) = 0;
+  virtual BOOL GenRandom(HCRYPTPROV prov, DWORD length, LPBYTE buffer) = 0;
+
+  virtual BOOL GenKey(HCRYPTPROV prov,
+                      ALG_ID algo,
+                      DWORD flags,
+                      HCRYPTKEY *key) = 0;
+  virtual BOOL GetUserKey(HCRYPTPROV prov, DWORD keySpec, HCRYPTKEY *key) = 0;
+  virtual BOOL ImportKey(HCRYPTPROV prov,
+                         LPCBYTE data,
+                         DWORD dataLength,
+                         HCRYPTKEY pubKey,
+                         DWORD flags,
+                         HCRYPTKEY *key) = 0;
+  virtual BOOL ExportKey(HCRYPTKEY key,
+                         HCRYPTKEY expKey,
+                         DWORD blobType,
+                         DWORD flags,
+                         LPBYTE data,
+                         LPDWORD dataLength) = 0;
+  virtual BOOL DestroyKey(HCRYPTKEY key) = 0;
+
+  virtual BOOL CreateHash(HCRYPTPROV prov,
+                          ALG_ID algo,
+                          HCRYPTKEY key,
+                          DWORD flags,
+                          HCRYPTHASH *hash) = 0;
+  virtual BOOL HashData(HCRYPTHASH hash,
+                        LPCBYTE data,
+                        DWORD dataLength,
+                        DWORD flags) = 0;
+  virtual BOOL GetHashParam(HCRYPTHASH hash,
+                            DWORD param,
+                            LPBYTE data,
+                            LPDWORD dataLength,
+                            DWORD flags) = 0;
+  virtual BOOL SetHashParam(HCRYPTHASH hash,
+                            DWORD param,
+                            LPCBYTE data,
+                            DWORD flags) = 0;
+  virtual BOOL DestroyHash(HCRYPTHASH hash) = 0;
+  virtual BOOL SignHash(HCRYPTHASH hash,
+                        DWORD keySpec,
+                        DWORD flags,
+                        LPBYTE signature,
+                        LPDWORD signatureLength) = 0;
+  virtual BOOL VerifySignature(HCRYPTHASH hash,
+                               LPCBYTE signature,
+                               DWORD signatureLength,
+                               HCRYPTKEY pubKey,
+                               DWORD flags) = 0;
+
+  // The provider every wrapper class calls.  CapiProvider unless another
+  // one has been installed.
+  static CryptoProvider &Current();
+  // Returns the previously installed provider, or nullptr for CapiProvider.
+  // Handles are not portable between providers, so install one at startup
+  // before any handle is opened, and pass nullptr to go back to CryptoAPI.
+  static CryptoProvider *Install(CryptoProvider *provider);
+};
+
+// Forwards every call to CryptoAPI.
+class CapiProvider : public CryptoProvider {
+public:
+  BOOL AcquireContext(HCRYPTPROV *prov,
+                      LPCWSTR containerName,
+                      LPCWSTR providerName,
+                      DWORD providerType,
+                      DWORD flags) override;
+  BOOL ReleaseContext(HCRYPTPROV prov, DWORD flags) override;
+  BOOL GetProvParam(HCRYPTPROV prov,
+                    DWORD param,
+                    LPBYTE data,
+                    LPDWORD dataLength,
+                    DWORD flags) override;
+  BOOL GenRandom(HCRYPTPROV prov, DWORD length, LPBYTE buffer) override;
+  BOOL GenKey(HCRYPTPROV prov,
+              ALG_ID algo,
+              DWORD flags,
+              HCRYPTKEY *key) override;
+  BOOL GetUserKey(HCRYPTPROV prov, DWORD keySpec, HCRYPTKEY *key) override;
+  BOOL ImportKey(HCRYPTPROV prov,
+                 LPCBYTE data,
+                 DWORD dataLength,
+                 HCRYPTKEY pubKey,
+                 DWORD flags,
+                 HCRYPTKEY *key) override;
+  BOOL ExportKey(HCRYPTKEY key,
+                 HCRYPTKEY expKey,
+                 DWORD blobType,
+                 DWORD flags,
+                 LPBYTE data,
+                 LPDWORD dataLength) override;
+  BOOL DestroyKey(HCRYPTKEY key) override;
+  BOOL CreateHash(HCRYPTPROV prov,
+                  ALG_ID algo,
+                  HCRYPTKEY key,
+                  DWORD flags,
+                  HCRYPTHASH *hash) override;
+  BOOL HashData(HCRYPTHASH hash,
+                LPCBYTE data,
+                DWORD dataLength,
+                DWORD flags) override;
+  BOOL GetHashParam(HCRYPTHASH hash,
+                    DWORD param,
+                    LPBYTE data,
+                    LPDWORD dataLength,
+                    DWORD flags) override;
+  BOOL SetHashParam(HCRYPTHASH hash,
+                    DWORD param,
+                    LPCBYTE data,
+                    DWORD flags) override;
+  BOOL DestroyHash(HCRYPTHASH hash) override;
+  BOOL SignHash(HCRYPTHASH hash,
+                DWORD keySpec,
+                DWORD flags,
+                LPBYTE signature,
+                LPDWORD signatureLength) override;
+  BOOL VerifySignature(HCRYPTHASH hash,
+                       LPCBYTE signature,
+                       DWORD signatureLength,
+                       HCRYPTKEY pubKey,
+                       DWORD flags) override;
+};
@@ -0,0 +1,168 @@
+#include <windows.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <vector>
+#include "blob.h"
+#include "csp.h"
+#include "hash.h"
+#include "key.h"
+#include "keyindex.h"
+#include "provision.h"
+
+void Log(LPCWSTR Format, ...);
+
+KeyProvisioner::KeyProvisioner(const ProvisionConfig &config)
+  : config_(config)
+{}
+
+ULONGLONG KeyProvisioner::ElapsedMicros() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start_).count();
+}
+
+DWORD KeyProvisioner::Provision(LPCWSTR name,
+                                KeyIndex *index,
+                                std::mutex &indexLock,
+                                DWORD &keys) {
+  LPCWSTR provider =
+    config_.provider.empty() ? nullptr : config_.provider.c_str();
+  keys = 0;
+
+  CSP csp;
+  if (!csp.Acquire(name,
+                   provider,
+                   config_.providerType,
+                   config_.flags | CRYPT_NEWKEYSET)) {
+    const DWORD status = GetLastError();
+    Log(L"CryptAcquireContext(%s) failed - %08x\n", name, status);
+    return status;
+  }
+
+  const DWORD genFlags =
+    (config_.keyBits << 16) | (config_.exportable ? CRYPT_EXPORTABLE : 0);
+  const DWORD keySpecs[] = {AT_KEYEXCHANGE, AT_SIGNATURE};
+  Blob publicKeys[ARRAYSIZE(keySpecs)];
+  DWORD status = ERROR_SUCCESS;
+  for (size_t i = 0; i < ARRAYSIZE(keySpecs); ++i) {
+    const DWORD keySpec = keySpecs[i];
+    if ((keySpec == AT_SIGNATURE && !config_.signature)
+        || (keySpec == AT_KEYEXCHANGE && !config_.exchange)) {
+      continue;
+    }
+    Key key(csp.GenKey(keySpec, genFlags));
+    if (!key) {
+      status = GetLastError();
+      Log(L"CryptGenKey(%s) failed - %08x\n", name, status);
+      break;
+    }
+    if (index) {
+      publicKeys[i] = key.Export(PUBLICKEYBLOB);
+      if (publicKeys[i].Size() == 0) {
+        status = GetLastError();
+        break;
+      }
+    }
+    ++keys;
+  }
+
+  if (status != ERROR_SUCCESS) {
+    CSP deleted;
+    deleted.Acquire(name,
+                    provider,
+                    config_.providerType,
+                    config_.flags | CRYPT_DELETEKEYSET);
+    keys = 0;
+    return status;
+  }
+
+  if (index) {
+    std::lock_guard<std::mutex> guard(indexLock);
+    const DWORD container = index->AddContainer(name,
+                                                provider ? provider : L"",
+                                                config_.providerType,
+                                                config_.flags);
+    for (size_t i = 0; i < ARRAYSIZE(keySpecs); ++i) {
+      if (publicKeys[i].Size() > 0) {
+        index->AddBlob(publicKeys[i],
+                       publicKeys[i].Size(),
+                       container,
+                       keySpecs[i]);
+      }
+    }
+  }
+  return ERROR_SUCCESS;
+}
+
+bool KeyProvisioner::Run(const std::vector<std::wstring> &names,
+                         KeyIndex *index,
+                         const ProgressCallback &progress,
+                         std::vector<DWORD> &status) {
+  status.assign(names.size(), ERROR_SUCCESS);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    progress_ = ProvisionProgress();
+    progress_.total = static_cast<DWORD>(names.size());
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  std::atomic<size_t> next(0);
+  std::mutex indexLock;
+  auto worker = [&]() {
+    for (size_t i = next++; i < names.size(); i = next++) {
+      DWORD keys = 0;
+      status[i] = Provision(names[i].c_str(), index, indexLock, keys);
+
+      std::lock_guard<std::mutex> guard(lock_);
+      ++progress_.containers;
+      progress_.keys += keys;
+      if (status[i] != ERROR_SUCCESS) ++progress_.failed;
+      if (progress_.containers == progress_.total) finished_.notify_all();
+    }
+  };
+
+  DWORD threads = config_.threads;
+  if (threads == 0) {
+    threads = max(1u, std::thread::hardware_concurrency());
+  }
+  threads = min(threads, max(1u, static_cast<DWORD>(names.size())));
+  std::vector<std::thread> workers;
+  for (DWORD i = 0; i < threads; ++i) {
+    workers.push_back(std::thread(worker));
+  }
+
+  const auto interval = std::chrono::milliseconds(config_.progressMillis);
+  for (bool done = false; !done;) {
+    ProvisionProgress snapshot;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      done = finished_.wait_for(lock, interval, [this]() {
+        return progress_.containers == progress_.total;
+      });
+      progress_.elapsedMicros = ElapsedMicros();
+      snapshot = progress_;
+    }
+    if (progress) progress(snapshot);
+  }
+  for (auto &it : workers) {
+    it.join();
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  return progress_.failed == 0;
+}
+
+ProvisionProgress KeyProvisioner::GetProgress() {
+  std::lock_guard<std::mutex> guard(lock_);
+  ProvisionProgress snapshot = progress_;
+  if (snapshot.containers < snapshot.total) {
+    snapshot.elapsedMicros = ElapsedMicros();
+  }
+  return snapshot;
+}
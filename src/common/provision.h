@@ -0,0 +1,80 @@
+struct ProvisionConfig {
+  std::wstring provider;  // empty for the default provider of the type
+  DWORD providerType;
+  DWORD flags;            // CRYPT_MACHINE_KEYSET or 0
+  DWORD keyBits;
+  bool signature;         // generate AT_SIGNATURE
+  bool exchange;          // generate AT_KEYEXCHANGE
+  bool exportable;
+  DWORD threads;          // 0 for one per processor
+  DWORD progressMillis;   // how often the progress callback runs
+
+  ProvisionConfig()
+    : providerType(PROV_RSA_AES),
+      flags(0),
+      keyBits(2048),
+      signature(true),
+      exchange(false),
+      exportable(false),
+      threads(0),
+      progressMillis(1000)
+  {}
+};
+
+struct ProvisionProgress {
+  DWORD total;
+  DWORD containers;  // finished, successfully or not
+  DWORD failed;
+  DWORD keys;
+  ULONGLONG elapsedMicros;
+
+  ProvisionProgress()
+    : total(0), containers(0), failed(0), keys(0), elapsedMicros(0)
+  {}
+
+  double KeysPerSecond() const {
+    return elapsedMicros ? keys * 1000000.0 / elapsedMicros : 0;
+  }
+};
+
+class KeyIndex;
+
+// Creates containers and generates their RSA keys in bulk.
+//
+// Key generation is almost all prime search, so every container is handed
+// to one of |threads| workers, each with its own context.  On the software
+// provider that runs the sieve and Miller-Rabin rounds of RsaKey on every
+// core.  As each container is finished its public keys go into the index,
+// so the key store and the index are written in the same pass.  A
+// container whose key cannot be generated is deleted again, so a failed
+// run never leaves half-provisioned containers behind.
+class KeyProvisioner {
+public:
+  // Called on the thread that called Run().
+  typedef std::function<void(const ProvisionProgress &)> ProgressCallback;
+
+private:
+  const ProvisionConfig config_;
+  std::mutex lock_;
+  std::condition_variable finished_;
+  ProvisionProgress progress_;
+  std::chrono::steady_clock::time_point start_;
+
+  DWORD Provision(LPCWSTR name,
+                  KeyIndex *index,
+                  std::mutex &indexLock,
+                  DWORD &keys);
+  ULONGLONG ElapsedMicros() const;
+
+public:
+  KeyProvisioner(const ProvisionConfig &config);
+
+  // Provisions every container in |names|.  |status| receives
+  // ERROR_SUCCESS or the error of each name, in order.  Returns false if
+  // any of them failed.  |index| and |progress| may be null.
+  bool Run(const std::vector<std::wstring> &names,
+           KeyIndex *index,
+           const ProgressCallback &progress,
+           std::vector<DWORD> &status);
+  ProvisionProgress GetProgress();
+};
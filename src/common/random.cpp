@@ -0,0 +1,239 @@
+#include <windows.h>
+#include <functional>
+#if defined(_M_X64) || defined(__x86_64__)
+#include <emmintrin.h>
+#define RANDOM_SSE2
+#endif
+#include "random.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+constexpr DWORD KeyWords = RandomGenerator::KeySize / sizeof(DWORD);
+constexpr DWORD Sigma[4] = {
+  0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,  // "expand 32-byte k"
+};
+
+inline DWORD Rotate(DWORD v, int n) {
+  return (v << n) | (v >> (32 - n));
+}
+
+inline void QuarterRound(DWORD &a, DWORD &b, DWORD &c, DWORD &d) {
+  a += b; d = Rotate(d ^ a, 16);
+  c += d; b = Rotate(b ^ c, 12);
+  a += b; d = Rotate(d ^ a, 8);
+  c += d; b = Rotate(b ^ c, 7);
+}
+
+void Block(const DWORD key[KeyWords], ULONGLONG counter, LPBYTE out) {
+  DWORD input[16];
+  memcpy(input, Sigma, sizeof(Sigma));
+  memcpy(input + 4, key, KeyWords * sizeof(DWORD));
+  input[12] = static_cast<DWORD>(counter);
+  input[13] = static_cast<DWORD>(counter >> 32);
+  input[14] = 0;
+  input[15] = 0;
+
+  DWORD x[16];
+  memcpy(x, input, sizeof(x));
+  for (int i = 0; i < 10; ++i) {
+    QuarterRound(x[0], x[4], x[8], x[12]);
+    QuarterRound(x[1], x[5], x[9], x[13]);
+    QuarterRound(x[2], x[6], x[10], x[14]);
+    QuarterRound(x[3], x[7], x[11], x[15]);
+    QuarterRound(x[0], x[5], x[10], x[15]);
+    QuarterRound(x[1], x[6], x[11], x[12]);
+    QuarterRound(x[2], x[7], x[8], x[13]);
+    QuarterRound(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; ++i) {
+    x[i] += input[i];
+  }
+  // The words go out little-endian, which is how Windows stores them.
+  memcpy(out, x, sizeof(x));
+}
+
+#ifdef RANDOM_SSE2
+
+template<int N>
+inline __m128i Rotate(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi32(v, N), _mm_srli_epi32(v, 32 - N));
+}
+
+inline void QuarterRound(__m128i &a, __m128i &b, __m128i &c, __m128i &d) {
+  a = _mm_add_epi32(a, b); d = Rotate<16>(_mm_xor_si128(d, a));
+  c = _mm_add_epi32(c, d); b = Rotate<12>(_mm_xor_si128(b, c));
+  a = _mm_add_epi32(a, b); d = Rotate<8>(_mm_xor_si128(d, a));
+  c = _mm_add_epi32(c, d); b = Rotate<7>(_mm_xor_si128(b, c));
+}
+
+// Four consecutive blocks, one per lane: x[i] holds word i of each block,
+// and the result is transposed back into block order as it is stored.
+void Block4(const DWORD key[KeyWords], ULONGLONG counter, LPBYTE out) {
+  __m128i input[16];
+  for (int i = 0; i < 4; ++i) {
+    input[i] = _mm_set1_epi32(static_cast<int>(Sigma[i]));
+  }
+  for (DWORD i = 0; i < KeyWords; ++i) {
+    input[4 + i] = _mm_set1_epi32(static_cast<int>(key[i]));
+  }
+  DWORD low[4], high[4];
+  for (int i = 0; i < 4; ++i) {
+    low[i] = static_cast<DWORD>(counter + i);
+    high[i] = static_cast<DWORD>((counter + i) >> 32);
+  }
+  input[12] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(low));
+  input[13] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(high));
+  input[14] = _mm_setzero_si128();
+  input[15] = _mm_setzero_si128();
+
+  __m128i x[16];
+  for (int i = 0; i < 16; ++i) {
+    x[i] = input[i];
+  }
+  for (int i = 0; i < 10; ++i) {
+    QuarterRound(x[0], x[4], x[8], x[12]);
+    QuarterRound(x[1], x[5], x[9], x[13]);
+    QuarterRound(x[2], x[6], x[10], x[14]);
+    QuarterRound(x[3], x[7], x[11], x[15]);
+    QuarterRound(x[0], x[5], x[10], x[15]);
+    QuarterRound(x[1], x[6], x[11], x[12]);
+    QuarterRound(x[2], x[7], x[8], x[13]);
+    QuarterRound(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; i += 4) {
+    const __m128i a = _mm_add_epi32(x[i], input[i]);
+    const __m128i b = _mm_add_epi32(x[i + 1], input[i + 1]);
+    const __m128i c = _mm_add_epi32(x[i + 2], input[i + 2]);
+    const __m128i d = _mm_add_epi32(x[i + 3], input[i + 3]);
+    const __m128i ab01 = _mm_unpacklo_epi32(a, b);
+    const __m128i cd01 = _mm_unpacklo_epi32(c, d);
+    const __m128i ab23 = _mm_unpackhi_epi32(a, b);
+    const __m128i cd23 = _mm_unpackhi_epi32(c, d);
+    const __m128i rows[4] = {
+      _mm_unpacklo_epi64(ab01, cd01),
+      _mm_unpackhi_epi64(ab01, cd01),
+      _mm_unpacklo_epi64(ab23, cd23),
+      _mm_unpackhi_epi64(ab23, cd23),
+    };
+    for (int lane = 0; lane < 4; ++lane) {
+      _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(out + lane * 64 + i * 4),
+        rows[lane]);
+    }
+  }
+}
+
+#endif  // RANDOM_SSE2
+
+}  // namespace
+
+bool RandomGenerator::SystemRandom(LPBYTE data, DWORD size) {
+  // Acquired once and kept for the life of the process.
+  static const HCRYPTPROV prov = []() {
+    HCRYPTPROV prov = 0;
+    if (!CryptAcquireContext(&prov,
+                             nullptr,
+                             nullptr,
+                             PROV_RSA_FULL,
+                             CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
+      Log(L"CryptAcquireContext failed - %08x\n", GetLastError());
+      return HCRYPTPROV(0);
+    }
+    return prov;
+  }();
+  if (!prov) {
+    SetLastError(NTE_PROV_TYPE_NOT_DEF);
+    return false;
+  }
+  if (!CryptGenRandom(prov, size, data)) {
+    Log(L"CryptGenRandom failed - %08x\n", GetLastError());
+    return false;
+  }
+  return true;
+}
+
+void RandomGenerator::KeyStream(const DWORD key[KeyWords],
+                                ULONGLONG counter,
+                                DWORD blocks,
+                                LPBYTE out) {
+#ifdef RANDOM_SSE2
+  for (; blocks >= 4; blocks -= 4, counter += 4, out += 4 * BlockSize) {
+    Block4(key, counter, out);
+  }
+#endif
+  for (; blocks > 0; --blocks, ++counter, out += BlockSize) {
+    Block(key, counter, out);
+  }
+}
+
+RandomGenerator &RandomGenerator::ThreadLocal() {
+  static thread_local RandomGenerator generator;
+  return generator;
+}
+
+RandomGenerator::RandomGenerator()
+  : RandomGenerator(SystemRandom)
+{}
+
+RandomGenerator::RandomGenerator(const SeedSource &seed)
+  : seed_(seed),
+    key_(),
+    used_(sizeof(buffer_)),
+    generated_(0),
+    seededAt_(0),
+    seeded_(false)
+{}
+
+RandomGenerator::~RandomGenerator() {
+  SecureZeroMemory(key_, sizeof(key_));
+  SecureZeroMemory(buffer_, sizeof(buffer_));
+}
+
+bool RandomGenerator::Reseed() {
+  BYTE seed[KeySize];
+  if (!seed_(seed, sizeof(seed))) return false;
+  // Mixed in rather than replacing the key, so a weak seed cannot make the
+  // state weaker than it was.
+  for (DWORD i = 0; i < KeyWords; ++i) {
+    DWORD word;
+    memcpy(&word, seed + i * sizeof(DWORD), sizeof(word));
+    key_[i] ^= word;
+  }
+  SecureZeroMemory(seed, sizeof(seed));
+  Refill();
+  generated_ = 0;
+  seededAt_ = GetTickCount64();
+  seeded_ = true;
+  return true;
+}
+
+void RandomGenerator::Refill() {
+  KeyStream(key_, 0, BufferBlocks, buffer_);
+  memcpy(key_, buffer_, KeySize);
+  SecureZeroMemory(buffer_, KeySize);
+  used_ = KeySize;
+}
+
+bool RandomGenerator::Generate(LPBYTE data, DWORD size) {
+  if (!seeded_
+      || generated_ >= ReseedBytes
+      || GetTickCount64() - seededAt_ >= ReseedMilliseconds) {
+    if (!Reseed()) {
+      SecureZeroMemory(data, size);
+      return false;
+    }
+  }
+  generated_ += size;
+  while (size > 0) {
+    if (used_ == sizeof(buffer_)) Refill();
+    const DWORD n = min(size, DWORD(sizeof(buffer_) - used_));
+    memcpy(data, buffer_ + used_, n);
+    SecureZeroMemory(buffer_ + used_, n);
+    used_ += n;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
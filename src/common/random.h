@@ -0,0 +1,55 @@
+// A ChaCha20 random generator for in-process signing: blinding factors,
+// nonces and key generation.
+//
+// Output is buffered.  Each refill runs the block function over a buffer
+// of BufferBlocks blocks, keeps the first 32 bytes as the next key and
+// hands out the rest, wiping bytes as they go.  A key is never used for a
+// second refill, so the state left in memory says nothing about output
+// already returned.  Four blocks are computed at a time with SSE2 on x64.
+//
+// The key is mixed with fresh bytes from the seed source, by default the
+// OS generator, on first use and again after ReseedBytes of output or
+// ReseedMilliseconds, whichever comes first.  Between reseeds a call is a
+// copy out of the buffer, with no system call.  A generator is not
+// thread-safe; ThreadLocal() gives each thread its own.
+class RandomGenerator {
+public:
+  // Fills |data| with entropy.  Returns false on failure.
+  typedef std::function<bool(LPBYTE data, DWORD size)> SeedSource;
+
+  static constexpr DWORD KeySize = 32;
+  static constexpr DWORD BlockSize = 64;
+  static constexpr DWORD BufferBlocks = 64;
+  static constexpr ULONGLONG ReseedBytes = 16 << 20;
+  static constexpr ULONGLONG ReseedMilliseconds = 5 * 60 * 1000;
+
+private:
+  const SeedSource seed_;
+  DWORD key_[KeySize / sizeof(DWORD)];
+  BYTE buffer_[BufferBlocks * BlockSize];
+  DWORD used_;
+  ULONGLONG generated_;
+  ULONGLONG seededAt_;
+  bool seeded_;
+
+  bool Reseed();
+  void Refill();
+
+public:
+  // CryptGenRandom on a verify-only context of the default provider.
+  static bool SystemRandom(LPBYTE data, DWORD size);
+  // ChaCha20 blocks |counter| onwards under |key| with a zero nonce.
+  static void KeyStream(const DWORD key[KeySize / sizeof(DWORD)],
+                        ULONGLONG counter,
+                        DWORD blocks,
+                        LPBYTE out);
+  // The calling thread's generator, seeded from SystemRandom.
+  static RandomGenerator &ThreadLocal();
+
+  RandomGenerator();
+  RandomGenerator(const SeedSource &seed);
+  ~RandomGenerator();
+
+  // Fails only when the seed source does, leaving |data| zeroed.
+  bool Generate(LPBYTE data, DWORD size);
+};
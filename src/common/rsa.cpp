@@ -0,0 +1,436 @@
+#include <windows.h>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "bignum.h"
+#include "blob.h"
+#include "hash.h"
+#include "rsa.h"
+
+namespace {
+
+constexpr DWORD RSA1Magic = 0x31415352;  // 'RSA1'
+constexpr DWORD RSA2Magic = 0x32415352;  // 'RSA2'
+constexpr DWORD HeaderSize = sizeof(BLOBHEADER) + sizeof(RSAPUBKEY);
+// Draws of r before NewBlinding gives up on the random source.
+constexpr int BlindingAttempts = 8;
+
+const std::vector<DWORD> &SmallPrimes() {
+  static const std::vector<DWORD> primes = []() {
+    const DWORD limit = 8192;
+    std::vector<bool> composite(limit);
+    std::vector<DWORD> found;
+    for (DWORD i = 3; i < limit; i += 2) {
+      if (composite[i]) continue;
+      found.push_back(i);
+      for (DWORD j = i * i; j < limit; j += 2 * i) composite[j] = true;
+    }
+    return found;
+  }();
+  return primes;
+}
+
+// Miller-Rabin rounds for an error rate below 2^-80, by candidate size.
+int Rounds(DWORD bits) {
+  return bits >= 1300 ? 2
+         : bits >= 850 ? 3
+         : bits >= 650 ? 4
+         : bits >= 550 ? 5
+         : bits >= 450 ? 6
+         : bits >= 400 ? 7
+         : bits >= 350 ? 8
+         : bits >= 300 ? 9
+         : bits >= 250 ? 12
+         : 27;
+}
+
+BigNum RandomBelow(const BigNum &limit,
+                   const RsaKey::RandomSource &random) {
+  std::vector<BYTE> bytes(limit.Bytes() + 8);
+  random(bytes.data(), static_cast<DWORD>(bytes.size()));
+  return BigNum::Mod(BigNum::FromLittleEndian(bytes.data(), bytes.size()),
+                     limit);
+}
+
+bool IsProbablePrime(const BigNum &n,
+                     int rounds,
+                     const RsaKey::RandomSource &random) {
+  const BigNum one(1);
+  const BigNum nMinus1 = BigNum::Sub(n, one);
+  DWORD s = 0;
+  while (!nMinus1.Bit(s)) ++s;
+  const BigNum d = BigNum::ShiftRight(nMinus1, s);
+  const Montgomery mont(n);
+  const BigNum range = BigNum::Sub(n, BigNum(3));
+
+  for (int i = 0; i < rounds; ++i) {
+    const BigNum a = BigNum::Add(RandomBelow(range, random), BigNum(2));
+    BigNum x = mont.Exp(a, d);
+    if (x == one || x == nMinus1) continue;
+    bool composite = true;
+    for (DWORD r = 1; r < s && composite; ++r) {
+      x = BigNum::Mod(BigNum::Mul(x, x), n);
+      if (x == nMinus1) composite = false;
+    }
+    if (composite) return false;
+  }
+  return true;
+}
+
+// Random prime of exactly |bits| bits with the top two bits set, so that
+// the product of two of them has exactly twice as many bits.  Candidates
+// are stepped by two from a random start and sieved by their residues
+// before any Miller-Rabin round is spent on them.
+BigNum RandomPrime(DWORD bits,
+                   DWORD publicExponent,
+                   const RsaKey::RandomSource &random) {
+  const auto &primes = SmallPrimes();
+  std::vector<BYTE> bytes((bits + 7) / 8);
+  std::vector<DWORD> residues(primes.size());
+  for (;;) {
+    random(bytes.data(), static_cast<DWORD>(bytes.size()));
+    const DWORD topBits = bits - (static_cast<DWORD>(bytes.size()) - 1) * 8;
+    bytes.back() &= static_cast<BYTE>((1u << topBits) - 1);
+    bytes.back() |= static_cast<BYTE>(1u << (topBits - 1));
+    if (topBits >= 2) {
+      bytes.back() |= static_cast<BYTE>(1u << (topBits - 2));
+    }
+    else {
+      bytes[bytes.size() - 2] |= 0x80;
+    }
+    bytes[0] |= 1;
+    const BigNum start = BigNum::FromLittleEndian(bytes.data(), bytes.size());
+
+    for (size_t i = 0; i < primes.size(); ++i) {
+      residues[i] = start.ModWord(primes[i]);
+    }
+
+    for (DWORD delta = 0; delta < (1u << 20); delta += 2) {
+      bool sieved = false;
+      for (size_t i = 0; i < primes.size() && !sieved; ++i) {
+        // Skip multiples of small primes, and p where p - 1 shares the
+        // factor e (e is prime for every exponent CryptoAPI uses).
+        const DWORD r = (residues[i] + delta) % primes[i];
+        sieved = r == 0 || (primes[i] == publicExponent && r == 1);
+      }
+      if (sieved) continue;
+
+      const BigNum candidate = BigNum::Add(start, BigNum(delta));
+      if (candidate.Bits() != bits) break;
+      if (publicExponent > primes.back()
+          && candidate.ModWord(publicExponent) == 1) {
+        continue;
+      }
+      if (IsProbablePrime(candidate, Rounds(bits), random)) {
+        return candidate;
+      }
+    }
+  }
+}
+
+void WriteLittleEndian(const BigNum &value, DWORD size, LPBYTE &out) {
+  value.ToLittleEndian(out, size);
+  out += size;
+}
+
+}  // namespace
+
+RsaKey::RsaKey() : bits_(0), publicExponent_(0) {}
+
+void RsaKey::Prepare() {
+  montN_ = std::make_shared<Montgomery>(n_);
+  if (HasPrivate()) {
+    montP_ = std::make_shared<Montgomery>(p_);
+    montQ_ = std::make_shared<Montgomery>(q_);
+  }
+  else {
+    montP_.reset();
+    montQ_.reset();
+  }
+}
+
+bool RsaKey::Generate(DWORD bits,
+                      DWORD publicExponent,
+                      const RandomSource &random) {
+  if (bits < 384 || bits > 16384 || bits % 16 != 0
+      || publicExponent < 3 || !(publicExponent & 1)) {
+    SetLastError(NTE_BAD_FLAGS);
+    return false;
+  }
+
+  const BigNum one(1);
+  const BigNum e(publicExponent);
+  for (;;) {
+    BigNum p = RandomPrime(bits / 2, publicExponent, random);
+    BigNum q = RandomPrime(bits / 2, publicExponent, random);
+    const int order = BigNum::Compare(p, q);
+    if (order == 0) continue;
+    if (order < 0) std::swap(p, q);
+
+    const BigNum p1 = BigNum::Sub(p, one), q1 = BigNum::Sub(q, one);
+    const BigNum d = BigNum::ModInverse(e, BigNum::Mul(p1, q1));
+    if (d.IsZero()) continue;
+
+    bits_ = bits;
+    publicExponent_ = publicExponent;
+    n_ = BigNum::Mul(p, q);
+    e_ = e;
+    d_ = d;
+    dp_ = BigNum::Mod(d, p1);
+    dq_ = BigNum::Mod(d, q1);
+    qinv_ = BigNum::ModInverse(q, p);
+    p_ = std::move(p);
+    q_ = std::move(q);
+    Prepare();
+    return true;
+  }
+}
+
+bool RsaKey::FromBlob(LPCBYTE blob, DWORD size) {
+  if (!blob || size < HeaderSize) {
+    SetLastError(NTE_BAD_DATA);
+    return false;
+  }
+  const auto header = reinterpret_cast<const BLOBHEADER*>(blob);
+  const auto rsa = reinterpret_cast<const RSAPUBKEY*>(header + 1);
+  const bool isPrivate = header->bType == PRIVATEKEYBLOB;
+  if ((header->bType != PUBLICKEYBLOB && !isPrivate)
+      || rsa->magic != (isPrivate ? RSA2Magic : RSA1Magic)
+      || rsa->bitlen == 0 || rsa->bitlen > 16384) {
+    SetLastError(NTE_BAD_TYPE);
+    return false;
+  }
+
+  const DWORD full = (rsa->bitlen + 7) / 8, half = (rsa->bitlen + 15) / 16;
+  const DWORD expected = HeaderSize + (isPrivate ? full * 2 + half * 5 : full);
+  if (size < expected) {
+    SetLastError(NTE_BAD_LEN);
+    return false;
+  }
+
+  LPCBYTE p = blob + HeaderSize;
+  auto next = [&p](DWORD bytes) {
+    const BigNum value = BigNum::FromLittleEndian(p, bytes);
+    p += bytes;
+    return value;
+  };
+  bits_ = rsa->bitlen;
+  publicExponent_ = rsa->pubexp;
+  e_ = BigNum(rsa->pubexp);
+  n_ = next(full);
+  if (isPrivate) {
+    p_ = next(half);
+    q_ = next(half);
+    dp_ = next(half);
+    dq_ = next(half);
+    qinv_ = next(half);
+    d_ = next(full);
+  }
+  else {
+    p_ = q_ = dp_ = dq_ = qinv_ = d_ = BigNum();
+  }
+
+  if (!n_.IsOdd() || e_.IsZero()
+      || (isPrivate && (p_.IsZero() || q_.IsZero() || d_.IsZero()))) {
+    SetLastError(NTE_BAD_DATA);
+    return false;
+  }
+  Prepare();
+  return true;
+}
+
+bool RsaKey::ToBlob(DWORD blobType,
+                    ALG_ID keyAlgo,
+                    LPBYTE blob,
+                    LPDWORD size) const {
+  const bool isPrivate = blobType == PRIVATEKEYBLOB;
+  if (!isPrivate && blobType != PUBLICKEYBLOB) {
+    SetLastError(NTE_BAD_TYPE);
+    return false;
+  }
+  if (isPrivate && !HasPrivate()) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return false;
+  }
+
+  const DWORD full = (bits_ + 7) / 8, half = (bits_ + 15) / 16;
+  const DWORD required = HeaderSize + (isPrivate ? full * 2 + half * 5 : full);
+  if (!blob) {
+    *size = required;
+    return true;
+  }
+  if (*size < required) {
+    *size = required;
+    SetLastError(ERROR_MORE_DATA);
+    return false;
+  }
+  *size = required;
+
+  auto header = reinterpret_cast<BLOBHEADER*>(blob);
+  header->bType = static_cast<BYTE>(blobType);
+  header->bVersion = CUR_BLOB_VERSION;
+  header->reserved = 0;
+  header->aiKeyAlg = keyAlgo;
+  auto rsa = reinterpret_cast<RSAPUBKEY*>(header + 1);
+  rsa->magic = isPrivate ? RSA2Magic : RSA1Magic;
+  rsa->bitlen = bits_;
+  rsa->pubexp = publicExponent_;
+
+  LPBYTE p = blob + HeaderSize;
+  WriteLittleEndian(n_, full, p);
+  if (isPrivate) {
+    WriteLittleEndian(p_, half, p);
+    WriteLittleEndian(q_, half, p);
+    WriteLittleEndian(dp_, half, p);
+    WriteLittleEndian(dq_, half, p);
+    WriteLittleEndian(qinv_, half, p);
+    WriteLittleEndian(d_, full, p);
+  }
+  return true;
+}
+
+DWORD RsaKey::Bits() const {
+  return bits_;
+}
+
+DWORD RsaKey::PublicExponent() const {
+  return publicExponent_;
+}
+
+DWORD RsaKey::SignatureSize() const {
+  return (bits_ + 7) / 8;
+}
+
+bool RsaKey::HasPrivate() const {
+  return !d_.IsZero();
+}
+
+const BigNum &RsaKey::Modulus() const {
+  return n_;
+}
+
+bool RsaKey::Encode(ALG_ID hashAlgo,
+                    LPCBYTE digest,
+                    DWORD digestSize,
+                    DWORD flags,
+                    std::vector<BYTE> &encoded) const {
+  // EMSA-PKCS1-v1_5: 00 01 FF..FF 00 DigestInfo H
+  LPCBYTE prefix = nullptr;
+  DWORD prefixSize = 0;
+  if (!(flags & CRYPT_NOHASHOID)) {
+    const auto algo = HashAlgorithm::Find(hashAlgo);
+    if (!algo) {
+      SetLastError(NTE_BAD_ALGID);
+      return false;
+    }
+    prefix = algo->digestInfo;
+    prefixSize = algo->digestInfoSize;
+  }
+
+  const DWORD k = SignatureSize();
+  if (prefixSize + digestSize + 11 > k) {
+    SetLastError(NTE_BAD_LEN);
+    return false;
+  }
+  encoded.assign(k, 0xff);
+  encoded[0] = 0;
+  encoded[1] = 1;
+  const DWORD t = k - prefixSize - digestSize;
+  encoded[t - 1] = 0;
+  std::copy(prefix, prefix + prefixSize, encoded.begin() + t);
+  std::copy(digest, digest + digestSize, encoded.begin() + t + prefixSize);
+  return true;
+}
+
+BigNum RsaKey::Private(const BigNum &m) const {
+  // Garner's CRT recombination: s = m2 + q * (qinv * (m1 - m2) mod p)
+  const BigNum m1 = montP_->Exp(m, dp_);
+  const BigNum m2 = montQ_->Exp(m, dq_);
+  const BigNum m2p = BigNum::Mod(m2, p_);
+  const BigNum diff = BigNum::Compare(m1, m2p) >= 0
+                      ? BigNum::Sub(m1, m2p)
+                      : BigNum::Sub(BigNum::Add(m1, p_), m2p);
+  const BigNum h = BigNum::Mod(BigNum::Mul(qinv_, diff), p_);
+  return BigNum::Add(m2, BigNum::Mul(h, q_));
+}
+
+bool RsaKey::Sign(ALG_ID hashAlgo,
+                  LPCBYTE digest,
+                  DWORD digestSize,
+                  DWORD flags,
+                  LPBYTE signature) const {
+  if (!HasPrivate()) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return false;
+  }
+  std::vector<BYTE> encoded;
+  if (!Encode(hashAlgo, digest, digestSize, flags, encoded)) return false;
+
+  const BigNum m = BigNum::FromBigEndian(encoded.data(), encoded.size());
+  return Private(m).ToLittleEndian(signature, SignatureSize());
+}
+
+bool RsaKey::NewBlinding(const RandomSource &random,
+                         RsaBlinding &blinding) const {
+  if (n_.IsZero()) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return false;
+  }
+  // A zero r, or one sharing a factor with n, has no inverse.  Drawing one
+  // is as likely as guessing a prime, so a source that keeps producing
+  // them is broken, like a generator whose seed failed and that hands out
+  // zeros.
+  for (int attempt = 0; attempt < BlindingAttempts; ++attempt) {
+    const BigNum r = RandomBelow(n_, random);
+    blinding.unblind = BigNum::ModInverse(r, n_);
+    if (!blinding.unblind.IsZero()) {
+      blinding.blind = montN_->Exp(r, e_);
+      return true;
+    }
+  }
+  SetLastError(NTE_FAIL);
+  return false;
+}
+
+bool RsaKey::Sign(ALG_ID hashAlgo,
+                  LPCBYTE digest,
+                  DWORD digestSize,
+                  DWORD flags,
+                  LPBYTE signature,
+                  const RsaBlinding &blinding) const {
+  if (!HasPrivate()) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return false;
+  }
+  std::vector<BYTE> encoded;
+  if (!Encode(hashAlgo, digest, digestSize, flags, encoded)) return false;
+
+  // (m * r^e)^d = m^d * r, which r^-1 takes away again.
+  const BigNum m = BigNum::FromBigEndian(encoded.data(), encoded.size());
+  const BigNum s = Private(BigNum::Mod(BigNum::Mul(m, blinding.blind), n_));
+  return BigNum::Mod(BigNum::Mul(s, blinding.unblind), n_)
+    .ToLittleEndian(signature, SignatureSize());
+}
+
+bool RsaKey::Verify(ALG_ID hashAlgo,
+                    LPCBYTE digest,
+                    DWORD digestSize,
+                    DWORD flags,
+                    LPCBYTE signature,
+                    DWORD signatureSize) const {
+  std::vector<BYTE> expected;
+  if (!Encode(hashAlgo, digest, digestSize, flags, expected)) return false;
+
+  const BigNum s = BigNum::FromLittleEndian(signature, signatureSize);
+  std::vector<BYTE> actual(expected.size());
+  if (signatureSize != SignatureSize()
+      || BigNum::Compare(s, n_) >= 0
+      || !montN_->Exp(s, e_).ToBigEndian(actual.data(), actual.size())
+      || actual != expected) {
+    SetLastError(NTE_BAD_SIGNATURE);
+    return false;
+  }
+  return true;
+}
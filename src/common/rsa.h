@@ -0,0 +1,77 @@
+// A blinding pair for one RSA key: r^e mod n and r^-1 mod n for a random r
+// coprime to n.  Each pair must blind a single signature.
+struct RsaBlinding {
+  BigNum blind;
+  BigNum unblind;
+};
+
+// RSA key material for the software provider, laid out the way CryptoAPI
+// exports it.  Signatures are PKCS#1 v1.5 and little-endian, the same byte
+// order CryptSignHash produces.
+class RsaKey {
+private:
+  DWORD bits_;
+  DWORD publicExponent_;
+  BigNum n_, e_, d_, p_, q_, dp_, dq_, qinv_;
+  std::shared_ptr<const Montgomery> montN_, montP_, montQ_;
+
+  void Prepare();
+  // m^d mod n through the CRT.
+  BigNum Private(const BigNum &m) const;
+
+public:
+  typedef std::function<void(LPBYTE, DWORD)> RandomSource;
+
+  RsaKey();
+
+  // |bits| must be a multiple of 16 between 384 and 16384.
+  bool Generate(DWORD bits, DWORD publicExponent, const RandomSource &random);
+  // Accepts PUBLICKEYBLOB and PRIVATEKEYBLOB with an RSA1/RSA2 header.
+  bool FromBlob(LPCBYTE blob, DWORD size);
+  // Writes a PUBLICKEYBLOB or PRIVATEKEYBLOB.  With |blob| null only the
+  // required size is returned.
+  bool ToBlob(DWORD blobType,
+              ALG_ID keyAlgo,
+              LPBYTE blob,
+              LPDWORD size) const;
+
+  DWORD Bits() const;
+  DWORD PublicExponent() const;
+  DWORD SignatureSize() const;
+  bool HasPrivate() const;
+  const BigNum &Modulus() const;
+
+  // The EMSA-PKCS1-v1_5 block a signature of |digest| decrypts to,
+  // SignatureSize() bytes big-endian.  |flags| takes CRYPT_NOHASHOID.
+  bool Encode(ALG_ID hashAlgo,
+              LPCBYTE digest,
+              DWORD digestSize,
+              DWORD flags,
+              std::vector<BYTE> &encoded) const;
+  // |flags| takes CRYPT_NOHASHOID.  |signature| receives SignatureSize()
+  // bytes.
+  bool Sign(ALG_ID hashAlgo,
+            LPCBYTE digest,
+            DWORD digestSize,
+            DWORD flags,
+            LPBYTE signature) const;
+  // Draws the r of a blinding pair from |random|.  Only the public half of
+  // the key is used.  Fails with NTE_FAIL if a few draws in a row give no
+  // usable r.
+  bool NewBlinding(const RandomSource &random, RsaBlinding &blinding) const;
+  // Sign with the encoded message multiplied by |blinding|.blind before the
+  // private exponentiation and the result by |blinding|.unblind after, so
+  // the exponentiation never sees the message.  The signature is the same.
+  bool Sign(ALG_ID hashAlgo,
+            LPCBYTE digest,
+            DWORD digestSize,
+            DWORD flags,
+            LPBYTE signature,
+            const RsaBlinding &blinding) const;
+  bool Verify(ALG_ID hashAlgo,
+              LPCBYTE digest,
+              DWORD digestSize,
+              DWORD flags,
+              LPCBYTE signature,
+              DWORD signatureSize) const;
+};
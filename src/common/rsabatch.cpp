@@ -0,0 +1,470 @@
+#include <windows.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RSABATCH_TARGET(features)
+#else
+#include <cpuid.h>
+#define RSABATCH_TARGET(features) __attribute__((target(features)))
+#endif
+#define RSABATCH_X64
+#endif
+#include "bignum.h"
+#include "rsa.h"
+#include "rsabatch.h"
+
+namespace {
+
+// Multiplies |lanes| independent pairs of |limbs|-limb numbers: out = a * b
+// / R mod n, for inputs below 2n and an output below 2n with every limb
+// normalized.  Limb k of lane i is at [k * lanes + i].  |out| may alias |a|
+// or |b|.
+typedef void (*LaneMultiply)(DWORD limbs,
+                             const ULONGLONG *a,
+                             const ULONGLONG *b,
+                             ULONGLONG *out,
+                             const ULONGLONG *n,
+                             const ULONGLONG *n0inv,
+                             ULONGLONG *scratch);
+
+struct LaneEngine {
+  DWORD lanes;
+  DWORD radix;
+  LaneMultiply multiply;
+};
+
+#ifdef RSABATCH_X64
+
+struct CpuFeatures {
+  bool avx2;
+  bool ifma;
+};
+
+void CpuId(int leaf, int info[4]) {
+#ifdef _MSC_VER
+  __cpuidex(info, leaf, 0);
+#else
+  unsigned a, b, c, d;
+  __cpuid_count(leaf, 0, a, b, c, d);
+  info[0] = a;
+  info[1] = b;
+  info[2] = c;
+  info[3] = d;
+#endif
+}
+
+ULONGLONG EnabledXState() {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  unsigned lo, hi;
+  __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  return (ULONGLONG(hi) << 32) | lo;
+#endif
+}
+
+const CpuFeatures &Cpu() {
+  static const CpuFeatures features = []() {
+    CpuFeatures found = {false, false};
+    int info[4];
+    CpuId(0, info);
+    if (info[0] < 7) return found;
+    CpuId(1, info);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || !(info[2] & (1 << 28))) return found;
+
+    // The OS has to save the YMM registers, and for AVX-512 the opmask
+    // and ZMM ones too.
+    const ULONGLONG xstate = EnabledXState();
+    CpuId(7, info);
+    found.avx2 = (xstate & 0x06) == 0x06 && (info[1] & (1 << 5));
+    found.ifma = (xstate & 0xe6) == 0xe6
+                 && (info[1] & (1 << 16))    // AVX512F
+                 && (info[1] & (1 << 21));   // AVX512IFMA
+    return found;
+  }();
+  return features;
+}
+
+RSABATCH_TARGET("avx2")
+inline __m256i Load4(const ULONGLONG *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+RSABATCH_TARGET("avx2")
+inline void Store4(ULONGLONG *p, __m256i v) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+// Radix 2^32 in 64-bit lanes, one row of the coarsely integrated operand
+// scanning method per limb of |b| with both carry chains in flight.  Every
+// sum is at most (2^32 - 1)^2 + 2 * (2^32 - 1), so nothing overflows.
+RSABATCH_TARGET("avx2")
+void Avx2Multiply(DWORD s,
+                  const ULONGLONG *a,
+                  const ULONGLONG *b,
+                  ULONGLONG *out,
+                  const ULONGLONG *n,
+                  const ULONGLONG *n0inv,
+                  ULONGLONG *scratch) {
+  const __m256i mask = _mm256_set1_epi64x(0xffffffff);
+  const __m256i k = Load4(n0inv);
+  ULONGLONG *t = scratch;
+  for (DWORD j = 0; j <= s; ++j) {
+    Store4(t + 4 * j, _mm256_setzero_si256());
+  }
+
+  for (DWORD i = 0; i < s; ++i) {
+    const __m256i bi = Load4(b + 4 * i);
+    __m256i c = _mm256_add_epi64(Load4(t), _mm256_mul_epu32(Load4(a), bi));
+    // Only the low 32 bits of m matter; _mm256_mul_epu32 ignores the rest.
+    const __m256i m = _mm256_mul_epu32(c, k);
+    __m256i d = _mm256_add_epi64(_mm256_and_si256(c, mask),
+                                 _mm256_mul_epu32(m, Load4(n)));
+    c = _mm256_srli_epi64(c, 32);
+    d = _mm256_srli_epi64(d, 32);
+    for (DWORD j = 1; j < s; ++j) {
+      c = _mm256_add_epi64(c, Load4(t + 4 * j));
+      c = _mm256_add_epi64(c, _mm256_mul_epu32(Load4(a + 4 * j), bi));
+      d = _mm256_add_epi64(d, _mm256_and_si256(c, mask));
+      d = _mm256_add_epi64(d, _mm256_mul_epu32(m, Load4(n + 4 * j)));
+      Store4(t + 4 * (j - 1), _mm256_and_si256(d, mask));
+      c = _mm256_srli_epi64(c, 32);
+      d = _mm256_srli_epi64(d, 32);
+    }
+    c = _mm256_add_epi64(c, Load4(t + 4 * s));
+    d = _mm256_add_epi64(d, _mm256_and_si256(c, mask));
+    Store4(t + 4 * (s - 1), _mm256_and_si256(d, mask));
+    Store4(t + 4 * s, _mm256_add_epi64(_mm256_srli_epi64(c, 32),
+                                       _mm256_srli_epi64(d, 32)));
+  }
+  // Below 2n < R, so t[s] is zero.
+  std::copy(t, t + 4 * s, out);
+}
+
+RSABATCH_TARGET("avx512f")
+inline __m512i Load8(const ULONGLONG *p) {
+  return _mm512_loadu_si512(p);
+}
+
+RSABATCH_TARGET("avx512f")
+inline void Store8(ULONGLONG *p, __m512i v) {
+  _mm512_storeu_si512(p, v);
+}
+
+// Radix 2^52 with the IFMA multiply-adds, which take the low 52 bits of
+// each operand and add the low or high half of the 104-bit product.  Row i
+// accumulates into t[i..i+s] without carrying; a limb gains less than
+// 2^54 per row, so 2^64 is not reached before the final normalization for
+// any modulus RsaKey accepts.
+RSABATCH_TARGET("avx512f,avx512ifma")
+void IfmaMultiply(DWORD s,
+                  const ULONGLONG *a,
+                  const ULONGLONG *b,
+                  ULONGLONG *out,
+                  const ULONGLONG *n,
+                  const ULONGLONG *n0inv,
+                  ULONGLONG *scratch) {
+  const __m512i mask = _mm512_set1_epi64((1ull << 52) - 1);
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i k = Load8(n0inv);
+  ULONGLONG *t = scratch;
+  for (DWORD j = 0; j <= 2 * s; ++j) {
+    Store8(t + 8 * j, zero);
+  }
+
+  for (DWORD i = 0; i < s; ++i) {
+    ULONGLONG *row = t + 8 * i;
+    const __m512i bi = Load8(b + 8 * i);
+    for (DWORD j = 0; j < s; ++j) {
+      const __m512i aj = Load8(a + 8 * j);
+      Store8(row + 8 * j, _mm512_madd52lo_epu64(Load8(row + 8 * j), aj, bi));
+      Store8(row + 8 * (j + 1),
+             _mm512_madd52hi_epu64(Load8(row + 8 * (j + 1)), aj, bi));
+    }
+    const __m512i m = _mm512_madd52lo_epu64(zero, Load8(row), k);
+    for (DWORD j = 0; j < s; ++j) {
+      const __m512i nj = Load8(n + 8 * j);
+      Store8(row + 8 * j, _mm512_madd52lo_epu64(Load8(row + 8 * j), nj, m));
+      Store8(row + 8 * (j + 1),
+             _mm512_madd52hi_epu64(Load8(row + 8 * (j + 1)), nj, m));
+    }
+    // The low 52 bits of row[0] are zero now.
+    Store8(row + 8, _mm512_add_epi64(Load8(row + 8),
+                                     _mm512_srli_epi64(Load8(row), 52)));
+  }
+
+  // Below 2n < R, so t[2s] and the last carry are zero.
+  __m512i carry = zero;
+  for (DWORD j = 0; j < s; ++j) {
+    const __m512i v = _mm512_add_epi64(Load8(t + 8 * (s + j)), carry);
+    Store8(out + 8 * j, _mm512_and_si512(v, mask));
+    carry = _mm512_srli_epi64(v, 52);
+  }
+}
+
+#endif  // RSABATCH_X64
+
+const LaneEngine *FindEngine(RsaBatchEngine engine) {
+#ifdef RSABATCH_X64
+  static const LaneEngine avx2 = {4, 32, Avx2Multiply};
+  static const LaneEngine ifma = {8, 52, IfmaMultiply};
+  if (engine == RsaBatchAvx2 && Cpu().avx2) return &avx2;
+  if (engine == RsaBatchIfma && Cpu().ifma) return &ifma;
+#endif
+  return nullptr;
+}
+
+// Splits |size| little-endian bytes into |count| limbs of |radix| bits,
+// written |stride| apart.
+void ToLimbs(LPCBYTE bytes,
+             DWORD size,
+             DWORD radix,
+             DWORD count,
+             ULONGLONG *out,
+             size_t stride) {
+  const ULONGLONG mask = (1ull << radix) - 1;
+  ULONGLONG held = 0;
+  DWORD bits = 0, pos = 0;
+  for (DWORD i = 0; i < count; ++i) {
+    for (; bits < radix && pos < size; bits += 8) {
+      held |= ULONGLONG(bytes[pos++]) << bits;
+    }
+    out[i * stride] = held & mask;
+    held >>= radix;
+    bits = bits > radix ? bits - radix : 0;
+  }
+}
+
+// The inverse of ToLimbs.  Bits beyond |size| bytes are dropped.
+void FromLimbs(const ULONGLONG *limbs,
+               size_t stride,
+               DWORD radix,
+               DWORD count,
+               LPBYTE bytes,
+               DWORD size) {
+  ULONGLONG held = 0;
+  DWORD bits = 0, pos = 0;
+  for (DWORD i = 0; i < count && pos < size; ++i) {
+    held |= limbs[i * stride] << bits;
+    for (bits += radix; bits >= 8 && pos < size; bits -= 8) {
+      bytes[pos++] = static_cast<BYTE>(held);
+      held >>= 8;
+    }
+  }
+  std::fill(bytes + pos, bytes + size, 0);
+}
+
+// base^exponent mod n for every lane, each below or equal to its n.
+void LaneExp(const LaneEngine &engine,
+             DWORD s,
+             DWORD exponent,
+             const ULONGLONG *n,
+             const ULONGLONG *n0inv,
+             const ULONGLONG *r2,
+             const ULONGLONG *base,
+             ULONGLONG *out) {
+  const DWORD lanes = engine.lanes;
+  std::vector<ULONGLONG> x(s * lanes), one(s * lanes, 0);
+  std::vector<ULONGLONG> scratch((2 * s + 1) * lanes);
+  std::fill(one.begin(), one.begin() + lanes, 1);
+
+  engine.multiply(s, base, r2, x.data(), n, n0inv, scratch.data());
+  std::copy(x.begin(), x.end(), out);
+  DWORD top = 31;
+  while (!(exponent >> top & 1)) --top;
+  for (DWORD bit = top; bit > 0; --bit) {
+    engine.multiply(s, out, out, out, n, n0inv, scratch.data());
+    if (exponent >> (bit - 1) & 1) {
+      engine.multiply(s, out, x.data(), out, n, n0inv, scratch.data());
+    }
+  }
+  // Multiplying by 1 leaves at most n, and n itself only stands for 0,
+  // which no PKCS#1 block equals.  No final subtraction is needed.
+  engine.multiply(s, out, one.data(), out, n, n0inv, scratch.data());
+}
+
+}  // namespace
+
+struct RsaBatchVerifier::LaneKey {
+  DWORD limbs;
+  DWORD exponent;
+  ULONGLONG n0inv;  // -n^-1 mod 2^radix
+  std::vector<ULONGLONG> n;
+  std::vector<ULONGLONG> r2;  // R^2 mod n, R = 2^(radix * limbs)
+};
+
+bool RsaBatchVerifier::IsSupported(RsaBatchEngine engine) {
+  return engine == RsaBatchScalar || FindEngine(engine) != nullptr;
+}
+
+RsaBatchEngine RsaBatchVerifier::BestEngine() {
+  return IsSupported(RsaBatchIfma) ? RsaBatchIfma
+         : IsSupported(RsaBatchAvx2) ? RsaBatchAvx2
+         : RsaBatchScalar;
+}
+
+RsaBatchVerifier::RsaBatchVerifier() : engine_(BestEngine()) {}
+
+RsaBatchVerifier::RsaBatchVerifier(RsaBatchEngine engine)
+  : engine_(IsSupported(engine) ? engine : RsaBatchScalar)
+{}
+
+RsaBatchVerifier::~RsaBatchVerifier() {}
+
+RsaBatchEngine RsaBatchVerifier::Engine() const {
+  return engine_;
+}
+
+DWORD RsaBatchVerifier::AddKey(const RsaKey &key) {
+  RsaKey copy;
+  DWORD size = 0;
+  if (key.ToBlob(PUBLICKEYBLOB, CALG_RSA_SIGN, nullptr, &size)) {
+    std::vector<BYTE> blob(size);
+    if (key.ToBlob(PUBLICKEYBLOB, CALG_RSA_SIGN, blob.data(), &size)) {
+      copy.FromBlob(blob.data(), size);
+    }
+  }
+
+  std::unique_ptr<LaneKey> lane;
+  const LaneEngine *engine = FindEngine(engine_);
+  if (engine && copy.Bits() > 0) {
+    const BigNum &n = copy.Modulus();
+    const DWORD radix = engine->radix;
+    lane = std::make_unique<LaneKey>();
+    lane->limbs = (n.Bits() + 2 + radix - 1) / radix;
+    lane->exponent = copy.PublicExponent();
+
+    std::vector<BYTE> bytes((lane->limbs * radix + 7) / 8);
+    const DWORD byteCount = static_cast<DWORD>(bytes.size());
+    n.ToLittleEndian(bytes.data(), bytes.size());
+    lane->n.resize(lane->limbs);
+    ToLimbs(bytes.data(), byteCount, radix, lane->limbs, lane->n.data(), 1);
+    BigNum::Mod(BigNum::ShiftLeft(BigNum(1), 2 * radix * lane->limbs), n)
+      .ToLittleEndian(bytes.data(), bytes.size());
+    lane->r2.resize(lane->limbs);
+    ToLimbs(bytes.data(), byteCount, radix, lane->limbs, lane->r2.data(), 1);
+
+    // Newton iteration; each step doubles the correct low bits.
+    ULONGLONG inv = 1;
+    for (int i = 0; i < 6; ++i) {
+      inv *= 2 - lane->n[0] * inv;
+    }
+    lane->n0inv = (0 - inv) & ((1ull << radix) - 1);
+  }
+
+  keys_.push_back(std::move(copy));
+  laneKeys_.push_back(std::move(lane));
+  return static_cast<DWORD>(keys_.size() - 1);
+}
+
+void RsaBatchVerifier::VerifyGroup(
+    const std::vector<Request> &requests,
+    const std::vector<std::vector<BYTE>> &expected,
+    const std::vector<size_t> &group,
+    std::vector<DWORD> &status) const {
+  const LaneEngine &engine = *FindEngine(engine_);
+  const DWORD lanes = engine.lanes;
+  const LaneKey &first = *laneKeys_[requests[group[0]].key];
+  const DWORD s = first.limbs;
+
+  std::vector<ULONGLONG> n(s * lanes), r2(s * lanes), base(s * lanes);
+  std::vector<ULONGLONG> out(s * lanes), n0inv(lanes);
+  std::vector<BYTE> actual;
+  for (size_t start = 0; start < group.size(); start += lanes) {
+    const size_t count = min(size_t(lanes), group.size() - start);
+    for (DWORD lane = 0; lane < lanes; ++lane) {
+      const Request &r = requests[group[start + min(size_t(lane), count - 1)]];
+      const LaneKey &key = *laneKeys_[r.key];
+      for (DWORD k = 0; k < s; ++k) {
+        n[k * lanes + lane] = key.n[k];
+        r2[k * lanes + lane] = key.r2[k];
+      }
+      n0inv[lane] = key.n0inv;
+      ToLimbs(r.signature,
+              r.signatureSize,
+              engine.radix,
+              s,
+              base.data() + lane,
+              lanes);
+    }
+
+    LaneExp(engine,
+            s,
+            first.exponent,
+            n.data(),
+            n0inv.data(),
+            r2.data(),
+            base.data(),
+            out.data());
+
+    for (size_t lane = 0; lane < count; ++lane) {
+      const size_t i = group[start + lane];
+      actual.resize(expected[i].size());
+      FromLimbs(out.data() + lane,
+                lanes,
+                engine.radix,
+                s,
+                actual.data(),
+                static_cast<DWORD>(actual.size()));
+      // |expected| is big-endian.
+      if (!std::equal(actual.rbegin(), actual.rend(), expected[i].begin())) {
+        status[i] = NTE_BAD_SIGNATURE;
+      }
+    }
+  }
+}
+
+bool RsaBatchVerifier::Verify(const std::vector<Request> &requests,
+                              std::vector<DWORD> &status) const {
+  status.assign(requests.size(), ERROR_SUCCESS);
+  std::vector<std::vector<BYTE>> expected(requests.size());
+  std::map<std::pair<DWORD, DWORD>, std::vector<size_t>> groups;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const Request &r = requests[i];
+    if (r.key >= keys_.size() || keys_[r.key].Bits() == 0) {
+      status[i] = NTE_BAD_KEY;
+      continue;
+    }
+    const RsaKey &key = keys_[r.key];
+    const LaneKey *lane = laneKeys_[r.key].get();
+    if (!lane) {
+      if (!key.Verify(r.hashAlgo,
+                      r.digest,
+                      r.digestSize,
+                      r.flags,
+                      r.signature,
+                      r.signatureSize)) {
+        status[i] = GetLastError();
+      }
+      continue;
+    }
+
+    if (!key.Encode(r.hashAlgo, r.digest, r.digestSize, r.flags,
+                    expected[i])) {
+      status[i] = GetLastError();
+      continue;
+    }
+    if (r.signatureSize != key.SignatureSize()
+        || BigNum::Compare(BigNum::FromLittleEndian(r.signature,
+                                                    r.signatureSize),
+                           key.Modulus()) >= 0) {
+      status[i] = NTE_BAD_SIGNATURE;
+      continue;
+    }
+    groups[std::make_pair(lane->limbs, lane->exponent)].push_back(i);
+  }
+
+  for (const auto &it : groups) {
+    VerifyGroup(requests, expected, it.second, status);
+  }
+  return std::all_of(status.begin(), status.end(), [](DWORD s) {
+    return s == ERROR_SUCCESS;
+  });
+}
@@ -0,0 +1,63 @@
+// How RsaBatchVerifier runs the public operation.
+enum RsaBatchEngine {
+  RsaBatchScalar,  // RsaKey::Verify, one signature at a time
+  RsaBatchAvx2,    // 4 lanes of 32-bit limbs
+  RsaBatchIfma,    // 8 lanes of 52-bit limbs with AVX-512 IFMA
+};
+
+// Verifies PKCS#1 v1.5 signatures made by many different RSA keys.
+//
+// RsaKey::Verify runs one exponentiation per call, so a corpus spread over
+// thousands of keys gets little from its cached Montgomery context.  This
+// packs independent (modulus, signature) pairs into SIMD lanes instead and
+// runs the public exponent's square-and-multiply chain for all of them at
+// once.  Requests are grouped by limb count and exponent; a group that does
+// not fill its last vector repeats a lane and throws the copies away.
+//
+// The lanes use almost-Montgomery multiplication: values stay below 2n and
+// only the final result is reduced, which needs 4n < R, so every modulus
+// gets at least two spare bits in its top limb.  Nothing here handles
+// secrets, and none of it is constant-time.
+class RsaBatchVerifier {
+public:
+  struct Request {
+    DWORD key;  // index returned by AddKey
+    ALG_ID hashAlgo;
+    LPCBYTE digest;
+    DWORD digestSize;
+    DWORD flags;  // CRYPT_NOHASHOID
+    LPCBYTE signature;  // little-endian, as CryptSignHash writes it
+    DWORD signatureSize;
+  };
+
+private:
+  struct LaneKey;
+
+  RsaBatchEngine engine_;
+  std::vector<RsaKey> keys_;
+  std::vector<std::unique_ptr<LaneKey>> laneKeys_;
+
+  void VerifyGroup(const std::vector<Request> &requests,
+                   const std::vector<std::vector<BYTE>> &expected,
+                   const std::vector<size_t> &group,
+                   std::vector<DWORD> &status) const;
+
+public:
+  // Whether this CPU and OS can run |engine|.
+  static bool IsSupported(RsaBatchEngine engine);
+  static RsaBatchEngine BestEngine();
+
+  RsaBatchVerifier();
+  // An engine that is not supported falls back to RsaBatchScalar.
+  RsaBatchVerifier(RsaBatchEngine engine);
+  ~RsaBatchVerifier();
+
+  RsaBatchEngine Engine() const;
+  // Copies the public half of |key| and precomputes its lane constants.
+  DWORD AddKey(const RsaKey &key);
+
+  // |status| receives ERROR_SUCCESS or the error RsaKey::Verify would set
+  // for each request.  Returns true when every signature verified.
+  bool Verify(const std::vector<Request> &requests,
+              std::vector<DWORD> &status) const;
+};
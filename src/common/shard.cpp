@@ -0,0 +1,221 @@
+#include <windows.h>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "blob.h"
+#include "csp.h"
+#include "hash.h"
+#include "key.h"
+#include "shard.h"
+
+void Log(LPCWSTR Format, ...);
+
+static std::atomic<DWORD> nextThreadSlot(0);
+
+static DWORD ThreadSlot() {
+  static thread_local DWORD slot = nextThreadSlot++;
+  return slot;
+}
+
+ShardedContainer::Lease::Lease() : owner_(nullptr), index_(0) {}
+
+ShardedContainer::Lease::Lease(ShardedContainer *owner, DWORD index)
+  : owner_(owner), index_(index)
+{}
+
+ShardedContainer::Lease::Lease(Lease &&other)
+  : owner_(other.owner_), index_(other.index_) {
+  other.owner_ = nullptr;
+}
+
+ShardedContainer::Lease::~Lease() {
+  if (owner_) owner_->Release(index_);
+}
+
+ShardedContainer::Lease &ShardedContainer::Lease::operator=(Lease &&other) {
+  if (this != &other) {
+    if (owner_) owner_->Release(index_);
+    owner_ = other.owner_;
+    index_ = other.index_;
+    other.owner_ = nullptr;
+  }
+  return *this;
+}
+
+ShardedContainer::Lease::operator bool() const {
+  return owner_ != nullptr;
+}
+
+DWORD ShardedContainer::Lease::Index() const {
+  return index_;
+}
+
+// A leased shard cannot be closed, so neither of these needs the lock.
+HCRYPTPROV ShardedContainer::Lease::Provider() const {
+  return owner_ ? HCRYPTPROV(owner_->shards_[index_].csp) : NULL;
+}
+
+Key &ShardedContainer::Lease::UserKey() const {
+  return owner_->shards_[index_].key;
+}
+
+ShardedContainer::ShardedContainer()
+  : count_(0),
+    keySpec_(0),
+    leased_(0),
+    closing_(false),
+    contended_(0)
+{}
+
+ShardedContainer::~ShardedContainer() {
+  Close();
+}
+
+bool ShardedContainer::Open(LPCWSTR containerName,
+                            LPCWSTR providerName,
+                            DWORD providerType,
+                            DWORD flags,
+                            DWORD keySpec,
+                            DWORD shards) {
+  Close();
+  if (keySpec == 0) {
+    SetLastError(NTE_BAD_KEY);
+    return false;
+  }
+  if (shards == 0) {
+    shards = max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Acquired outside the lock; a slow token must not hold up Uses() etc.
+  std::unique_ptr<Shard[]> opened(new Shard[shards]);
+  DWORD count = 0;
+  for (DWORD i = 0; i < shards; ++i) {
+    Shard &shard = opened[count];
+    if (!shard.csp.Acquire(containerName, providerName, providerType, flags)) {
+      // Some providers (e.g. smart cards) allow only one context.  Use
+      // whatever we could get.
+      break;
+    }
+    shard.key.Attach(shard.csp.GetUserKey(keySpec));
+    if (!shard.key) {
+      const auto gle = GetLastError();
+      Log(L"Shard %u has no key %u - %08x\n", count, keySpec, gle);
+      // Do not leave a context behind in a slot that is not counted.
+      shard.csp.Attach(NULL);
+      SetLastError(gle);
+      break;
+    }
+    ++count;
+  }
+
+  if (count == 0) {
+    return false;
+  }
+  if (count < shards) {
+    Log(L"Opened %u of %u shards\n", count, shards);
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  shards_ = std::move(opened);
+  count_ = count;
+  keySpec_ = keySpec;
+  return true;
+}
+
+void ShardedContainer::Close() {
+  std::unique_lock<std::mutex> lock(lock_);
+  closing_ = true;
+  // Wakes threads waiting in Acquire so that they give up.
+  released_.notify_all();
+  released_.wait(lock, [this]() { return leased_ == 0; });
+  std::unique_ptr<Shard[]> shards = std::move(shards_);
+  count_ = 0;
+  keySpec_ = 0;
+  closing_ = false;
+  lock.unlock();
+  // The contexts are released outside the lock.
+  shards.reset();
+}
+
+void ShardedContainer::Release(DWORD index) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    shards_[index].busy = false;
+    --leased_;
+  }
+  // Both Acquire and Close wait on this.
+  released_.notify_all();
+}
+
+bool ShardedContainer::Claim(DWORD &index) {
+  const DWORD first = ThreadSlot() % count_;
+  for (DWORD i = 0; i < count_; ++i) {
+    index = (first + i) % count_;
+    auto &shard = shards_[index];
+    if (!shard.busy) {
+      shard.busy = true;
+      ++shard.uses;
+      ++leased_;
+      return true;
+    }
+  }
+  return false;
+}
+
+ShardedContainer::Lease ShardedContainer::TryAcquire() {
+  std::lock_guard<std::mutex> guard(lock_);
+  DWORD index;
+  if (closing_ || count_ == 0 || !Claim(index)) return Lease();
+  return Lease(this, index);
+}
+
+ShardedContainer::Lease ShardedContainer::Acquire() {
+  std::unique_lock<std::mutex> lock(lock_);
+  DWORD index;
+  bool waited = false;
+  for (;;) {
+    if (closing_ || count_ == 0) return Lease();
+    if (Claim(index)) return Lease(this, index);
+    if (!waited) {
+      ++contended_;
+      waited = true;
+    }
+    released_.wait(lock);
+  }
+}
+
+Blob ShardedContainer::Sign(ALG_ID algo, LPCBYTE digest, DWORD digestLength) {
+  Blob signature;
+  if (auto lease = Acquire()) {
+    Hash hash;
+    if (hash.Create(lease.Provider(), algo)
+        && hash.SetHashValue(digest, digestLength)) {
+      signature = hash.Sign(KeySpec());
+    }
+  }
+  return signature;
+}
+
+DWORD ShardedContainer::Size() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return count_;
+}
+
+DWORD ShardedContainer::KeySpec() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return keySpec_;
+}
+
+ULONGLONG ShardedContainer::Uses(DWORD index) const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return index < count_ ? shards_[index].uses : 0;
+}
+
+ULONGLONG ShardedContainer::Contended() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return contended_;
+}
@@ -0,0 +1,81 @@
+// A set of independently acquired contexts for one container, so that
+// worker threads can sign in parallel without sharing a handle.
+//
+// Each thread prefers the shard it was pinned to on first use and falls
+// back to scanning the others when that one is busy.  When every shard is
+// leased, Acquire sleeps until a lease is returned.  Close waits for all
+// outstanding leases, so a handle is never released while in use.
+class ShardedContainer {
+private:
+  struct Shard {
+    CSP csp;
+    Key key;
+    bool busy;
+    ULONGLONG uses;
+
+    Shard() : busy(false), uses(0) {}
+  };
+
+  std::unique_ptr<Shard[]> shards_;
+  DWORD count_;
+  DWORD keySpec_;
+  mutable std::mutex lock_;
+  std::condition_variable released_;
+  DWORD leased_;
+  bool closing_;
+  ULONGLONG contended_;
+
+  // Marks a free shard busy.  Called with |lock_| held.
+  bool Claim(DWORD &index);
+  void Release(DWORD index);
+
+public:
+  class Lease {
+  private:
+    ShardedContainer *owner_;
+    DWORD index_;
+
+    friend class ShardedContainer;
+    Lease(ShardedContainer *owner, DWORD index);
+
+  public:
+    Lease();
+    Lease(Lease &&other);
+    ~Lease();
+    Lease &operator=(Lease &&other);
+
+    operator bool() const;
+    DWORD Index() const;
+    HCRYPTPROV Provider() const;
+    Key &UserKey() const;
+  };
+
+  ShardedContainer();
+  ~ShardedContainer();
+
+  // Acquires up to |shards| contexts, 0 for one per processor, and opens
+  // the |keySpec| key of each.  Succeeds if at least one context was
+  // acquired.  Fails with NTE_BAD_KEY if |keySpec| is 0.
+  bool Open(LPCWSTR containerName,
+            LPCWSTR providerName,
+            DWORD providerType,
+            DWORD flags,
+            DWORD keySpec,
+            DWORD shards);
+  // Makes Acquire return an empty lease and waits until every lease is
+  // returned.  Must not be called by a thread holding a lease.
+  void Close();
+
+  // An empty lease if every shard is busy or the container is closed.
+  Lease TryAcquire();
+  // Waits for a free shard.  An empty lease if the container is closed.
+  Lease Acquire();
+
+  Blob Sign(ALG_ID algo, LPCBYTE digest, DWORD digestLength);
+
+  DWORD Size() const;
+  DWORD KeySpec() const;
+  ULONGLONG Uses(DWORD index) const;
+  // How many times Acquire had to wait for a shard.
+  ULONGLONG Contended() const;
+};
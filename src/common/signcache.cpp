@@ -0,0 +1,374 @@
+#include <windows.h>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "blob.h"
+#include "blobbuilder.h"
+#include "csp.h"
+#include "digest.h"
+#include "hash.h"
+#include "keyindex.h"
+#include "signcache.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+struct SignatureCacheFileHeader {
+  DWORD magic;
+  DWORD version;
+  DWORD entries;
+};
+
+struct SignatureCacheRecord {
+  KeyFingerprint fingerprint;
+  ALG_ID algo;
+  DWORD digestSize;
+  DWORD signatureSize;
+};
+
+constexpr DWORD SignatureCacheMagic = 0x4d505343;  // 'CSPM'
+constexpr DWORD SignatureCacheVersion = 1;
+constexpr DWORD ChecksumSize = SHA256Traits::DigestSize;
+
+void Checksum(LPCBYTE data, DWORD size, LPBYTE checksum) {
+  auto digester = Digester::Create(CALG_SHA_256);
+  digester->Update(data, size);
+  digester->Final(checksum);
+}
+
+}  // namespace
+
+bool SignatureCache::CacheKey::operator==(const CacheKey &other) const {
+  return algo == other.algo
+         && digestSize == other.digestSize
+         && fingerprint == other.fingerprint
+         && memcmp(digest.data(), other.digest.data(), digestSize) == 0;
+}
+
+size_t SignatureCache::CacheKeyHash::operator()(const CacheKey &key) const {
+  // Both are hash outputs, so a few of their bytes are as good as any hash.
+  ULONGLONG d = 0, f = 0;
+  memcpy(&d, key.digest.data(), sizeof(d));
+  memcpy(&f, key.fingerprint.data(), sizeof(f));
+  return static_cast<size_t>(d ^ f ^ key.algo);
+}
+
+bool SignatureCache::Fingerprint(LPCBYTE publicKeyBlob,
+                                 DWORD size,
+                                 KeyFingerprint &fingerprint) {
+  std::vector<BYTE> normalized;
+  if (!KeyIndex::Normalize(publicKeyBlob, size, normalized)) {
+    SetLastError(NTE_BAD_ALGID);
+    return false;
+  }
+  Checksum(normalized.data(),
+           static_cast<DWORD>(normalized.size()),
+           fingerprint.data());
+  return true;
+}
+
+SignatureCache::SignatureCache(const SignatureCacheConfig &config)
+  : shardCount_(max(config.shards, 1u)),
+    shards_(std::make_unique<Shard[]>(shardCount_)),
+    maxEntriesPerShard_(max(config.maxEntries / shardCount_, 1u)),
+    maxBytesPerShard_(config.maxBytes / shardCount_)
+{}
+
+bool SignatureCache::MakeKey(const KeyFingerprint &fingerprint,
+                             ALG_ID algo,
+                             LPCBYTE digest,
+                             DWORD digestSize,
+                             CacheKey &key) {
+  if (!digest || digestSize == 0 || digestSize > MaxDigestSize) return false;
+  key.fingerprint = fingerprint;
+  key.algo = algo;
+  key.digestSize = digestSize;
+  key.digest.fill(0);
+  memcpy(key.digest.data(), digest, digestSize);
+  return true;
+}
+
+SignatureCache::Shard &SignatureCache::ShardOf(const CacheKey &key) {
+  DWORD d;
+  memcpy(&d, key.digest.data(), sizeof(d));
+  return shards_[d % shardCount_];
+}
+
+bool SignatureCache::Lookup(const KeyFingerprint &fingerprint,
+                            ALG_ID algo,
+                            LPCBYTE digest,
+                            DWORD digestSize,
+                            Blob &signature,
+                            const Verifier &verify) {
+  CacheKey key;
+  if (!MakeKey(fingerprint, algo, digest, digestSize, key)) return false;
+
+  auto &shard = ShardOf(key);
+  std::vector<BYTE> unverified;
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto it = shard.map.find(key);
+    if (it == shard.map.end()) {
+      ++shard.misses;
+      return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    const auto &cached = it->second->signature;
+    if (it->second->verified) {
+      ++shard.hits;
+      if (!signature.Alloc(static_cast<DWORD>(cached.size()))) return false;
+      memcpy(LPBYTE(signature), cached.data(), cached.size());
+      return true;
+    }
+    unverified = cached;
+  }
+
+  // Loaded from a file.  The check runs outside the lock, so another thread
+  // may have replaced or dropped the entry by the time it is done.
+  const bool valid =
+    verify && verify(unverified.data(), static_cast<DWORD>(unverified.size()));
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto it = shard.map.find(key);
+  const bool same = it != shard.map.end()
+                    && it->second->signature == unverified;
+  if (!valid) {
+    if (same && !it->second->verified) {
+      shard.bytes -= unverified.size();
+      shard.lru.erase(it->second);
+      shard.map.erase(it);
+    }
+    ++shard.misses;
+    return false;
+  }
+  if (same) it->second->verified = true;
+  ++shard.hits;
+  if (!signature.Alloc(static_cast<DWORD>(unverified.size()))) return false;
+  memcpy(LPBYTE(signature), unverified.data(), unverified.size());
+  return true;
+}
+
+void SignatureCache::Put(Shard &shard,
+                         CacheKey &&key,
+                         std::vector<BYTE> &&signature,
+                         bool verified) {
+  auto it = shard.map.find(key);
+  if (it != shard.map.end()) {
+    shard.bytes -= it->second->signature.size();
+    shard.bytes += signature.size();
+    it->second->signature = std::move(signature);
+    it->second->verified = verified;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  }
+  else {
+    shard.bytes += signature.size();
+    shard.lru.push_front({key, std::move(signature), verified});
+    shard.map.emplace(std::move(key), shard.lru.begin());
+    ++shard.insertions;
+  }
+
+  while (shard.lru.size() > 1
+         && (shard.lru.size() > maxEntriesPerShard_
+             || (maxBytesPerShard_ && shard.bytes > maxBytesPerShard_))) {
+    auto &oldest = shard.lru.back();
+    shard.bytes -= oldest.signature.size();
+    shard.map.erase(oldest.key);
+    shard.lru.pop_back();
+    ++shard.evictions;
+  }
+}
+
+void SignatureCache::Insert(const KeyFingerprint &fingerprint,
+                            ALG_ID algo,
+                            LPCBYTE digest,
+                            DWORD digestSize,
+                            LPCBYTE signature,
+                            DWORD signatureSize) {
+  CacheKey key;
+  if (!signature
+      || signatureSize == 0
+      || !MakeKey(fingerprint, algo, digest, digestSize, key)) {
+    return;
+  }
+
+  auto &shard = ShardOf(key);
+  std::vector<BYTE> copy(signature, signature + signatureSize);
+  std::lock_guard<std::mutex> guard(shard.lock);
+  Put(shard, std::move(key), std::move(copy), true);
+}
+
+void SignatureCache::Clear() {
+  for (DWORD i = 0; i < shardCount_; ++i) {
+    auto &shard = shards_[i];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.map.clear();
+    shard.lru.clear();
+    shard.bytes = 0;
+  }
+}
+
+SignatureCacheMetrics SignatureCache::GetMetrics() {
+  SignatureCacheMetrics m;
+  for (DWORD i = 0; i < shardCount_; ++i) {
+    auto &shard = shards_[i];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    m.hits += shard.hits;
+    m.misses += shard.misses;
+    m.insertions += shard.insertions;
+    m.evictions += shard.evictions;
+    m.entries += static_cast<DWORD>(shard.lru.size());
+    m.bytes += shard.bytes;
+  }
+  return m;
+}
+
+bool SignatureCache::Save(LPCWSTR filename) {
+  BlobBuilder builder;
+  SignatureCacheFileHeader header = {
+    SignatureCacheMagic,
+    SignatureCacheVersion,
+    0,
+  };
+  if (!builder.AppendValue(header)) return false;
+  for (DWORD i = 0; i < shardCount_; ++i) {
+    auto &shard = shards_[i];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    // Oldest first, so that Load() leaves the newest most recently used.
+    for (auto it = shard.lru.rbegin(); it != shard.lru.rend(); ++it) {
+      const SignatureCacheRecord record = {
+        it->key.fingerprint,
+        it->key.algo,
+        it->key.digestSize,
+        static_cast<DWORD>(it->signature.size()),
+      };
+      if (!builder.AppendValue(record)
+          || !builder.Append(it->key.digest.data(), it->key.digestSize)
+          || !builder.Append(it->signature.data(), record.signatureSize)) {
+        return false;
+      }
+      ++header.entries;
+    }
+  }
+  // Room for the checksum, which covers the final header too.
+  if (!builder.Extend(ChecksumSize)) return false;
+  Blob contents = builder.Finish();
+  memcpy(LPBYTE(contents), &header, sizeof(header));
+  Checksum(contents,
+           contents.Size() - ChecksumSize,
+           LPBYTE(contents) + contents.Size() - ChecksumSize);
+
+  HANDLE file = CreateFile(filename,
+                           GENERIC_WRITE,
+                           0,
+                           nullptr,
+                           CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+  DWORD bytesWritten = 0;
+  const bool ret = WriteFile(file,
+                             LPCBYTE(contents),
+                             contents.Size(),
+                             &bytesWritten,
+                             nullptr)
+                   && bytesWritten == contents.Size();
+  if (!ret) {
+    Log(L"WriteFile failed - %08x\n", GetLastError());
+  }
+  CloseHandle(file);
+  return ret;
+}
+
+bool SignatureCache::Load(LPCWSTR filename) {
+  HANDLE file = CreateFile(filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+
+  Blob contents;
+  LARGE_INTEGER fileSize = {};
+  DWORD bytesRead = 0;
+  bool ret = GetFileSizeEx(file, &fileSize)
+             && fileSize.QuadPart >= sizeof(SignatureCacheFileHeader)
+                                     + ChecksumSize
+             && fileSize.QuadPart <= MAXDWORD
+             && contents.Alloc(static_cast<DWORD>(fileSize.QuadPart))
+             && ReadFile(file,
+                         LPBYTE(contents),
+                         contents.Size(),
+                         &bytesRead,
+                         nullptr)
+             && bytesRead == contents.Size();
+  CloseHandle(file);
+
+  BYTE checksum[ChecksumSize];
+  if (ret) {
+    Checksum(contents, contents.Size() - ChecksumSize, checksum);
+    ret = memcmp(checksum,
+                 LPCBYTE(contents) + contents.Size() - ChecksumSize,
+                 ChecksumSize) == 0;
+  }
+
+  // Parse everything before adding anything.
+  std::vector<std::pair<CacheKey, std::vector<BYTE>>> loaded;
+  if (ret) {
+    SignatureCacheFileHeader header;
+    memcpy(&header, LPCBYTE(contents), sizeof(header));
+    LPCBYTE p = LPCBYTE(contents) + sizeof(header);
+    DWORD left = contents.Size() - sizeof(header) - ChecksumSize;
+    ret = header.magic == SignatureCacheMagic
+          && header.version == SignatureCacheVersion;
+    for (DWORD i = 0; ret && i < header.entries; ++i) {
+      SignatureCacheRecord record;
+      CacheKey key;
+      ret = left >= sizeof(record);
+      if (!ret) break;
+      memcpy(&record, p, sizeof(record));
+      p += sizeof(record);
+      left -= sizeof(record);
+      ret = record.digestSize <= left
+            && record.signatureSize <= left - record.digestSize
+            && record.signatureSize > 0
+            && MakeKey(record.fingerprint,
+                       record.algo,
+                       p,
+                       record.digestSize,
+                       key);
+      if (!ret) break;
+      p += record.digestSize;
+      loaded.emplace_back(key,
+                          std::vector<BYTE>(p, p + record.signatureSize));
+      p += record.signatureSize;
+      left -= record.digestSize + record.signatureSize;
+    }
+    ret = ret && left == 0;
+  }
+  if (!ret) {
+    Log(L"%s is not a valid signature cache\n", filename);
+    return false;
+  }
+
+  for (auto &it : loaded) {
+    auto &shard = ShardOf(it.first);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Put(shard, std::move(it.first), std::move(it.second), false);
+  }
+  return true;
+}
@@ -0,0 +1,129 @@
+struct SignatureCacheConfig {
+  DWORD shards;
+  DWORD maxEntries;  // across all shards
+  SIZE_T maxBytes;   // signature bytes across all shards; 0 for no limit
+
+  SignatureCacheConfig()
+    : shards(16), maxEntries(65536), maxBytes(64 * 1024 * 1024)
+  {}
+};
+
+struct SignatureCacheMetrics {
+  ULONGLONG hits;
+  ULONGLONG misses;
+  ULONGLONG insertions;
+  ULONGLONG evictions;
+  DWORD entries;
+  SIZE_T bytes;
+
+  SignatureCacheMetrics()
+    : hits(0), misses(0), insertions(0), evictions(0), entries(0), bytes(0)
+  {}
+
+  double HitRate() const {
+    return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0;
+  }
+};
+
+// Remembers signatures by (key fingerprint, hash algorithm, digest).
+//
+// Only schemes that always give the same signature for the same input can
+// be cached.  Fingerprint() accepts RSA keys only, whose PKCS#1 v1.5
+// signatures are deterministic, so a caller that fingerprints the key
+// first never caches DSS or ECDSA signatures.  The cache is split into
+// shards by the digest, each with its own lock and LRU list, and evicts
+// the least recently used entries of a shard once it holds more than its
+// share of |maxEntries| or |maxBytes|.
+class SignatureCache {
+public:
+  // Longest digest that is cached (SHA-512).
+  static const DWORD MaxDigestSize = 64;
+
+  // Checks |signature| over the digest being looked up with the key being
+  // looked up.
+  typedef std::function<bool(LPCBYTE signature, DWORD size)> Verifier;
+
+private:
+  struct CacheKey {
+    KeyFingerprint fingerprint;
+    ALG_ID algo;
+    DWORD digestSize;
+    std::array<BYTE, MaxDigestSize> digest;
+
+    bool operator==(const CacheKey &other) const;
+  };
+
+  struct CacheKeyHash {
+    size_t operator()(const CacheKey &key) const;
+  };
+
+  struct Entry {
+    CacheKey key;
+    std::vector<BYTE> signature;
+    bool verified;  // false until a signature from Load() has been checked
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::list<Entry> lru;  // most recently used first
+    std::unordered_map<CacheKey, std::list<Entry>::iterator, CacheKeyHash> map;
+    SIZE_T bytes;
+    ULONGLONG hits;
+    ULONGLONG misses;
+    ULONGLONG insertions;
+    ULONGLONG evictions;
+
+    Shard() : bytes(0), hits(0), misses(0), insertions(0), evictions(0) {}
+  };
+
+  const DWORD shardCount_;
+  std::unique_ptr<Shard[]> shards_;
+  DWORD maxEntriesPerShard_;
+  SIZE_T maxBytesPerShard_;
+
+  static bool MakeKey(const KeyFingerprint &fingerprint,
+                      ALG_ID algo,
+                      LPCBYTE digest,
+                      DWORD digestSize,
+                      CacheKey &key);
+  Shard &ShardOf(const CacheKey &key);
+  void Put(Shard &shard,
+           CacheKey &&key,
+           std::vector<BYTE> &&signature,
+           bool verified);
+
+public:
+  // Fingerprints the key in |publicKeyBlob| the way KeyIndex does.  Fails
+  // with NTE_BAD_ALGID for keys whose signatures must not be cached.
+  static bool Fingerprint(LPCBYTE publicKeyBlob,
+                          DWORD size,
+                          KeyFingerprint &fingerprint);
+
+  SignatureCache(const SignatureCacheConfig &config);
+
+  // A signature from Load() is returned only once |verify| accepts it, and
+  // only that first hit pays for the check.  One that |verify| rejects, or
+  // that is found with no |verify|, is dropped and counts as a miss.
+  bool Lookup(const KeyFingerprint &fingerprint,
+              ALG_ID algo,
+              LPCBYTE digest,
+              DWORD digestSize,
+              Blob &signature,
+              const Verifier &verify = nullptr);
+  void Insert(const KeyFingerprint &fingerprint,
+              ALG_ID algo,
+              LPCBYTE digest,
+              DWORD digestSize,
+              LPCBYTE signature,
+              DWORD signatureSize);
+  void Clear();
+  SignatureCacheMetrics GetMetrics();
+
+  // The file ends with a SHA-256 of its contents, and Load() rejects the
+  // whole file if that does not match.  The checksum only catches damage;
+  // whoever can write the file can forge it, which is why Lookup() checks
+  // each loaded signature before handing it out.  Load() adds to what is
+  // cached.
+  bool Save(LPCWSTR filename);
+  bool Load(LPCWSTR filename);
+};
@@ -0,0 +1,695 @@
+#include <windows.h>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <list>
+#include <unordered_map>
+#include "executor.h"
+#include "blob.h"
+#include "csp.h"
+#include "hash.h"
+#include "key.h"
+#include "keyindex.h"
+#include "shard.h"
+#include "signcache.h"
+#include "signsvc.h"
+
+void Log(LPCWSTR Format, ...);
+
+bool SignKey::operator<(const SignKey &other) const {
+  if (keySpec != other.keySpec) return keySpec < other.keySpec;
+  if (flags != other.flags) return flags < other.flags;
+  if (providerType != other.providerType)
+    return providerType < other.providerType;
+  if (provider != other.provider) return provider < other.provider;
+  return container < other.container;
+}
+
+CapiSignBackend::CapiSignBackend(SignatureCache *cache, DWORD shards)
+  : cache_(cache),
+    shards_(max(shards, 1u))
+{}
+
+std::shared_ptr<ShardedContainer> CapiSignBackend::GetContext(
+    const SignKey &key,
+    DWORD &status) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = contexts_.find(key);
+    if (it != contexts_.end()) {
+      status = ERROR_SUCCESS;
+      return it->second;
+    }
+  }
+
+  // Acquire outside the lock; a slow token must not block other keys.
+  auto shards = std::make_shared<ShardedContainer>();
+  if (!shards->Open(key.container.c_str(),
+                    key.provider.empty() ? nullptr : key.provider.c_str(),
+                    key.providerType,
+                    key.flags,
+                    key.keySpec,
+                    shards_)) {
+    status = GetLastError();
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  status = ERROR_SUCCESS;
+  return contexts_.insert(std::make_pair(key, shards)).first->second;
+}
+
+void CapiSignBackend::DropContext(const SignKey &key) {
+  std::lock_guard<std::mutex> guard(lock_);
+  // Batches still signing keep their reference; the contexts are released
+  // with the last of them.
+  contexts_.erase(key);
+  // A reinserted card may hold a different key under the same name.
+  fingerprints_.erase(key);
+}
+
+bool CapiSignBackend::GetFingerprint(const SignKey &key,
+                                     Key &userKey,
+                                     KeyFingerprint &fingerprint) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = fingerprints_.find(key);
+    if (it != fingerprints_.end()) {
+      if (it->second) fingerprint = *it->second;
+      return it->second.has_value();
+    }
+  }
+
+  const Blob publicKey = userKey.Export(PUBLICKEYBLOB);
+  if (publicKey.Size() == 0) {
+    // Try again with the next batch.
+    return false;
+  }
+  std::optional<KeyFingerprint> computed;
+  if (SignatureCache::Fingerprint(publicKey, publicKey.Size(), fingerprint)) {
+    computed = fingerprint;
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  fingerprints_[key] = computed;
+  return computed.has_value();
+}
+
+void CapiSignBackend::SignBatch(const SignKey &key,
+                                std::vector<SignRequest> &batch) {
+  DWORD status = ERROR_SUCCESS;
+  auto shards = GetContext(key, status);
+  // Declared after |shards| so that it is returned first.
+  ShardedContainer::Lease lease;
+  if (shards) {
+    lease = shards->Acquire();
+    if (!lease) status = NTE_BAD_KEYSET;
+  }
+  KeyFingerprint fingerprint;
+  const bool cacheable =
+    cache_ && lease && GetFingerprint(key, lease.UserKey(), fingerprint);
+  bool drop = false;
+  for (auto &request : batch) {
+    if (!lease) {
+      request.status = status;
+      continue;
+    }
+
+    // A signature the cache read from disk is checked with this key once.
+    const auto verify = [&lease, &request](LPCBYTE signature, DWORD size) {
+      Hash hash;
+      return hash.Create(lease.Provider(), request.algo)
+             && hash.SetHashValue(request.digest, request.digest.Size())
+             && hash.Verify(signature, size, lease.UserKey());
+    };
+    if (cacheable && cache_->Lookup(fingerprint,
+                                    request.algo,
+                                    request.digest,
+                                    request.digest.Size(),
+                                    request.signature,
+                                    verify)) {
+      request.status = ERROR_SUCCESS;
+      continue;
+    }
+
+    Hash hash;
+    if (hash.Create(lease.Provider(), request.algo)
+        && hash.SetHashValue(request.digest, request.digest.Size())) {
+      request.signature = hash.Sign(key.keySpec);
+    }
+    if (request.signature.Size() > 0) {
+      request.status = ERROR_SUCCESS;
+      if (cacheable) {
+        cache_->Insert(fingerprint,
+                       request.algo,
+                       request.digest,
+                       request.digest.Size(),
+                       request.signature,
+                       request.signature.Size());
+      }
+    }
+    else {
+      request.status = GetLastError();
+      if (request.status == static_cast<DWORD>(NTE_BAD_KEYSET)
+          || request.status == static_cast<DWORD>(NTE_BAD_UID)
+          || request.status == static_cast<DWORD>(SCARD_W_REMOVED_CARD)) {
+        drop = true;
+      }
+    }
+  }
+
+  // The container went away, the handle went stale or the card was pulled.
+  // Acquire new contexts for the next batch.
+  if (drop) {
+    DropContext(key);
+  }
+}
+
+DWORD CapiSignBackend::Concurrency(const SignKey &/*key*/) {
+  return shards_;
+}
+
+FanOutSigner::FanOutSigner(SignBackend &backend, DWORD threads)
+  : backend_(backend),
+    executor_(threads)
+{}
+
+Executor &FanOutSigner::GetExecutor() {
+  return executor_;
+}
+
+std::vector<FanOutResult> FanOutSigner::Sign(
+    const std::vector<SignKey> &targets,
+    ALG_ID algo,
+    LPCBYTE data,
+    DWORD dataLength) {
+  Blob digest;
+  CSP csp;
+  if (csp.Acquire(nullptr, nullptr, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)) {
+    Hash hash;
+    if (hash.Create(csp, algo) && hash.AddData(data, dataLength)) {
+      digest = hash.GetHashValue();
+    }
+  }
+  if (digest.Size() == 0) {
+    const DWORD status = GetLastError();
+    std::vector<FanOutResult> results(targets.size());
+    for (size_t i = 0; i < targets.size(); ++i) {
+      results[i].key = targets[i];
+      results[i].status = status;
+    }
+    return results;
+  }
+  return SignDigest(targets, algo, digest, digest.Size());
+}
+
+std::vector<FanOutResult> FanOutSigner::SignDigest(
+    const std::vector<SignKey> &targets,
+    ALG_ID algo,
+    LPCBYTE digest,
+    DWORD digestLength) {
+  // Every target has the same digest, so a key named more than once is
+  // signed once.  |slots| remembers which batch each target went to.
+  std::map<SignKey, size_t> batchOf;
+  std::vector<std::pair<SignKey, std::vector<SignRequest>>> batches;
+  std::vector<size_t> slots(targets.size());
+  for (size_t i = 0; i < targets.size(); ++i) {
+    auto it = batchOf.find(targets[i]);
+    if (it == batchOf.end()) {
+      it = batchOf.insert(std::make_pair(targets[i], batches.size())).first;
+      SignRequest request;
+      request.requestId = static_cast<DWORD>(i);
+      request.key = targets[i];
+      request.algo = algo;
+      // Left empty if this fails; the backend then fails the request.
+      if (request.digest.Alloc(digestLength)) {
+        memcpy(request.digest, digest, digestLength);
+      }
+      batches.emplace_back(targets[i], std::vector<SignRequest>());
+      batches.back().second.push_back(std::move(request));
+    }
+    slots[i] = it->second;
+  }
+
+  std::mutex lock;
+  std::condition_variable done;
+  size_t left = batches.size();
+  for (auto &batch : batches) {
+    executor_.Post([this, &batch, &lock, &done, &left]() {
+      backend_.SignBatch(batch.first, batch.second);
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        --left;
+      }
+      done.notify_one();
+    });
+  }
+  {
+    std::unique_lock<std::mutex> wait(lock);
+    done.wait(wait, [&left]() { return left == 0; });
+  }
+
+  std::vector<FanOutResult> results(targets.size());
+  for (size_t i = 0; i < targets.size(); ++i) {
+    const auto &request = batches[slots[i]].second.front();
+    const DWORD size = request.signature.Size();
+    results[i].key = targets[i];
+    results[i].status = request.status;
+    if (size == 0) continue;
+    if (results[i].signature.Alloc(size)) {
+      memcpy(results[i].signature, request.signature, size);
+    }
+    else {
+      results[i].status = ERROR_NOT_ENOUGH_MEMORY;
+    }
+  }
+  return results;
+}
+
+SignService::SignService(SignBackend &backend,
+                         const SignServiceConfig &config)
+  : backend_(backend),
+    config_(config),
+    stopping_(false)
+{}
+
+SignService::~SignService() {
+  Stop();
+}
+
+void SignService::Start() {
+  std::lock_guard<std::mutex> guard(lock_);
+  stopping_ = false;
+  for (auto i = static_cast<DWORD>(workers_.size()); i < config_.workers; ++i) {
+    workers_.push_back(std::thread(&SignService::Worker, this));
+  }
+}
+
+void SignService::Stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  for (auto &it : workers_) {
+    it.join();
+  }
+  workers_.clear();
+}
+
+bool SignService::Submit(SignRequest &&request) {
+  std::unique_lock<std::mutex> lock(lock_);
+  auto &client = clients_[request.clientId];
+  if (stopping_
+      || total_.pending >= config_.maxPending
+      || client.pending >= config_.maxPendingPerClient) {
+    ++client.rejected;
+    ++total_.rejected;
+    return false;
+  }
+
+  ++client.submitted;
+  ++client.pending;
+  ++total_.submitted;
+  ++total_.pending;
+
+  request.enqueuedAt = GetTickCount64();
+  const SignKey key = request.key;
+  auto it = queues_.find(key);
+  if (it == queues_.end()) {
+    it = queues_.insert(std::make_pair(key, KeyQueue())).first;
+    it->second.concurrency = max(backend_.Concurrency(key), 1u);
+  }
+  it->second.requests.push_back(std::move(request));
+  const bool scheduled = Schedule(key, it->second);
+  lock.unlock();
+
+  if (scheduled) {
+    ready_.notify_one();
+  }
+  return true;
+}
+
+bool SignService::Schedule(const SignKey &key, KeyQueue &queue) {
+  if (queue.runnable
+      || queue.requests.empty()
+      || queue.running >= queue.concurrency) {
+    return false;
+  }
+  queue.runnable = true;
+  runnable_.push_back(key);
+  return true;
+}
+
+void SignService::Account(SignMetrics &metrics,
+                          const SignRequest &request,
+                          ULONGLONG now) {
+  const auto latency = now - request.enqueuedAt;
+  --metrics.pending;
+  if (request.status == ERROR_SUCCESS)
+    ++metrics.completed;
+  else
+    ++metrics.failed;
+  metrics.totalLatency += latency;
+  metrics.maxLatency = max(metrics.maxLatency, latency);
+}
+
+void SignService::Worker() {
+  std::unique_lock<std::mutex> lock(lock_);
+  for (;;) {
+    ready_.wait(lock, [this]() { return stopping_ || !runnable_.empty(); });
+    if (runnable_.empty()) break;
+
+    // Take everything queued for one key, up to maxBatch.  Requests that
+    // arrive while the batch is being signed form the next batch.
+    const SignKey key = std::move(runnable_.front());
+    runnable_.pop_front();
+    auto &queue = queues_[key];
+    queue.runnable = false;
+    ++queue.running;
+    std::vector<SignRequest> batch;
+    while (!queue.requests.empty() && batch.size() < config_.maxBatch) {
+      batch.push_back(std::move(queue.requests.front()));
+      queue.requests.pop_front();
+    }
+    // What is left can go to another worker if the backend takes more than
+    // one batch of this key at a time.
+    if (Schedule(key, queue)) {
+      ready_.notify_one();
+    }
+    lock.unlock();
+
+    backend_.SignBatch(key, batch);
+    for (auto &request : batch) {
+      if (request.completion) {
+        request.completion(request);
+      }
+    }
+
+    const auto now = GetTickCount64();
+    lock.lock();
+    ++total_.batches;
+    std::vector<DWORD> batchClients;
+    for (const auto &request : batch) {
+      auto &client = clients_[request.clientId];
+      Account(client, request, now);
+      Account(total_, request, now);
+      if (std::find(batchClients.begin(),
+                    batchClients.end(),
+                    request.clientId) == batchClients.end()) {
+        batchClients.push_back(request.clientId);
+        ++client.batches;
+      }
+    }
+
+    auto it = queues_.find(key);
+    --it->second.running;
+    if (Schedule(key, it->second)) {
+      ready_.notify_one();
+    }
+    else if (it->second.running == 0 && !it->second.runnable) {
+      // Nothing queued, or it would have been scheduled.
+      queues_.erase(it);
+    }
+  }
+}
+
+bool SignService::GetClientMetrics(DWORD clientId, SignMetrics &metrics) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = clients_.find(clientId);
+  if (it == clients_.end()) return false;
+  metrics = it->second;
+  return true;
+}
+
+SignMetrics SignService::GetTotalMetrics() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return total_;
+}
+
+void SignService::RemoveClient(DWORD clientId) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = clients_.find(clientId);
+  if (it != clients_.end() && it->second.pending == 0) {
+    clients_.erase(it);
+  }
+}
+
+namespace {
+
+class Writer {
+private:
+  Blob &blob_;
+  DWORD offset_;
+
+public:
+  Writer(Blob &blob, DWORD offset) : blob_(blob), offset_(offset) {}
+
+  void Put(LPCVOID data, DWORD size) {
+    if (size > 0) {
+      memcpy(LPBYTE(blob_) + offset_, data, size);
+      offset_ += size;
+    }
+  }
+
+  void Put(DWORD value) {
+    Put(&value, sizeof(value));
+  }
+};
+
+class Reader {
+private:
+  LPCBYTE p_;
+  DWORD left_;
+
+public:
+  Reader(LPCBYTE data, DWORD size) : p_(data), left_(size) {}
+
+  bool Get(LPVOID data, DWORD size) {
+    if (size > left_) return false;
+    memcpy(data, p_, size);
+    p_ += size;
+    left_ -= size;
+    return true;
+  }
+
+  bool Get(DWORD &value) {
+    return Get(&value, sizeof(value));
+  }
+
+  bool Get(std::wstring &s, DWORD chars) {
+    if (chars > left_ / sizeof(WCHAR)) return false;
+    s.resize(chars);
+    return Get(&s[0], chars * sizeof(WCHAR));
+  }
+
+  bool Get(Blob &blob, DWORD size) {
+    if (size > left_) return false;
+    return blob.Alloc(size) && Get(LPBYTE(blob), size);
+  }
+
+  bool AtEnd() const {
+    return left_ == 0;
+  }
+};
+
+Blob NewFrame(DWORD payloadSize) {
+  Blob frame;
+  if (frame.Alloc(sizeof(SignFrameHeader) + payloadSize)) {
+    SignFrameHeader header = {SignProtocol::Magic, payloadSize};
+    memcpy(LPBYTE(frame), &header, sizeof(header));
+  }
+  return frame;
+}
+
+}
+
+Blob SignProtocol::EncodeRequest(DWORD requestId,
+                                 const SignKey &key,
+                                 ALG_ID algo,
+                                 LPCBYTE digest,
+                                 DWORD digestLength) {
+  const DWORD containerLength = static_cast<DWORD>(key.container.size());
+  const DWORD providerLength = static_cast<DWORD>(key.provider.size());
+  const DWORD payloadSize = 8 * sizeof(DWORD)
+                            + (containerLength + providerLength) * sizeof(WCHAR)
+                            + digestLength;
+  if (payloadSize > MaxPayload) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return Blob();
+  }
+
+  Blob frame = NewFrame(payloadSize);
+  if (frame.Size() > 0) {
+    Writer w(frame, sizeof(SignFrameHeader));
+    w.Put(requestId);
+    w.Put(key.keySpec);
+    w.Put(algo);
+    w.Put(key.providerType);
+    w.Put(key.flags);
+    w.Put(containerLength);
+    w.Put(providerLength);
+    w.Put(digestLength);
+    w.Put(key.container.data(), containerLength * sizeof(WCHAR));
+    w.Put(key.provider.data(), providerLength * sizeof(WCHAR));
+    w.Put(digest, digestLength);
+  }
+  return frame;
+}
+
+bool SignProtocol::DecodeRequest(LPCBYTE payload,
+                                 DWORD size,
+                                 SignRequest &request) {
+  Reader r(payload, size);
+  DWORD containerLength, providerLength, digestLength;
+  return r.Get(request.requestId)
+         && r.Get(request.key.keySpec)
+         && r.Get(request.algo)
+         && r.Get(request.key.providerType)
+         && r.Get(request.key.flags)
+         && r.Get(containerLength)
+         && r.Get(providerLength)
+         && r.Get(digestLength)
+         && r.Get(request.key.container, containerLength)
+         && r.Get(request.key.provider, providerLength)
+         && r.Get(request.digest, digestLength)
+         && r.AtEnd();
+}
+
+DWORD SignProtocol::ValidateRequest(SignRequest &request) {
+  if (request.key.flags & ~AllowedFlags) {
+    return ERROR_INVALID_PARAMETER;
+  }
+  request.key.flags |= CRYPT_SILENT;
+  return ERROR_SUCCESS;
+}
+
+Blob SignProtocol::EncodeResponse(DWORD requestId,
+                                  DWORD status,
+                                  LPCBYTE signature,
+                                  DWORD signatureLength) {
+  Blob frame = NewFrame(3 * sizeof(DWORD) + signatureLength);
+  if (frame.Size() > 0) {
+    Writer w(frame, sizeof(SignFrameHeader));
+    w.Put(requestId);
+    w.Put(status);
+    w.Put(signatureLength);
+    w.Put(signature, signatureLength);
+  }
+  return frame;
+}
+
+bool SignProtocol::DecodeResponse(LPCBYTE payload,
+                                  DWORD size,
+                                  DWORD &requestId,
+                                  DWORD &status,
+                                  Blob &signature) {
+  Reader r(payload, size);
+  DWORD signatureLength;
+  return r.Get(requestId)
+         && r.Get(status)
+         && r.Get(signatureLength)
+         && (signatureLength == 0 || r.Get(signature, signatureLength))
+         && r.AtEnd();
+}
+
+LPCWSTR SignPipe::DefaultName() {
+  return L"\\\\.\\pipe\\csputil-signd";
+}
+
+SignPipe::SignPipe()
+  : pipe_(INVALID_HANDLE_VALUE),
+    readEvent_(CreateEvent(nullptr, TRUE, FALSE, nullptr)),
+    writeEvent_(CreateEvent(nullptr, TRUE, FALSE, nullptr))
+{}
+
+SignPipe::~SignPipe() {
+  Close();
+  if (readEvent_) CloseHandle(readEvent_);
+  if (writeEvent_) CloseHandle(writeEvent_);
+}
+
+bool SignPipe::Attach(HANDLE pipe) {
+  Close();
+  pipe_ = pipe;
+  return pipe_ != INVALID_HANDLE_VALUE;
+}
+
+bool SignPipe::Connect(LPCWSTR pipeName) {
+  HANDLE pipe = CreateFile(pipeName,
+                           GENERIC_READ | GENERIC_WRITE,
+                           0,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_FLAG_OVERLAPPED,
+                           nullptr);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", pipeName, GetLastError());
+    return false;
+  }
+  return Attach(pipe);
+}
+
+void SignPipe::Close() {
+  if (pipe_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(pipe_);
+    pipe_ = INVALID_HANDLE_VALUE;
+  }
+}
+
+bool SignPipe::Transfer(HANDLE event, LPBYTE buffer, DWORD size, bool write) {
+  while (size > 0) {
+    OVERLAPPED ov = {};
+    ov.hEvent = event;
+    DWORD transferred = 0;
+    BOOL ok = write
+              ? WriteFile(pipe_, buffer, size, nullptr, &ov)
+              : ReadFile(pipe_, buffer, size, nullptr, &ov);
+    if (!ok && GetLastError() != ERROR_IO_PENDING) {
+      return false;
+    }
+    if (!GetOverlappedResult(pipe_, &ov, &transferred, TRUE)
+        || transferred == 0) {
+      return false;
+    }
+    buffer += transferred;
+    size -= transferred;
+  }
+  return true;
+}
+
+bool SignPipe::ReadFrame(Blob &payload) {
+  SignFrameHeader header;
+  if (!Transfer(readEvent_,
+                reinterpret_cast<LPBYTE>(&header),
+                sizeof(header),
+                /*write*/false)) {
+    return false;
+  }
+  if (header.magic != SignProtocol::Magic
+      || header.size > SignProtocol::MaxPayload) {
+    SetLastError(ERROR_INVALID_DATA);
+    Log(L"Invalid frame header\n");
+    return false;
+  }
+  return payload.Alloc(header.size)
+         && Transfer(readEvent_, payload, header.size, /*write*/false);
+}
+
+bool SignPipe::WriteFrame(const Blob &frame) {
+  std::lock_guard<std::mutex> guard(writeLock_);
+  return frame.Size() > 0
+         && Transfer(writeEvent_,
+                     const_cast<LPBYTE>(LPCBYTE(frame)),
+                     frame.Size(),
+                     /*write*/true);
+}
@@ -0,0 +1,261 @@
+// Identifies one key in one container.  Requests with the same SignKey are
+// coalesced into a batch and signed with the same acquired handle.
+struct SignKey {
+  std::wstring container;
+  std::wstring provider;
+  DWORD providerType;
+  DWORD flags;
+  DWORD keySpec;
+
+  SignKey() : providerType(0), flags(0), keySpec(0) {}
+  bool operator<(const SignKey &other) const;
+};
+
+struct SignRequest {
+  DWORD clientId;
+  DWORD requestId;
+  SignKey key;
+  ALG_ID algo;
+  Blob digest;
+  ULONGLONG enqueuedAt;
+
+  // Filled in by SignBackend::SignBatch.
+  DWORD status;
+  Blob signature;
+
+  // Called from a worker thread once the request is signed or failed.
+  std::function<void(SignRequest &)> completion;
+
+  SignRequest() : clientId(0), requestId(0), algo(0), enqueuedAt(0), status(0) {}
+  SignRequest(SignRequest &&other) = default;
+  SignRequest &operator=(SignRequest &&other) = default;
+};
+
+class SignBackend {
+public:
+  virtual ~SignBackend() {}
+
+  // Signs every request in |batch| with |key|, setting status and signature
+  // of each.  Called for one key from at most Concurrency(key) worker
+  // threads at a time.
+  virtual void SignBatch(const SignKey &key,
+                         std::vector<SignRequest> &batch) = 0;
+
+  // How many batches of |key| SignBatch can take at once.
+  virtual DWORD Concurrency(const SignKey &/*key*/) {
+    return 1;
+  }
+};
+
+class SignatureCache;
+class ShardedContainer;
+class Key;
+
+// Keeps acquired contexts per key so that clients do not pay for
+// CryptAcquireContext on every request.  With |shards| above 1 each key
+// gets a ShardedContainer of that many contexts and up to that many of its
+// batches are signed in parallel, on providers that allow it.
+//
+// Given a SignatureCache, a digest that was signed before with the same
+// RSA key is answered from the cache without touching the token.  Keys of
+// other types are never cached.
+class CapiSignBackend : public SignBackend {
+private:
+  SignatureCache *cache_;
+  const DWORD shards_;
+  std::mutex lock_;
+  std::map<SignKey, std::shared_ptr<ShardedContainer>> contexts_;
+  // nullopt for a key that cannot be cached
+  std::map<SignKey, std::optional<KeyFingerprint>> fingerprints_;
+
+  std::shared_ptr<ShardedContainer> GetContext(const SignKey &key,
+                                               DWORD &status);
+  void DropContext(const SignKey &key);
+  bool GetFingerprint(const SignKey &key,
+                      Key &userKey,
+                      KeyFingerprint &fingerprint);
+
+public:
+  CapiSignBackend(SignatureCache *cache = nullptr, DWORD shards = 1);
+
+  void SignBatch(const SignKey &key, std::vector<SignRequest> &batch);
+  DWORD Concurrency(const SignKey &key);
+};
+
+struct FanOutResult {
+  SignKey key;
+  DWORD status;
+  Blob signature;
+
+  FanOutResult() : status(0) {}
+  FanOutResult(FanOutResult &&other) = default;
+  FanOutResult &operator=(FanOutResult &&other) = default;
+};
+
+// Signs one digest with several keys at once.
+//
+// Sign() hashes the data once and hands the digest to |backend| for every
+// target on an Executor, so a call takes about as long as the slowest key
+// instead of the sum of them.  A key named by several targets is signed
+// once and each of them gets a copy, which also keeps the one-thread-per-
+// key rule of SignBackend.  The results are in the order of |targets|,
+// each with its own status.
+class FanOutSigner {
+private:
+  SignBackend &backend_;
+  Executor executor_;
+
+public:
+  // At most |threads| keys are signed at once; 0 for one per processor.
+  FanOutSigner(SignBackend &backend, DWORD threads = 0);
+
+  std::vector<FanOutResult> Sign(const std::vector<SignKey> &targets,
+                                 ALG_ID algo,
+                                 LPCBYTE data,
+                                 DWORD dataLength);
+  std::vector<FanOutResult> SignDigest(const std::vector<SignKey> &targets,
+                                       ALG_ID algo,
+                                       LPCBYTE digest,
+                                       DWORD digestLength);
+  // The threads the keys are signed on, for other provider work to share.
+  Executor &GetExecutor();
+};
+
+struct SignMetrics {
+  ULONGLONG submitted;
+  ULONGLONG completed;
+  ULONGLONG failed;
+  ULONGLONG rejected;
+  ULONGLONG batches;
+  ULONGLONG totalLatency;
+  ULONGLONG maxLatency;
+  DWORD pending;
+
+  SignMetrics()
+    : submitted(0), completed(0), failed(0), rejected(0), batches(0),
+      totalLatency(0), maxLatency(0), pending(0)
+  {}
+};
+
+struct SignServiceConfig {
+  DWORD workers;
+  DWORD maxBatch;
+  DWORD maxPending;
+  DWORD maxPendingPerClient;
+
+  SignServiceConfig()
+    : workers(4), maxBatch(64), maxPending(4096), maxPendingPerClient(256)
+  {}
+};
+
+class SignService {
+private:
+  struct KeyQueue {
+    std::deque<SignRequest> requests;
+    DWORD running;      // batches being signed
+    DWORD concurrency;  // from SignBackend::Concurrency
+    bool runnable;      // in runnable_
+    KeyQueue() : running(0), concurrency(1), runnable(false) {}
+  };
+
+  SignBackend &backend_;
+  const SignServiceConfig config_;
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::map<SignKey, KeyQueue> queues_;
+  std::deque<SignKey> runnable_;
+  std::map<DWORD, SignMetrics> clients_;
+  SignMetrics total_;
+  std::vector<std::thread> workers_;
+  bool stopping_;
+
+  void Worker();
+  // Puts |key| on runnable_ if it has requests and room for another batch.
+  // Called with |lock_| held.
+  bool Schedule(const SignKey &key, KeyQueue &queue);
+  void Account(SignMetrics &metrics, const SignRequest &request, ULONGLONG now);
+
+public:
+  SignService(SignBackend &backend, const SignServiceConfig &config);
+  ~SignService();
+
+  void Start();
+  void Stop();
+
+  // Returns false without calling the completion if the service is
+  // stopping or the queue limits are reached.  Callers should report
+  // ERROR_BUSY to their client in that case.
+  bool Submit(SignRequest &&request);
+
+  bool GetClientMetrics(DWORD clientId, SignMetrics &metrics);
+  SignMetrics GetTotalMetrics();
+  void RemoveClient(DWORD clientId);
+};
+
+// Wire format shared by the signing daemon and its clients.  Every frame is
+// a SignFrameHeader followed by |size| bytes of payload.  Integers are
+// little-endian and strings are UTF-16 without a terminator.
+//
+//   request:  requestId, keySpec, algo, providerType, flags,
+//             containerLength, providerLength, digestLength,
+//             container, provider, digest
+//   response: requestId, status, signatureLength, signature
+struct SignFrameHeader {
+  DWORD magic;
+  DWORD size;
+};
+
+class SignProtocol {
+public:
+  static constexpr DWORD Magic = 0x53505343; // 'CSPS'
+  static constexpr DWORD MaxPayload = 64 * 1024;
+
+  static Blob EncodeRequest(DWORD requestId,
+                            const SignKey &key,
+                            ALG_ID algo,
+                            LPCBYTE digest,
+                            DWORD digestLength);
+  static bool DecodeRequest(LPCBYTE payload,
+                            DWORD size,
+                            SignRequest &request);
+  // The acquire flags a client may choose.  A signing daemon must not let
+  // a request create or delete a keyset, or show UI.
+  static constexpr DWORD AllowedFlags = CRYPT_MACHINE_KEYSET | CRYPT_SILENT;
+  // Checks a decoded request before it is submitted and adds CRYPT_SILENT
+  // to its flags.  Returns ERROR_INVALID_PARAMETER if the flags carry
+  // anything but AllowedFlags.
+  static DWORD ValidateRequest(SignRequest &request);
+  static Blob EncodeResponse(DWORD requestId,
+                             DWORD status,
+                             LPCBYTE signature,
+                             DWORD signatureLength);
+  static bool DecodeResponse(LPCBYTE payload,
+                             DWORD size,
+                             DWORD &requestId,
+                             DWORD &status,
+                             Blob &signature);
+};
+
+// A message pipe opened for overlapped I/O, so that one thread can block
+// in ReadFrame while completions are written from worker threads.
+class SignPipe {
+private:
+  HANDLE pipe_;
+  HANDLE readEvent_;
+  HANDLE writeEvent_;
+  std::mutex writeLock_;
+
+  bool Transfer(HANDLE event, LPBYTE buffer, DWORD size, bool write);
+
+public:
+  static LPCWSTR DefaultName();
+
+  SignPipe();
+  ~SignPipe();
+
+  bool Attach(HANDLE pipe);
+  bool Connect(LPCWSTR pipeName);
+  void Close();
+  bool ReadFrame(Blob &payload);
+  bool WriteFrame(const Blob &frame);
+};
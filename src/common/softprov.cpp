@@ -0,0 +1,722 @@
+#include <windows.h>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "bignum.h"
+#include "blob.h"
+#include "digest.h"
+#include "hash.h"
+#include "provider.h"
+#include "rsa.h"
+#include "softprov.h"
+
+void Log(LPCWSTR Format, ...);
+
+namespace {
+
+// Key store file: a header, then one record per key in the container.
+struct KeyStoreHeader {
+  DWORD magic;
+  DWORD version;
+};
+
+struct KeyStoreRecord {
+  DWORD keySpec;
+  DWORD exportable;
+  DWORD size;  // followed by a PRIVATEKEYBLOB of this size
+};
+
+constexpr DWORD KeyStoreMagic = 0x53505343;  // 'CSPS'
+constexpr DWORD KeyStoreVersion = 1;
+// The largest PRIVATEKEYBLOB RsaKey::FromBlob accepts: the headers, then
+// n and d of 16384 bits and five CRT values of half that.
+constexpr DWORD MaxKeyBlobSize =
+  sizeof(BLOBHEADER) + sizeof(RSAPUBKEY) + 9 * (16384 / 16);
+
+constexpr LPCWSTR DefaultContainer = L"default";
+constexpr DWORD MaxKeySpec = AT_SIGNATURE;
+
+// CryptoAPI reports names in the ANSI code page.  Container names created
+// here are expected to be ASCII; anything else comes back as '?'.
+std::string Narrow(const std::wstring &s) {
+  std::string narrow(s.size(), '\0');
+  for (size_t i = 0; i < s.size(); ++i) {
+    narrow[i] = s[i] < 0x80 ? static_cast<char>(s[i]) : '?';
+  }
+  return narrow;
+}
+
+BOOL CopyOut(LPBYTE data, LPDWORD dataLength, LPCVOID source, DWORD size) {
+  if (!dataLength) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  if (data) {
+    if (*dataLength < size) {
+      *dataLength = size;
+      SetLastError(ERROR_MORE_DATA);
+      return FALSE;
+    }
+    memcpy(data, source, size);
+  }
+  *dataLength = size;
+  return TRUE;
+}
+
+DWORD KeySpecOf(ALG_ID algo) {
+  switch (algo) {
+  case AT_SIGNATURE:
+  case CALG_RSA_SIGN:
+    return AT_SIGNATURE;
+  case AT_KEYEXCHANGE:
+  case CALG_RSA_KEYX:
+    return AT_KEYEXCHANGE;
+  }
+  return 0;
+}
+
+ALG_ID AlgorithmOf(DWORD keySpec) {
+  return keySpec == AT_SIGNATURE ? CALG_RSA_SIGN : CALG_RSA_KEYX;
+}
+
+}  // namespace
+
+SoftProvider::SoftProvider(const SoftProviderConfig &config)
+  : config_(config),
+    nextHandle_(0x10000),
+    randomCounter_(0),
+    randomUsed_(sizeof(randomBlock_)) {
+  LoadStore();
+}
+
+template<class T>
+std::shared_ptr<T> SoftProvider::Lookup(
+    const std::map<ULONG_PTR, std::shared_ptr<T>> &map,
+    ULONG_PTR handle,
+    DWORD error) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = map.find(handle);
+  if (it == map.end()) {
+    SetLastError(error);
+    return nullptr;
+  }
+  return it->second;
+}
+
+ULONG_PTR SoftProvider::NewHandle() {
+  // Called with lock_ held.
+  return nextHandle_ += 8;
+}
+
+void SoftProvider::Random(LPBYTE buffer, DWORD length) {
+  std::lock_guard<std::mutex> guard(randomLock_);
+  while (length > 0) {
+    if (randomUsed_ == sizeof(randomBlock_)) {
+      BYTE input[16];
+      for (int i = 0; i < 8; ++i) {
+        input[i] = static_cast<BYTE>(config_.seed >> (8 * i));
+        input[8 + i] = static_cast<BYTE>(randomCounter_ >> (8 * i));
+      }
+      ++randomCounter_;
+      Sha256 sha;
+      sha.Update(input, sizeof(input));
+      sha.Final(randomBlock_);
+      randomUsed_ = 0;
+    }
+    const DWORD n = min(length, DWORD(sizeof(randomBlock_) - randomUsed_));
+    memcpy(buffer, randomBlock_ + randomUsed_, n);
+    randomUsed_ += n;
+    buffer += n;
+    length -= n;
+  }
+}
+
+std::wstring SoftProvider::StorePath(const Container &container) const {
+  static constexpr wchar_t hex[] = L"0123456789abcdef";
+  std::wstring file = container.machine ? L"m-" : L"u-";
+  for (wchar_t c : container.name) {
+    for (int shift = 12; shift >= 0; shift -= 4) {
+      file += hex[(c >> shift) & 0xf];
+    }
+  }
+  file += L".key";
+  return (std::filesystem::path(config_.directory) / file).wstring();
+}
+
+bool SoftProvider::ContainerOfFile(LPCWSTR file,
+                                   bool &machine,
+                                   std::wstring &name) {
+  const size_t length = wcslen(file);
+  if (length < 6
+      || (file[0] != L'u' && file[0] != L'm')
+      || file[1] != L'-'
+      || wcscmp(file + length - 4, L".key") != 0
+      || (length - 6) % 4 != 0) {
+    return false;
+  }
+
+  std::wstring decoded;
+  for (size_t i = 2; i < length - 4; i += 4) {
+    wchar_t c = 0;
+    for (size_t j = i; j < i + 4; ++j) {
+      const wchar_t digit = file[j];
+      if (digit >= L'0' && digit <= L'9') {
+        c = static_cast<wchar_t>(c * 16 + (digit - L'0'));
+      }
+      else if (digit >= L'a' && digit <= L'f') {
+        c = static_cast<wchar_t>(c * 16 + (digit - L'a' + 10));
+      }
+      else {
+        return false;
+      }
+    }
+    decoded += c;
+  }
+  machine = file[0] == L'm';
+  name = std::move(decoded);
+  return true;
+}
+
+void SoftProvider::LoadStore() {
+  if (config_.directory.empty()) return;
+
+  std::error_code ec;
+  std::filesystem::create_directories(config_.directory, ec);
+  // The range-for increments with the throwing overload, so walk the
+  // directory by hand and stop at the first error.
+  std::filesystem::directory_iterator it(config_.directory, ec);
+  for (; !ec && it != std::filesystem::directory_iterator();
+       it.increment(ec)) {
+    const std::wstring file = it->path().filename().wstring();
+    auto container = std::make_shared<Container>();
+    if (!ContainerOfFile(file.c_str(), container->machine, container->name))
+      continue;
+
+    std::ifstream in(it->path(), std::ios::binary);
+    KeyStoreHeader header = {};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || header.magic != KeyStoreMagic
+        || header.version != KeyStoreVersion) {
+      Log(L"Skipping %s: not a key store file\n", file.c_str());
+      continue;
+    }
+    KeyStoreRecord record;
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+      if (record.size > MaxKeyBlobSize) {
+        Log(L"Skipping a broken key in %s\n", file.c_str());
+        break;
+      }
+      std::vector<BYTE> blob(record.size);
+      auto key = std::make_shared<RsaKey>();
+      if (!in.read(reinterpret_cast<char*>(blob.data()), blob.size())
+          || record.keySpec < 1 || record.keySpec > MaxKeySpec
+          || !key->FromBlob(blob.data(), record.size)) {
+        Log(L"Skipping a broken key in %s\n", file.c_str());
+        break;
+      }
+      container->keys[record.keySpec - 1] = { key, !!record.exportable };
+    }
+    containers_[{container->machine, container->name}] = container;
+  }
+  if (ec) {
+    Log(L"Listing %s failed - %08x\n",
+        config_.directory.c_str(),
+        ec.value());
+  }
+}
+
+bool SoftProvider::Persist(const Container &container) {
+  // Called with lock_ held.
+  if (config_.directory.empty()) return true;
+
+  std::ofstream out(std::filesystem::path(StorePath(container)),
+                    std::ios::binary | std::ios::trunc);
+  const KeyStoreHeader header = { KeyStoreMagic, KeyStoreVersion };
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (DWORD keySpec = 1; keySpec <= MaxKeySpec; ++keySpec) {
+    const auto &stored = container.keys[keySpec - 1];
+    if (!stored.key) continue;
+    KeyStoreRecord record = { keySpec, stored.exportable, 0 };
+    stored.key->ToBlob(PRIVATEKEYBLOB,
+                       AlgorithmOf(keySpec),
+                       nullptr,
+                       &record.size);
+    std::vector<BYTE> blob(record.size);
+    stored.key->ToBlob(PRIVATEKEYBLOB,
+                       AlgorithmOf(keySpec),
+                       blob.data(),
+                       &record.size);
+    out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    out.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+  }
+  if (!out) {
+    Log(L"Failed to write the key store file of %s\n",
+        container.name.c_str());
+    SetLastError(NTE_FAIL);
+    return false;
+  }
+  return true;
+}
+
+bool SoftProvider::StoreKey(Context &context,
+                            DWORD keySpec,
+                            std::shared_ptr<const RsaKey> key,
+                            bool exportable) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto &stored = context.container->keys[keySpec - 1];
+  const StoredKey previous = stored;
+  stored = { std::move(key), exportable };
+  if (context.persistent && !Persist(*context.container)) {
+    stored = previous;
+    return false;
+  }
+  return true;
+}
+
+void SoftProvider::Finish(HashObject &hash) {
+  if (!hash.finished) {
+    hash.value.resize(hash.digester->DigestSize());
+    hash.digester->Final(hash.value.data());
+    hash.finished = true;
+  }
+}
+
+BOOL SoftProvider::AcquireContext(HCRYPTPROV *prov,
+                                  LPCWSTR containerName,
+                                  LPCWSTR,
+                                  DWORD,
+                                  DWORD flags) {
+  if (!prov) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  *prov = 0;
+
+  auto context = std::make_shared<Context>();
+  context->machine = !!(flags & CRYPT_MACHINE_KEYSET);
+  context->persistent = false;
+  context->enumPosition = 0;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  if ((flags & CRYPT_VERIFYCONTEXT) == CRYPT_VERIFYCONTEXT) {
+    // Keys imported into a verification context live only as long as it.
+    context->container = std::make_shared<Container>();
+    context->container->machine = context->machine;
+  }
+  else {
+    const std::pair<bool, std::wstring> id(
+      context->machine,
+      containerName ? containerName : DefaultContainer);
+    auto it = containers_.find(id);
+    if (flags & CRYPT_DELETEKEYSET) {
+      if (it == containers_.end()) {
+        SetLastError(NTE_BAD_KEYSET);
+        return FALSE;
+      }
+      if (!config_.directory.empty()) {
+        std::error_code ec;
+        std::filesystem::remove(
+          std::filesystem::path(StorePath(*it->second)), ec);
+      }
+      containers_.erase(it);
+      return TRUE;
+    }
+    if (flags & CRYPT_NEWKEYSET) {
+      if (it != containers_.end()) {
+        SetLastError(NTE_EXISTS);
+        return FALSE;
+      }
+      auto container = std::make_shared<Container>();
+      container->machine = id.first;
+      container->name = id.second;
+      if (!Persist(*container)) return FALSE;
+      it = containers_.emplace(id, container).first;
+    }
+    else if (it == containers_.end()) {
+      SetLastError(NTE_BAD_KEYSET);
+      return FALSE;
+    }
+    context->container = it->second;
+    context->persistent = true;
+  }
+
+  *prov = NewHandle();
+  contexts_[*prov] = context;
+  return TRUE;
+}
+
+BOOL SoftProvider::ReleaseContext(HCRYPTPROV prov, DWORD) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!contexts_.erase(prov)) {
+    SetLastError(NTE_BAD_UID);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+BOOL SoftProvider::GetProvParam(HCRYPTPROV prov,
+                                DWORD param,
+                                LPBYTE data,
+                                LPDWORD dataLength,
+                                DWORD flags) {
+  auto context = Lookup(contexts_, prov, NTE_BAD_UID);
+  if (!context) return FALSE;
+
+  switch (param) {
+  case PP_ENUMCONTAINERS: {
+    std::lock_guard<std::mutex> guard(lock_);
+    if ((flags & CRYPT_FIRST) || context->enumeration.empty()) {
+      context->enumeration.clear();
+      context->enumPosition = 0;
+      for (const auto &it : containers_) {
+        if (it.first.first == context->machine) {
+          context->enumeration.push_back(Narrow(it.first.second));
+        }
+      }
+    }
+    if (!data) {
+      // Like CryptoAPI, a size query returns the longest name so that one
+      // buffer serves the whole enumeration.
+      size_t longest = 0;
+      for (const auto &name : context->enumeration) {
+        longest = max(longest, name.size() + 1);
+      }
+      if (longest == 0) {
+        SetLastError(ERROR_NO_MORE_ITEMS);
+        return FALSE;
+      }
+      return CopyOut(nullptr, dataLength, nullptr, DWORD(longest));
+    }
+    if (context->enumPosition >= context->enumeration.size()) {
+      SetLastError(ERROR_NO_MORE_ITEMS);
+      return FALSE;
+    }
+    const auto &name = context->enumeration[context->enumPosition];
+    if (!CopyOut(data, dataLength, name.c_str(), DWORD(name.size() + 1))) {
+      return FALSE;
+    }
+    ++context->enumPosition;
+    return TRUE;
+  }
+  case PP_CONTAINER:
+  case PP_UNIQUE_CONTAINER: {
+    if (!context->persistent) {
+      SetLastError(NTE_BAD_KEYSET);
+      return FALSE;
+    }
+    const auto name = Narrow(context->container->name);
+    return CopyOut(data, dataLength, name.c_str(), DWORD(name.size() + 1));
+  }
+  case PP_NAME: {
+    const auto name = Narrow(config_.name);
+    return CopyOut(data, dataLength, name.c_str(), DWORD(name.size() + 1));
+  }
+  case PP_PROVTYPE:
+    return CopyOut(data, dataLength, &config_.type, sizeof(DWORD));
+  case PP_IMPTYPE: {
+    const DWORD type = CRYPT_IMPL_SOFTWARE;
+    return CopyOut(data, dataLength, &type, sizeof(type));
+  }
+  }
+  SetLastError(NTE_BAD_TYPE);
+  return FALSE;
+}
+
+BOOL SoftProvider::GenRandom(HCRYPTPROV prov, DWORD length, LPBYTE buffer) {
+  if (!Lookup(contexts_, prov, NTE_BAD_UID)) return FALSE;
+  Random(buffer, length);
+  return TRUE;
+}
+
+BOOL SoftProvider::GenKey(HCRYPTPROV prov,
+                          ALG_ID algo,
+                          DWORD flags,
+                          HCRYPTKEY *key) {
+  auto context = Lookup(contexts_, prov, NTE_BAD_UID);
+  if (!context) return FALSE;
+  const DWORD keySpec = KeySpecOf(algo);
+  if (!keySpec) {
+    SetLastError(NTE_BAD_ALGID);
+    return FALSE;
+  }
+
+  // The key size rides in the upper 16 bits of the flags.
+  const DWORD bits = (flags >> 16) ? (flags >> 16) : config_.keyBits;
+  auto generated = std::make_shared<RsaKey>();
+  if (!generated->Generate(bits,
+                           config_.publicExponent,
+                           [this](LPBYTE buffer, DWORD length) {
+                             Random(buffer, length);
+                           })) {
+    return FALSE;
+  }
+
+  const bool exportable = !!(flags & CRYPT_EXPORTABLE);
+  if (!StoreKey(*context, keySpec, generated, exportable)) return FALSE;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  *key = NewHandle();
+  keys_[*key] = std::make_shared<KeyObject>(
+    KeyObject{ generated, AlgorithmOf(keySpec), exportable });
+  return TRUE;
+}
+
+BOOL SoftProvider::GetUserKey(HCRYPTPROV prov,
+                              DWORD keySpec,
+                              HCRYPTKEY *key) {
+  auto context = Lookup(contexts_, prov, NTE_BAD_UID);
+  if (!context) return FALSE;
+  if (keySpec < 1 || keySpec > MaxKeySpec) {
+    SetLastError(NTE_BAD_KEY);
+    return FALSE;
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  const auto stored = context->container->keys[keySpec - 1];
+  if (!stored.key) {
+    SetLastError(NTE_NO_KEY);
+    return FALSE;
+  }
+  *key = NewHandle();
+  keys_[*key] = std::make_shared<KeyObject>(
+    KeyObject{ stored.key, AlgorithmOf(keySpec), stored.exportable });
+  return TRUE;
+}
+
+BOOL SoftProvider::ImportKey(HCRYPTPROV prov,
+                             LPCBYTE data,
+                             DWORD dataLength,
+                             HCRYPTKEY pubKey,
+                             DWORD flags,
+                             HCRYPTKEY *key) {
+  auto context = Lookup(contexts_, prov, NTE_BAD_UID);
+  if (!context) return FALSE;
+  if (pubKey) {
+    // Encrypted key blobs are not supported.
+    SetLastError(NTE_BAD_KEY);
+    return FALSE;
+  }
+
+  auto imported = std::make_shared<RsaKey>();
+  if (!imported->FromBlob(data, dataLength)) return FALSE;
+
+  const auto header = reinterpret_cast<const BLOBHEADER*>(data);
+  const DWORD keySpec = KeySpecOf(header->aiKeyAlg);
+  if (!keySpec) {
+    SetLastError(NTE_BAD_ALGID);
+    return FALSE;
+  }
+  const bool exportable = !!(flags & CRYPT_EXPORTABLE);
+  if (imported->HasPrivate()
+      && !StoreKey(*context, keySpec, imported, exportable)) {
+    return FALSE;
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  *key = NewHandle();
+  keys_[*key] = std::make_shared<KeyObject>(
+    KeyObject{ imported, header->aiKeyAlg, exportable });
+  return TRUE;
+}
+
+BOOL SoftProvider::ExportKey(HCRYPTKEY key,
+                             HCRYPTKEY expKey,
+                             DWORD blobType,
+                             DWORD,
+                             LPBYTE data,
+                             LPDWORD dataLength) {
+  auto object = Lookup(keys_, key, NTE_BAD_KEY);
+  if (!object) return FALSE;
+  if (expKey) {
+    SetLastError(NTE_BAD_KEY);
+    return FALSE;
+  }
+  if (blobType == PRIVATEKEYBLOB && !object->exportable) {
+    SetLastError(NTE_BAD_KEY_STATE);
+    return FALSE;
+  }
+  if (!dataLength) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  return object->key->ToBlob(blobType, object->algo, data, dataLength);
+}
+
+BOOL SoftProvider::DestroyKey(HCRYPTKEY key) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!keys_.erase(key)) {
+    SetLastError(NTE_BAD_KEY);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+BOOL SoftProvider::CreateHash(HCRYPTPROV prov,
+                              ALG_ID algo,
+                              HCRYPTKEY key,
+                              DWORD,
+                              HCRYPTHASH *hash) {
+  auto context = Lookup(contexts_, prov, NTE_BAD_UID);
+  if (!context) return FALSE;
+  auto digester = Digester::Create(algo);
+  if (!digester || key) {
+    SetLastError(NTE_BAD_ALGID);
+    return FALSE;
+  }
+
+  auto object = std::make_shared<HashObject>();
+  object->context = context;
+  object->digester = std::move(digester);
+  object->finished = false;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  *hash = NewHandle();
+  hashes_[*hash] = object;
+  return TRUE;
+}
+
+BOOL SoftProvider::HashData(HCRYPTHASH hash,
+                            LPCBYTE data,
+                            DWORD dataLength,
+                            DWORD) {
+  auto object = Lookup(hashes_, hash, NTE_BAD_HASH);
+  if (!object) return FALSE;
+  if (object->finished) {
+    SetLastError(NTE_BAD_HASH_STATE);
+    return FALSE;
+  }
+  object->digester->Update(data, dataLength);
+  return TRUE;
+}
+
+BOOL SoftProvider::GetHashParam(HCRYPTHASH hash,
+                                DWORD param,
+                                LPBYTE data,
+                                LPDWORD dataLength,
+                                DWORD) {
+  auto object = Lookup(hashes_, hash, NTE_BAD_HASH);
+  if (!object) return FALSE;
+
+  switch (param) {
+  case HP_ALGID: {
+    const ALG_ID algo = object->digester->Algorithm();
+    return CopyOut(data, dataLength, &algo, sizeof(algo));
+  }
+  case HP_HASHSIZE: {
+    const DWORD size = object->digester->DigestSize();
+    return CopyOut(data, dataLength, &size, sizeof(size));
+  }
+  case HP_HASHVAL:
+    if (!data) {
+      return CopyOut(nullptr,
+                     dataLength,
+                     nullptr,
+                     object->digester->DigestSize());
+    }
+    Finish(*object);
+    return CopyOut(data,
+                   dataLength,
+                   object->value.data(),
+                   DWORD(object->value.size()));
+  }
+  SetLastError(NTE_BAD_TYPE);
+  return FALSE;
+}
+
+BOOL SoftProvider::SetHashParam(HCRYPTHASH hash,
+                                DWORD param,
+                                LPCBYTE data,
+                                DWORD flags) {
+  auto object = Lookup(hashes_, hash, NTE_BAD_HASH);
+  if (!object) return FALSE;
+  if (param != HP_HASHVAL) {
+    SetLastError(NTE_BAD_TYPE);
+    return FALSE;
+  }
+  // CryptSetHashParam takes no length; HP_HASHVAL is always the digest size
+  // of the hash's algorithm, so that many bytes must be readable at |data|.
+  if (!data) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  if (flags) {
+    SetLastError(NTE_BAD_FLAGS);
+    return FALSE;
+  }
+  object->value.assign(data, data + object->digester->DigestSize());
+  object->finished = true;
+  return TRUE;
+}
+
+BOOL SoftProvider::DestroyHash(HCRYPTHASH hash) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!hashes_.erase(hash)) {
+    SetLastError(NTE_BAD_HASH);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+BOOL SoftProvider::SignHash(HCRYPTHASH hash,
+                            DWORD keySpec,
+                            DWORD flags,
+                            LPBYTE signature,
+                            LPDWORD signatureLength) {
+  auto object = Lookup(hashes_, hash, NTE_BAD_HASH);
+  if (!object) return FALSE;
+  if (!signatureLength || keySpec < 1 || keySpec > MaxKeySpec) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  std::shared_ptr<const RsaKey> key;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    key = object->context->container->keys[keySpec - 1].key;
+  }
+  if (!key) {
+    SetLastError(NTE_NO_KEY);
+    return FALSE;
+  }
+
+  const DWORD size = key->SignatureSize();
+  if (!signature || *signatureLength < size) {
+    return CopyOut(signature, signatureLength, nullptr, size);
+  }
+  Finish(*object);
+  if (!key->Sign(object->digester->Algorithm(),
+                 object->value.data(),
+                 DWORD(object->value.size()),
+                 flags,
+                 signature)) {
+    return FALSE;
+  }
+  *signatureLength = size;
+  return TRUE;
+}
+
+BOOL SoftProvider::VerifySignature(HCRYPTHASH hash,
+                                   LPCBYTE signature,
+                                   DWORD signatureLength,
+                                   HCRYPTKEY pubKey,
+                                   DWORD flags) {
+  auto object = Lookup(hashes_, hash, NTE_BAD_HASH);
+  if (!object) return FALSE;
+  auto key = Lookup(keys_, pubKey, NTE_BAD_KEY);
+  if (!key) return FALSE;
+
+  Finish(*object);
+  return key->key->Verify(object->digester->Algorithm(),
+                          object->value.data(),
+                          DWORD(object->value.size()),
+                          flags,
+                          signature,
+                          signatureLength);
+}
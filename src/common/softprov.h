@@ -0,0 +1,161 @@
+struct SoftProviderConfig {
+  std::wstring name;       // returned for PP_NAME
+  DWORD type;              // returned for PP_PROVTYPE
+  std::wstring directory;  // key store; empty keeps containers in memory
+  ULONGLONG seed;          // seeds the deterministic random generator
+  DWORD keyBits;           // CryptGenKey size when the flags carry none
+  DWORD publicExponent;
+
+  SoftProviderConfig()
+    : name(L"Software Cryptographic Provider"),
+      type(PROV_RSA_FULL),
+      seed(0),
+      keyBits(1024),
+      publicExponent(65537)
+  {}
+};
+
+// A CryptoProvider that keeps containers and RSA keys in process memory, or
+// in a directory of PRIVATEKEYBLOB files when |directory| is set.  Key
+// blobs and signatures are byte-for-byte what an RSA CSP produces for the
+// same key, so code above CSP/Key/Hash cannot tell the difference.
+//
+// Randomness comes from SHA-256 in counter mode over |seed|, so key
+// generation is reproducible run to run.  This is a test and benchmark
+// backend: nothing is constant-time and key files are not protected.
+// The provider name and type passed to AcquireContext are ignored.
+class SoftProvider : public CryptoProvider {
+private:
+  struct StoredKey {
+    std::shared_ptr<const RsaKey> key;
+    bool exportable;
+  };
+
+  struct Container {
+    std::wstring name;
+    bool machine;
+    StoredKey keys[2];  // indexed by keySpec - 1
+  };
+
+  struct Context {
+    std::shared_ptr<Container> container;
+    bool machine;
+    bool persistent;
+    std::vector<std::string> enumeration;
+    size_t enumPosition;
+  };
+
+  struct KeyObject {
+    std::shared_ptr<const RsaKey> key;
+    ALG_ID algo;
+    bool exportable;
+  };
+
+  struct HashObject {
+    std::shared_ptr<Context> context;
+    std::unique_ptr<Digester> digester;
+    std::vector<BYTE> value;
+    bool finished;
+  };
+
+  const SoftProviderConfig config_;
+  std::mutex lock_;
+  ULONG_PTR nextHandle_;
+  std::map<std::pair<bool, std::wstring>, std::shared_ptr<Container>>
+    containers_;
+  std::map<HCRYPTPROV, std::shared_ptr<Context>> contexts_;
+  std::map<HCRYPTKEY, std::shared_ptr<KeyObject>> keys_;
+  std::map<HCRYPTHASH, std::shared_ptr<HashObject>> hashes_;
+
+  std::mutex randomLock_;
+  ULONGLONG randomCounter_;
+  BYTE randomBlock_[32];
+  DWORD randomUsed_;
+
+  template<class T>
+  std::shared_ptr<T> Lookup(const std::map<ULONG_PTR, std::shared_ptr<T>> &map,
+                            ULONG_PTR handle,
+                            DWORD error);
+  ULONG_PTR NewHandle();
+  std::wstring StorePath(const Container &container) const;
+  void LoadStore();
+  bool Persist(const Container &container);
+  bool StoreKey(Context &context,
+                DWORD keySpec,
+                std::shared_ptr<const RsaKey> key,
+                bool exportable);
+  void Finish(HashObject &hash);
+
+public:
+  // Decodes the name of a key store file, which is "u-" or "m-" for the
+  // user or machine keyset, the container name as 4 hex digits per char,
+  // then ".key".
+  static bool ContainerOfFile(LPCWSTR file,
+                              bool &machine,
+                              std::wstring &name);
+
+  SoftProvider(const SoftProviderConfig &config);
+
+  // Fills |buffer| from the deterministic generator.
+  void Random(LPBYTE buffer, DWORD length);
+
+  BOOL AcquireContext(HCRYPTPROV *prov,
+                      LPCWSTR containerName,
+                      LPCWSTR providerName,
+                      DWORD providerType,
+                      DWORD flags) override;
+  BOOL ReleaseContext(HCRYPTPROV prov, DWORD flags) override;
+  BOOL GetProvParam(HCRYPTPROV prov,
+                    DWORD param,
+                    LPBYTE data,
+                    LPDWORD dataLength,
+                    DWORD flags) override;
+  BOOL GenRandom(HCRYPTPROV prov, DWORD length, LPBYTE buffer) override;
+  BOOL GenKey(HCRYPTPROV prov,
+              ALG_ID algo,
+              DWORD flags,
+              HCRYPTKEY *key) override;
+  BOOL GetUserKey(HCRYPTPROV prov, DWORD keySpec, HCRYPTKEY *key) override;
+  BOOL ImportKey(HCRYPTPROV prov,
+                 LPCBYTE data,
+                 DWORD dataLength,
+                 HCRYPTKEY pubKey,
+                 DWORD flags,
+                 HCRYPTKEY *key) override;
+  BOOL ExportKey(HCRYPTKEY key,
+                 HCRYPTKEY expKey,
+                 DWORD blobType,
+                 DWORD flags,
+                 LPBYTE data,
+                 LPDWORD dataLength) override;
+  BOOL DestroyKey(HCRYPTKEY key) override;
+  BOOL CreateHash(HCRYPTPROV prov,
+                  ALG_ID algo,
+                  HCRYPTKEY key,
+                  DWORD flags,
+                  HCRYPTHASH *hash) override;
+  BOOL HashData(HCRYPTHASH hash,
+                LPCBYTE data,
+                DWORD dataLength,
+                DWORD flags) override;
+  BOOL GetHashParam(HCRYPTHASH hash,
+                    DWORD param,
+                    LPBYTE data,
+                    LPDWORD dataLength,
+                    DWORD flags) override;
+  BOOL SetHashParam(HCRYPTHASH hash,
+                    DWORD param,
+                    LPCBYTE data,
+                    DWORD flags) override;
+  BOOL DestroyHash(HCRYPTHASH hash) override;
+  BOOL SignHash(HCRYPTHASH hash,
+                DWORD keySpec,
+                DWORD flags,
+                LPBYTE signature,
+                LPDWORD signatureLength) override;
+  BOOL VerifySignature(HCRYPTHASH hash,
+                       LPCBYTE signature,
+                       DWORD signatureLength,
+                       HCRYPTKEY pubKey,
+                       DWORD flags) override;
+};
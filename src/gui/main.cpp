@@ -3,16 +3,35 @@
 #include <strsafe.h>
 #include <atlbase.h>
 #include <shobjidl.h>
+#include <array>
+#include <functional>
+#include <mutex>
 #include <vector>
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <optional>
+#include <deque>
+#include <condition_variable>
+#include <thread>
 #include "resource.h"
+#include "..\common\executor.h"
+#include "..\common\arena.h"
+#include "..\common\archive.h"
 #include "..\common\csp.h"
 #include "..\common\blob.h"
+#include "..\common\blobbuilder.h"
 #include "..\common\key.h"
 #include "..\common\hash.h"
+#include "..\common\cms.h"
+#include "..\common\keyindex.h"
+#include "..\common\keywatch.h"
+#include "..\common\nameindex.h"
+#include "..\common\provider.h"
+#include "..\common\signsvc.h"
 
 void Log(LPCWSTR Format, ...) {
   WCHAR LineBuf[1024];
@@ -32,8 +51,6 @@ static void for_each(std::initializer_list<T> list, F f) {
 
 class CMainDialog {
 private:
-  static CONST INT MAX_CONTAINER_NAME = 1024;
-
   static INT_PTR CALLBACK MainDlgProc(HWND dialog,
                                       UINT msg,
                                       WPARAM w,
@@ -94,20 +111,12 @@ private:
   std::vector<NameAndType> validProviderTypes_;
   std::vector<NameAndType> validProviders_;
 
-  const struct {
-    ALG_ID id;
-    LPCWSTR name;
-  } validHashAlgos_[3] = {
-    { CALG_MD5, L"MD5" },
-    { CALG_SHA1, L"SHA1" },
-    { CALG_SHA_256, L"SHA256" },
-  };
-
   struct ContainerListCache {
     bool isForMachine_;
     DWORD providerType_;
     NameAndType providerName_;
-    std::vector<std::wstring> names_;
+    NameIndex names_;
+    std::vector<DWORD> visible_;  // listbox row -> index in names_
 
     ContainerListCache() : isForMachine_(false), providerType_(0)
     {}
@@ -126,13 +135,32 @@ private:
         providerType_ = other.providerType_;
         providerName_ = std::move(other.providerName_);
         names_ = std::move(other.names_);
+        visible_ = std::move(other.visible_);
       }
       return *this;
     }
   } activeContainerList_;
 
+  // The KeyStoreWatcher runs on a thread of its own, since opening it reads
+  // every key file, and posts this when it queues changes or fails.
+  static constexpr UINT WM_KEYSTORE_CHANGED = WM_APP + 1;
+  std::thread keyStoreThread_;
+  HANDLE keyStoreStop_;
+  std::mutex keyStoreLock_;
+  // Both guarded by keyStoreLock_.
+  std::vector<ContainerChange> keyStoreChanges_;
+  bool keyStoreFailed_;
+
+  // Posted by SignFile's work item with the message to show, which the
+  // dialog then owns.
+  static constexpr UINT WM_SIGNFILE_DONE = WM_APP + 2;
+
   CSP activeContainer_;
+  // Keeps the containers it signs with acquired between clicks.
+  CapiSignBackend signBackend_;
+  std::unique_ptr<FanOutSigner> fanOutSigner_;
   CComPtr<IFileSaveDialog> savedialog_;
+  CComPtr<IFileOpenDialog> opendialog_;
 
   enum KeyIndex : int {
     keySigPub = 0,
@@ -142,10 +170,10 @@ private:
     keyMax,
   };
   const LPCWSTR defaultFileNames_[keyMax] = {
-    L"exchg_pub",
-    L"exchg_pri",
     L"sig_pub",
     L"sig_pri",
+    L"exchg_pub",
+    L"exchg_pri",
   };
   Blob keys_[keyMax];
 
@@ -260,10 +288,20 @@ private:
   }
 
   void InitHashAlgorithms() {
-    for (const auto &it : validHashAlgos_) {
-      ComboBox_AddString(comboHashAlgos_, it.name);
+    for (auto it = HashAlgorithm::Begin(); it != HashAlgorithm::End(); ++it) {
+      ComboBox_AddString(comboHashAlgos_, it->name);
     }
-    ComboBox_SetCurSel(comboHashAlgos_, 2);
+    ComboBox_SetCurSel(comboHashAlgos_,
+                       HashAlgorithm::Find(CALG_SHA_256)
+                       - HashAlgorithm::Begin());
+  }
+
+  // The combo box lists HashAlgorithm's table in order.
+  const HashAlgorithm *SelectedHashAlgorithm() const {
+    const auto index = ComboBox_GetCurSel(comboHashAlgos_);
+    return index >= 0 && index < HashAlgorithm::End() - HashAlgorithm::Begin()
+           ? HashAlgorithm::Begin() + index
+           : nullptr;
   }
 
   void InitFormatList() {
@@ -280,56 +318,258 @@ private:
 
   void UpdateContainerList(bool true_if_machine) {
     auto index = ComboBox_GetCurSel(comboProviderTypes_);
-    if (index < 0 && index >= static_cast<int>(validProviderTypes_.size()))
+    if (index < 0 || index >= static_cast<int>(validProviderTypes_.size()))
       return;
     const auto &selectedProviderType = validProviderTypes_[index];
 
     index = ComboBox_GetCurSel(comboProviderNames_);
-    if (index < 0 && index >= static_cast<int>(validProviders_.size()))
+    if (index < 0 || index >= static_cast<int>(validProviders_.size()))
       return;
     const auto &selectedProvider = validProviders_[index];
 
+    // While the same list is watched, it is already up to date but for
+    // the changes queued since the last notification.  If the watcher has
+    // failed in the meantime, the list is enumerated again.
+    auto &list = activeContainerList_;
+    if (keyStoreThread_.joinable()
+        && list.isForMachine_ == true_if_machine
+        && list.providerType_ == selectedProviderType.GetType()
+        && list.providerName_.DisplayName() == selectedProvider.DisplayName()) {
+      ApplyKeyStoreChanges();
+      if (keyStoreThread_.joinable()) return;
+    }
+
+    StopWatchingKeyStore();
     while (ListBox_DeleteString(listContainers_, 0) > 0);
 
     activeContainerList_ = ContainerListCache(true_if_machine,
                                               selectedProviderType.GetType(),
                                               selectedProvider);
+
     DWORD flags = CRYPT_VERIFYCONTEXT;
     if (activeContainerList_.isForMachine_)
       flags |= CRYPT_MACHINE_KEYSET;
 
     CSP csp;
-    if (csp.Acquire(/*containerName*/nullptr,
-                    selectedProvider.GetName(),
-                    selectedProviderType.GetType(),
-                    flags)) {
-      CHAR containerNameA[MAX_CONTAINER_NAME];
-      WCHAR containerNameW[MAX_CONTAINER_NAME];
-      DWORD bufferSize = sizeof(containerNameA);
-      BOOL loop = CryptGetProvParam(csp,
-                                    PP_ENUMCONTAINERS,
-                                    reinterpret_cast<LPBYTE>(containerNameA),
-                                    &bufferSize,
-                                    CRYPT_FIRST);
-      while (loop) {
-        if (MultiByteToWideChar(CP_ACP,
-                                0,
-                                containerNameA,
-                                -1,
-                                containerNameW,
-                                MAX_CONTAINER_NAME) > 0) {
-          activeContainerList_.names_.push_back(containerNameW);
+    const bool complete =
+      csp.Acquire(/*containerName*/nullptr,
+                  selectedProvider.GetName(),
+                  selectedProviderType.GetType(),
+                  flags)
+      && EnumerateContainers(csp, activeContainerList_.names_);
+    activeContainerList_.names_.Sort();
+    FilterContainerList();
+    // What a failed enumeration found is shown but not taken for the whole
+    // store, so it is not patched; the next search enumerates again.
+    if (complete) {
+      WatchKeyStore();
+    }
+  }
+
+  // Adds every container of |csp| to |names|.  Returns false if the
+  // enumeration stopped before the end.
+  static bool EnumerateContainers(CSP &csp, NameIndex &names) {
+    // PP_ENUMCONTAINERS with a null buffer returns the longest name, so
+    // one scratch buffer covers the whole enumeration.
+    DWORD maxLength = 0;
+    auto &provider = CryptoProvider::Current();
+    if (!provider.GetProvParam(csp,
+                               PP_ENUMCONTAINERS,
+                               nullptr,
+                               &maxLength,
+                               CRYPT_FIRST)) {
+      return GetLastError() == ERROR_NO_MORE_ITEMS;
+    }
+    Blob containerName;
+    if (!containerName.Alloc(maxLength + 1)) return false;
+
+    DWORD bufferSize = maxLength + 1;
+    BOOL loop = provider.GetProvParam(csp,
+                                      PP_ENUMCONTAINERS,
+                                      containerName,
+                                      &bufferSize,
+                                      CRYPT_FIRST);
+    while (loop) {
+      names.AddMultiByte(reinterpret_cast<LPCSTR>(LPBYTE(containerName)),
+                         CP_ACP);
+      bufferSize = maxLength + 1;
+      loop = provider.GetProvParam(csp,
+                                   PP_ENUMCONTAINERS,
+                                   containerName,
+                                   &bufferSize,
+                                   CRYPT_NEXT);
+    }
+    if (GetLastError() != ERROR_NO_MORE_ITEMS) {
+      Log(L"PP_ENUMCONTAINERS failed - %08x\n", GetLastError());
+      return false;
+    }
+    return true;
+  }
+
+  void FilterContainerList() {
+    const auto pattern = GetWindowText(editFilter_);
+    auto &list = activeContainerList_;
+    list.visible_.clear();
+    list.names_.FindSubstring(pattern.c_str(), list.visible_);
+
+    SetWindowRedraw(listContainers_, FALSE);
+    ListBox_ResetContent(listContainers_);
+    for (auto index : list.visible_) {
+      ListBox_AddString(listContainers_, list.names_.Get(index));
+    }
+    SetWindowRedraw(listContainers_, TRUE);
+    InvalidateRect(listContainers_, nullptr, TRUE);
+  }
+
+  // Only the Microsoft RSA providers keep their keys where
+  // KeyStoreWatcher::CapiKeyDirectory points.  Other lists are enumerated
+  // again on every search.
+  void WatchKeyStore() {
+    StopWatchingKeyStore();
+    const auto &list = activeContainerList_;
+    const auto providerName = list.providerName_.GetName();
+    if (list.providerType_ != PROV_RSA_FULL
+        && list.providerType_ != PROV_RSA_SIG
+        && list.providerType_ != PROV_RSA_SCHANNEL
+        && list.providerType_ != PROV_RSA_AES) {
+      return;
+    }
+    if (providerName && wcsncmp(providerName, L"Microsoft", 9) != 0) return;
+
+    std::wstring directory;
+    if (!KeyStoreWatcher::CapiKeyDirectory(list.isForMachine_, directory))
+      return;
+    if (!keyStoreStop_) {
+      keyStoreStop_ =
+        CreateEvent(nullptr, /*bManualReset*/TRUE, FALSE, nullptr);
+      if (!keyStoreStop_) {
+        Log(L"CreateEvent failed - %08x\n", GetLastError());
+        return;
+      }
+    }
+    std::vector<std::wstring> listed;
+    listed.reserve(list.names_.Size());
+    for (DWORD i = 0; i < list.names_.Size(); ++i) {
+      listed.emplace_back(list.names_.Get(i));
+    }
+    keyStoreThread_ = std::thread(&CMainDialog::RunKeyStoreWatcher,
+                                  this,
+                                  std::move(directory),
+                                  std::move(listed));
+  }
+
+  void StopWatchingKeyStore() {
+    if (keyStoreThread_.joinable()) {
+      SetEvent(keyStoreStop_);
+      keyStoreThread_.join();
+      ResetEvent(keyStoreStop_);
+    }
+    std::lock_guard<std::mutex> lock(keyStoreLock_);
+    keyStoreChanges_.clear();
+    keyStoreFailed_ = false;
+  }
+
+  // The watcher thread.  KeyStoreWatcher wants one thread for all its
+  // calls, and this is it.
+  void RunKeyStoreWatcher(std::wstring directory,
+                          std::vector<std::wstring> listed) {
+    KeyStoreWatcher watcher;
+    std::vector<ContainerChange> changes;
+    bool ok = watcher.Open(directory.c_str(),
+                           KeyStoreWatcher::CapiContainerName);
+    if (ok) {
+      // The watcher started after the enumeration, so whatever was created
+      // or deleted in between is where the two disagree.
+      std::vector<std::wstring> found, added, removed;
+      watcher.Containers(found);
+      std::sort(listed.begin(), listed.end());
+      std::set_difference(found.begin(), found.end(),
+                          listed.begin(), listed.end(),
+                          std::back_inserter(added));
+      std::set_difference(listed.begin(), listed.end(),
+                          found.begin(), found.end(),
+                          std::back_inserter(removed));
+      for (auto &name : added) {
+        changes.push_back({ContainerChange::Added, std::move(name)});
+      }
+      for (auto &name : removed) {
+        changes.push_back({ContainerChange::Removed, std::move(name)});
+      }
+    }
+
+    const HANDLE events[] = {keyStoreStop_, watcher.Event()};
+    while (ok) {
+      if (!changes.empty()) {
+        {
+          std::lock_guard<std::mutex> lock(keyStoreLock_);
+          keyStoreChanges_.insert(keyStoreChanges_.end(),
+                                  changes.begin(),
+                                  changes.end());
+        }
+        PostMessage(dialog_, WM_KEYSTORE_CHANGED, 0, 0);
+        changes.clear();
+      }
+      if (WaitForMultipleObjects(2, events, FALSE, INFINITE)
+          != WAIT_OBJECT_0 + 1) {
+        return;
+      }
+      ok = watcher.Read(changes);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(keyStoreLock_);
+      keyStoreFailed_ = true;
+    }
+    PostMessage(dialog_, WM_KEYSTORE_CHANGED, 0, 0);
+  }
+
+  // Patches the list and the listbox row by row, so the selection and the
+  // scroll position survive a change elsewhere in the store.
+  void ApplyKeyStoreChanges() {
+    std::vector<ContainerChange> changes;
+    bool failed = false;
+    {
+      std::lock_guard<std::mutex> lock(keyStoreLock_);
+      changes.swap(keyStoreChanges_);
+      failed = keyStoreFailed_;
+    }
+    if (failed) {
+      // The next search enumerates in full.
+      StopWatchingKeyStore();
+      return;
+    }
+
+    auto &list = activeContainerList_;
+    auto &visible = list.visible_;
+    const auto pattern = GetWindowText(editFilter_);
+    const auto selected = GetWindowText(editContainerName_);
+    for (const auto &change : changes) {
+      const auto length = static_cast<DWORD>(change.name.size());
+      DWORD index = 0;
+      if (change.action == ContainerChange::Removed) {
+        if (!list.names_.Find(change.name.c_str(), length, index)) continue;
+        auto it = std::lower_bound(visible.begin(), visible.end(), index);
+        if (it != visible.end() && *it == index) {
+          ListBox_DeleteString(listContainers_,
+                               static_cast<int>(it - visible.begin()));
+          it = visible.erase(it);
+        }
+        for (; it != visible.end(); ++it) --*it;
+        list.names_.Remove(index);
+      }
+      else if (list.names_.Insert(change.name.c_str(), length, index)) {
+        auto it = std::lower_bound(visible.begin(), visible.end(), index);
+        for (auto later = it; later != visible.end(); ++later) ++*later;
+        if (list.names_.Contains(index, pattern.c_str())) {
+          ListBox_InsertString(listContainers_,
+                               static_cast<int>(it - visible.begin()),
+                               list.names_.Get(index));
+          visible.insert(it, index);
         }
-        loop = CryptGetProvParam(csp,
-                                 PP_ENUMCONTAINERS,
-                                 reinterpret_cast<LPBYTE>(containerNameA),
-                                 &bufferSize,
-                                 CRYPT_NEXT);
       }
-      std::sort(activeContainerList_.names_.begin(),
-                activeContainerList_.names_.end());
-      for (const auto &it : activeContainerList_.names_) {
-        ListBox_AddString(listContainers_, it.c_str());
+      else if (change.name == selected) {
+        // The keys shown may no longer be the ones in the container.
+        OnSelectContainer();
       }
     }
   }
@@ -355,9 +595,10 @@ private:
 
   void OnSelectContainer() {
     auto index = ListBox_GetCurSel(listContainers_);
+    const auto &visible = activeContainerList_.visible_;
     LPCWSTR containerName =
-      (index >= 0 && index < static_cast<int>(activeContainerList_.names_.size()))
-        ? activeContainerList_.names_[index].c_str()
+      (index >= 0 && index < static_cast<int>(visible.size()))
+        ? activeContainerList_.names_.Get(visible[index])
         : nullptr;
     if (!containerName) return;
 
@@ -385,7 +626,8 @@ private:
                       keyExchgPri,
                       editKeyExchangePri_,
                       btnSaveKeyExchangePri_,
-                      std::move(keyExchange.Export(PRIVATEKEYBLOB)));
+                      std::move(keyExchange.Export(PRIVATEKEYBLOB,
+                                                    SecureArena::Default())));
       }
       else {
         if (gle == NTE_NO_KEY) {
@@ -413,7 +655,8 @@ private:
                       keySigPri,
                       editKeySignaturePri_,
                       btnSaveKeySignaturePri_,
-                      std::move(keySignature.Export(PRIVATEKEYBLOB)));
+                      std::move(keySignature.Export(PRIVATEKEYBLOB,
+                                                     SecureArena::Default())));
       }
       else {
         if (gle == NTE_NO_KEY) {
@@ -469,6 +712,28 @@ private:
     return ret;
   }
 
+  bool ShowOpenDialog(std::wstring &filepath) {
+    bool ret = false;
+    filepath = L"";
+    if (opendialog_ == nullptr) {
+      opendialog_.CoCreateInstance(CLSID_FileOpenDialog);
+    }
+
+    if (opendialog_) {
+      CComPtr<IShellItem> item;
+      if (SUCCEEDED(opendialog_->Show(dialog_))
+          && SUCCEEDED(opendialog_->GetResult(&item))) {
+        LPWSTR displayName = nullptr;
+        if (SUCCEEDED(item->GetDisplayName(SIGDN_FILESYSPATH, &displayName))) {
+          ret = true;
+          filepath = displayName;
+          CoTaskMemFree(displayName);
+        }
+      }
+    }
+    return ret;
+  }
+
   void SaveKey(KeyIndex keyIndex) {
     if (keyIndex >= 0 && keyIndex < keyMax) {
       std::wstring filepath;
@@ -481,12 +746,66 @@ private:
     }
   }
 
+  // Writes every key of the listed containers into one archive.  Keys that
+  // cannot be exported, e.g. non-exportable private keys, are skipped.
+  void ExportAll() {
+    const auto &list = activeContainerList_;
+    if (list.visible_.empty()) return;
+
+    std::wstring filepath;
+    if (!ShowSaveDialog(L"keys.cspa", filepath)) return;
+
+    KeyArchiveWriter writer;
+    bool ret = writer.Create(filepath.c_str(),
+                             KeyArchiveFormat::FlagChecksums);
+    DWORD flags = CRYPT_SILENT;
+    if (list.isForMachine_)
+      flags |= CRYPT_MACHINE_KEYSET;
+
+    for (auto it = list.visible_.begin(); ret && it != list.visible_.end();
+         ++it) {
+      LPCWSTR containerName = list.names_.Get(*it);
+      CSP csp;
+      if (!csp.Acquire(containerName,
+                       list.providerName_.GetName(),
+                       list.providerType_,
+                       flags)) {
+        continue;
+      }
+      for (DWORD keySpec : { AT_KEYEXCHANGE, AT_SIGNATURE }) {
+        Key key(csp.GetUserKey(keySpec));
+        if (!key) continue;
+        for (DWORD blobType : { PUBLICKEYBLOB, PRIVATEKEYBLOB }) {
+          Blob blob = blobType == PRIVATEKEYBLOB
+                      ? key.Export(blobType, SecureArena::Default())
+                      : key.Export(blobType);
+          if (GetLastError() == ERROR_SUCCESS) {
+            ret = ret && writer.Add(containerName,
+                                    keySpec,
+                                    blobType,
+                                    blob,
+                                    blob.Size());
+          }
+        }
+      }
+    }
+
+    WCHAR message[64];
+    if (ret && writer.Finish()) {
+      StringCbPrintf(message, sizeof(message),
+                     L"Exported %u keys.", writer.Size());
+    }
+    else {
+      StringCbCopy(message, sizeof(message), L"Failed.");
+    }
+    MessageBox(dialog_, message, L"csputil", MB_OK);
+  }
+
   static Blob GenerateHash(ALG_ID algo, Blob blob) {
     CSP csp;
     if (csp.Acquire(nullptr, nullptr, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)) {
-      HCRYPTHASH hHash = 0;
-      if (CryptCreateHash(csp, algo, 0, 0, &hHash)) {
-        Hash hash(hHash);
+      Hash hash;
+      if (hash.Create(csp, algo)) {
         if (hash.AddData(blob, blob.Size())) {
           return hash.GetHashValue();
         }
@@ -495,63 +814,214 @@ private:
     return Blob();
   }
 
+  // The selected containers, each with |keySpec|, in list order.
+  std::vector<SignKey> SelectedSignKeys(DWORD keySpec) const {
+    std::vector<SignKey> targets;
+    const auto &visible = activeContainerList_.visible_;
+    std::vector<int> rows(max(ListBox_GetSelCount(listContainers_), 0));
+    if (!rows.empty()) {
+      rows.resize(max(ListBox_GetSelItems(listContainers_,
+                                          static_cast<int>(rows.size()),
+                                          rows.data()),
+                      0));
+    }
+    for (int row : rows) {
+      if (row < 0 || row >= static_cast<int>(visible.size())) continue;
+      SignKey target;
+      target.container = activeContainerList_.names_.Get(visible[row]);
+      if (activeContainerList_.providerName_.GetName()) {
+        target.provider = activeContainerList_.providerName_.GetName();
+      }
+      target.providerType = activeContainerList_.providerType_;
+      target.flags = activeContainerList_.isForMachine_
+                     ? CRYPT_MACHINE_KEYSET
+                     : 0;
+      target.keySpec = keySpec;
+      targets.push_back(target);
+    }
+    return targets;
+  }
+
+  // Signs the digest with every selected container at once.  With one
+  // container the box shows just its signature, as it always has.
   void Sign() {
     const bool useExchgKey = !!IsDlgButtonChecked(dialog_, IDC_RADIO_EXCHANGE);
     const bool useSigKey = !!IsDlgButtonChecked(dialog_, IDC_RADIO_SIGNATURE);
-    const auto algoIndex = ComboBox_GetCurSel(comboHashAlgos_);
-    if (activeContainer_
-        && (useExchgKey ^ useSigKey)
-        && (algoIndex >= 0 && algoIndex < ARRAYSIZE(validHashAlgos_))) {
-      const auto algo = validHashAlgos_[algoIndex].id;
-      const auto keyType = useExchgKey ? AT_KEYEXCHANGE : AT_SIGNATURE;
-      std::wstring message;
-      HCRYPTHASH hHash = NULL;
-      if (CryptCreateHash(activeContainer_, algo, /*hKey*/0, /*dwFlags*/0, &hHash)) {
-        Hash hash(hHash);
-        const auto hashStr = GetWindowText(editHash_);
-        const auto inputFormat = ComboBox_GetCurSel(comboInputFormats_);
-        const auto hashVal =
-          inputFormat == ifBase64
-          ? Blob::FromBase64String(hashStr.c_str())
-          : inputFormat == ifHex
-          ? Blob::FromHexString(hashStr.c_str())
-          : inputFormat == ifUtf8
-          ? GenerateHash(algo, Blob::AsUTF8(hashStr.c_str()))
-          : Blob();
-        if (hash.SetHashValue(hashVal, hashVal.Size())) {
-          auto signature = hash.Sign(keyType);
-          if (signature.Size() > 0) {
-            if (IsDlgButtonChecked(dialog_, IDC_CHECK_FLIP)) {
-              signature.Reverse();
-            }
-            const auto outputFormat = ComboBox_GetCurSel(comboOutputFormats_);
-            if (outputFormat == ofHex) {
-              std::wstringstream ss;
-              signature.Dump(ss, /*width*/16, /*ellipsis*/4096);
-              message = ss.str();
-            }
-            else if (outputFormat == ofBase64) {
-              message = signature.ToBase64String();
-            }
-            else {
-              message = L"Invalid format selected";
-            }
-          }
-          else {
-            BuildErrorMessage(L"Failed to generate a signature",
-                              GetLastError(),
-                              message);
-          }
+    const HashAlgorithm *hashAlgo = SelectedHashAlgorithm();
+    if (!(useExchgKey ^ useSigKey) || !hashAlgo) return;
+
+    const auto algo = hashAlgo->id;
+    const auto keyType = useExchgKey ? AT_KEYEXCHANGE : AT_SIGNATURE;
+    const auto targets = SelectedSignKeys(keyType);
+    if (targets.empty()) return;
+
+    const auto hashStr = GetWindowText(editHash_);
+    const auto inputFormat = ComboBox_GetCurSel(comboInputFormats_);
+    const auto hashVal =
+      inputFormat == ifBase64
+      ? Blob::FromBase64String(hashStr.c_str())
+      : inputFormat == ifHex
+      ? Blob::FromHexString(hashStr.c_str())
+      : inputFormat == ifUtf8
+      ? GenerateHash(algo, Blob::AsUTF8(hashStr.c_str()))
+      : Blob();
+    if (hashVal.Size() == 0) {
+      SetWindowText(editSignature_, L"Invalid hash value");
+      return;
+    }
+
+    auto results = Signer().SignDigest(targets,
+                                       algo,
+                                       hashVal,
+                                       hashVal.Size());
+    const bool flip = !!IsDlgButtonChecked(dialog_, IDC_CHECK_FLIP);
+    const auto outputFormat = ComboBox_GetCurSel(comboOutputFormats_);
+    std::wstringstream ss;
+    for (auto &result : results) {
+      if (results.size() > 1) {
+        ss << result.key.container << L":\r\n";
+      }
+      if (result.status != ERROR_SUCCESS) {
+        std::wstring error;
+        BuildErrorMessage(result.status == NTE_BAD_HASH
+                            ? L"Invalid hash value"
+                            : L"Failed to generate a signature",
+                          result.status,
+                          error);
+        ss << error;
+      }
+      else if (outputFormat == ofHex || outputFormat == ofBase64) {
+        if (flip) {
+          result.signature.Reverse();
+        }
+        if (outputFormat == ofHex) {
+          result.signature.Dump(ss, /*width*/16, /*ellipsis*/4096);
         }
         else {
-          message = L"Invalid hash value";
+          ss << result.signature.ToBase64String();
         }
       }
       else {
-        BuildErrorMessage(L"CryptCreateHash failed", GetLastError(), message);
+        ss << L"Invalid format selected";
+      }
+      if (results.size() > 1) {
+        ss << L"\r\n\r\n";
+      }
+    }
+    SetWindowText(editSignature_, ss.str().c_str());
+  }
+
+  FanOutSigner &Signer() {
+    if (!fanOutSigner_) {
+      fanOutSigner_ = std::make_unique<FanOutSigner>(signBackend_);
+    }
+    return *fanOutSigner_;
+  }
+
+  // Writes a detached CMS signature of a file, in PEM when the signature
+  // format is Base64.  The file is streamed through CmsSigner, so it can be
+  // of any size, and is signed on the signer's executor with a context of
+  // its own; the result comes back as WM_SIGNFILE_DONE.
+  void SignFile() {
+    const bool useExchgKey = !!IsDlgButtonChecked(dialog_, IDC_RADIO_EXCHANGE);
+    const bool useSigKey = !!IsDlgButtonChecked(dialog_, IDC_RADIO_SIGNATURE);
+    const HashAlgorithm *hashAlgo = SelectedHashAlgorithm();
+    if (!activeContainer_ || !(useExchgKey ^ useSigKey) || !hashAlgo) {
+      return;
+    }
+
+    std::wstring content, output;
+    if (!ShowOpenDialog(content)
+        || !ShowSaveDialog(L"signature.p7s", output)) {
+      return;
+    }
+
+    CmsSignerConfig config;
+    config.hashAlgo = hashAlgo->id;
+    config.keySpec = useExchgKey ? AT_KEYEXCHANGE : AT_SIGNATURE;
+    config.pem = ComboBox_GetCurSel(comboOutputFormats_) == ofBase64;
+
+    SignKey key;
+    key.container = GetWindowText(editContainerName_);
+    if (activeContainerList_.providerName_.GetName()) {
+      key.provider = activeContainerList_.providerName_.GetName();
+    }
+    key.providerType = activeContainerList_.providerType_;
+    key.flags = activeContainerList_.isForMachine_ ? CRYPT_MACHINE_KEYSET : 0;
+    key.keySpec = config.keySpec;
+
+    EnableWindow(GetDlgItem(dialog_, IDC_BTN_SIGN_FILE), FALSE);
+    SetWindowText(editSignature_, (L"Signing " + content + L"...").c_str());
+    const HWND dialog = dialog_;
+    Signer().GetExecutor().Post([dialog, config, key, content, output]() {
+      auto message = std::make_unique<std::wstring>(
+        SignFileWith(config, key, content, output));
+      if (PostMessage(dialog,
+                      WM_SIGNFILE_DONE,
+                      0,
+                      reinterpret_cast<LPARAM>(message.get()))) {
+        message.release();
       }
-      SetWindowText(editSignature_, message.c_str());
+    });
+  }
+
+  // Runs on the executor, so it touches no member of the dialog.
+  static std::wstring SignFileWith(const CmsSignerConfig &config,
+                                   const SignKey &key,
+                                   const std::wstring &content,
+                                   const std::wstring &output) {
+    std::wstring message;
+    CSP csp;
+    if (!csp.Acquire(key.container.c_str(),
+                     key.provider.empty() ? nullptr : key.provider.c_str(),
+                     key.providerType,
+                     key.flags)) {
+      BuildErrorMessage(L"Failed to open the container",
+                        GetLastError(),
+                        message);
+      return message;
+    }
+
+    CmsSigner signer(config);
+    HANDLE file = CreateFile(output.c_str(),
+                             GENERIC_WRITE,
+                             0,
+                             nullptr,
+                             CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL,
+                             nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      BuildErrorMessage(L"CreateFile failed", GetLastError(), message);
+      return message;
+    }
+    const bool ret = signer.SignFile(
+      csp,
+      /*certificate*/nullptr,
+      0,
+      content.c_str(),
+      [file](LPCBYTE data, DWORD size) {
+        DWORD written = 0;
+        return WriteFile(file, data, size, &written, nullptr)
+               && written == size;
+      });
+    const DWORD gle = GetLastError();
+    CloseHandle(file);
+    if (ret) {
+      std::wstringstream ss;
+      ss << L"Signed " << signer.ContentSize() << L" bytes of "
+         << content << L" into " << output;
+      message = ss.str();
     }
+    else {
+      DeleteFile(output.c_str());
+      BuildErrorMessage(L"Failed to sign the file", gle, message);
+    }
+    return message;
+  }
+
+  void OnSignFileDone(std::unique_ptr<std::wstring> message) {
+    SetWindowText(editSignature_, message->c_str());
+    EnableWindow(GetDlgItem(dialog_, IDC_BTN_SIGN_FILE), TRUE);
   }
 
   HWND dialog_;
@@ -562,6 +1032,7 @@ private:
   HWND comboOutputFormats_;
   HWND listContainers_;
   HWND editContainerName_;
+  HWND editFilter_;
   HWND editKeyExchangePub_;
   HWND editKeyExchangePri_;
   HWND editKeySignaturePub_;
@@ -577,7 +1048,7 @@ private:
   INT_PTR MainDlgProcInternal(HWND dialog,
                               UINT msg,
                               WPARAM w,
-                              LPARAM) {
+                              LPARAM l) {
     INT_PTR ret = 1;
     switch (msg) {
     case WM_INITDIALOG:
@@ -589,6 +1060,7 @@ private:
       comboOutputFormats_ = GetDlgItem(dialog, IDC_COMBO_SIGNATURE_FORMAT);
       listContainers_ = GetDlgItem(dialog, IDC_LIST_CONTAINERS);
       editContainerName_ = GetDlgItem(dialog, IDC_EDIT_CONTAINERNAME);
+      editFilter_ = GetDlgItem(dialog, IDC_EDIT_FILTER);
       editKeyExchangePub_ = GetDlgItem(dialog_, IDC_EDIT_KEY_EXCHG_PUB);
       editKeyExchangePri_ = GetDlgItem(dialog_, IDC_EDIT_KEY_EXCHG_PRI);
       editKeySignaturePub_ = GetDlgItem(dialog_, IDC_EDIT_KEY_SIG_PUB);
@@ -605,9 +1077,17 @@ private:
       InitFormatList();
       InitFont();
       break;
+    case WM_KEYSTORE_CHANGED:
+      ApplyKeyStoreChanges();
+      break;
+    case WM_SIGNFILE_DONE:
+      OnSignFileDone(std::unique_ptr<std::wstring>(
+        reinterpret_cast<std::wstring*>(l)));
+      break;
     case WM_COMMAND:
       switch (LOWORD(w)) {
       case IDCANCEL:
+        StopWatchingKeyStore();
         EndDialog(dialog, IDCANCEL);
         break;
       case IDC_BTN_SEARCH_USER:
@@ -616,6 +1096,14 @@ private:
       case IDC_BTN_SEARCH_MACHINE:
         UpdateContainerList(/*true_if_machine*/true);
         break;
+      case IDC_EDIT_FILTER:
+        if (HIWORD(w) == EN_CHANGE) {
+          FilterContainerList();
+        }
+        else {
+          ret = 0;
+        }
+        break;
       case IDC_LIST_CONTAINERS:
         if (HIWORD(w) == LBN_SELCHANGE) {
           OnSelectContainer();
@@ -624,6 +1112,9 @@ private:
           ret = 0;
         }
         break;
+      case IDC_BTN_EXPORT_ALL:
+        ExportAll();
+        break;
       case IDC_BTN_SAVE_EXCHG_PUB:
         SaveKey(keyExchgPub);
         break;
@@ -639,6 +1130,9 @@ private:
       case IDC_BTN_SIGN:
         Sign();
         break;
+      case IDC_BTN_SIGN_FILE:
+        SignFile();
+        break;
       default:
         ret = 0;
       }
@@ -651,7 +1145,9 @@ private:
 
 public:
   CMainDialog()
-    : dialog_(nullptr),
+    : keyStoreStop_(nullptr),
+      keyStoreFailed_(false),
+      dialog_(nullptr),
       comboProviderTypes_(nullptr),
       comboProviderNames_(nullptr),
       comboHashAlgos_(nullptr),
@@ -671,6 +1167,9 @@ public:
   {}
 
   ~CMainDialog() {
+    StopWatchingKeyStore();
+    if (keyStoreStop_)
+      CloseHandle(keyStoreStop_);
     if (monoSpaceFont_)
       DeleteObject(monoSpaceFont_);
   }
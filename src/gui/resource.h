@@ -23,3 +23,6 @@
 #define IDC_BTN_SIGN                    1021
 #define IDC_CHECK_FLIP                  1022
 #define IDC_COMBO_SIGNATURE_FORMAT      1023
+#define IDC_EDIT_FILTER                 1024
+#define IDC_BTN_EXPORT_ALL              1025
+#define IDC_BTN_SIGN_FILE               1026
@@ -0,0 +1,395 @@
+#include <windows.h>
+#include <strsafe.h>
+#include <stdio.h>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <string>
+#include <vector>
+#include "..\common\archive.h"
+#include "..\common\blob.h"
+#include "..\common\blobbuilder.h"
+#include "..\common\csp.h"
+#include "..\common\hash.h"
+#include "..\common\keyconv.h"
+#include "..\common\keyindex.h"
+#include "..\common\keywatch.h"
+#include "..\common\provision.h"
+
+void Log(LPCWSTR Format, ...) {
+  WCHAR LineBuf[1024];
+  va_list v;
+  va_start(v, Format);
+  StringCbVPrintf(LineBuf, sizeof(LineBuf), Format, v);
+  va_end(v);
+  OutputDebugString(LineBuf);
+  fputws(LineBuf, stderr);
+}
+
+static Blob ReadContents(LPCWSTR filename) {
+  Blob blob;
+  HANDLE file = CreateFile(filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return blob;
+  }
+  LARGE_INTEGER size = {};
+  DWORD bytesRead = 0;
+  if (GetFileSizeEx(file, &size)
+      && size.QuadPart > 0
+      && size.QuadPart <= 0x100000
+      && blob.Alloc(static_cast<DWORD>(size.QuadPart))
+      && !ReadFile(file, blob, blob.Size(), &bytesRead, nullptr)) {
+    Log(L"ReadFile failed - %08x\n", GetLastError());
+    blob = Blob();
+  }
+  CloseHandle(file);
+  return blob;
+}
+
+static bool WriteContents(LPCWSTR filename, const Blob &blob) {
+  HANDLE file = CreateFile(filename,
+                           GENERIC_WRITE,
+                           0,
+                           nullptr,
+                           CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    return false;
+  }
+  DWORD bytesWritten = 0;
+  const bool ret =
+    WriteFile(file, blob, blob.Size(), &bytesWritten, nullptr)
+    && bytesWritten == blob.Size();
+  if (!ret) Log(L"WriteFile failed - %08x\n", GetLastError());
+  CloseHandle(file);
+  return ret;
+}
+
+static void PrintMatches(const KeyIndex &index,
+                         const std::vector<KeyIndex::Match> &matches) {
+  for (const auto &it : matches) {
+    const auto c = index.GetContainer(it.container);
+    wprintf(L"  %s  %s  %s  (%s, type: %u)\n",
+            c.name,
+            it.keySpec == AT_SIGNATURE ? L"AT_SIGNATURE" : L"AT_KEYEXCHANGE",
+            (c.flags & CRYPT_MACHINE_KEYSET) ? L"machine" : L"user",
+            *c.provider ? c.provider : L"(Default)",
+            c.providerType);
+  }
+}
+
+static int Scan(LPCWSTR indexFile, int argc, wchar_t *argv[]) {
+  // keyidx scan <index> <provider type> [provider name] [machine]
+  if (argc < 1) return 1;
+  const DWORD providerType = static_cast<DWORD>(_wtoi(argv[0]));
+  LPCWSTR providerName = argc >= 2 && *argv[1] ? argv[1] : nullptr;
+  const DWORD flags = argc >= 3 && _wcsicmp(argv[2], L"machine") == 0
+                      ? CRYPT_MACHINE_KEYSET : 0;
+
+  // Scans accumulate so that several providers and both the user and the
+  // machine store end up in one index.
+  KeyIndex index;
+  if (GetFileAttributes(indexFile) != INVALID_FILE_ATTRIBUTES
+      && !index.Load(indexFile)) {
+    return 1;
+  }
+  const DWORD before = index.ContainerCount();
+  if (!index.Scan(providerName, providerType, flags)) return 1;
+  wprintf(L"Indexed %u containers (%u keys in total)\n",
+          index.ContainerCount() - before,
+          index.Size());
+  return index.Save(indexFile) ? 0 : 1;
+}
+
+static void PrintChange(ContainerChange::Action action, LPCWSTR name) {
+  wprintf(L"%c %s\n",
+          action == ContainerChange::Added ? L'+'
+            : action == ContainerChange::Removed ? L'-' : L'*',
+          name);
+}
+
+// Brings an index loaded from disk up to date with |names|, the containers
+// in the key store now: new ones are indexed and the keys of ones no longer
+// there are dropped.  A container changed while nothing was watching keeps
+// the keys it had.  Returns true if the index changed.
+static bool Reconcile(KeyIndex &index,
+                      const std::vector<std::wstring> &names,
+                      LPCWSTR providerName,
+                      DWORD providerType,
+                      DWORD flags) {
+  bool changed = false;
+  const std::set<std::wstring> present(names.begin(), names.end());
+  std::set<std::wstring> indexed;
+  for (DWORD i = 0; i < index.ContainerCount(); ++i) {
+    const auto c = index.GetContainer(i);
+    if (c.providerType != providerType
+        || c.flags != flags
+        || wcscmp(c.provider, providerName ? providerName : L"") != 0) {
+      continue;
+    }
+    indexed.insert(c.name);
+    if (!present.count(c.name) && index.RemoveKeys(i)) {
+      PrintChange(ContainerChange::Removed, c.name);
+      changed = true;
+    }
+  }
+  // Added after the loop, since a new container moves the names it points
+  // to.
+  for (const auto &name : names) {
+    if (indexed.count(name)) continue;
+    if (index.ScanContainer(name.c_str(),
+                            providerName,
+                            providerType,
+                            flags)) {
+      PrintChange(ContainerChange::Added, name.c_str());
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static int Watch(LPCWSTR indexFile, int argc, wchar_t *argv[]) {
+  // keyidx watch <index> <provider type> [provider name] [machine]
+  if (argc < 1) return 1;
+  const DWORD providerType = static_cast<DWORD>(_wtoi(argv[0]));
+  LPCWSTR providerName = argc >= 2 && *argv[1] ? argv[1] : nullptr;
+  const DWORD flags = argc >= 3 && _wcsicmp(argv[2], L"machine") == 0
+                      ? CRYPT_MACHINE_KEYSET : 0;
+
+  std::wstring directory;
+  KeyStoreWatcher watcher;
+  if (!KeyStoreWatcher::CapiKeyDirectory(flags != 0, directory)
+      || !watcher.Open(directory.c_str(),
+                       KeyStoreWatcher::CapiContainerName)) {
+    return 1;
+  }
+
+  // Watching starts before the scan so that no change falls in between.
+  // An index from an earlier run is compared with what the watcher found
+  // instead.
+  KeyIndex index;
+  if (GetFileAttributes(indexFile) != INVALID_FILE_ATTRIBUTES) {
+    std::vector<std::wstring> names;
+    watcher.Containers(names);
+    if (!index.Load(indexFile)) return 1;
+    if (Reconcile(index, names, providerName, providerType, flags)
+        && !index.Save(indexFile)) {
+      return 1;
+    }
+  }
+  else if (!index.Scan(providerName, providerType, flags)
+           || !index.Save(indexFile)) {
+    return 1;
+  }
+  wprintf(L"Watching %s (%u keys indexed)\n", directory.c_str(), index.Size());
+
+  // Runs until interrupted; the index is saved after every batch.
+  std::vector<ContainerChange> changes;
+  while (WaitForSingleObject(watcher.Event(), INFINITE) == WAIT_OBJECT_0) {
+    changes.clear();
+    if (!watcher.Read(changes)) return 1;
+    for (const auto &change : changes) {
+      if (change.action == ContainerChange::Removed) {
+        const DWORD container = index.FindContainer(change.name.c_str(),
+                                                    providerName,
+                                                    providerType,
+                                                    flags);
+        if (container != KeyIndex::NoContainer) {
+          index.RemoveKeys(container);
+        }
+      }
+      else {
+        index.ScanContainer(change.name.c_str(),
+                            providerName,
+                            providerType,
+                            flags);
+      }
+      PrintChange(change.action, change.name.c_str());
+    }
+    if (!changes.empty() && !index.Save(indexFile)) return 1;
+  }
+  return 1;
+}
+
+static int Find(LPCWSTR indexFile, LPCWSTR keyFile) {
+  KeyIndex index;
+  if (!index.Load(indexFile)) return 1;
+
+  Blob key = ReadContents(keyFile);
+  if (!key.Size()) return 1;
+
+  // Either a CAPI key blob or a DER-encoded certificate.
+  LARGE_INTEGER start, end, freq;
+  std::vector<KeyIndex::Match> matches;
+  std::vector<BYTE> normalized;
+  QueryPerformanceCounter(&start);
+  const bool found =
+    KeyIndex::Normalize(key, key.Size(), normalized)
+      ? index.FindBlob(key, key.Size(), matches)
+      : index.FindCertificate(key, key.Size(), matches);
+  QueryPerformanceCounter(&end);
+  QueryPerformanceFrequency(&freq);
+
+  wprintf(L"%u match(es) in %lldus\n",
+          static_cast<DWORD>(matches.size()),
+          (end.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart);
+  PrintMatches(index, matches);
+  return found ? 0 : 2;
+}
+
+static int Duplicates(LPCWSTR indexFile) {
+  KeyIndex index;
+  if (!index.Load(indexFile)) return 1;
+
+  std::vector<std::vector<KeyIndex::Match>> groups;
+  index.Duplicates(groups);
+  for (const auto &group : groups) {
+    wprintf(L"Key held by %u containers:\n",
+            static_cast<DWORD>(group.size()));
+    PrintMatches(index, group);
+  }
+  wprintf(L"%u duplicated key(s)\n", static_cast<DWORD>(groups.size()));
+  return 0;
+}
+
+static int Provision(LPCWSTR indexFile, int argc, wchar_t *argv[]) {
+  // keyidx provision <index> <provider type> <prefix> <count>
+  //                  [bits] [sig|exchange|both] [machine]
+  if (argc < 3) return 1;
+  ProvisionConfig config;
+  config.providerType = static_cast<DWORD>(_wtoi(argv[0]));
+  LPCWSTR prefix = argv[1];
+  const int count = _wtoi(argv[2]);
+  if (argc >= 4) config.keyBits = static_cast<DWORD>(_wtoi(argv[3]));
+  if (argc >= 5) {
+    config.signature = _wcsicmp(argv[4], L"exchange") != 0;
+    config.exchange = _wcsicmp(argv[4], L"sig") != 0;
+  }
+  if (argc >= 6 && _wcsicmp(argv[5], L"machine") == 0) {
+    config.flags = CRYPT_MACHINE_KEYSET;
+  }
+  if (count <= 0 || config.keyBits == 0) return 1;
+
+  KeyIndex index;
+  if (GetFileAttributes(indexFile) != INVALID_FILE_ATTRIBUTES
+      && !index.Load(indexFile)) {
+    return 1;
+  }
+
+  std::vector<std::wstring> names;
+  WCHAR name[MAX_PATH];
+  for (int i = 0; i < count; ++i) {
+    StringCbPrintf(name, sizeof(name), L"%s-%06d", prefix, i);
+    names.push_back(name);
+  }
+
+  KeyProvisioner provisioner(config);
+  std::vector<DWORD> status;
+  const bool ret = provisioner.Run(
+    names,
+    &index,
+    [](const ProvisionProgress &p) {
+      fwprintf(stderr,
+               L"\r%u/%u containers, %u keys, %.1f keys/s",
+               p.containers,
+               p.total,
+               p.keys,
+               p.KeysPerSecond());
+    },
+    status);
+  fputws(L"\n", stderr);
+
+  const auto p = provisioner.GetProgress();
+  wprintf(L"Provisioned %u containers (%u keys) in %.1fs, %u failed\n",
+          p.containers - p.failed,
+          p.keys,
+          p.elapsedMicros / 1e6,
+          p.failed);
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (status[i] != ERROR_SUCCESS) {
+      wprintf(L"  %s  %08x\n", names[i].c_str(), status[i]);
+    }
+  }
+  return index.Save(indexFile) && ret ? 0 : 2;
+}
+
+static int Convert(LPCWSTR archiveFile, int argc, wchar_t *argv[]) {
+  // keyidx convert <archive> <output> <spki|pkcs1|pkcs8|jwk> [pem] [public]
+  if (argc < 2) return 1;
+  KeyConverterConfig config;
+  if (_wcsicmp(argv[1], L"pkcs1") == 0) {
+    config.format = KeyConverterConfig::Pkcs1;
+  }
+  else if (_wcsicmp(argv[1], L"pkcs8") == 0) {
+    config.format = KeyConverterConfig::Pkcs8;
+  }
+  else if (_wcsicmp(argv[1], L"jwk") == 0) {
+    config.format = KeyConverterConfig::Jwk;
+  }
+  else if (_wcsicmp(argv[1], L"spki") != 0) {
+    return 1;
+  }
+  for (int i = 2; i < argc; ++i) {
+    if (_wcsicmp(argv[i], L"pem") == 0) config.pem = true;
+    if (_wcsicmp(argv[i], L"public") == 0) config.publicOnly = true;
+  }
+
+  KeyArchive archive;
+  if (!archive.Open(archiveFile)) return 1;
+
+  KeyConverter converter(config);
+  BlobBuilder out;
+  DWORD converted = 0, skipped = 0;
+  if (!converter.Convert(archive, out, converted, skipped)
+      || !WriteContents(argv[0], out.Finish())) {
+    return 1;
+  }
+  wprintf(L"Converted %u keys, skipped %u\n", converted, skipped);
+  return 0;
+}
+
+int wmain(int argc, wchar_t *argv[]) {
+  if (argc >= 4 && _wcsicmp(argv[1], L"scan") == 0) {
+    return Scan(argv[2], argc - 3, argv + 3);
+  }
+  if (argc >= 4 && _wcsicmp(argv[1], L"watch") == 0) {
+    return Watch(argv[2], argc - 3, argv + 3);
+  }
+  if (argc >= 4 && _wcsicmp(argv[1], L"find") == 0) {
+    return Find(argv[2], argv[3]);
+  }
+  if (argc >= 3 && _wcsicmp(argv[1], L"dups") == 0) {
+    return Duplicates(argv[2]);
+  }
+  if (argc >= 6 && _wcsicmp(argv[1], L"provision") == 0) {
+    return Provision(argv[2], argc - 3, argv + 3);
+  }
+  if (argc >= 5 && _wcsicmp(argv[1], L"convert") == 0) {
+    return Convert(argv[2], argc - 3, argv + 3);
+  }
+  fputws(L"USAGE:\n"
+         L"  keyidx scan <index> <provider type> [provider name] [machine]\n"
+         L"  keyidx watch <index> <provider type> [provider name] [machine]\n"
+         L"  keyidx find <index> <key blob or certificate>\n"
+         L"  keyidx dups <index>\n"
+         L"  keyidx provision <index> <provider type> <prefix> <count>"
+         L" [bits] [sig|exchange|both] [machine]\n"
+         L"  keyidx convert <archive> <output> <spki|pkcs1|pkcs8|jwk>"
+         L" [pem] [public]\n",
+         stderr);
+  return 1;
+}
@@ -0,0 +1,480 @@
+#include <windows.h>
+#include <strsafe.h>
+#include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "..\common\allocprof.h"
+#include "..\common\executor.h"
+#include "..\common\bignum.h"
+#include "..\common\blob.h"
+#include "..\common\csp.h"
+#include "..\common\digest.h"
+#include "..\common\ecdsa.h"
+#include "..\common\hash.h"
+#include "..\common\key.h"
+#include "..\common\keyindex.h"
+#include "..\common\provider.h"
+#include "..\common\random.h"
+#include "..\common\rsa.h"
+#include "..\common\blinding.h"
+#include "..\common\rsabatch.h"
+#include "..\common\latency.h"
+#include "..\common\signsvc.h"
+#include "..\common\softprov.h"
+
+static bool verbose = false;
+
+void Log(LPCWSTR Format, ...) {
+  // Injected faults make every layer log; keep the report readable.
+  if (!verbose) return;
+  WCHAR LineBuf[1024];
+  va_list v;
+  va_start(v, Format);
+  StringCbVPrintf(LineBuf, sizeof(LineBuf), Format, v);
+  va_end(v);
+  OutputDebugString(LineBuf);
+  fputws(LineBuf, stderr);
+}
+
+struct BenchConfig {
+  DWORD requests;
+  DWORD clients;
+  DWORD keys;
+  DWORD workers;
+  DWORD shards;     // contexts per key
+  DWORD maxAllocs;  // per request; 0 to not profile allocations
+
+  BenchConfig()
+    : requests(200), clients(8), keys(4), workers(4), shards(1), maxAllocs(0)
+  {}
+};
+
+static bool FindProfile(LPCWSTR name, LatencyProfile &profile) {
+  if (_wcsicmp(name, L"none") == 0) {
+    profile = LatencyProfile();
+  }
+  else if (_wcsicmp(name, L"smartcard") == 0) {
+    profile = LatencyProfile::SmartCard();
+  }
+  else if (_wcsicmp(name, L"hsm") == 0) {
+    profile = LatencyProfile::NetworkHsm();
+  }
+  else if (_wcsicmp(name, L"flaky") == 0) {
+    profile = LatencyProfile::FlakyCard();
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+static std::wstring ContainerName(DWORD index) {
+  return L"signbench-" + std::to_wstring(index);
+}
+
+static bool CreateKeys(DWORD keys) {
+  for (DWORD i = 0; i < keys; ++i) {
+    CSP csp;
+    if (!csp.Acquire(ContainerName(i).c_str(),
+                     nullptr,
+                     PROV_RSA_AES,
+                     CRYPT_NEWKEYSET)) {
+      return false;
+    }
+    Key key(csp.GenKey(AT_SIGNATURE, 0));
+    if (!key) return false;
+  }
+  return true;
+}
+
+static double Percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  const size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+static int Run(LPCWSTR profileName, const BenchConfig &bench) {
+  LatencyProfile profile;
+  if (!FindProfile(profileName, profile)) {
+    wprintf(L"Unknown profile: %s\n", profileName);
+    return 1;
+  }
+
+  // Keys are made on the bare software provider so that setup does not
+  // pay the token's latency.
+  SoftProviderConfig softConfig;
+  softConfig.seed = 1;
+  SoftProvider soft(softConfig);
+  LatencyProvider token(soft, profile);
+  CryptoProvider::Install(&soft);
+  if (!CreateKeys(bench.keys)) return 1;
+  CryptoProvider::Install(&token);
+  if (bench.maxAllocs) {
+    AllocProfiler::Reset();
+    AllocProfiler::Enable(true);
+  }
+
+  std::vector<LARGE_INTEGER> submitted(bench.requests);
+  std::vector<LARGE_INTEGER> completed(bench.requests);
+  std::vector<DWORD> status(bench.requests);
+  LARGE_INTEGER start, end, freq;
+  QueryPerformanceFrequency(&freq);
+  SignMetrics total;
+  {
+    // The backend releases its contexts on destruction, which has to
+    // happen while the token is still installed.
+    SignServiceConfig serviceConfig;
+    serviceConfig.workers = bench.workers;
+    CapiSignBackend backend(nullptr, bench.shards);
+    SignService service(backend, serviceConfig);
+    service.Start();
+
+    std::mutex lock;
+    std::condition_variable done;
+    DWORD remaining = bench.requests;
+
+    QueryPerformanceCounter(&start);
+
+    std::vector<std::thread> clients;
+    for (DWORD c = 0; c < bench.clients; ++c) {
+      clients.emplace_back([&, c]() {
+        std::mt19937 random(c);
+        for (DWORD id = c; id < bench.requests; id += bench.clients) {
+          SignRequest request;
+          request.clientId = c + 1;
+          request.requestId = id;
+          request.key.container = ContainerName(id % bench.keys);
+          request.key.providerType = PROV_RSA_AES;
+          request.key.keySpec = AT_SIGNATURE;
+          request.algo = CALG_SHA_256;
+          request.digest.Alloc(SHA256Traits::DigestSize);
+          for (DWORD i = 0; i < request.digest.Size(); ++i) {
+            LPBYTE(request.digest)[i] = static_cast<BYTE>(random());
+          }
+          request.completion = [&](SignRequest &r) {
+            QueryPerformanceCounter(&completed[r.requestId]);
+            status[r.requestId] = r.status;
+            std::lock_guard<std::mutex> guard(lock);
+            if (--remaining == 0) done.notify_all();
+          };
+
+          QueryPerformanceCounter(&submitted[id]);
+          while (!service.Submit(std::move(request))) {
+            // Backpressure; SignService did not take the request.
+            Sleep(1);
+            QueryPerformanceCounter(&submitted[id]);
+          }
+        }
+      });
+    }
+    for (auto &t : clients) t.join();
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      done.wait(guard, [&remaining]() { return remaining == 0; });
+    }
+    QueryPerformanceCounter(&end);
+    service.Stop();
+    total = service.GetTotalMetrics();
+  }
+  CryptoProvider::Install(nullptr);
+  AllocProfiler::Enable(false);
+
+  std::vector<double> latencies;
+  std::map<DWORD, DWORD> failures;
+  for (DWORD id = 0; id < bench.requests; ++id) {
+    latencies.push_back((completed[id].QuadPart - submitted[id].QuadPart)
+                        * 1000.0 / freq.QuadPart);
+    if (status[id] != ERROR_SUCCESS) ++failures[status[id]];
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const double seconds =
+    static_cast<double>(end.QuadPart - start.QuadPart) / freq.QuadPart;
+
+  const auto m = token.GetMetrics();
+  wprintf(L"profile=%s requests=%u clients=%u keys=%u workers=%u"
+          L" shards=%u\n",
+          profileName,
+          bench.requests,
+          bench.clients,
+          bench.keys,
+          bench.workers,
+          bench.shards);
+  wprintf(L"elapsed=%.3fs throughput=%.1f/s batches=%llu\n",
+          seconds,
+          bench.requests / seconds,
+          total.batches);
+  wprintf(L"latency ms: p50=%.1f p90=%.1f p99=%.1f max=%.1f\n",
+          Percentile(latencies, 0.5),
+          Percentile(latencies, 0.9),
+          Percentile(latencies, 0.99),
+          latencies.empty() ? 0 : latencies.back());
+  wprintf(L"token: acquire=%llu sign=%llu faults=%llu"
+          L" busy=%.1fs queued=%.1fs maxConcurrency=%u\n",
+          m.calls[LatencyAcquire],
+          m.calls[LatencySign],
+          m.faults,
+          m.delayMicros / 1e6,
+          m.waitMicros / 1e6,
+          m.maxConcurrency);
+  for (const auto &it : failures) {
+    wprintf(L"failed: %08x x %u\n", it.first, it.second);
+  }
+
+  if (bench.maxAllocs) {
+    const auto allocs = AllocProfiler::Snapshot();
+    const double perRequest =
+      static_cast<double>(allocs.allocations) / bench.requests;
+    wprintf(L"allocations: %.1f/request %.0f bytes/request peak=%llu bytes\n",
+            perRequest,
+            static_cast<double>(allocs.bytes) / bench.requests,
+            static_cast<ULONGLONG>(allocs.peakLiveBytes));
+    if (verbose) {
+      std::wstringstream report;
+      AllocProfiler::Report(report);
+      wprintf(L"%s", report.str().c_str());
+    }
+    if (perRequest > bench.maxAllocs) {
+      wprintf(L"FAILED: more than %u allocations per request\n",
+              bench.maxAllocs);
+      return 2;
+    }
+  }
+  return 0;
+}
+
+// Signs and verifies in process, without a provider in between, to compare
+// the cost of an RSA-2048 key with a P-256 key.
+static int CompareKeys(DWORD requests) {
+  std::mt19937 random(1);
+  const auto source = [&random](LPBYTE p, DWORD n) {
+    for (DWORD i = 0; i < n; ++i) p[i] = static_cast<BYTE>(random());
+  };
+  RsaKey rsa;
+  EcdsaP256Key ecdsa;
+  if (!rsa.Generate(2048, 65537, source) || !ecdsa.Generate(source)) {
+    return 1;
+  }
+
+  std::vector<Digest<SHA256Traits>> digests(requests);
+  for (auto &digest : digests) {
+    source(digest.data(), static_cast<DWORD>(digest.size()));
+  }
+  std::vector<BYTE> rsaSignatures(requests * rsa.SignatureSize());
+  std::vector<BYTE> ecdsaSignatures(requests * EcdsaP256Key::SignatureSize);
+
+  LARGE_INTEGER freq, t0, t1, t2, t3, t4;
+  QueryPerformanceFrequency(&freq);
+  bool ok = true;
+  QueryPerformanceCounter(&t0);
+  for (DWORD i = 0; i < requests; ++i) {
+    ok &= rsa.Sign(CALG_SHA_256,
+                   digests[i].data(),
+                   SHA256Traits::DigestSize,
+                   0,
+                   &rsaSignatures[i * rsa.SignatureSize()]);
+  }
+  QueryPerformanceCounter(&t1);
+  for (DWORD i = 0; i < requests; ++i) {
+    ok &= rsa.Verify(CALG_SHA_256,
+                     digests[i].data(),
+                     SHA256Traits::DigestSize,
+                     0,
+                     &rsaSignatures[i * rsa.SignatureSize()],
+                     rsa.SignatureSize());
+  }
+  QueryPerformanceCounter(&t2);
+  for (DWORD i = 0; i < requests; ++i) {
+    ok &= ecdsa.Sign(digests[i].data(),
+                     SHA256Traits::DigestSize,
+                     &ecdsaSignatures[i * EcdsaP256Key::SignatureSize]);
+  }
+  QueryPerformanceCounter(&t3);
+  for (DWORD i = 0; i < requests; ++i) {
+    ok &= ecdsa.Verify(digests[i].data(),
+                       SHA256Traits::DigestSize,
+                       &ecdsaSignatures[i * EcdsaP256Key::SignatureSize],
+                       EcdsaP256Key::SignatureSize);
+  }
+  QueryPerformanceCounter(&t4);
+
+  const auto rate = [&](const LARGE_INTEGER &from, const LARGE_INTEGER &to) {
+    return requests * static_cast<double>(freq.QuadPart)
+           / max(to.QuadPart - from.QuadPart, 1ll);
+  };
+  wprintf(L"operations=%u\n", requests);
+  wprintf(L"rsa-2048:   sign=%.1f/s verify=%.1f/s\n",
+          rate(t0, t1),
+          rate(t1, t2));
+  wprintf(L"ecdsa-p256: sign=%.1f/s verify=%.1f/s\n",
+          rate(t2, t3),
+          rate(t3, t4));
+
+  // The same RSA signatures blinded, with the pairs made ahead of time.
+  Executor executor(1);
+  RsaBlindingPoolConfig config;
+  config.capacity = min(requests, DWORD(1024));
+  config.refillBelow = config.capacity / 2;
+  RsaBlindingPool pool(executor, std::make_shared<const RsaKey>(rsa), config);
+  while (pool.Available() < config.capacity) Sleep(10);
+  std::vector<BYTE> blinded(rsa.SignatureSize());
+  QueryPerformanceCounter(&t0);
+  for (DWORD i = 0; i < requests; ++i) {
+    ok &= pool.Sign(CALG_SHA_256,
+                    digests[i].data(),
+                    SHA256Traits::DigestSize,
+                    0,
+                    blinded.data());
+    ok &= memcmp(blinded.data(),
+                 &rsaSignatures[i * rsa.SignatureSize()],
+                 blinded.size()) == 0;
+  }
+  QueryPerformanceCounter(&t1);
+  wprintf(L"rsa-2048 blinded: sign=%.1f/s\n", rate(t0, t1));
+
+  if (!ok) {
+    wprintf(L"FAILED: a signature did not verify\n");
+    return 2;
+  }
+  return 0;
+}
+
+// Verifies signatures spread over |keyCount| RSA-2048 keys, first one at a
+// time with RsaKey::Verify and then with every RsaBatchVerifier engine this
+// CPU can run.
+static int CompareBatch(DWORD signatures, DWORD keyCount) {
+  std::mt19937 random(1);
+  const auto source = [&random](LPBYTE p, DWORD n) {
+    for (DWORD i = 0; i < n; ++i) p[i] = static_cast<BYTE>(random());
+  };
+  std::vector<RsaKey> keys(keyCount);
+  for (auto &key : keys) {
+    if (!key.Generate(2048, 65537, source)) return 1;
+  }
+
+  const DWORD size = keys[0].SignatureSize();
+  std::vector<Digest<SHA256Traits>> digests(signatures);
+  std::vector<BYTE> signatureBytes(signatures * size);
+  std::vector<RsaBatchVerifier::Request> requests(signatures);
+  for (DWORD i = 0; i < signatures; ++i) {
+    source(digests[i].data(), static_cast<DWORD>(digests[i].size()));
+    RsaBatchVerifier::Request &r = requests[i];
+    r.key = i % keyCount;
+    r.hashAlgo = CALG_SHA_256;
+    r.digest = digests[i].data();
+    r.digestSize = SHA256Traits::DigestSize;
+    r.flags = 0;
+    r.signature = &signatureBytes[i * size];
+    r.signatureSize = size;
+    if (!keys[r.key].Sign(r.hashAlgo,
+                          r.digest,
+                          r.digestSize,
+                          r.flags,
+                          &signatureBytes[i * size])) {
+      return 1;
+    }
+  }
+
+  LARGE_INTEGER freq, t0, t1;
+  QueryPerformanceFrequency(&freq);
+  const auto rate = [&]() {
+    return signatures * static_cast<double>(freq.QuadPart)
+           / max(t1.QuadPart - t0.QuadPart, 1ll);
+  };
+  bool ok = true;
+  QueryPerformanceCounter(&t0);
+  for (const auto &r : requests) {
+    ok &= keys[r.key].Verify(r.hashAlgo,
+                             r.digest,
+                             r.digestSize,
+                             r.flags,
+                             r.signature,
+                             r.signatureSize);
+  }
+  QueryPerformanceCounter(&t1);
+  const double baseline = rate();
+  wprintf(L"signatures=%u keys=%u\n", signatures, keyCount);
+  wprintf(L"scalar: verify=%.1f/s\n", baseline);
+
+  const struct {
+    RsaBatchEngine engine;
+    LPCWSTR name;
+  } engines[] = {
+    {RsaBatchAvx2, L"avx2"},
+    {RsaBatchIfma, L"ifma"},
+  };
+  for (const auto &it : engines) {
+    if (!RsaBatchVerifier::IsSupported(it.engine)) {
+      wprintf(L"%s: not supported\n", it.name);
+      continue;
+    }
+    RsaBatchVerifier verifier(it.engine);
+    for (const auto &key : keys) {
+      verifier.AddKey(key);
+    }
+    std::vector<DWORD> status;
+    QueryPerformanceCounter(&t0);
+    ok &= verifier.Verify(requests, status);
+    QueryPerformanceCounter(&t1);
+    wprintf(L"%s: verify=%.1f/s (x%.1f)\n",
+            it.name,
+            rate(),
+            rate() / baseline);
+  }
+  if (!ok) {
+    wprintf(L"FAILED: a signature did not verify\n");
+    return 2;
+  }
+  return 0;
+}
+
+int wmain(int argc, wchar_t *argv[]) {
+  if (argc < 2) {
+    wprintf(L"USAGE: signbench <none|smartcard|hsm|flaky>"
+            L" [requests] [clients] [keys] [workers] [-v]"
+            L" [-s <contexts per key>] [-a <max allocations per request>]\n"
+            L"       signbench keys [operations]\n"
+            L"       signbench batch [signatures] [keys]\n");
+    return 1;
+  }
+
+  BenchConfig bench;
+  DWORD *const fields[] = {
+    &bench.requests, &bench.clients, &bench.keys, &bench.workers,
+  };
+  size_t field = 0;
+  for (int i = 2; i < argc; ++i) {
+    if (_wcsicmp(argv[i], L"-v") == 0) {
+      verbose = true;
+    }
+    else if (_wcsicmp(argv[i], L"-s") == 0 && i + 1 < argc) {
+      bench.shards = static_cast<DWORD>(max(1, _wtoi(argv[++i])));
+    }
+    else if (_wcsicmp(argv[i], L"-a") == 0 && i + 1 < argc) {
+      bench.maxAllocs = static_cast<DWORD>(max(1, _wtoi(argv[++i])));
+    }
+    else if (field < ARRAYSIZE(fields)) {
+      *fields[field++] = static_cast<DWORD>(max(1, _wtoi(argv[i])));
+    }
+  }
+  if (_wcsicmp(argv[1], L"keys") == 0) {
+    return CompareKeys(bench.requests);
+  }
+  if (_wcsicmp(argv[1], L"batch") == 0) {
+    // The second number is the key count here.
+    return CompareBatch(bench.requests, bench.clients);
+  }
+  return Run(argv[1], bench);
+}
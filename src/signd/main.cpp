@@ -0,0 +1,219 @@
+#include <windows.h>
+#include <strsafe.h>
+#include <stdio.h>
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <list>
+#include <unordered_map>
+#include "..\common\executor.h"
+#include "..\common\blob.h"
+#include "..\common\csp.h"
+#include "..\common\hash.h"
+#include "..\common\keyindex.h"
+#include "..\common\signcache.h"
+#include "..\common\signsvc.h"
+
+void Log(LPCWSTR Format, ...) {
+  WCHAR LineBuf[1024];
+  va_list v;
+  va_start(v, Format);
+  StringCbVPrintf(LineBuf, sizeof(LineBuf), Format, v);
+  va_end(v);
+  OutputDebugString(LineBuf);
+  fputws(LineBuf, stderr);
+}
+
+// The signature cache and the file it is kept in.  Shared by the thread
+// that saves it every minute and the console handler that saves it when
+// the service is stopped.
+struct CacheFile {
+  std::shared_ptr<SignatureCache> cache;
+  std::wstring filename;
+  std::mutex lock;  // one Save() at a time
+  ULONGLONG saved;
+
+  CacheFile(LPCWSTR file)
+    : cache(std::make_shared<SignatureCache>(SignatureCacheConfig())),
+      filename(file),
+      saved(0)
+  {}
+
+  void Save() {
+    std::lock_guard<std::mutex> guard(lock);
+    const auto m = cache->GetMetrics();
+    if (m.insertions != saved && cache->Save(filename.c_str())) {
+      saved = m.insertions;
+      Log(L"Saved %u signatures (hit rate %.1f%%)\n",
+          m.entries,
+          m.HitRate() * 100);
+    }
+  }
+};
+
+// Set once, before the console handler is installed.
+static std::shared_ptr<CacheFile> cacheFile;
+
+static BOOL WINAPI OnConsoleEvent(DWORD event) {
+  switch (event) {
+  case CTRL_C_EVENT:
+  case CTRL_BREAK_EVENT:
+  case CTRL_CLOSE_EVENT:
+  case CTRL_LOGOFF_EVENT:
+  case CTRL_SHUTDOWN_EVENT:
+    if (cacheFile) cacheFile->Save();
+    break;
+  }
+  // Let the default handler end the process.
+  return FALSE;
+}
+
+struct Connection {
+  DWORD id;
+  SignPipe pipe;
+
+  Connection(DWORD clientId) : id(clientId) {}
+};
+
+static void Serve(SignService &service, std::shared_ptr<Connection> conn) {
+  Blob payload;
+  while (conn->pipe.ReadFrame(payload)) {
+    SignRequest request;
+    if (!SignProtocol::DecodeRequest(payload, payload.Size(), request)) {
+      Log(L"[%u] Malformed request\n", conn->id);
+      break;
+    }
+
+    const auto requestId = request.requestId;
+    const DWORD status = SignProtocol::ValidateRequest(request);
+    if (status != ERROR_SUCCESS) {
+      Log(L"[%u] Refused request with flags %08x\n",
+          conn->id,
+          request.key.flags);
+      conn->pipe.WriteFrame(SignProtocol::EncodeResponse(requestId,
+                                                         status,
+                                                         nullptr,
+                                                         0));
+      continue;
+    }
+    request.clientId = conn->id;
+    request.completion = [conn](SignRequest &r) {
+      conn->pipe.WriteFrame(SignProtocol::EncodeResponse(r.requestId,
+                                                         r.status,
+                                                         r.signature,
+                                                         r.signature.Size()));
+    };
+    if (!service.Submit(std::move(request))) {
+      // Backpressure.  The client is expected to retry later.
+      conn->pipe.WriteFrame(SignProtocol::EncodeResponse(requestId,
+                                                         ERROR_BUSY,
+                                                         nullptr,
+                                                         0));
+    }
+  }
+
+  SignMetrics m;
+  if (service.GetClientMetrics(conn->id, m)) {
+    Log(L"[%u] disconnected: submitted=%llu completed=%llu failed=%llu"
+        L" rejected=%llu batches=%llu avg=%llums max=%llums\n",
+        conn->id,
+        m.submitted,
+        m.completed,
+        m.failed,
+        m.rejected,
+        m.batches,
+        m.completed + m.failed > 0
+          ? m.totalLatency / (m.completed + m.failed) : 0,
+        m.maxLatency);
+  }
+  service.RemoveClient(conn->id);
+}
+
+static HANDLE AcceptClient(LPCWSTR pipeName, HANDLE event) {
+  HANDLE pipe = CreateNamedPipe(pipeName,
+                                PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                                PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT
+                                  | PIPE_REJECT_REMOTE_CLIENTS,
+                                PIPE_UNLIMITED_INSTANCES,
+                                SignProtocol::MaxPayload,
+                                SignProtocol::MaxPayload,
+                                0,
+                                nullptr);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    Log(L"CreateNamedPipe(%s) failed - %08x\n", pipeName, GetLastError());
+    return pipe;
+  }
+
+  OVERLAPPED ov = {};
+  ov.hEvent = event;
+  DWORD unused;
+  if (ConnectNamedPipe(pipe, &ov)
+      || GetLastError() == ERROR_PIPE_CONNECTED
+      || (GetLastError() == ERROR_IO_PENDING
+          && GetOverlappedResult(pipe, &ov, &unused, TRUE))) {
+    return pipe;
+  }
+
+  Log(L"ConnectNamedPipe failed - %08x\n", GetLastError());
+  CloseHandle(pipe);
+  return INVALID_HANDLE_VALUE;
+}
+
+int wmain(int argc, wchar_t *argv[]) {
+  LPCWSTR pipeName = argc >= 2 ? argv[1] : SignPipe::DefaultName();
+  SignServiceConfig config;
+  if (argc >= 3) {
+    config.workers = static_cast<DWORD>(max(1, _wtoi(argv[2])));
+  }
+
+  // With a cache file, signatures are remembered across restarts.
+  std::shared_ptr<SignatureCache> cache;
+  if (argc >= 4) {
+    auto file = std::make_shared<CacheFile>(argv[3]);
+    if (GetFileAttributes(argv[3]) != INVALID_FILE_ATTRIBUTES) {
+      file->cache->Load(argv[3]);
+    }
+    cache = file->cache;
+    cacheFile = file;
+    if (!SetConsoleCtrlHandler(OnConsoleEvent, TRUE)) {
+      Log(L"SetConsoleCtrlHandler failed - %08x\n", GetLastError());
+    }
+    // The thread holds its own reference, so the cache outlives wmain.
+    std::thread([file]() {
+      for (;;) {
+        Sleep(60 * 1000);
+        file->Save();
+      }
+    }).detach();
+  }
+
+  // Contexts per key; keys on a token with several sessions sign that many
+  // batches at once.
+  const DWORD shards = argc >= 5 ? static_cast<DWORD>(max(1, _wtoi(argv[4])))
+                                 : 1;
+  CapiSignBackend backend(cache.get(), shards);
+  SignService service(backend, config);
+  service.Start();
+  Log(L"Listening on %s with %u workers\n", pipeName, config.workers);
+
+  HANDLE event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  DWORD nextClientId = 1;
+  for (;;) {
+    HANDLE pipe = AcceptClient(pipeName, event);
+    if (pipe == INVALID_HANDLE_VALUE) {
+      Sleep(1000);
+      continue;
+    }
+    auto conn = std::make_shared<Connection>(nextClientId++);
+    conn->pipe.Attach(pipe);
+    std::thread(Serve, std::ref(service), conn).detach();
+  }
+}
@@ -0,0 +1,115 @@
+#include <windows.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <allocprof.h>
+#include <blob.h>
+
+class AllocProfilerTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    AllocProfiler::Reset();
+    AllocProfiler::Enable(true);
+  }
+
+  void TearDown() override {
+    AllocProfiler::Enable(false);
+    AllocProfiler::Reset();
+  }
+};
+
+TEST_F(AllocProfilerTest, Disabled) {
+  AllocProfiler::Enable(false);
+  {
+    Blob blob(100);
+  }
+  const auto stats = AllocProfiler::Snapshot();
+  EXPECT_EQ(stats.allocations, 0u);
+  EXPECT_EQ(stats.frees, 0u);
+  EXPECT_TRUE(stats.sites.empty());
+}
+
+TEST_F(AllocProfilerTest, LiveAndPeak) {
+  {
+    Blob a(100);
+    Blob b(20);
+    EXPECT_EQ(AllocProfiler::Snapshot().liveBytes, 120u);
+    ASSERT_TRUE(b.Alloc(300));
+    auto stats = AllocProfiler::Snapshot();
+    EXPECT_EQ(stats.liveBytes, 400u);
+    EXPECT_EQ(stats.allocations, 3u);
+    EXPECT_EQ(stats.reallocations, 1u);
+    EXPECT_EQ(stats.bytes, 420u);
+  }
+  const auto stats = AllocProfiler::Snapshot();
+  EXPECT_EQ(stats.liveBytes, 0u);
+  EXPECT_EQ(stats.peakLiveBytes, 400u);
+  EXPECT_EQ(stats.frees, 2u);
+
+  // 20 -> [16, 32), 100 -> [64, 128), 300 -> [256, 512)
+  EXPECT_EQ(stats.histogram[4], 1u);
+  EXPECT_EQ(stats.histogram[6], 1u);
+  EXPECT_EQ(stats.histogram[8], 1u);
+  EXPECT_EQ(stats.sites.at("(other)").allocations, 3u);
+}
+
+TEST_F(AllocProfilerTest, Sites) {
+  {
+    AllocSite outer("outer");
+    Blob a(8);
+    {
+      AllocSite inner("inner");
+      Blob b(16);
+    }
+    Blob c(32);
+  }
+  EXPECT_EQ(AllocSite::Current(), nullptr);
+
+  auto hex = Blob::FromHexString(L"01 02 03 04 05 06 07 08");
+  EXPECT_EQ(hex.Size(), 8u);
+
+  const auto stats = AllocProfiler::Snapshot();
+  EXPECT_EQ(stats.sites.at("outer").allocations, 2u);
+  EXPECT_EQ(stats.sites.at("outer").bytes, 40u);
+  EXPECT_EQ(stats.sites.at("inner").bytes, 16u);
+  // The parser's stream buffer is counted along with the blob itself.
+  const auto &fromHex = stats.sites.at("Blob::FromHexString");
+  EXPECT_GE(fromHex.allocations, 1u);
+  EXPECT_GE(fromHex.bytes, 8u);
+}
+
+TEST_F(AllocProfilerTest, DumpIntoProfiledStream) {
+  Blob blob(64);
+  memset(blob, 0xcc, blob.Size());
+  AllocProfiler::Reset();
+
+  std::basic_ostringstream<wchar_t,
+                           std::char_traits<wchar_t>,
+                           ProfiledAllocator<wchar_t>> os;
+  blob.Dump(os, 16, 64);
+  EXPECT_GT(os.str().size(), 0u);
+  EXPECT_GE(AllocProfiler::Snapshot().sites.at("Blob::Dump").allocations, 1u);
+}
+
+TEST_F(AllocProfilerTest, Report) {
+  {
+    AllocSite site("Report");
+    Blob blob(1000);
+  }
+  std::wstringstream ss;
+  AllocProfiler::Report(ss);
+  const auto report = ss.str();
+  EXPECT_NE(report.find(L"Allocations: 1 (0 reallocations), frees: 1"),
+            std::wstring::npos);
+  EXPECT_NE(report.find(L"peak: 1000 bytes"), std::wstring::npos);
+  EXPECT_NE(report.find(L"Report"), std::wstring::npos);
+  EXPECT_NE(report.find(L"< 1024"), std::wstring::npos);
+}
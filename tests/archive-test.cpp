@@ -0,0 +1,179 @@
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <archive.h>
+
+static std::vector<BYTE> Payload(DWORD size, BYTE seed) {
+  std::vector<BYTE> v(size);
+  for (DWORD i = 0; i < size; ++i) v[i] = static_cast<BYTE>(seed + i);
+  return v;
+}
+
+static std::vector<BYTE> ReadFileBytes(LPCWSTR filename) {
+  std::vector<BYTE> data;
+  HANDLE file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return data;
+  LARGE_INTEGER size = {};
+  DWORD read = 0;
+  if (GetFileSizeEx(file, &size)) {
+    data.resize(static_cast<size_t>(size.QuadPart));
+    if (!ReadFile(file, data.data(), DWORD(data.size()), &read, nullptr)) {
+      data.clear();
+    }
+  }
+  CloseHandle(file);
+  return data;
+}
+
+static bool WriteFileBytes(LPCWSTR filename, const std::vector<BYTE> &data) {
+  HANDLE file = CreateFile(filename, GENERIC_WRITE, 0, nullptr,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  DWORD written = 0;
+  const bool ok = WriteFile(file, data.data(), DWORD(data.size()), &written,
+                            nullptr)
+                  && written == data.size();
+  CloseHandle(file);
+  return ok;
+}
+
+TEST(KeyArchive, Crc32) {
+  const char check[] = "123456789";
+  EXPECT_EQ(KeyArchiveFormat::Crc32(reinterpret_cast<LPCBYTE>(check), 9),
+            0xcbf43926);
+  EXPECT_EQ(KeyArchiveFormat::Crc32(nullptr, 0), 0);
+}
+
+TEST(KeyArchive, WriteAndRead) {
+  const LPCWSTR filename = L"archive-test.cspa";
+  {
+    KeyArchiveWriter writer;
+    ASSERT_TRUE(writer.Create(filename, KeyArchiveFormat::FlagChecksums));
+    // Added out of order; the index is sorted on Finish().
+    for (int i = 99; i >= 0; --i) {
+      const auto name = L"container-" + std::to_wstring(i);
+      const auto pub = Payload(148 + i, BYTE(i));
+      const auto pri = Payload(596 + i, BYTE(i + 1));
+      ASSERT_TRUE(writer.Add(name.c_str(), AT_KEYEXCHANGE, PUBLICKEYBLOB,
+                             pub.data(), DWORD(pub.size())));
+      ASSERT_TRUE(writer.Add(name.c_str(), AT_KEYEXCHANGE, PRIVATEKEYBLOB,
+                             pri.data(), DWORD(pri.size())));
+    }
+    // A payload larger than the write buffer goes straight to the file.
+    const auto big = Payload(200000, 7);
+    ASSERT_TRUE(writer.Add(L"big", AT_SIGNATURE, PUBLICKEYBLOB,
+                           big.data(), DWORD(big.size())));
+    EXPECT_EQ(writer.Size(), 201);
+    ASSERT_TRUE(writer.Finish());
+  }
+
+  KeyArchive archive;
+  ASSERT_TRUE(archive.Open(filename));
+  ASSERT_EQ(archive.Size(), 201);
+
+  KeyArchive::Item prev = {}, item = {};
+  for (DWORD i = 0; i < archive.Size(); ++i) {
+    ASSERT_TRUE(archive.Get(i, item));
+    EXPECT_EQ(reinterpret_cast<ULONG_PTR>(item.data)
+                % KeyArchiveFormat::Alignment, 0);
+    EXPECT_TRUE(archive.Verify(i));
+    if (i > 0) {
+      EXPECT_LE(wcscmp(prev.container, item.container), 0);
+    }
+    prev = item;
+  }
+
+  DWORD index;
+  ASSERT_TRUE(archive.Find(L"container-42", AT_KEYEXCHANGE, PRIVATEKEYBLOB,
+                           index));
+  ASSERT_TRUE(archive.Get(index, item));
+  EXPECT_STREQ(item.container, L"container-42");
+  EXPECT_EQ(item.blobType, DWORD(PRIVATEKEYBLOB));
+  const auto expected = Payload(596 + 42, 43);
+  ASSERT_EQ(item.size, expected.size());
+  EXPECT_EQ(memcmp(item.data, expected.data(), item.size), 0);
+
+  ASSERT_TRUE(archive.Find(L"big", AT_SIGNATURE, PUBLICKEYBLOB, index));
+  ASSERT_TRUE(archive.Get(index, item));
+  EXPECT_EQ(item.size, 200000);
+
+  EXPECT_FALSE(archive.Find(L"container-42", AT_SIGNATURE, PUBLICKEYBLOB,
+                            index));
+  EXPECT_FALSE(archive.Find(L"container-100", AT_KEYEXCHANGE, PUBLICKEYBLOB,
+                            index));
+  EXPECT_FALSE(archive.Find(L"zzz", AT_KEYEXCHANGE, PUBLICKEYBLOB, index));
+  archive.Close();
+  DeleteFile(filename);
+}
+
+TEST(KeyArchive, Unfinished) {
+  const LPCWSTR filename = L"archive-test-unfinished.cspa";
+  {
+    KeyArchiveWriter writer;
+    ASSERT_TRUE(writer.Create(filename, 0));
+    const auto pub = Payload(148, 0);
+    ASSERT_TRUE(writer.Add(L"c", AT_SIGNATURE, PUBLICKEYBLOB,
+                           pub.data(), DWORD(pub.size())));
+  }
+  // The writer removes the file rather than leave a partial archive.
+  KeyArchive archive;
+  EXPECT_FALSE(archive.Open(filename));
+}
+
+TEST(KeyArchive, Corrupted) {
+  const LPCWSTR filename = L"archive-test-corrupted.cspa";
+  {
+    KeyArchiveWriter writer;
+    ASSERT_TRUE(writer.Create(filename, 0));
+    const auto pub = Payload(148, 0);
+    ASSERT_TRUE(writer.Add(L"c", AT_SIGNATURE, PUBLICKEYBLOB,
+                           pub.data(), DWORD(pub.size())));
+    ASSERT_TRUE(writer.Finish());
+  }
+  const auto good = ReadFileBytes(filename);
+  ASSERT_GE(good.size(), sizeof(KeyArchiveHeader));
+  KeyArchiveHeader header;
+  memcpy(&header, good.data(), sizeof(header));
+
+  // Header fields whose sums would wrap, or that point past the file.
+  const auto openWith = [&](const KeyArchiveHeader &bad) {
+    auto data = good;
+    memcpy(data.data(), &bad, sizeof(bad));
+    KeyArchive archive;
+    return WriteFileBytes(filename, data) && archive.Open(filename);
+  };
+  KeyArchiveHeader bad = header;
+  bad.indexOffset = 0xffffffffffffffc0ull;
+  bad.stringsOffset = bad.indexOffset + sizeof(KeyArchiveEntry);
+  EXPECT_FALSE(openWith(bad));
+  bad = header;
+  bad.indexOffset = (good.size() + 64) & ~63ull;
+  bad.stringsOffset = bad.indexOffset + sizeof(KeyArchiveEntry);
+  EXPECT_FALSE(openWith(bad));
+  bad = header;
+  bad.entryCount = 0x7fffffff;
+  EXPECT_FALSE(openWith(bad));
+  bad = header;
+  bad.stringsSize = 0xffffffff;
+  EXPECT_FALSE(openWith(bad));
+  EXPECT_TRUE(openWith(header));
+
+  // An entry whose offset plus size wraps around to inside the file.
+  auto data = good;
+  KeyArchiveEntry entry;
+  memcpy(&entry, &data[size_t(header.indexOffset)], sizeof(entry));
+  entry.offset = 0 - ULONGLONG(entry.size) + sizeof(KeyArchiveHeader);
+  memcpy(&data[size_t(header.indexOffset)], &entry, sizeof(entry));
+  ASSERT_TRUE(WriteFileBytes(filename, data));
+  KeyArchive archive;
+  ASSERT_TRUE(archive.Open(filename));
+  KeyArchive::Item item = {};
+  EXPECT_FALSE(archive.Get(0, item));
+  archive.Close();
+  DeleteFile(filename);
+}
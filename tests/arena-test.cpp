@@ -0,0 +1,109 @@
+#include <windows.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <arena.h>
+#include <blob.h>
+
+TEST(SecureArena, AllocFree) {
+  SecureArena arena(/*slabSize*/16384);
+  auto stats = arena.Stats();
+  EXPECT_EQ(stats.reserved, 0);
+  EXPECT_EQ(stats.inUse, 0);
+
+  // A 2048-bit PRIVATEKEYBLOB fits its own size class.
+  auto p = reinterpret_cast<LPBYTE>(arena.Alloc(1172));
+  ASSERT_NE(p, nullptr);
+  EXPECT_TRUE(arena.Owns(p));
+  memset(p, 0xcc, 1172);
+  stats = arena.Stats();
+  EXPECT_EQ(stats.inUse, 1184);
+  EXPECT_GE(stats.reserved, 16384 + 2 * 4096);
+  EXPECT_EQ(stats.locked, 16384);
+
+  arena.Free(p);
+  for (int i = 0; i < 1172; ++i) {
+    ASSERT_EQ(p[i], 0);
+  }
+  stats = arena.Stats();
+  EXPECT_EQ(stats.inUse, 0);
+  EXPECT_EQ(stats.peakInUse, 1184);
+  EXPECT_EQ(stats.allocations, 1);
+
+  EXPECT_EQ(arena.Alloc(0), nullptr);
+  EXPECT_EQ(arena.Stats().failures, 1);
+}
+
+TEST(SecureArena, Grow) {
+  // A full slab is followed by another of the same class, which is given
+  // back once it is empty again.
+  SecureArena arena(/*slabSize*/16384);
+  const DWORD slots = 16384 / 288;
+  std::vector<LPVOID> small;
+  for (DWORD i = 0; i < slots; ++i) {
+    small.push_back(arena.Alloc(200));
+    ASSERT_NE(small.back(), nullptr);
+  }
+  const SIZE_T oneSlab = arena.Stats().reserved;
+  auto spilled = arena.Alloc(200);
+  ASSERT_NE(spilled, nullptr);
+  EXPECT_TRUE(arena.Owns(spilled));
+  EXPECT_EQ(arena.Stats().inUse, (slots + 1) * 288);
+  EXPECT_EQ(arena.Stats().reserved, 2 * oneSlab);
+
+  arena.Free(spilled);
+  EXPECT_EQ(arena.Stats().reserved, oneSlab);
+  for (auto p : small) arena.Free(p);
+  EXPECT_EQ(arena.Stats().inUse, 0);
+  EXPECT_EQ(arena.Stats().reserved, oneSlab);
+}
+
+TEST(SecureArena, Oversized) {
+  SecureArena arena(/*slabSize*/16384);
+  const SIZE_T size = arena.MaxAllocation() + 1;
+  auto p = reinterpret_cast<LPBYTE>(arena.Alloc(size));
+  ASSERT_NE(p, nullptr);
+  EXPECT_TRUE(arena.Owns(p));
+  EXPECT_TRUE(arena.Owns(p + size - 1));
+  memset(p, 0x5a, size);
+  const auto stats = arena.Stats();
+  EXPECT_GE(stats.inUse, size);
+  EXPECT_EQ(stats.locked, stats.inUse);
+
+  arena.Free(p);
+  EXPECT_FALSE(arena.Owns(p));
+  EXPECT_EQ(arena.Stats().reserved, 0);
+  EXPECT_EQ(arena.Stats().locked, 0);
+}
+
+TEST(SecureArena, Blob) {
+  SecureArena arena(/*slabSize*/16384);
+  {
+    Blob blob(arena);
+    ASSERT_TRUE(blob.Alloc(100));
+    EXPECT_TRUE(blob.IsSecure());
+    EXPECT_TRUE(arena.Owns(LPCBYTE(blob)));
+    memset(blob, 0x5a, 100);
+
+    // Growing keeps the contents and stays in the arena.
+    ASSERT_TRUE(blob.Alloc(2000));
+    EXPECT_EQ(LPCBYTE(blob)[99], 0x5a);
+    EXPECT_TRUE(arena.Owns(LPCBYTE(blob)));
+    EXPECT_EQ(arena.Stats().inUse, 2336);
+
+    // Past the largest slot too.
+    ASSERT_TRUE(blob.Alloc(40000));
+    EXPECT_EQ(LPCBYTE(blob)[99], 0x5a);
+    EXPECT_TRUE(arena.Owns(LPCBYTE(blob)));
+
+    Blob moved(std::move(blob));
+    EXPECT_TRUE(moved.IsSecure());
+  }
+  EXPECT_EQ(arena.Stats().inUse, 0);
+}
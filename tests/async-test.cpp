@@ -0,0 +1,72 @@
+#include <windows.h>
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <executor.h>
+#include <async.h>
+
+namespace {
+
+Task<int> AddOnStrand(Strand &strand, int a, int b) {
+  int x = co_await Operation<int>(strand, [a]() { return a; });
+  int y = co_await Operation<int>(strand, [b]() {
+    SetLastError(ERROR_INVALID_DATA);
+    return b;
+  });
+  EXPECT_EQ(GetLastError(), static_cast<DWORD>(ERROR_INVALID_DATA));
+  co_return x + y;
+}
+
+Task<void> CountOnStrand(Strand &strand,
+                         std::atomic<int> &inside,
+                         std::atomic<int> &overlaps,
+                         std::atomic<int> &done) {
+  for (int i = 0; i < 3; ++i) {
+    co_await Operation<bool>(strand, [&]() {
+      if (++inside > 1) ++overlaps;
+      std::this_thread::yield();
+      --inside;
+      return true;
+    });
+  }
+  ++done;
+}
+
+}
+
+TEST(Async, Task) {
+  Executor executor(2);
+  Strand strand(executor);
+  EXPECT_EQ(SyncWait(AddOnStrand(strand, 40, 2)), 42);
+}
+
+TEST(Async, StrandSerializes) {
+  // Thousands of coroutines in flight over two threads and four strands.
+  // Operations on one strand must never overlap.
+  Executor executor(2);
+  std::vector<std::unique_ptr<Strand>> strands;
+  std::atomic<int> inside[4];
+  for (auto &it : inside) {
+    it = 0;
+    strands.push_back(std::make_unique<Strand>(executor));
+  }
+
+  std::atomic<int> overlaps(0), done(0);
+  const int count = 2000;
+  for (int i = 0; i < count; ++i) {
+    Spawn(executor, CountOnStrand(*strands[i % 4], inside[i % 4], overlaps, done));
+  }
+  while (done < count) Sleep(1);
+  EXPECT_EQ(overlaps, 0);
+}
@@ -1,6 +1,9 @@
 #include <windows.h>
 #include <strsafe.h>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -66,3 +69,38 @@ TEST(Blob, Dump) {
                L"Total: 42 (=0x2a) bytes\r\n"
                L"0000: 00 01 02 03 04 05 06 07  08 09 ...\r\n");
 }
+
+TEST(Blob, Narrow) {
+  const BYTE utf8[] = {0xE3, 0x83, 0xA9, 0xE3, 0x83, 0xBC, 0xE3, 0x83,
+                       0xA1, 0xE3, 0x83, 0xB3};
+  auto blob = Blob::FromHexString("E3 83 A9 E3 83 BC E3 83 A1 E3 83 B3");
+  ASSERT_EQ(blob.Size(), sizeof(utf8));
+  EXPECT_EQ(memcmp(blob, utf8, sizeof(utf8)), 0);
+
+  // Not null-terminated.
+  const std::string_view hex("0102zz", 4);
+  blob = Blob::FromHexString(hex);
+  ASSERT_EQ(blob.Size(), 2u);
+  EXPECT_EQ(LPCBYTE(blob)[1], 2);
+
+  blob = Blob::FromHexString(std::string_view("E383A9E383BCE383A1E383B3"));
+  std::string base64 = "reused";
+  ASSERT_TRUE(blob.ToBase64String(base64));
+  EXPECT_EQ(base64, "44Op44O844Oh44Oz\r\n");
+
+  blob = Blob::FromBase64String(std::string_view(base64));
+  ASSERT_EQ(blob.Size(), sizeof(utf8));
+  EXPECT_EQ(memcmp(blob, utf8, sizeof(utf8)), 0);
+  EXPECT_EQ(Blob::FromBase64String(std::string_view()).Size(), 0u);
+
+  std::ostringstream narrow;
+  std::wostringstream wide;
+  blob.Dump(narrow, /*width*/8, /*ellipsis*/100);
+  blob.Dump(wide, /*width*/8, /*ellipsis*/100);
+  EXPECT_EQ(narrow.str(),
+            "Total: 12 (=0xc) bytes\r\n"
+            "0000: e3 83 a9 e3 83 bc e3 83\r\n"
+            "0008: a1 e3 83 b3");
+  const std::string text = narrow.str();
+  EXPECT_EQ(wide.str(), std::wstring(text.begin(), text.end()));
+}
@@ -0,0 +1,157 @@
+#include <windows.h>
+#include <iostream>
+#include <type_traits>
+
+#include "testutil.h"
+
+#include <allocprof.h>
+#include <arena.h>
+
+TEST(BlobBuilder, GeometricGrowth) {
+  AllocProfiler::Reset();
+  AllocProfiler::Enable(true);
+  BlobBuilder builder;
+  for (DWORD i = 0; i < 10000; ++i) {
+    const BYTE b = static_cast<BYTE>(i);
+    ASSERT_TRUE(builder.Append(&b, 1));
+  }
+  const auto stats = AllocProfiler::Snapshot();
+  AllocProfiler::Enable(false);
+  AllocProfiler::Reset();
+
+  // 64, 128, ..., 16384
+  EXPECT_EQ(stats.allocations, 9u);
+  EXPECT_EQ(builder.Capacity(), 16384u);
+  EXPECT_EQ(builder.Size(), 10000u);
+  EXPECT_TRUE(builder.IsContiguous());
+
+  const LPCBYTE built = builder.Segments()[0].data;
+  Blob blob = builder.Finish();
+  ASSERT_EQ(blob.Size(), 10000u);
+  EXPECT_EQ(LPCBYTE(blob), built);
+  for (DWORD i = 0; i < blob.Size(); ++i) {
+    ASSERT_EQ(LPCBYTE(blob)[i], static_cast<BYTE>(i));
+  }
+  EXPECT_EQ(builder.Size(), 0u);
+  EXPECT_EQ(builder.Finish().Size(), 0u);
+}
+
+TEST(BlobBuilder, ReserveAndExtend) {
+  BlobBuilder builder;
+  ASSERT_TRUE(builder.Reserve(100));
+  EXPECT_EQ(builder.Capacity(), 100u);
+
+  ASSERT_TRUE(builder.AppendValue(DWORD(0x04030201)));
+  LPBYTE p = builder.Extend(4);
+  ASSERT_NE(p, nullptr);
+  memset(p, 0xee, 4);
+  EXPECT_EQ(builder.Capacity(), 100u);
+  EXPECT_EQ(builder.Segments().size(), 1u);
+
+  const BYTE expected[] = {1, 2, 3, 4, 0xee, 0xee, 0xee, 0xee};
+  Blob blob = builder.Finish();
+  ASSERT_EQ(blob.Size(), sizeof(expected));
+  EXPECT_EQ(memcmp(LPCBYTE(blob), expected, sizeof(expected)), 0);
+}
+
+TEST(BlobBuilder, ScatterGather) {
+  const BYTE digest[] = {0xd0, 0xd1, 0xd2, 0xd3};
+  Blob signature(3);
+  memset(signature, 0x55, signature.Size());
+
+  BlobBuilder builder;
+  ASSERT_TRUE(builder.AppendValue(DWORD(sizeof(digest))));
+  ASSERT_TRUE(builder.Reference(BlobView(digest, 2)));
+  // Adjacent references are merged.
+  ASSERT_TRUE(builder.Reference(BlobView(digest + 2, 2)));
+  ASSERT_TRUE(builder.Reference(signature));
+  ASSERT_TRUE(builder.Append(digest, 1));
+  EXPECT_FALSE(builder.Reference(BlobView(nullptr, 1)));
+  EXPECT_FALSE(builder.IsContiguous());
+  EXPECT_EQ(builder.Size(), 4u + 4 + 3 + 1);
+
+  const auto segments = builder.Segments();
+  ASSERT_EQ(segments.size(), 4u);
+  EXPECT_EQ(segments[1].data, digest);
+  EXPECT_EQ(segments[1].size, 4u);
+  EXPECT_EQ(segments[2].data, LPCBYTE(signature));
+
+  const BYTE expected[] = {4, 0, 0, 0,
+                           0xd0, 0xd1, 0xd2, 0xd3,
+                           0x55, 0x55, 0x55,
+                           0xd0};
+  Blob blob = builder.Finish();
+  ASSERT_EQ(blob.Size(), sizeof(expected));
+  EXPECT_EQ(memcmp(LPCBYTE(blob), expected, sizeof(expected)), 0);
+}
+
+TEST(BlobBuilder, Arena) {
+  SecureArena arena(/*slabSize*/16384);
+  const BYTE secret[] = {1, 2, 3};
+
+  BlobBuilder builder(arena);
+  ASSERT_TRUE(builder.Append(secret, sizeof(secret)));
+  Blob contiguous = builder.Finish();
+  EXPECT_TRUE(contiguous.IsSecure());
+  EXPECT_TRUE(arena.Owns(LPCBYTE(contiguous)));
+
+  ASSERT_TRUE(builder.Append(secret, sizeof(secret)));
+  ASSERT_TRUE(builder.Reference(contiguous));
+  Blob gathered = builder.Finish();
+  EXPECT_TRUE(gathered.IsSecure());
+  EXPECT_EQ(gathered.Size(), 6u);
+
+  // Past the largest slot the buffer moves to pages of its own.
+  std::vector<BYTE> large(40000, 0x5a);
+  ASSERT_TRUE(builder.Append(large.data(), DWORD(large.size())));
+  Blob oversized = builder.Finish();
+  ASSERT_EQ(oversized.Size(), large.size());
+  EXPECT_TRUE(arena.Owns(LPCBYTE(oversized)));
+  EXPECT_EQ(memcmp(oversized, large.data(), large.size()), 0);
+}
+
+TEST(BlobBuilder, AppendFromItself) {
+  BlobBuilder builder;
+  BYTE first[48];
+  for (DWORD i = 0; i < sizeof(first); ++i) first[i] = static_cast<BYTE>(i);
+  ASSERT_TRUE(builder.Append(first, sizeof(first)));
+  ASSERT_EQ(builder.Capacity(), 64u);
+
+  // The source is inside the buffer that has to grow to take it.
+  for (int round = 0; round < 3; ++round) {
+    const BlobView own = builder.Segments()[0];
+    ASSERT_TRUE(builder.Append(own));
+  }
+  Blob blob = builder.Finish();
+  ASSERT_EQ(blob.Size(), 8 * sizeof(first));
+  for (DWORD i = 0; i < blob.Size(); ++i) {
+    ASSERT_EQ(LPCBYTE(blob)[i], static_cast<BYTE>(i % sizeof(first))) << i;
+  }
+}
+
+class BlobBuilderHashTest : public SoftProviderTest {};
+
+TEST_F(BlobBuilderHashTest, Segments) {
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(nullptr, nullptr, PROV_RSA_AES, CRYPT_VERIFYCONTEXT));
+
+  const BYTE body[] = "The quick brown fox jumps over the lazy dog";
+  BlobBuilder builder;
+  ASSERT_TRUE(builder.AppendValue(DWORD(sizeof(body))));
+  ASSERT_TRUE(builder.Reference(BlobView(body, sizeof(body))));
+  ASSERT_TRUE(builder.AppendValue(DWORD(0)));
+
+  BasicHash<SHA256Traits> gathered;
+  ASSERT_TRUE(gathered.Create(csp));
+  ASSERT_TRUE(gathered.AddData(builder));
+
+  const Blob joined = builder.Finish();
+  BasicHash<SHA256Traits> contiguous;
+  ASSERT_TRUE(contiguous.Create(csp));
+  ASSERT_TRUE(contiguous.AddData(joined, joined.Size()));
+
+  Digest<SHA256Traits> a, b;
+  ASSERT_TRUE(gathered.GetHashValue(a));
+  ASSERT_TRUE(contiguous.GetHashValue(b));
+  EXPECT_EQ(a, b);
+}
@@ -0,0 +1,278 @@
+#include <windows.h>
+#include <filesystem>
+
+#include "testutil.h"
+
+#include <cms.h>
+
+namespace {
+
+struct Der {
+  BYTE tag;
+  LPCBYTE value;
+  DWORD length;
+
+  std::vector<BYTE> Bytes() const {
+    return std::vector<BYTE>(value, value + length);
+  }
+};
+
+// The values one after another in [p, p + size), short-form or long-form
+// lengths only.
+std::vector<Der> Parse(LPCBYTE p, DWORD size) {
+  std::vector<Der> values;
+  while (size >= 2) {
+    DWORD header = 2, length = p[1];
+    if (length & 0x80) {
+      const DWORD count = length & 0x7f;
+      length = 0;
+      for (DWORD i = 0; i < count; ++i) length = (length << 8) | p[2 + i];
+      header += count;
+    }
+    if (header + length > size) break;
+    values.push_back({p[0], p + header, length});
+    p += header + length;
+    size -= header + length;
+  }
+  EXPECT_EQ(size, 0u);
+  return values;
+}
+
+std::vector<Der> Parse(const Der &der) {
+  return Parse(der.value, der.length);
+}
+
+std::vector<BYTE> Bytes(std::initializer_list<BYTE> bytes) {
+  return std::vector<BYTE>(bytes);
+}
+
+}  // namespace
+
+class CmsSignerTest : public SoftProviderTest {
+protected:
+  std::wstring directory_;
+  CSP csp_;
+
+  void SetUp() override {
+    directory_ =
+      (std::filesystem::temp_directory_path() / "cms-test").wstring();
+    std::filesystem::remove_all(directory_);
+    SoftProviderConfig config = TestConfig();
+    config.directory = directory_;
+    Install(config);
+    ASSERT_TRUE(csp_.Acquire(L"cms", nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+    Key key(csp_.GenKey(AT_SIGNATURE, 0));
+    ASSERT_NE(HCRYPTKEY(key), HCRYPTKEY(NULL));
+  }
+
+  void TearDown() override {
+    csp_.Attach(NULL);
+    SoftProviderTest::TearDown();
+    std::filesystem::remove_all(directory_);
+  }
+
+  static CmsSigner::Sink Collect(std::vector<BYTE> &out) {
+    return [&out](LPCBYTE data, DWORD size) {
+      out.insert(out.end(), data, data + size);
+      return true;
+    };
+  }
+
+  // Returns the SignerInfo after checking the ContentInfo around it.
+  static std::vector<Der> SignerInfo(const std::vector<BYTE> &der,
+                                     std::vector<Der> &signedData) {
+    const auto contentInfo = Parse(der.data(), static_cast<DWORD>(der.size()));
+    EXPECT_EQ(contentInfo.size(), 1u);
+    const auto fields = Parse(contentInfo[0]);
+    EXPECT_EQ(fields.size(), 2u);
+    EXPECT_EQ(fields[0].Bytes(),
+              Bytes({0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x02}));
+    EXPECT_EQ(fields[1].tag, 0xa0);
+    signedData = Parse(Parse(fields[1])[0]);
+    const auto signerInfos = Parse(signedData.back());
+    EXPECT_EQ(signerInfos.size(), 1u);
+    return Parse(signerInfos[0]);
+  }
+
+  // The value of the attribute of |type| (the last byte of its OID).
+  static std::vector<BYTE> Attribute(const Der &attributes, BYTE type) {
+    for (const auto &it : Parse(attributes)) {
+      const auto attribute = Parse(it);
+      if (attribute[0].value[attribute[0].length - 1] == type) {
+        return Parse(attribute[1])[0].Bytes();
+      }
+    }
+    return {};
+  }
+
+  void ExpectSignature(const std::vector<Der> &signerInfo) {
+    std::vector<BYTE> attributes = {0x31};
+    const auto &signedAttrs = signerInfo[3];
+    const LPCBYTE header = LPCBYTE(signerInfo[2].value) + signerInfo[2].length;
+    attributes.insert(attributes.end(), header + 1, signedAttrs.value);
+    attributes.insert(attributes.end(),
+                      signedAttrs.value,
+                      signedAttrs.value + signedAttrs.length);
+
+    auto signature = signerInfo[5].Bytes();
+    std::reverse(signature.begin(), signature.end());
+    Key key(csp_.GetUserKey(AT_SIGNATURE));
+    Hash hash;
+    ASSERT_TRUE(hash.Create(csp_, CALG_SHA_256));
+    ASSERT_TRUE(hash.AddData(attributes.data(),
+                             static_cast<DWORD>(attributes.size())));
+    EXPECT_TRUE(hash.Verify(signature.data(),
+                            static_cast<DWORD>(signature.size()),
+                            key));
+  }
+};
+
+TEST_F(CmsSignerTest, SubjectKeyIdentifier) {
+  const std::string content(100000, 'x');
+  std::vector<BYTE> digest(32);
+  Sha256 sha;
+  sha.Update(reinterpret_cast<LPCBYTE>(content.data()), content.size());
+  sha.Final(digest.data());
+
+  CmsSigner signer{CmsSignerConfig()};
+  ASSERT_TRUE(signer.Begin(csp_, nullptr, 0));
+  for (size_t i = 0; i < content.size(); i += 30000) {
+    const DWORD n = static_cast<DWORD>(min(size_t(30000), content.size() - i));
+    ASSERT_TRUE(signer.Update(reinterpret_cast<LPCBYTE>(&content[i]), n));
+  }
+  EXPECT_EQ(signer.ContentSize(), content.size());
+  std::vector<BYTE> der;
+  ASSERT_TRUE(signer.Finish(Collect(der)));
+
+  std::vector<Der> signedData;
+  const auto signerInfo = SignerInfo(der, signedData);
+  // version, digestAlgorithms, encapContentInfo and signerInfos; there is
+  // no certificate to include.
+  ASSERT_EQ(signedData.size(), 4u);
+  EXPECT_EQ(signedData[0].Bytes(), Bytes({3}));
+  EXPECT_EQ(Parse(signedData[2]).size(), 1u);
+
+  ASSERT_EQ(signerInfo.size(), 6u);
+  EXPECT_EQ(signerInfo[0].Bytes(), Bytes({3}));
+  EXPECT_EQ(signerInfo[1].tag, 0x80);
+  EXPECT_EQ(signerInfo[1].length, CmsSigner::KeyIdSize);
+  EXPECT_EQ(signerInfo[3].tag, 0xa0);
+  EXPECT_EQ(signerInfo[5].length, 64u);
+
+  EXPECT_EQ(Parse(signerInfo[3]).size(), 3u);
+  EXPECT_EQ(Attribute(signerInfo[3], 3),
+            Bytes({0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x01}));
+  EXPECT_EQ(Attribute(signerInfo[3], 4), digest);
+  EXPECT_EQ(Attribute(signerInfo[3], 5).size(), 13u);
+  ExpectSignature(signerInfo);
+}
+
+TEST_F(CmsSignerTest, CertificateAndPem) {
+  // Only the parts of a certificate the signer reads need to make sense.
+  const std::vector<BYTE> certificate = {
+    0x30, 0x1e,
+      0x30, 0x17,
+        0xa0, 0x03, 0x02, 0x01, 0x02,
+        0x02, 0x02, 0x01, 0x23,
+        0x30, 0x03, 0x06, 0x01, 0x00,
+        0x30, 0x07, 0x31, 0x05, 0x30, 0x03, 0x06, 0x01, 0x01,
+      0x30, 0x03, 0x06, 0x01, 0x00,
+  };
+  CmsSignerConfig config;
+  config.signingTime = false;
+  CmsSigner signer(config);
+  ASSERT_TRUE(signer.Begin(csp_,
+                           certificate.data(),
+                           static_cast<DWORD>(certificate.size())));
+  ASSERT_TRUE(signer.Update(reinterpret_cast<LPCBYTE>("abc"), 3));
+  std::vector<BYTE> der;
+  ASSERT_TRUE(signer.Finish(Collect(der)));
+
+  std::vector<Der> signedData;
+  const auto signerInfo = SignerInfo(der, signedData);
+  ASSERT_EQ(signedData.size(), 5u);
+  EXPECT_EQ(signedData[0].Bytes(), Bytes({1}));
+  EXPECT_EQ(signedData[3].tag, 0xa0);
+  EXPECT_EQ(signedData[3].Bytes(), certificate);
+
+  ASSERT_EQ(signerInfo.size(), 6u);
+  EXPECT_EQ(signerInfo[0].Bytes(), Bytes({1}));
+  EXPECT_EQ(signerInfo[1].Bytes(),
+            Bytes({0x30, 0x07, 0x31, 0x05, 0x30, 0x03, 0x06, 0x01, 0x01,
+                   0x02, 0x02, 0x01, 0x23}));
+  EXPECT_EQ(Parse(signerInfo[3]).size(), 2u);
+  ExpectSignature(signerInfo);
+
+  // PKCS#1 v1.5 is deterministic, so without a signing time the PEM
+  // carries the same DER.
+  config.pem = true;
+  CmsSigner pemSigner(config);
+  ASSERT_TRUE(pemSigner.Begin(csp_,
+                              certificate.data(),
+                              static_cast<DWORD>(certificate.size())));
+  ASSERT_TRUE(pemSigner.Update(reinterpret_cast<LPCBYTE>("abc"), 3));
+  std::vector<BYTE> pem;
+  ASSERT_TRUE(pemSigner.Finish(Collect(pem)));
+  const std::string text(pem.begin(), pem.end());
+  const std::string begin = "-----BEGIN PKCS7-----\r\n";
+  const std::string end = "-----END PKCS7-----\r\n";
+  ASSERT_EQ(text.substr(0, begin.size()), begin);
+  ASSERT_EQ(text.substr(text.size() - end.size()), end);
+  EXPECT_EQ(text.find("\r\n", begin.size()), begin.size() + 64);
+  const Blob decoded = Blob::FromBase64String(std::string_view(text).substr(
+    begin.size(),
+    text.size() - begin.size() - end.size()));
+  EXPECT_EQ(std::vector<BYTE>(LPCBYTE(decoded),
+                              LPCBYTE(decoded) + decoded.Size()),
+            der);
+
+  // A certificate that is not one is refused.
+  CmsSigner bad{CmsSignerConfig()};
+  EXPECT_FALSE(bad.Begin(csp_, certificate.data() + 2, 5));
+}
+
+TEST_F(CmsSignerTest, SignFile) {
+  const std::wstring path =
+    (std::filesystem::path(directory_) / "cms-test.bin").wstring();
+  const std::wstring missing =
+    (std::filesystem::path(directory_) / "missing.bin").wstring();
+  const LPCWSTR filename = path.c_str();
+  const DWORD size = CmsSigner::ReadSize * 2 + 12345;
+  Blob data(size);
+  for (DWORD i = 0; i < size; ++i) {
+    data[i] = static_cast<BYTE>(i * 13 + (i >> 10));
+  }
+  ASSERT_TRUE(data.Save(filename));
+  std::vector<BYTE> digest(20);
+  Sha1 sha;
+  sha.Update(data, size);
+  sha.Final(digest.data());
+
+  CmsSignerConfig config;
+  config.hashAlgo = CALG_SHA1;
+  CmsSigner signer(config);
+  std::vector<BYTE> der;
+  ASSERT_TRUE(signer.SignFile(csp_, nullptr, 0, filename, Collect(der)));
+  EXPECT_EQ(signer.ContentSize(), size);
+
+  std::vector<Der> signedData;
+  const auto signerInfo = SignerInfo(der, signedData);
+  ASSERT_EQ(signerInfo.size(), 6u);
+  EXPECT_EQ(Parse(signerInfo[2])[0].Bytes(),
+            Bytes({0x2b, 0x0e, 0x03, 0x02, 0x1a}));
+  EXPECT_EQ(Attribute(signerInfo[3], 4), digest);
+
+  EXPECT_FALSE(signer.SignFile(csp_, nullptr, 0, missing.c_str(),
+                               Collect(der)));
+}
+
+TEST_F(CmsSignerTest, UnsupportedAlgorithm) {
+  CmsSignerConfig config;
+  config.hashAlgo = CALG_SHA_512;
+  CmsSigner signer(config);
+  std::vector<BYTE> der;
+  EXPECT_FALSE(signer.Begin(csp_, nullptr, 0));
+  EXPECT_FALSE(signer.Finish(Collect(der)));
+  EXPECT_EQ(GetLastError(), NTE_BAD_ALGID);
+  EXPECT_TRUE(der.empty());
+}
@@ -0,0 +1,113 @@
+#include <windows.h>
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <blob.h>
+#include <dumpview.h>
+
+TEST(DumpView, Render) {
+  std::vector<BYTE> data(40);
+  for (BYTE i = 0; i < data.size(); ++i) data[i] = i;
+  DumpView view;
+  view.Attach(data.data(), data.size());
+  EXPECT_EQ(view.LineCount(16), 3u);
+
+  std::wostringstream ss;
+  ASSERT_TRUE(view.Render(ss, 16, 1, 5, false));
+  EXPECT_EQ(ss.str(),
+            L"0010: 10 11 12 13 14 15 16 17  18 19 1a 1b 1c 1d 1e 1f\r\n"
+            L"0020: 20 21 22 23 24 25 26 27\r\n");
+
+  ss.str(L"");
+  ASSERT_TRUE(view.Render(ss, 8, 4, 1, true));
+  EXPECT_EQ(ss.str(), L"0020: 20 21 22 23 24 25 26 27   !\"#$%&'\r\n");
+
+  // Short lines keep the ASCII column where the full ones have it.
+  ss.str(L"");
+  ASSERT_TRUE(view.Render(ss, 16, 2, 1, true));
+  EXPECT_EQ(ss.str(),
+            L"0020: 20 21 22 23 24 25 26 27" + std::wstring(25, L' ')
+            + L"   !\"#$%&'\r\n");
+
+  std::ostringstream narrow;
+  ASSERT_TRUE(view.Render(narrow, 8, 4, 1, true));
+  EXPECT_EQ(narrow.str(), "0020: 20 21 22 23 24 25 26 27   !\"#$%&'\r\n");
+
+  // Past the end there is nothing to render.
+  ss.str(L"");
+  EXPECT_TRUE(view.Render(ss, 16, 3, 1, true));
+  EXPECT_TRUE(ss.str().empty());
+}
+
+TEST(DumpView, Find) {
+  std::mt19937 random(1);
+  std::vector<BYTE> data(4096);
+  for (auto &it : data) it = static_cast<BYTE>(random() % 4);
+  DumpView view;
+  view.Attach(data.data(), data.size());
+
+  for (DWORD size = 1; size <= 24; ++size) {
+    for (int trial = 0; trial < 8; ++trial) {
+      std::vector<BYTE> pattern(size);
+      for (auto &it : pattern) it = static_cast<BYTE>(random() % 4);
+      const ULONGLONG from = random() % data.size();
+      const auto expected = std::search(data.begin() + from,
+                                        data.end(),
+                                        pattern.begin(),
+                                        pattern.end());
+      ULONGLONG offset = 0;
+      const bool found = view.Find(pattern.data(), size, from, offset);
+      EXPECT_EQ(found, expected != data.end());
+      if (found) EXPECT_EQ(offset, ULONGLONG(expected - data.begin()));
+    }
+  }
+}
+
+TEST(DumpView, MappedFile) {
+  const LPCWSTR filename = L"dumpview-test.bin";
+  const DWORD size = 300000;
+  {
+    Blob data(size);
+    for (DWORD i = 0; i < size; ++i) {
+      data[i] = static_cast<BYTE>(i * 7 + (i >> 8));
+    }
+    // Straddles the boundary of the first 64KB window.
+    memcpy(LPBYTE(data) + 65536 - 3, "needle", 6);
+    memcpy(LPBYTE(data) + size - 6, "needle", 6);
+    DeleteFile(filename);
+    ASSERT_TRUE(data.Save(filename));
+  }
+
+  DumpView view(1);
+  ASSERT_TRUE(view.Open(filename));
+  EXPECT_EQ(view.Size(), size);
+  EXPECT_EQ(view.LineCount(16), (size + 15) / 16);
+
+  ULONGLONG offset = 0;
+  const auto needle = reinterpret_cast<LPCBYTE>("needle");
+  ASSERT_TRUE(view.Find(needle, 6, 0, offset));
+  EXPECT_EQ(offset, 65536u - 3);
+  ASSERT_TRUE(view.Find(needle, 6, offset + 1, offset));
+  EXPECT_EQ(offset, size - 6u);
+  EXPECT_FALSE(view.Find(needle, 6, offset + 1, offset));
+
+  // Offsets take as many digits as the largest one needs.
+  std::wostringstream ss;
+  ASSERT_TRUE(view.Render(ss, 16, view.LineCount(16) - 1, 1, true));
+  EXPECT_EQ(ss.str().substr(0, 6), L"493d0:");
+  EXPECT_NE(ss.str().find(L"needle\r\n"), std::wstring::npos);
+
+  ss.str(L"");
+  ASSERT_TRUE(view.Render(ss, 16, (65536 - 16) / 16, 2, true));
+  EXPECT_EQ(ss.str().substr(0, 6), L"0fff0:");
+  EXPECT_NE(ss.str().find(L"nee\r\n10000:"), std::wstring::npos);
+
+  view.Close();
+  DeleteFile(filename);
+}
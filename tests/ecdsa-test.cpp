@@ -0,0 +1,124 @@
+#include <windows.h>
+#include <iostream>
+#include <random>
+
+#include "testutil.h"
+
+#include <ecdsa.h>
+
+static std::vector<BYTE> Sha256Of(const char *message) {
+  std::vector<BYTE> digest(32);
+  Sha256 sha;
+  sha.Update(reinterpret_cast<LPCBYTE>(message), strlen(message));
+  sha.Final(digest.data());
+  return digest;
+}
+
+// RFC 6979, A.2.5
+static std::vector<BYTE> Rfc6979Key() {
+  std::vector<BYTE> blob = {
+    'E', 'C', 'S', '2', 32, 0, 0, 0,
+  };
+  for (auto part : {
+         "60FED4BA255A9D31C961EB74C6356D68C049B8923B61FA6CE669622E60F29FB6",
+         "7903FE1008B8BC99A41AE9E95628BC64F2F1B20C2D7E9F5177A3C294D4462299",
+         "C9AFA9D845BA75166B5C215767B1D6934E50C3DB36E89B127B8A622B120F6721",
+       }) {
+    const auto bytes = FromHex(part);
+    blob.insert(blob.end(), bytes.begin(), bytes.end());
+  }
+  return blob;
+}
+
+TEST(EcdsaP256, Rfc6979) {
+  const auto blob = Rfc6979Key();
+  EcdsaP256Key key;
+  ASSERT_TRUE(key.FromBlob(blob.data(), static_cast<DWORD>(blob.size())));
+  EXPECT_TRUE(key.HasPrivate());
+
+  const struct {
+    const char *message;
+    const char *signature;
+  } vectors[] = {
+    { "sample",
+      "EFD48B2AACB6A8FD1140DD9CD45E81D69D2C877B56AAF991C34D0EA84EAF3716"
+      "F7CB1C942D657C41D436C7A1B6E29F65F3E900DBB9AFF4064DC4AB2F843ACDA8" },
+    { "test",
+      "F1ABB023518351CD71D881567B1EA663ED3EFCF6C5132B354F28D3B0B7D38367"
+      "019F4113742A2B14BD25926B49C649155F267E60D3814B4C0CC84250E46F0083" },
+  };
+  for (const auto &v : vectors) {
+    const auto digest = Sha256Of(v.message);
+    std::vector<BYTE> signature(EcdsaP256Key::SignatureSize);
+    ASSERT_TRUE(key.Sign(digest.data(), 32, signature.data()));
+    EXPECT_EQ(signature, FromHex(v.signature)) << v.message;
+    EXPECT_TRUE(key.Verify(digest.data(), 32, signature.data(), 64));
+
+    signature[10] ^= 1;
+    EXPECT_FALSE(key.Verify(digest.data(), 32, signature.data(), 64));
+    EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_SIGNATURE));
+  }
+}
+
+TEST(EcdsaP256, Blobs) {
+  std::mt19937 random(1);
+  EcdsaP256Key key;
+  ASSERT_TRUE(key.Generate([&random](LPBYTE p, DWORD n) {
+    for (DWORD i = 0; i < n; ++i) p[i] = static_cast<BYTE>(random());
+  }));
+
+  DWORD size = 0;
+  ASSERT_TRUE(key.ToBlob(PUBLICKEYBLOB, nullptr, &size));
+  EXPECT_EQ(size, EcdsaP256Key::PublicBlobSize);
+  std::vector<BYTE> publicBlob(size);
+  ASSERT_TRUE(key.ToBlob(PUBLICKEYBLOB, publicBlob.data(), &size));
+  EXPECT_EQ(memcmp(publicBlob.data(), "ECS1", 4), 0);
+
+  EcdsaP256Key verifier;
+  ASSERT_TRUE(verifier.FromBlob(publicBlob.data(), size));
+  EXPECT_FALSE(verifier.HasPrivate());
+  EXPECT_FALSE(verifier.ToBlob(PRIVATEKEYBLOB, nullptr, &size));
+
+  std::vector<BYTE> digest(48, 0xab);  // longer digests are truncated
+  BYTE signature[EcdsaP256Key::SignatureSize];
+  ASSERT_TRUE(key.Sign(digest.data(), 48, signature));
+  EXPECT_TRUE(verifier.Verify(digest.data(), 48, signature, sizeof(signature)));
+  EXPECT_FALSE(verifier.Sign(digest.data(), 48, signature));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_KEY_STATE));
+
+  // Not on the curve.
+  publicBlob.back() ^= 1;
+  EXPECT_FALSE(verifier.FromBlob(publicBlob.data(), size));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_KEY));
+
+  // A private key whose public half does not match.
+  auto mismatched = Rfc6979Key();
+  mismatched.back() ^= 1;
+  EXPECT_FALSE(verifier.FromBlob(mismatched.data(),
+                                 static_cast<DWORD>(mismatched.size())));
+}
+
+class EcdsaHashTest : public SoftProviderTest {};
+
+TEST_F(EcdsaHashTest, SignAndVerify) {
+  const auto blob = Rfc6979Key();
+  EcdsaP256Key key;
+  ASSERT_TRUE(key.FromBlob(blob.data(), static_cast<DWORD>(blob.size())));
+
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(nullptr, nullptr, PROV_RSA_AES, CRYPT_VERIFYCONTEXT));
+  Hash hash;
+  ASSERT_TRUE(hash.Create(csp, CALG_SHA_256));
+  ASSERT_TRUE(hash.AddData(reinterpret_cast<LPCBYTE>("sample"), 6));
+  const Blob signature = hash.Sign(key);
+  ASSERT_EQ(signature.Size(), EcdsaP256Key::SignatureSize);
+  EXPECT_EQ(memcmp(LPCBYTE(signature),
+                   FromHex("EFD48B2AACB6A8FD1140DD9CD45E81D6").data(),
+                   16),
+            0);
+
+  Hash again;
+  ASSERT_TRUE(again.Create(csp, CALG_SHA_256));
+  ASSERT_TRUE(again.AddData(reinterpret_cast<LPCBYTE>("sample"), 6));
+  EXPECT_TRUE(again.Verify(signature, signature.Size(), key));
+}
@@ -0,0 +1,170 @@
+#include <windows.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <blob.h>
+#include <blobbuilder.h>
+#include <filewriter.h>
+
+static std::vector<BYTE> ReadBack(LPCWSTR filename) {
+  std::vector<BYTE> data;
+  HANDLE file = CreateFile(filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER size = {};
+    DWORD bytesRead = 0;
+    GetFileSizeEx(file, &size);
+    data.resize(static_cast<size_t>(size.QuadPart));
+    if (!data.empty()) {
+      ReadFile(file, data.data(), DWORD(data.size()), &bytesRead, nullptr);
+    }
+    CloseHandle(file);
+  }
+  return data;
+}
+
+TEST(AsyncFileWriter, NotStarted) {
+  AsyncFileWriter writer{AsyncFileWriterConfig()};
+  const BYTE data[] = {1, 2, 3};
+  EXPECT_FALSE(writer.Write(L"filewriter-never.bin", data, 3, nullptr));
+  EXPECT_EQ(writer.Write(L"filewriter-never.bin", data, 3).get(),
+            DWORD(ERROR_OPERATION_ABORTED));
+}
+
+TEST(AsyncFileWriter, ManyFiles) {
+  AsyncFileWriterConfig config;
+  config.maxInFlight = 4;
+  config.maxPending = 8;
+  config.bufferSize = 1024;
+  AsyncFileWriter writer(config);
+  ASSERT_TRUE(writer.Start());
+
+  std::atomic<int> succeeded(0);
+  const int count = 200;
+  for (int i = 0; i < count; ++i) {
+    const auto name = L"filewriter-" + std::to_wstring(i) + L".bin";
+    // Every tenth write is too large for a pooled buffer.
+    std::vector<BYTE> data(i % 10 == 0 ? 4000 + i : 100 + i, BYTE(i));
+    ASSERT_TRUE(writer.Write(name.c_str(),
+                             data.data(),
+                             DWORD(data.size()),
+                             [&succeeded](DWORD status) {
+                               if (status == ERROR_SUCCESS) ++succeeded;
+                             }));
+  }
+  writer.Flush();
+  EXPECT_EQ(succeeded, count);
+
+  const auto m = writer.GetMetrics();
+  EXPECT_EQ(m.submitted, ULONGLONG(count));
+  EXPECT_EQ(m.completed, ULONGLONG(count));
+  EXPECT_EQ(m.failed, 0);
+  EXPECT_LE(m.buffersAllocated, config.maxPending);
+
+  for (int i = 0; i < count; ++i) {
+    const auto name = L"filewriter-" + std::to_wstring(i) + L".bin";
+    const auto data = ReadBack(name.c_str());
+    ASSERT_EQ(data.size(), size_t(i % 10 == 0 ? 4000 + i : 100 + i));
+    EXPECT_EQ(data.front(), BYTE(i));
+    EXPECT_EQ(data.back(), BYTE(i));
+    DeleteFile(name.c_str());
+  }
+  writer.Stop();
+}
+
+TEST(AsyncFileWriter, Future) {
+  AsyncFileWriter writer{AsyncFileWriterConfig()};
+  ASSERT_TRUE(writer.Start());
+  const BYTE data[] = {1, 2, 3};
+  auto ok = writer.Write(L"filewriter-future.bin", data, sizeof(data));
+  auto ng = writer.Write(L"no-such-directory/x.bin", data, sizeof(data));
+  EXPECT_EQ(ok.get(), DWORD(ERROR_SUCCESS));
+  EXPECT_NE(ng.get(), DWORD(ERROR_SUCCESS));
+  EXPECT_EQ(ReadBack(L"filewriter-future.bin").size(), sizeof(data));
+  DeleteFile(L"filewriter-future.bin");
+
+  // Stop drains what is still queued.
+  auto last = writer.Write(L"filewriter-last.bin", data, sizeof(data));
+  writer.Stop();
+  EXPECT_EQ(last.get(), DWORD(ERROR_SUCCESS));
+  DeleteFile(L"filewriter-last.bin");
+  EXPECT_FALSE(writer.Write(L"filewriter-last.bin", data, 3, nullptr));
+}
+
+TEST(AsyncFileWriter, Gather) {
+  AsyncFileWriter writer{AsyncFileWriterConfig()};
+  ASSERT_TRUE(writer.Start());
+
+  const BYTE body[] = {0xb0, 0xb1, 0xb2};
+  BlobBuilder parts;
+  ASSERT_TRUE(parts.AppendValue(DWORD(sizeof(body))));
+  ASSERT_TRUE(parts.Reference(BlobView(body, sizeof(body))));
+  ASSERT_TRUE(parts.AppendValue(BYTE(0xff)));
+  EXPECT_EQ(writer.Write(L"filewriter-gather.bin", parts).get(),
+            DWORD(ERROR_SUCCESS));
+  writer.Stop();
+
+  const std::vector<BYTE> expected = {3, 0, 0, 0, 0xb0, 0xb1, 0xb2, 0xff};
+  EXPECT_EQ(ReadBack(L"filewriter-gather.bin"), expected);
+  DeleteFile(L"filewriter-gather.bin");
+}
+
+TEST(AsyncFileWriter, WriteFromCompletion) {
+  AsyncFileWriterConfig config;
+  config.maxInFlight = 1;
+  config.maxPending = 1;
+  AsyncFileWriter writer(config);
+  ASSERT_TRUE(writer.Start());
+
+  // Each completion submits the next write while the writer is full.
+  const BYTE data[] = {1, 2, 3};
+  const int count = 10;
+  std::promise<int> done;
+  std::function<void(int, DWORD)> next;
+  next = [&](int i, DWORD status) {
+    if (status != ERROR_SUCCESS || i == count) {
+      done.set_value(i);
+      return;
+    }
+    const auto name = L"filewriter-chain" + std::to_wstring(i) + L".bin";
+    if (!writer.Write(name.c_str(),
+                      data,
+                      sizeof(data),
+                      [&next, i](DWORD status) { next(i + 1, status); })) {
+      done.set_value(-1);
+    }
+  };
+  next(0, ERROR_SUCCESS);
+
+  auto result = done.get_future();
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(30)),
+            std::future_status::ready);
+  EXPECT_EQ(result.get(), count);
+  writer.Flush();
+  EXPECT_EQ(writer.GetMetrics().completed, ULONGLONG(count));
+  writer.Stop();
+
+  for (int i = 0; i < count; ++i) {
+    const auto name = L"filewriter-chain" + std::to_wstring(i) + L".bin";
+    EXPECT_EQ(ReadBack(name.c_str()).size(), sizeof(data));
+    DeleteFile(name.c_str());
+  }
+}
@@ -0,0 +1,76 @@
+#include <windows.h>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <blob.h>
+#include <csp.h>
+#include <hash.h>
+
+static_assert(sizeof(Digest<MD5Traits>) == 16, "MD5");
+static_assert(sizeof(Digest<SHA1Traits>) == 20, "SHA1");
+static_assert(sizeof(Digest<SHA256Traits>) == 32, "SHA256");
+static_assert(sizeof(SHA256Traits::DigestInfo) == 19, "SHA256 DigestInfo");
+
+TEST(Hash, Traits) {
+  for (auto p = HashAlgorithm::Begin(); p != HashAlgorithm::End(); ++p) {
+    // The last byte of a DigestInfo prefix is the length of the digest.
+    EXPECT_EQ(p->digestInfo[p->digestInfoSize - 1], p->digestSize);
+    EXPECT_EQ(HashAlgorithm::Find(p->id), p);
+  }
+  EXPECT_EQ(HashAlgorithm::Find(CALG_SHA_512), nullptr);
+}
+
+TEST(Hash, Typed) {
+  const BYTE abc[] = {'a', 'b', 'c'};
+  const Digest<SHA256Traits> expected = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+    0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+    0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+  };
+
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(nullptr, nullptr, PROV_RSA_AES, CRYPT_VERIFYCONTEXT));
+
+  BasicHash<SHA256Traits> typed;
+  ASSERT_TRUE(typed.Create(csp));
+  ASSERT_TRUE(typed.AddData(abc, sizeof(abc)));
+  Digest<SHA256Traits> digest;
+  ASSERT_TRUE(typed.GetHashValue(digest));
+  EXPECT_EQ(digest, expected);
+
+  Hash erased;
+  ASSERT_TRUE(erased.Create(csp, CALG_SHA_256));
+  EXPECT_EQ(erased.DigestSize(), SHA256Traits::DigestSize);
+  ASSERT_TRUE(erased.AddData(abc, sizeof(abc)));
+  auto blob = erased.GetHashValue();
+  ASSERT_EQ(blob.Size(), expected.size());
+  EXPECT_EQ(memcmp(blob, expected.data(), expected.size()), 0);
+}
+
+TEST(Hash, SetHashValue) {
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(nullptr, nullptr, PROV_RSA_AES, CRYPT_VERIFYCONTEXT));
+
+  Hash hash;
+  ASSERT_TRUE(hash.Create(csp, CALG_SHA1));
+  const BYTE shortDigest[16] = {};
+  EXPECT_FALSE(hash.SetHashValue(shortDigest, sizeof(shortDigest)));
+  EXPECT_EQ(GetLastError(), static_cast<DWORD>(ERROR_INVALID_DATA));
+
+  const BYTE digest[20] = {1, 2, 3};
+  EXPECT_TRUE(hash.SetHashValue(digest, sizeof(digest)));
+  auto blob = hash.GetHashValue();
+  ASSERT_EQ(blob.Size(), sizeof(digest));
+  EXPECT_EQ(memcmp(blob, digest, sizeof(digest)), 0);
+
+  BasicHash<SHA1Traits> typed;
+  ASSERT_TRUE(typed.Create(csp));
+  EXPECT_TRUE(typed.SetHashValue(digest));
+}
@@ -0,0 +1,141 @@
+#include <windows.h>
+#include <list>
+#include <unordered_map>
+
+#include "testutil.h"
+
+#include <keyindex.h>
+#include <keycache.h>
+
+// Three signing keys in an in-memory SoftProvider, their PUBLICKEYBLOBs
+// and a signature by each over the same digest.
+class PublicKeyCacheTest : public SoftProviderTest {
+protected:
+  static constexpr int KeyCount = 3;
+
+  CSP verifier_;
+  Blob blobs_[KeyCount];
+  Blob signatures_[KeyCount];
+  BYTE digest_[32];
+
+  void SetUp() override {
+    SoftProviderTest::SetUp();
+    memset(digest_, 0x3c, sizeof(digest_));
+    for (int i = 0; i < KeyCount; ++i) {
+      CSP csp;
+      const std::wstring name = L"signer" + std::to_wstring(i);
+      ASSERT_TRUE(csp.Acquire(name.c_str(),
+                              nullptr,
+                              PROV_RSA_FULL,
+                              CRYPT_NEWKEYSET));
+      Key key(csp.GenKey(AT_SIGNATURE, 0));
+      blobs_[i] = key.Export(PUBLICKEYBLOB);
+      ASSERT_NE(blobs_[i].Size(), 0u);
+      Hash hash;
+      ASSERT_TRUE(hash.Create(csp, CALG_SHA_256));
+      ASSERT_TRUE(hash.SetHashValue(digest_, sizeof(digest_)));
+      signatures_[i] = hash.Sign(AT_SIGNATURE);
+      ASSERT_NE(signatures_[i].Size(), 0u);
+    }
+    ASSERT_TRUE(verifier_.Acquire(nullptr,
+                                  nullptr,
+                                  PROV_RSA_FULL,
+                                  CRYPT_VERIFYCONTEXT));
+  }
+
+  void TearDown() override {
+    verifier_.Attach(NULL);
+    SoftProviderTest::TearDown();
+  }
+
+  bool Verify(PublicKeyCache &cache, int signer, int key) {
+    Hash hash;
+    return hash.Create(verifier_, CALG_SHA_256)
+           && hash.SetHashValue(digest_, sizeof(digest_))
+           && cache.Verify(hash,
+                           signatures_[signer],
+                           signatures_[signer].Size(),
+                           blobs_[key]);
+  }
+};
+
+TEST_F(PublicKeyCacheTest, Import) {
+  Key key;
+  ASSERT_TRUE(key.Import(verifier_, blobs_[0]));
+  const HCRYPTKEY first = key;
+  EXPECT_NE(first, HCRYPTKEY(NULL));
+  ASSERT_TRUE(key.Import(verifier_, BlobView(blobs_[1])));
+  EXPECT_NE(HCRYPTKEY(key), first);
+
+  // A failed import keeps the key held.
+  const BYTE garbage[] = {PUBLICKEYBLOB, CUR_BLOB_VERSION, 0, 0};
+  const HCRYPTKEY second = key;
+  EXPECT_FALSE(key.Import(verifier_, garbage, sizeof(garbage)));
+  EXPECT_EQ(HCRYPTKEY(key), second);
+
+  Hash hash;
+  ASSERT_TRUE(hash.Create(verifier_, CALG_SHA_256));
+  ASSERT_TRUE(hash.SetHashValue(digest_, sizeof(digest_)));
+  EXPECT_TRUE(hash.Verify(signatures_[1], signatures_[1].Size(), key));
+}
+
+TEST_F(PublicKeyCacheTest, Verify) {
+  PublicKeyCache cache(verifier_, PublicKeyCacheConfig());
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < KeyCount; ++i) {
+      EXPECT_TRUE(Verify(cache, i, i)) << round << " " << i;
+    }
+  }
+  EXPECT_FALSE(Verify(cache, 0, 1));
+  EXPECT_EQ(GetLastError(), NTE_BAD_SIGNATURE);
+
+  // Each key was imported once; every later use was a hit on its handle.
+  const auto metrics = cache.GetMetrics();
+  EXPECT_EQ(metrics.misses, ULONGLONG(KeyCount));
+  EXPECT_EQ(metrics.hits, ULONGLONG(2 * KeyCount + 1));
+  EXPECT_EQ(metrics.entries, DWORD(KeyCount));
+  EXPECT_EQ(metrics.evictions, 0u);
+
+  const auto key = cache.Get(blobs_[0]);
+  ASSERT_TRUE(key);
+  EXPECT_EQ(HCRYPTKEY(*cache.Get(blobs_[0])), HCRYPTKEY(*key));
+  EXPECT_NE(HCRYPTKEY(*cache.Get(blobs_[1])), HCRYPTKEY(*key));
+}
+
+TEST_F(PublicKeyCacheTest, Evict) {
+  PublicKeyCacheConfig config;
+  config.maxEntries = 2;
+  PublicKeyCache cache(verifier_, config);
+  auto held = cache.Get(blobs_[0]);
+  ASSERT_TRUE(held);
+  ASSERT_TRUE(cache.Get(blobs_[1]));
+  ASSERT_TRUE(cache.Get(blobs_[0]));  // 1 is now the oldest
+  ASSERT_TRUE(cache.Get(blobs_[2]));
+  auto metrics = cache.GetMetrics();
+  EXPECT_EQ(metrics.evictions, 1u);
+  EXPECT_EQ(metrics.entries, 2u);
+  ASSERT_TRUE(cache.Get(blobs_[0]));
+  EXPECT_EQ(cache.GetMetrics().misses, 3u);
+
+  // An evicted handle stays usable by whoever still holds it.
+  cache.Clear();
+  EXPECT_EQ(cache.GetMetrics().entries, 0u);
+  Hash hash;
+  ASSERT_TRUE(hash.Create(verifier_, CALG_SHA_256));
+  ASSERT_TRUE(hash.SetHashValue(digest_, sizeof(digest_)));
+  EXPECT_TRUE(hash.Verify(signatures_[0], signatures_[0].Size(), *held));
+}
+
+TEST_F(PublicKeyCacheTest, PublicBlobsOnly) {
+  PublicKeyCache cache(verifier_, PublicKeyCacheConfig());
+  BYTE blob[sizeof(PUBLICKEYSTRUC)] = {PRIVATEKEYBLOB, CUR_BLOB_VERSION};
+  EXPECT_FALSE(cache.Get(blob, sizeof(blob)));
+  EXPECT_EQ(GetLastError(), NTE_BAD_TYPE);
+  EXPECT_FALSE(cache.Get(nullptr, 0));
+  EXPECT_EQ(GetLastError(), NTE_BAD_TYPE);
+
+  // A truncated PUBLICKEYBLOB fails in the import and is not cached.
+  blob[0] = PUBLICKEYBLOB;
+  EXPECT_FALSE(cache.Get(blob, sizeof(blob)));
+  EXPECT_EQ(cache.GetMetrics().entries, 0u);
+}
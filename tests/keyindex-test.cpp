@@ -0,0 +1,281 @@
+#include <windows.h>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <blob.h>
+#include <csp.h>
+#include <hash.h>
+#include <keyindex.h>
+
+static std::vector<BYTE> MakeKeyBlob(BYTE type,
+                                     DWORD magic,
+                                     DWORD bitlen,
+                                     DWORD pubexp,
+                                     BYTE fill) {
+  const DWORD modulusSize = bitlen / 8;
+  std::vector<BYTE> blob(sizeof(PUBLICKEYSTRUC) + sizeof(RSAPUBKEY)
+                         + modulusSize * (type == PRIVATEKEYBLOB ? 2 : 1));
+  auto header = reinterpret_cast<PUBLICKEYSTRUC*>(blob.data());
+  header->bType = type;
+  header->bVersion = CUR_BLOB_VERSION;
+  header->aiKeyAlg = CALG_RSA_KEYX;
+  auto rsa = reinterpret_cast<RSAPUBKEY*>(header + 1);
+  rsa->magic = magic;
+  rsa->bitlen = bitlen;
+  rsa->pubexp = pubexp;
+  auto modulus = reinterpret_cast<LPBYTE>(rsa + 1);
+  for (DWORD i = 0; i < modulusSize; ++i) {
+    modulus[i] = static_cast<BYTE>(fill + i);
+  }
+  return blob;
+}
+
+static KeyFingerprint MakeFingerprint(BYTE seed) {
+  KeyFingerprint fp;
+  for (size_t i = 0; i < fp.size(); ++i) {
+    fp[i] = static_cast<BYTE>(seed * 31 + i);
+  }
+  return fp;
+}
+
+static std::vector<BYTE> ReadBack(LPCWSTR filename) {
+  std::vector<BYTE> data;
+  HANDLE file = CreateFile(filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  if (file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER size = {};
+    DWORD bytesRead = 0;
+    GetFileSizeEx(file, &size);
+    data.resize(static_cast<size_t>(size.QuadPart));
+    if (!data.empty()) {
+      ReadFile(file, data.data(), DWORD(data.size()), &bytesRead, nullptr);
+    }
+    CloseHandle(file);
+  }
+  return data;
+}
+
+static bool WriteBack(LPCWSTR filename, const std::vector<BYTE> &data) {
+  Blob blob;
+  if (!blob.Alloc(static_cast<DWORD>(data.size()))) return false;
+  memcpy(blob, data.data(), data.size());
+  return blob.Save(filename);
+}
+
+TEST(KeyIndex, Normalize) {
+  const auto pub = MakeKeyBlob(PUBLICKEYBLOB, 0x31415352, 512, 65537, 1);
+  const auto pri = MakeKeyBlob(PRIVATEKEYBLOB, 0x32415352, 512, 65537, 1);
+  std::vector<BYTE> a, b;
+  ASSERT_TRUE(KeyIndex::Normalize(pub.data(), DWORD(pub.size()), a));
+  ASSERT_TRUE(KeyIndex::Normalize(pri.data(), DWORD(pri.size()), b));
+  EXPECT_EQ(a, b);
+
+  // length(64) || modulus big-endian || length(3) || 01 00 01
+  ASSERT_EQ(a.size(), 4 + 64 + 4 + 3);
+  EXPECT_EQ(a[3], 64);
+  EXPECT_EQ(a[4], 64);
+  EXPECT_EQ(a[4 + 63], 1);
+  EXPECT_EQ(a[4 + 64 + 3], 3);
+  EXPECT_EQ(a[4 + 64 + 4], 1);
+  EXPECT_EQ(a[4 + 64 + 6], 1);
+
+  // Leading zeros of the modulus do not change the result.
+  auto padded = MakeKeyBlob(PUBLICKEYBLOB, 0x31415352, 520, 65537, 1);
+  padded.back() = 0;
+  std::vector<BYTE> c;
+  ASSERT_TRUE(KeyIndex::Normalize(padded.data(), DWORD(padded.size()), c));
+  EXPECT_EQ(c, a);
+
+  EXPECT_FALSE(KeyIndex::Normalize(pub.data(), DWORD(pub.size() - 1), a));
+  auto bad = pub;
+  bad[0] = SIMPLEBLOB;
+  EXPECT_FALSE(KeyIndex::Normalize(bad.data(), DWORD(bad.size()), a));
+}
+
+TEST(KeyIndex, FindAndDuplicates) {
+  KeyIndex index;
+  const DWORD c0 = index.AddContainer(L"c0", L"prov", PROV_RSA_FULL, 0);
+  const DWORD c1 = index.AddContainer(L"c1", L"prov", PROV_RSA_FULL, 0);
+  const DWORD c2 = index.AddContainer(L"c2", nullptr, PROV_RSA_AES,
+                                      CRYPT_MACHINE_KEYSET);
+  EXPECT_EQ(index.ContainerCount(), 3);
+  EXPECT_STREQ(index.GetContainer(c2).name, L"c2");
+  EXPECT_STREQ(index.GetContainer(c2).provider, L"");
+  EXPECT_EQ(index.GetContainer(c2).flags, DWORD(CRYPT_MACHINE_KEYSET));
+
+  for (int i = 0; i < 1000; ++i) {
+    index.Add(MakeFingerprint(BYTE(i)), i % 2 ? c0 : c1, AT_KEYEXCHANGE);
+  }
+  index.Add(MakeFingerprint(7), c2, AT_SIGNATURE);
+  EXPECT_EQ(index.Size(), 1001);
+
+  std::vector<KeyIndex::Match> matches;
+  EXPECT_TRUE(index.Find(MakeFingerprint(7), matches));
+  // BYTE(i) wraps, so fingerprint 7 was added for i = 7, 263, 519, 775.
+  ASSERT_EQ(matches.size(), 5);
+  EXPECT_EQ(matches[0].container, c0);
+  EXPECT_EQ(matches[4].container, c2);
+  EXPECT_EQ(matches[4].keySpec, DWORD(AT_SIGNATURE));
+
+  KeyFingerprint unknown = {};
+  matches.clear();
+  EXPECT_FALSE(index.Find(unknown, matches));
+  EXPECT_TRUE(matches.empty());
+
+  std::vector<std::vector<KeyIndex::Match>> groups;
+  index.Duplicates(groups);
+  EXPECT_EQ(groups.size(), 256);
+}
+
+TEST(KeyIndex, SaveAndLoad) {
+  const LPCWSTR filename = L"keyindex-test.idx";
+  KeyIndex index;
+  const DWORD c = index.AddContainer(L"container", L"prov", PROV_RSA_FULL, 0);
+  for (int i = 0; i < 100; ++i) {
+    index.Add(MakeFingerprint(BYTE(i % 50)), c, AT_KEYEXCHANGE);
+  }
+  ASSERT_TRUE(index.Save(filename));
+
+  KeyIndex loaded;
+  ASSERT_TRUE(loaded.Load(filename));
+  EXPECT_EQ(loaded.Size(), 100);
+  EXPECT_STREQ(loaded.GetContainer(c).name, L"container");
+  std::vector<KeyIndex::Match> matches;
+  EXPECT_TRUE(loaded.Find(MakeFingerprint(42), matches));
+  EXPECT_EQ(matches.size(), 2);
+  std::vector<std::vector<KeyIndex::Match>> groups;
+  loaded.Duplicates(groups);
+  EXPECT_EQ(groups.size(), 50);
+
+  // Adding to a loaded index keeps the table consistent.
+  loaded.Add(MakeFingerprint(42), c, AT_SIGNATURE);
+  matches.clear();
+  EXPECT_TRUE(loaded.Find(MakeFingerprint(42), matches));
+  EXPECT_EQ(matches.size(), 3);
+
+  // Anything that is not an index is rejected.
+  Blob truncated;
+  ASSERT_TRUE(truncated.Alloc(16));
+  ZeroMemory(truncated, 16);
+  ASSERT_TRUE(truncated.Save(filename));
+  EXPECT_FALSE(loaded.Load(filename));
+  DeleteFile(filename);
+}
+
+TEST(KeyIndex, RemoveKeys) {
+  const LPCWSTR filename = L"keyindex-removed.idx";
+  KeyIndex index;
+  const DWORD c0 = index.AddContainer(L"c0", L"prov", PROV_RSA_FULL, 0);
+  const DWORD c1 = index.AddContainer(L"c1", L"prov", PROV_RSA_FULL, 0);
+  const DWORD c2 = index.AddContainer(L"c2", L"prov", PROV_RSA_FULL, 0);
+  for (int i = 0; i < 10; ++i) {
+    index.Add(MakeFingerprint(BYTE(i)), c0, AT_KEYEXCHANGE);
+    index.Add(MakeFingerprint(BYTE(i)), c1, AT_SIGNATURE);
+  }
+  for (int i = 10; i < 20; ++i) {
+    index.Add(MakeFingerprint(BYTE(i)), c2, AT_KEYEXCHANGE);
+  }
+  ASSERT_EQ(index.Size(), 30u);
+
+  // c0 heads every shared chain; the rest of each chain stays reachable.
+  index.RemoveKeys(c0);
+  EXPECT_EQ(index.Size(), 20u);
+  std::vector<KeyIndex::Match> matches;
+  ASSERT_TRUE(index.Find(MakeFingerprint(3), matches));
+  ASSERT_EQ(matches.size(), 1u);
+  EXPECT_EQ(matches[0].container, c1);
+  std::vector<std::vector<KeyIndex::Match>> groups;
+  index.Duplicates(groups);
+  EXPECT_TRUE(groups.empty());
+
+  // Removed entries are saved as they are and still skipped once loaded.
+  ASSERT_TRUE(index.Save(filename));
+  KeyIndex loaded;
+  ASSERT_TRUE(loaded.Load(filename));
+  EXPECT_EQ(loaded.Size(), 20u);
+  loaded.Add(MakeFingerprint(3), c0, AT_SIGNATURE);
+  matches.clear();
+  ASSERT_TRUE(loaded.Find(MakeFingerprint(3), matches));
+  ASSERT_EQ(matches.size(), 2u);
+  EXPECT_EQ(matches[1].container, c0);
+
+  // Past half of the entries the table is rebuilt without them.
+  loaded.RemoveKeys(c1);
+  EXPECT_EQ(loaded.Size(), 11u);
+  matches.clear();
+  EXPECT_FALSE(loaded.Find(MakeFingerprint(5), matches));
+  EXPECT_TRUE(matches.empty());
+  ASSERT_TRUE(loaded.Find(MakeFingerprint(3), matches));
+  EXPECT_EQ(matches.size(), 1u);
+  ASSERT_TRUE(loaded.Save(filename));
+  const std::vector<BYTE> saved = ReadBack(filename);
+  DWORD entries = 0;
+  ASSERT_GT(saved.size(), 3 * sizeof(DWORD));
+  memcpy(&entries, &saved[2 * sizeof(DWORD)], sizeof(entries));
+  EXPECT_EQ(entries, 11u);
+  DeleteFile(filename);
+}
+
+TEST(KeyIndex, LoadFullTable) {
+  // The file is the header, the entries, the slots, the containers and the
+  // strings, all as they are in memory.
+  const LPCWSTR filename = L"keyindex-full.idx";
+  const size_t headerSize = 6 * sizeof(DWORD);
+  KeyIndex index;
+  const DWORD c = index.AddContainer(L"container", L"prov", PROV_RSA_FULL, 0);
+  for (int i = 0; i < 8; ++i) {
+    index.Add(MakeFingerprint(BYTE(i)), c, AT_KEYEXCHANGE);
+  }
+  ASSERT_TRUE(index.Save(filename));
+  const std::vector<BYTE> saved = ReadBack(filename);
+  ASSERT_GT(saved.size(), headerSize);
+  DWORD header[6];
+  memcpy(header, saved.data(), sizeof(header));
+  const DWORD entries = header[2];
+  const DWORD slots = header[3];
+  ASSERT_EQ(entries, 8u);
+  ASSERT_EQ(slots, 16u);
+  const size_t slotsAt = saved.size()
+                         - header[4] * (4 * sizeof(DWORD))
+                         - header[5] * sizeof(WCHAR)
+                         - slots * sizeof(DWORD);
+
+  // No empty slot: a lookup for a missing key would never end.
+  std::vector<BYTE> full = saved;
+  for (DWORD i = 0; i < slots; ++i) {
+    const DWORD head = i % entries + 1;
+    memcpy(&full[slotsAt + i * sizeof(DWORD)], &head, sizeof(head));
+  }
+  ASSERT_TRUE(WriteBack(filename, full));
+  KeyIndex loaded;
+  EXPECT_FALSE(loaded.Load(filename));
+
+  // Fuller than Add ever leaves it: 8 entries in 8 slots, with free ones.
+  std::vector<BYTE> dense(saved.begin(), saved.begin() + slotsAt);
+  const DWORD halved = slots / 2;
+  memcpy(&dense[3 * sizeof(DWORD)], &halved, sizeof(halved));
+  dense.insert(dense.end(), halved * sizeof(DWORD), 0);
+  dense.insert(dense.end(),
+               saved.begin() + slotsAt + slots * sizeof(DWORD),
+               saved.end());
+  ASSERT_TRUE(WriteBack(filename, dense));
+  EXPECT_FALSE(loaded.Load(filename));
+
+  ASSERT_TRUE(WriteBack(filename, saved));
+  ASSERT_TRUE(loaded.Load(filename));
+  std::vector<KeyIndex::Match> matches;
+  EXPECT_FALSE(loaded.Find(MakeFingerprint(200), matches));
+  EXPECT_TRUE(loaded.Find(MakeFingerprint(3), matches));
+  DeleteFile(filename);
+}
@@ -0,0 +1,128 @@
+#include <windows.h>
+#include <filesystem>
+
+#include "testutil.h"
+
+#include <keyindex.h>
+#include <keywatch.h>
+
+class KeyStoreWatcherTest : public SoftProviderTest {
+protected:
+  std::wstring directory_;
+
+  void SetUp() override {
+    directory_ =
+      (std::filesystem::temp_directory_path() / "keywatch-test").wstring();
+    std::filesystem::remove_all(directory_);
+    SoftProviderConfig config = TestConfig();
+    config.directory = directory_;
+    Install(config);
+  }
+
+  void TearDown() override {
+    SoftProviderTest::TearDown();
+    std::filesystem::remove_all(directory_);
+  }
+
+  static bool CreateContainer(LPCWSTR name, DWORD flags) {
+    CSP csp;
+    return csp.Acquire(name, nullptr, PROV_RSA_FULL, flags | CRYPT_NEWKEYSET)
+           && Key(csp.GenKey(AT_SIGNATURE, CRYPT_EXPORTABLE));
+  }
+
+  static bool DeleteContainer(LPCWSTR name) {
+    CSP csp;
+    return csp.Acquire(name, nullptr, PROV_RSA_FULL, CRYPT_DELETEKEYSET);
+  }
+
+  // Notifications of one change may arrive over several reads, so this
+  // collects them until |name| reaches |action| or nothing more comes.
+  static std::map<std::wstring, ContainerChange::Action> WaitFor(
+      KeyStoreWatcher &watcher,
+      const std::wstring &name,
+      ContainerChange::Action action) {
+    std::map<std::wstring, ContainerChange::Action> seen;
+    while (WaitForSingleObject(watcher.Event(), 5000) == WAIT_OBJECT_0) {
+      std::vector<ContainerChange> changes;
+      EXPECT_TRUE(watcher.Read(changes));
+      for (const auto &it : changes) {
+        seen[it.name] = it.action;
+      }
+      auto it = seen.find(name);
+      if (it != seen.end() && it->second == action) break;
+    }
+    return seen;
+  }
+};
+
+TEST_F(KeyStoreWatcherTest, SoftStore) {
+  ASSERT_TRUE(CreateContainer(L"existing", 0));
+
+  KeyStoreWatcher watcher;
+  ASSERT_TRUE(watcher.Open(directory_.c_str(),
+                           KeyStoreWatcher::SoftResolver(false)));
+  std::vector<std::wstring> names;
+  watcher.Containers(names);
+  EXPECT_THAT(names, testing::ElementsAre(L"existing"));
+
+  // A machine keyset in the same directory is not ours.
+  ASSERT_TRUE(CreateContainer(L"machine", CRYPT_MACHINE_KEYSET));
+  ASSERT_TRUE(CreateContainer(L"added", 0));
+  auto seen = WaitFor(watcher, L"added", ContainerChange::Added);
+  EXPECT_EQ(seen[L"added"], ContainerChange::Added);
+  EXPECT_EQ(seen.count(L"machine"), 0u);
+
+  // The key index follows the same changes one container at a time.
+  KeyIndex index;
+  ASSERT_TRUE(index.Scan(nullptr, PROV_RSA_FULL, 0));
+  EXPECT_EQ(index.ContainerCount(), 2u);
+  ASSERT_TRUE(DeleteContainer(L"existing"));
+  seen = WaitFor(watcher, L"existing", ContainerChange::Removed);
+  EXPECT_EQ(seen[L"existing"], ContainerChange::Removed);
+  EXPECT_FALSE(index.ScanContainer(L"existing", nullptr, PROV_RSA_FULL, 0));
+  EXPECT_EQ(index.Size(), 1u);
+
+  ASSERT_TRUE(CreateContainer(L"existing", 0));
+  seen = WaitFor(watcher, L"existing", ContainerChange::Added);
+  EXPECT_EQ(seen[L"existing"], ContainerChange::Added);
+  EXPECT_TRUE(index.ScanContainer(L"existing", nullptr, PROV_RSA_FULL, 0));
+  EXPECT_EQ(index.ContainerCount(), 2u);
+  EXPECT_EQ(index.Size(), 2u);
+
+  watcher.Containers(names);
+  EXPECT_THAT(names, testing::ElementsAre(L"added", L"existing"));
+
+  std::vector<ContainerChange> changes;
+  watcher.Close();
+  EXPECT_FALSE(watcher.Read(changes));
+}
+
+TEST_F(KeyStoreWatcherTest, RemoveKeys) {
+  ASSERT_TRUE(CreateContainer(L"first", 0));
+  ASSERT_TRUE(CreateContainer(L"second", 0));
+  KeyIndex index;
+  ASSERT_TRUE(index.Scan(nullptr, PROV_RSA_FULL, 0));
+  ASSERT_EQ(index.Size(), 2u);
+
+  const DWORD first = index.FindContainer(L"first", nullptr, PROV_RSA_FULL, 0);
+  ASSERT_NE(first, KeyIndex::NoContainer);
+  EXPECT_EQ(index.FindContainer(L"first",
+                                nullptr,
+                                PROV_RSA_FULL,
+                                CRYPT_MACHINE_KEYSET),
+            KeyIndex::NoContainer);
+
+  Blob blob;
+  {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"second", nullptr, PROV_RSA_FULL, 0));
+    Key key(csp.GetUserKey(AT_SIGNATURE));
+    blob = key.Export(PUBLICKEYBLOB);
+  }
+  index.RemoveKeys(first);
+  EXPECT_EQ(index.Size(), 1u);
+  std::vector<KeyIndex::Match> matches;
+  ASSERT_TRUE(index.FindBlob(blob, blob.Size(), matches));
+  ASSERT_EQ(matches.size(), 1u);
+  EXPECT_STREQ(index.GetContainer(matches[0].container).name, L"second");
+}
@@ -0,0 +1,188 @@
+#include <windows.h>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <condition_variable>
+#include <optional>
+#include <random>
+#include <thread>
+
+#include "testutil.h"
+
+#include <executor.h>
+#include <keyindex.h>
+#include <latency.h>
+#include <signsvc.h>
+
+class LatencyProviderTest : public SoftProviderTest {
+protected:
+  void SetUp() override {
+    SoftProviderTest::SetUp();
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"token", nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+    Key key(csp.GenKey(AT_SIGNATURE, 0));
+    ASSERT_NE(HCRYPTKEY(key), HCRYPTKEY(NULL));
+  }
+};
+
+TEST_F(LatencyProviderTest, Sessions) {
+  LatencyProfile profile;
+  profile.latency[LatencySign] = LatencyDistribution(2000, 0);
+  profile.sessions = 2;
+  LatencyProvider token(*provider_, profile);
+  CryptoProvider::Install(&token);
+
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(L"token", nullptr, PROV_RSA_FULL, 0));
+  const Signer<SHA1Traits> signer(csp, AT_SIGNATURE);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 6; ++i) {
+    threads.emplace_back([&signer, i]() {
+      Digest<SHA1Traits> digest = {static_cast<BYTE>(i)};
+      for (int j = 0; j < 4; ++j) {
+        EXPECT_EQ(signer.Sign(digest).Size(), 64u);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  // 24 signatures of 2ms each through two sessions take at least 24ms.
+  EXPECT_GE(elapsed, std::chrono::milliseconds(24));
+  const auto m = token.GetMetrics();
+  EXPECT_EQ(m.calls[LatencySign], 24u);
+  EXPECT_EQ(m.delayMicros, 24u * 2000);
+  EXPECT_EQ(m.maxConcurrency, 2u);
+  EXPECT_GT(m.waitMicros, 0u);
+  // Hashing has no service time and does not queue for a session.
+  EXPECT_EQ(m.calls[LatencyHash], 48u);
+  EXPECT_EQ(m.faults, 0u);
+}
+
+TEST_F(LatencyProviderTest, Faults) {
+  LatencyProfile profile;
+  profile.faults.push_back({ 1u << LatencyKeyAccess,
+                             static_cast<DWORD>(NTE_NO_KEY),
+                             1.0 });
+  profile.faults.push_back({ 1u << LatencySign,
+                             static_cast<DWORD>(SCARD_W_REMOVED_CARD),
+                             0.5 });
+  LatencyProvider token(*provider_, profile);
+  CryptoProvider::Install(&token);
+
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(L"token", nullptr, PROV_RSA_FULL, 0));
+  EXPECT_EQ(csp.GetUserKey(AT_SIGNATURE), HCRYPTKEY(NULL));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_NO_KEY));
+
+  int removed = 0;
+  const Signer<SHA1Traits> signer(csp, AT_SIGNATURE);
+  for (int i = 0; i < 200; ++i) {
+    if (signer.Sign(Digest<SHA1Traits>()).Size() == 0) {
+      EXPECT_EQ(GetLastError(), DWORD(SCARD_W_REMOVED_CARD));
+      ++removed;
+    }
+  }
+  EXPECT_GT(removed, 60);
+  EXPECT_LT(removed, 140);
+  EXPECT_EQ(token.GetMetrics().faults, ULONGLONG(removed + 1));
+}
+
+TEST_F(LatencyProviderTest, ReacquireAfterRemoval) {
+  LatencyProfile profile;
+  profile.faults.push_back({ 1u << LatencySign,
+                             static_cast<DWORD>(SCARD_W_REMOVED_CARD),
+                             0.3 });
+  profile.seed = 7;
+  LatencyProvider token(*provider_, profile);
+  CryptoProvider::Install(&token);
+
+  SignServiceConfig config;
+  config.workers = 1;
+  config.maxBatch = 1;
+  CapiSignBackend backend;
+  {
+    SignService service(backend, config);
+    service.Start();
+
+    std::mutex lock;
+    std::condition_variable done;
+    int remaining = 20;
+    std::vector<DWORD> status;
+    for (int i = 0; i < 20; ++i) {
+      SignRequest request;
+      request.key.container = L"token";
+      request.key.providerType = PROV_RSA_FULL;
+      request.key.keySpec = AT_SIGNATURE;
+      request.algo = CALG_SHA1;
+      request.digest.Alloc(SHA1Traits::DigestSize);
+      request.completion = [&](SignRequest &r) {
+        std::lock_guard<std::mutex> guard(lock);
+        status.push_back(r.status);
+        if (--remaining == 0) done.notify_all();
+      };
+      ASSERT_TRUE(service.Submit(std::move(request)));
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&remaining]() { return remaining == 0; });
+    guard.unlock();
+    service.Stop();
+
+    // Every removal drops the cached context, so the next batch acquires
+    // a fresh one.
+    const auto m = token.GetMetrics();
+    ASSERT_GT(m.faults, 0u);
+    const bool lastRemoved =
+      status.back() == static_cast<DWORD>(SCARD_W_REMOVED_CARD);
+    EXPECT_EQ(m.calls[LatencyAcquire], 1 + m.faults - (lastRemoved ? 1 : 0));
+  }
+}
+
+TEST_F(LatencyProviderTest, ShardedBackend) {
+  LatencyProfile profile;
+  profile.latency[LatencySign] = LatencyDistribution(2000, 0);
+  profile.sessions = 2;
+  LatencyProvider token(*provider_, profile);
+  CryptoProvider::Install(&token);
+
+  // Two contexts on the one key let two of its batches use both sessions.
+  SignServiceConfig config;
+  config.workers = 4;
+  config.maxBatch = 1;
+  CapiSignBackend backend(nullptr, 2);
+  {
+    SignService service(backend, config);
+    std::mutex lock;
+    std::condition_variable done;
+    int remaining = 16;
+    int succeeded = 0;
+    for (int i = 0; i < 16; ++i) {
+      SignRequest request;
+      request.key.container = L"token";
+      request.key.providerType = PROV_RSA_FULL;
+      request.key.keySpec = AT_SIGNATURE;
+      request.algo = CALG_SHA1;
+      request.digest.Alloc(SHA1Traits::DigestSize);
+      request.completion = [&](SignRequest &r) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (r.status == ERROR_SUCCESS && r.signature.Size() == 64) {
+          ++succeeded;
+        }
+        if (--remaining == 0) done.notify_all();
+      };
+      ASSERT_TRUE(service.Submit(std::move(request)));
+    }
+    service.Start();
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&remaining]() { return remaining == 0; });
+    guard.unlock();
+    service.Stop();
+
+    EXPECT_EQ(succeeded, 16);
+    const auto m = token.GetMetrics();
+    EXPECT_EQ(m.calls[LatencySign], 16u);
+    EXPECT_EQ(m.maxConcurrency, 2u);
+  }
+}
@@ -0,0 +1,134 @@
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <nameindex.h>
+
+static std::vector<std::wstring> Names(const NameIndex &index,
+                                       const std::vector<DWORD> &matches) {
+  std::vector<std::wstring> names;
+  for (auto i : matches) names.push_back(index.Get(i));
+  return names;
+}
+
+TEST(NameIndex, InternAndSort) {
+  NameIndex index;
+  EXPECT_TRUE(index.Add(L"beta", 4));
+  EXPECT_TRUE(index.AddMultiByte("Alpha", CP_ACP));
+  EXPECT_TRUE(index.Add(L"gamma", 5));
+  EXPECT_FALSE(index.Add(L"beta", 4));
+  EXPECT_FALSE(index.AddMultiByte("gamma", CP_ACP));
+  EXPECT_TRUE(index.Add(L"bet", 3));
+  ASSERT_EQ(index.Size(), 4);
+
+  index.Sort();
+  EXPECT_STREQ(index.Get(0), L"Alpha");
+  EXPECT_STREQ(index.Get(1), L"bet");
+  EXPECT_STREQ(index.Get(2), L"beta");
+  EXPECT_STREQ(index.Get(3), L"gamma");
+  EXPECT_EQ(index.Length(3), 5);
+  EXPECT_EQ(index.Get(4), nullptr);
+}
+
+TEST(NameIndex, Find) {
+  NameIndex index;
+  for (int i = 0; i < 1000; ++i) {
+    auto name = L"le-" + std::to_wstring(i) + L"-Container";
+    index.Add(name.c_str(), static_cast<DWORD>(name.size()));
+  }
+  index.Add(L"IIS-Key", 7);
+  index.Sort();
+
+  std::vector<DWORD> matches;
+  index.FindSubstring(L"9-cont", matches);
+  EXPECT_EQ(matches.size(), 100);
+  for (auto i : matches) {
+    std::wstring name = index.Get(i);
+    EXPECT_EQ(name.find(L"9-Container"), name.size() - 11);
+  }
+
+  matches.clear();
+  index.FindSubstring(L"iis", matches);
+  EXPECT_THAT(Names(index, matches), testing::ElementsAre(L"IIS-Key"));
+
+  matches.clear();
+  index.FindSubstring(L"", matches);
+  EXPECT_EQ(matches.size(), index.Size());
+
+  matches.clear();
+  index.FindSubstring(L"Container-", matches);
+  EXPECT_TRUE(matches.empty());
+}
+
+TEST(NameIndex, InsertAndRemove) {
+  NameIndex index;
+  for (int i = 0; i < 200; ++i) {
+    auto name = L"key-" + std::to_wstring(i);
+    index.Add(name.c_str(), static_cast<DWORD>(name.size()));
+  }
+  index.Sort();
+
+  // Insert keeps the order a full Sort would give.
+  DWORD position = 0;
+  EXPECT_TRUE(index.Insert(L"KEY-1000", 8, position));
+  EXPECT_STREQ(index.Get(position), L"KEY-1000");
+  EXPECT_STREQ(index.Get(position - 1), L"key-100");
+  EXPECT_FALSE(index.Insert(L"key-42", 6, position));
+  EXPECT_STREQ(index.Get(position), L"key-42");
+  EXPECT_TRUE(index.Insert(L"aaa", 3, position));
+  EXPECT_EQ(position, 0u);
+  for (DWORD i = 1; i < index.Size(); ++i) {
+    EXPECT_LT(_wcsicmp(index.Get(i - 1), index.Get(i)), 0);
+  }
+
+  // Remove every other name, enough to compact the buffer on the way.
+  for (int i = 0; i < 200; i += 2) {
+    auto name = L"key-" + std::to_wstring(i);
+    ASSERT_TRUE(index.Find(name.c_str(),
+                           static_cast<DWORD>(name.size()),
+                           position));
+    EXPECT_TRUE(index.Remove(position));
+    EXPECT_FALSE(index.Find(name.c_str(),
+                            static_cast<DWORD>(name.size()),
+                            position));
+  }
+  EXPECT_FALSE(index.Remove(index.Size()));
+  ASSERT_EQ(index.Size(), 102u);
+  for (int i = 1; i < 200; i += 2) {
+    auto name = L"key-" + std::to_wstring(i);
+    EXPECT_TRUE(index.Find(name.c_str(),
+                           static_cast<DWORD>(name.size()),
+                           position))
+      << i;
+  }
+
+  // Removed names neither match nor shift the matches of others.
+  std::vector<DWORD> matches;
+  index.FindSubstring(L"-19", matches);
+  EXPECT_THAT(Names(index, matches),
+              testing::ElementsAre(L"key-19", L"key-191", L"key-193",
+                                   L"key-195", L"key-197", L"key-199"));
+  for (auto i : matches) {
+    EXPECT_TRUE(index.Contains(i, L"-19"));
+  }
+  EXPECT_FALSE(index.Contains(0, L"-19"));
+  EXPECT_TRUE(index.Contains(0, L""));
+
+  // Positions stay right for names inserted after the compaction above.
+  ASSERT_TRUE(index.Insert(L"a-19", 4, position));
+  matches.clear();
+  index.FindSubstring(L"-19", matches);
+  EXPECT_THAT(Names(index, matches),
+              testing::ElementsAre(L"a-19", L"key-19", L"key-191", L"key-193",
+                                   L"key-195", L"key-197", L"key-199"));
+  ASSERT_TRUE(index.Find(L"a-19", 4, position));
+  ASSERT_TRUE(index.Remove(position));
+
+  // A removed name can come back.
+  EXPECT_TRUE(index.Insert(L"key-190", 7, position));
+  EXPECT_STREQ(index.Get(position + 1), L"key-191");
+  EXPECT_FALSE(index.Add(L"key-190", 7));
+}
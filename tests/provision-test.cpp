@@ -0,0 +1,101 @@
+#include <windows.h>
+#include <chrono>
+#include <iostream>
+#include <condition_variable>
+
+#include "testutil.h"
+
+#include <keyindex.h>
+#include <provision.h>
+
+class KeyProvisionerTest : public SoftProviderTest {
+protected:
+  static std::vector<std::wstring> Names(LPCWSTR prefix, int count) {
+    std::vector<std::wstring> names;
+    for (int i = 0; i < count; ++i) {
+      names.push_back(prefix + std::to_wstring(i));
+    }
+    return names;
+  }
+};
+
+TEST_F(KeyProvisionerTest, Parallel) {
+  ProvisionConfig config;
+  config.keyBits = 512;
+  config.exchange = true;
+  config.threads = 4;
+  config.progressMillis = 1;
+  KeyProvisioner provisioner(config);
+
+  const auto names = Names(L"fleet", 12);
+  KeyIndex index;
+  std::vector<DWORD> status;
+  DWORD calls = 0, lastKeys = 0;
+  ASSERT_TRUE(provisioner.Run(names,
+                              &index,
+                              [&](const ProvisionProgress &p) {
+                                ++calls;
+                                EXPECT_GE(p.keys, lastKeys);
+                                lastKeys = p.keys;
+                              },
+                              status));
+  ASSERT_EQ(status.size(), names.size());
+  for (auto it : status) EXPECT_EQ(it, DWORD(ERROR_SUCCESS));
+
+  const auto p = provisioner.GetProgress();
+  EXPECT_EQ(p.total, 12u);
+  EXPECT_EQ(p.containers, 12u);
+  EXPECT_EQ(p.keys, 24u);
+  EXPECT_EQ(p.failed, 0u);
+  EXPECT_GT(p.KeysPerSecond(), 0);
+  EXPECT_GE(calls, 1u);
+  EXPECT_EQ(lastKeys, 24u);
+
+  // The index points at the containers that hold the keys.
+  EXPECT_EQ(index.ContainerCount(), 12u);
+  EXPECT_EQ(index.Size(), 24u);
+  for (const auto &name : names) {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(name.c_str(), nullptr, PROV_RSA_AES, 0));
+    Key key(csp.GetUserKey(AT_SIGNATURE));
+    const Blob blob = key.Export(PUBLICKEYBLOB);
+    std::vector<KeyIndex::Match> matches;
+    ASSERT_TRUE(index.FindBlob(blob, blob.Size(), matches));
+    ASSERT_EQ(matches.size(), 1u);
+    EXPECT_EQ(matches[0].keySpec, DWORD(AT_SIGNATURE));
+    EXPECT_EQ(std::wstring(index.GetContainer(matches[0].container).name),
+              name);
+  }
+}
+
+TEST_F(KeyProvisionerTest, Failures) {
+  {
+    CSP existing;
+    ASSERT_TRUE(existing.Acquire(L"taken",
+                                 nullptr,
+                                 PROV_RSA_AES,
+                                 CRYPT_NEWKEYSET));
+  }
+
+  ProvisionConfig config;
+  config.keyBits = 512;
+  KeyProvisioner provisioner(config);
+  std::vector<DWORD> status;
+  EXPECT_FALSE(provisioner.Run({L"fresh", L"taken"}, nullptr, nullptr, status));
+  ASSERT_EQ(status.size(), 2u);
+  EXPECT_EQ(status[0], DWORD(ERROR_SUCCESS));
+  EXPECT_EQ(status[1], DWORD(NTE_EXISTS));
+  EXPECT_EQ(provisioner.GetProgress().failed, 1u);
+
+  // A key that cannot be generated takes its new container with it.
+  config.keyBits = 500;
+  KeyProvisioner invalid(config);
+  EXPECT_FALSE(invalid.Run({L"odd"}, nullptr, nullptr, status));
+  EXPECT_EQ(status[0], DWORD(NTE_BAD_FLAGS));
+  CSP csp;
+  EXPECT_FALSE(csp.Acquire(L"odd", nullptr, PROV_RSA_AES, 0));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_KEYSET));
+
+  // The one that already existed is left alone.
+  EXPECT_TRUE(csp.Acquire(L"taken", nullptr, PROV_RSA_AES, 0));
+}
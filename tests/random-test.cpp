@@ -0,0 +1,258 @@
+#include <windows.h>
+#include <deque>
+#include <condition_variable>
+#include <random>
+#include <thread>
+
+#include "testutil.h"
+
+#include <executor.h>
+#include <random.h>
+#include <blinding.h>
+
+// A seed source that counts its calls and returns |byte| repeated.
+static RandomGenerator::SeedSource CountingSeed(int &calls, BYTE byte) {
+  return [&calls, byte](LPBYTE data, DWORD size) {
+    ++calls;
+    memset(data, byte, size);
+    return true;
+  };
+}
+
+TEST(RandomGenerator, KeyStream) {
+  // RFC 7539, appendix A.1, test vectors 1 and 2: the zero key and nonce
+  // at block counters 0 and 1.
+  const DWORD key[8] = {};
+  std::vector<BYTE> stream(8 * RandomGenerator::BlockSize);
+  RandomGenerator::KeyStream(key, 0, 8, stream.data());
+  EXPECT_EQ(std::vector<BYTE>(stream.begin(), stream.begin() + 128),
+            FromHex("76b8e0ada0f13d90405d6ae55386bd28"
+                    "bdd219b8a08ded1aa836efcc8b770dc7"
+                    "da41597c5157488d7724e03fb8d84a37"
+                    "6a43b8f41518a11cc387b669b2ee6586"
+                    "9f07e7be5551387a98ba977c732d080d"
+                    "cb0f29a048e3656912c6533e32ee7aed"
+                    "29b721769ce64e43d57133b074d839d5"
+                    "31ed1f28510afb45ace10a1f4b794d6f"));
+
+  // Four blocks at a time must match one at a time, including across a
+  // carry into the high counter word.
+  const DWORD other[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  for (ULONGLONG start : {0ull, 0xfffffffeull}) {
+    RandomGenerator::KeyStream(other, start, 8, stream.data());
+    for (DWORD i = 0; i < 8; ++i) {
+      BYTE block[RandomGenerator::BlockSize];
+      RandomGenerator::KeyStream(other, start + i, 1, block);
+      EXPECT_EQ(memcmp(block,
+                       &stream[i * RandomGenerator::BlockSize],
+                       sizeof(block)),
+                0)
+        << start << "+" << i;
+    }
+  }
+}
+
+TEST(RandomGenerator, Buffered) {
+  int calls = 0;
+  RandomGenerator a(CountingSeed(calls, 0x5a));
+  RandomGenerator b(CountingSeed(calls, 0x5a));
+
+  // The same seed gives the same stream however it is read.
+  std::vector<BYTE> whole(10000), pieces(10000);
+  ASSERT_TRUE(a.Generate(whole.data(), DWORD(whole.size())));
+  DWORD offset = 0;
+  for (DWORD size : {1u, 31u, 32u, 4000u, 5936u}) {
+    ASSERT_TRUE(b.Generate(&pieces[offset], size));
+    offset += size;
+  }
+  EXPECT_EQ(whole, pieces);
+  EXPECT_EQ(calls, 2);
+
+  // A refill never reuses a key, so no 32-byte run repeats.
+  for (size_t i = 32; i + 32 <= whole.size(); i += 32) {
+    EXPECT_NE(memcmp(&whole[0], &whole[i], 32), 0) << i;
+  }
+
+  // Output counts towards the reseed, and the new seed changes the stream.
+  std::vector<BYTE> chunk(1 << 20);
+  for (ULONGLONG n = 0; n < RandomGenerator::ReseedBytes; n += chunk.size()) {
+    ASSERT_TRUE(a.Generate(chunk.data(), DWORD(chunk.size())));
+  }
+  EXPECT_EQ(calls, 2);
+  ASSERT_TRUE(a.Generate(chunk.data(), 16));
+  EXPECT_EQ(calls, 3);
+}
+
+TEST(RandomGenerator, SeedFailure) {
+  RandomGenerator generator([](LPBYTE, DWORD) {
+    SetLastError(NTE_FAIL);
+    return false;
+  });
+  BYTE data[16];
+  memset(data, 0xcc, sizeof(data));
+  EXPECT_FALSE(generator.Generate(data, sizeof(data)));
+  EXPECT_EQ(GetLastError(), NTE_FAIL);
+  EXPECT_EQ(std::count(data, data + sizeof(data), 0), 16);
+}
+
+TEST(RandomGenerator, ThreadLocal) {
+  RandomGenerator *mine = &RandomGenerator::ThreadLocal();
+  EXPECT_EQ(mine, &RandomGenerator::ThreadLocal());
+
+  BYTE a[32] = {}, b[32] = {};
+  RandomGenerator *theirs = nullptr;
+  bool ok = false;
+  std::thread([&]() {
+    theirs = &RandomGenerator::ThreadLocal();
+    ok = theirs->Generate(b, sizeof(b));
+  }).join();
+  EXPECT_NE(mine, theirs);
+  ASSERT_TRUE(ok);
+  ASSERT_TRUE(mine->Generate(a, sizeof(a)));
+  EXPECT_NE(memcmp(a, b, sizeof(a)), 0);
+}
+
+class RsaBlindingTest : public ::testing::Test {
+protected:
+  static std::shared_ptr<const RsaKey> key_;
+
+  static void SetUpTestSuite() {
+    std::mt19937 random(1);
+    auto key = std::make_shared<RsaKey>();
+    ASSERT_TRUE(key->Generate(512, 65537, [&random](LPBYTE p, DWORD n) {
+      for (DWORD i = 0; i < n; ++i) p[i] = static_cast<BYTE>(random());
+    }));
+    key_ = key;
+  }
+
+  static void TearDownTestSuite() {
+    key_.reset();
+  }
+
+  // Waits for a pool to settle at |count| pairs.
+  static bool WaitFor(RsaBlindingPool &pool, DWORD count) {
+    for (int i = 0; i < 500 && pool.Available() != count; ++i) Sleep(10);
+    return pool.Available() == count;
+  }
+};
+
+std::shared_ptr<const RsaKey> RsaBlindingTest::key_;
+
+TEST_F(RsaBlindingTest, SameSignature) {
+  const BYTE digest[32] = {1, 2, 3};
+  std::vector<BYTE> plain(key_->SignatureSize());
+  std::vector<BYTE> blinded(key_->SignatureSize());
+  ASSERT_TRUE(key_->Sign(CALG_SHA_256, digest, sizeof(digest), 0,
+                         plain.data()));
+
+  RandomGenerator &random = RandomGenerator::ThreadLocal();
+  for (int i = 0; i < 4; ++i) {
+    RsaBlinding blinding;
+    ASSERT_TRUE(key_->NewBlinding([&random](LPBYTE p, DWORD n) {
+      random.Generate(p, n);
+    }, blinding));
+    // r^e * (r^-1)^e = 1
+    EXPECT_EQ(BigNum::Mod(BigNum::Mul(blinding.blind,
+                                      BigNum::ModExp(
+                                        blinding.unblind,
+                                        BigNum(key_->PublicExponent()),
+                                        key_->Modulus())),
+                          key_->Modulus()),
+              BigNum(1));
+    ASSERT_TRUE(key_->Sign(CALG_SHA_256, digest, sizeof(digest), 0,
+                           blinded.data(), blinding));
+    EXPECT_EQ(blinded, plain);
+  }
+
+  RsaKey publicOnly;
+  std::vector<BYTE> blob;
+  DWORD size = 0;
+  ASSERT_TRUE(key_->ToBlob(PUBLICKEYBLOB, CALG_RSA_SIGN, nullptr, &size));
+  blob.resize(size);
+  ASSERT_TRUE(key_->ToBlob(PUBLICKEYBLOB, CALG_RSA_SIGN, blob.data(), &size));
+  ASSERT_TRUE(publicOnly.FromBlob(blob.data(), size));
+  RsaBlinding blinding;
+  ASSERT_TRUE(publicOnly.NewBlinding([&random](LPBYTE p, DWORD n) {
+    random.Generate(p, n);
+  }, blinding));
+  EXPECT_FALSE(publicOnly.Sign(CALG_SHA_256, digest, sizeof(digest), 0,
+                               blinded.data(), blinding));
+  EXPECT_EQ(GetLastError(), NTE_BAD_KEY_STATE);
+}
+
+TEST_F(RsaBlindingTest, Pool) {
+  Executor executor(2);
+  RsaBlindingPoolConfig config;
+  config.capacity = 8;
+  config.refillBelow = 4;
+  RsaBlindingPool pool(executor, key_, config);
+  ASSERT_TRUE(WaitFor(pool, 8));
+
+  const BYTE digest[32] = {4, 5, 6};
+  std::vector<BYTE> plain(key_->SignatureSize());
+  std::vector<BYTE> pooled(key_->SignatureSize());
+  ASSERT_TRUE(key_->Sign(CALG_SHA_256, digest, sizeof(digest), 0,
+                         plain.data()));
+
+  // Taking down to the low-water mark posts a refill back to capacity.
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(pool.Sign(CALG_SHA_256, digest, sizeof(digest), 0,
+                          pooled.data()));
+    EXPECT_EQ(pooled, plain);
+  }
+  EXPECT_TRUE(WaitFor(pool, 8));
+
+  // Pairs are handed out once.
+  RsaBlinding first, second;
+  ASSERT_TRUE(pool.Take(first));
+  ASSERT_TRUE(pool.Take(second));
+  EXPECT_NE(first.blind, second.blind);
+  EXPECT_NE(first.unblind, second.unblind);
+}
+
+TEST_F(RsaBlindingTest, FailingSeed) {
+  // A generator whose seed fails hands out zeros, and zero has no inverse.
+  RandomGenerator failing([](LPBYTE, DWORD) {
+    SetLastError(NTE_FAIL);
+    return false;
+  });
+  std::mutex lock;
+  int draws = 0;
+  RsaBlindingPoolConfig config;
+  config.capacity = 4;
+  config.refillBelow = 2;
+  config.random = [&failing, &lock, &draws](LPBYTE p, DWORD n) {
+    std::lock_guard<std::mutex> guard(lock);
+    ++draws;
+    failing.Generate(p, n);
+  };
+  RsaBlinding blinding;
+  EXPECT_FALSE(key_->NewBlinding(config.random, blinding));
+  EXPECT_EQ(GetLastError(), NTE_FAIL);
+  EXPECT_GT(draws, 1);
+
+  // The refill gives up and signing fails instead of drawing forever.
+  Executor executor(1);
+  RsaBlindingPool pool(executor, key_, config);
+  const BYTE digest[32] = {8};
+  std::vector<BYTE> signature(key_->SignatureSize());
+  EXPECT_FALSE(pool.Sign(CALG_SHA_256, digest, sizeof(digest), 0,
+                         signature.data()));
+  EXPECT_EQ(pool.Available(), 0u);
+}
+
+TEST_F(RsaBlindingTest, EmptyPool) {
+  // With no capacity nothing is precomputed; each pair is made in place.
+  Executor executor(1);
+  RsaBlindingPoolConfig config;
+  config.capacity = 0;
+  config.refillBelow = 0;
+  RsaBlindingPool pool(executor, key_, config);
+  const BYTE digest[20] = {7};
+  std::vector<BYTE> plain(key_->SignatureSize());
+  std::vector<BYTE> pooled(key_->SignatureSize());
+  ASSERT_TRUE(key_->Sign(CALG_SHA1, digest, sizeof(digest), 0, plain.data()));
+  ASSERT_TRUE(pool.Sign(CALG_SHA1, digest, sizeof(digest), 0, pooled.data()));
+  EXPECT_EQ(pooled, plain);
+  EXPECT_EQ(pool.Available(), 0u);
+}
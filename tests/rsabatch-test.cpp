@@ -0,0 +1,163 @@
+#include <windows.h>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <bignum.h>
+#include <blob.h>
+#include <hash.h>
+#include <rsa.h>
+#include <rsabatch.h>
+
+struct SignedDigest {
+  DWORD key;
+  std::vector<BYTE> digest;
+  std::vector<BYTE> signature;
+  DWORD flags;
+  DWORD expected;
+};
+
+// Keys of three limb counts and two public exponents, with a handful of
+// signatures each, some of them broken.
+class RsaBatchTest : public ::testing::Test {
+protected:
+  static std::vector<RsaKey> keys_;
+  std::vector<SignedDigest> signatures_;
+
+  static void SetUpTestSuite() {
+    std::mt19937 random(1);
+    const auto source = [&random](LPBYTE p, DWORD n) {
+      for (DWORD i = 0; i < n; ++i) p[i] = static_cast<BYTE>(random());
+    };
+    const struct {
+      DWORD bits;
+      DWORD exponent;
+    } specs[] = {
+      {512, 65537}, {512, 65537}, {512, 3}, {768, 65537}, {1024, 65537},
+    };
+    for (const auto &spec : specs) {
+      RsaKey key;
+      ASSERT_TRUE(key.Generate(spec.bits, spec.exponent, source));
+      keys_.push_back(std::move(key));
+    }
+  }
+
+  static void TearDownTestSuite() {
+    keys_.clear();
+  }
+
+  void SetUp() override {
+    std::mt19937 random(2);
+    for (DWORD k = 0; k < keys_.size(); ++k) {
+      for (DWORD i = 0; i < 7; ++i) {
+        SignedDigest s;
+        s.key = k;
+        s.digest.resize(32);
+        for (auto &it : s.digest) it = static_cast<BYTE>(random());
+        s.flags = i == 5 ? CRYPT_NOHASHOID : 0;
+        s.signature.resize(keys_[k].SignatureSize());
+        ASSERT_TRUE(keys_[k].Sign(CALG_SHA_256,
+                                  s.digest.data(),
+                                  32,
+                                  s.flags,
+                                  s.signature.data()));
+        s.expected = ERROR_SUCCESS;
+        if (i == 3) {
+          s.signature[7] ^= 0x10;
+          s.expected = NTE_BAD_SIGNATURE;
+        }
+        else if (i == 4) {
+          // Not below the modulus.
+          std::fill(s.signature.begin(), s.signature.end(), 0xff);
+          s.expected = NTE_BAD_SIGNATURE;
+        }
+        signatures_.push_back(std::move(s));
+      }
+    }
+  }
+
+  std::vector<RsaBatchVerifier::Request> Requests() const {
+    std::vector<RsaBatchVerifier::Request> requests;
+    for (const auto &s : signatures_) {
+      RsaBatchVerifier::Request r;
+      r.key = s.key;
+      r.hashAlgo = CALG_SHA_256;
+      r.digest = s.digest.data();
+      r.digestSize = static_cast<DWORD>(s.digest.size());
+      r.flags = s.flags;
+      r.signature = s.signature.data();
+      r.signatureSize = static_cast<DWORD>(s.signature.size());
+      requests.push_back(r);
+    }
+    return requests;
+  }
+};
+
+std::vector<RsaKey> RsaBatchTest::keys_;
+
+TEST_F(RsaBatchTest, Engines) {
+  for (auto engine : {RsaBatchScalar, RsaBatchAvx2, RsaBatchIfma}) {
+    RsaBatchVerifier verifier(engine);
+    if (!RsaBatchVerifier::IsSupported(engine)) {
+      EXPECT_EQ(verifier.Engine(), RsaBatchScalar);
+      continue;
+    }
+    EXPECT_EQ(verifier.Engine(), engine);
+    for (const auto &key : keys_) {
+      verifier.AddKey(key);
+    }
+
+    std::vector<DWORD> status;
+    EXPECT_FALSE(verifier.Verify(Requests(), status));
+    ASSERT_EQ(status.size(), signatures_.size());
+    for (size_t i = 0; i < status.size(); ++i) {
+      EXPECT_EQ(status[i], signatures_[i].expected)
+        << "engine " << engine << " request " << i;
+    }
+
+    // Groups that do not fill their last vector.
+    const auto requests = Requests();
+    std::vector<RsaBatchVerifier::Request> valid;
+    for (size_t i = 0; i < signatures_.size(); ++i) {
+      if (signatures_[i].expected == ERROR_SUCCESS) {
+        valid.push_back(requests[i]);
+      }
+    }
+    EXPECT_TRUE(verifier.Verify(valid, status));
+  }
+}
+
+TEST_F(RsaBatchTest, BadRequests) {
+  RsaBatchVerifier verifier;
+  const DWORD key = verifier.AddKey(keys_[0]);
+  const DWORD empty = verifier.AddKey(RsaKey());
+
+  auto requests = Requests();
+  requests.resize(3);
+  requests[0].key = 99;
+  requests[1].key = empty;
+  requests[2].key = key;
+  requests[2].signatureSize -= 1;
+  std::vector<DWORD> status;
+  EXPECT_FALSE(verifier.Verify(requests, status));
+  EXPECT_EQ(status[0], DWORD(NTE_BAD_KEY));
+  EXPECT_EQ(status[1], DWORD(NTE_BAD_KEY));
+  EXPECT_EQ(status[2], DWORD(NTE_BAD_SIGNATURE));
+
+  // The same status RsaKey::Verify sets for an algorithm that is not a hash.
+  requests.resize(1);
+  requests[0].key = key;
+  requests[0].hashAlgo = CALG_RSA_SIGN;
+  EXPECT_FALSE(verifier.Verify(requests, status));
+  EXPECT_EQ(status[0], DWORD(NTE_BAD_ALGID));
+
+  EXPECT_TRUE(verifier.Verify({}, status));
+  EXPECT_TRUE(status.empty());
+}
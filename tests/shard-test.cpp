@@ -0,0 +1,209 @@
+#include <windows.h>
+#include <atomic>
+#include <latch>
+#include <condition_variable>
+#include <set>
+#include <thread>
+
+#include "testutil.h"
+
+#include <shard.h>
+
+// One signing key in an in-memory SoftProvider, which allows any number of
+// contexts on a container at once.
+class ShardedContainerTest : public SoftProviderTest {
+protected:
+  CSP verifier_;
+  Key publicKey_;
+
+  void SetUp() override {
+    SoftProviderTest::SetUp();
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"sharded",
+                            nullptr,
+                            PROV_RSA_FULL,
+                            CRYPT_NEWKEYSET));
+    Key key(csp.GenKey(AT_SIGNATURE, 0));
+    const Blob blob = key.Export(PUBLICKEYBLOB);
+    ASSERT_TRUE(verifier_.Acquire(nullptr,
+                                  nullptr,
+                                  PROV_RSA_FULL,
+                                  CRYPT_VERIFYCONTEXT));
+    ASSERT_TRUE(publicKey_.Import(verifier_, blob));
+  }
+
+  void TearDown() override {
+    publicKey_.Attach(NULL);
+    verifier_.Attach(NULL);
+    SoftProviderTest::TearDown();
+  }
+
+  bool Open(ShardedContainer &container, DWORD shards) {
+    return container.Open(L"sharded",
+                          nullptr,
+                          PROV_RSA_FULL,
+                          0,
+                          AT_SIGNATURE,
+                          shards);
+  }
+
+  bool Verify(const BYTE (&digest)[32], const Blob &signature) {
+    Hash hash;
+    return hash.Create(verifier_, CALG_SHA_256)
+           && hash.SetHashValue(digest, sizeof(digest))
+           && hash.Verify(signature, signature.Size(), publicKey_);
+  }
+};
+
+TEST_F(ShardedContainerTest, Open) {
+  ShardedContainer container;
+  EXPECT_FALSE(container.Open(L"sharded", nullptr, PROV_RSA_FULL, 0, 0, 2));
+  EXPECT_EQ(GetLastError(), static_cast<DWORD>(NTE_BAD_KEY));
+  EXPECT_FALSE(container.Acquire());
+  EXPECT_FALSE(container.Open(L"missing",
+                              nullptr,
+                              PROV_RSA_FULL,
+                              0,
+                              AT_SIGNATURE,
+                              2));
+  EXPECT_EQ(container.Size(), 0u);
+  // The container exists but has no exchange key.
+  EXPECT_FALSE(container.Open(L"sharded",
+                              nullptr,
+                              PROV_RSA_FULL,
+                              0,
+                              AT_KEYEXCHANGE,
+                              2));
+  EXPECT_EQ(GetLastError(), static_cast<DWORD>(NTE_NO_KEY));
+  EXPECT_EQ(container.Size(), 0u);
+
+  ASSERT_TRUE(Open(container, 3));
+  EXPECT_EQ(container.Size(), 3u);
+  EXPECT_EQ(container.KeySpec(), DWORD(AT_SIGNATURE));
+  const BYTE digest[32] = {1, 2, 3};
+  const Blob signature = container.Sign(CALG_SHA_256, digest, sizeof(digest));
+  ASSERT_NE(signature.Size(), 0u);
+  EXPECT_TRUE(Verify(digest, signature));
+
+  container.Close();
+  EXPECT_EQ(container.Size(), 0u);
+  EXPECT_FALSE(container.TryAcquire());
+  EXPECT_EQ(container.Sign(CALG_SHA_256, digest, sizeof(digest)).Size(), 0u);
+}
+
+TEST_F(ShardedContainerTest, Exhaustion) {
+  ShardedContainer container;
+  ASSERT_TRUE(Open(container, 2));
+  auto first = container.TryAcquire();
+  auto second = container.TryAcquire();
+  ASSERT_TRUE(first);
+  ASSERT_TRUE(second);
+  EXPECT_NE(first.Index(), second.Index());
+  EXPECT_FALSE(container.TryAcquire());
+
+  // Acquire waits for a lease to come back and gets that shard.
+  const DWORD freed = first.Index();
+  ShardedContainer::Lease waited;
+  std::thread waiter([&]() { waited = container.Acquire(); });
+  while (container.Contended() == 0) Sleep(1);
+  EXPECT_FALSE(waited);
+  first = ShardedContainer::Lease();
+  waiter.join();
+  ASSERT_TRUE(waited);
+  EXPECT_EQ(waited.Index(), freed);
+  EXPECT_EQ(container.Contended(), 1u);
+  EXPECT_EQ(container.Uses(0) + container.Uses(1), 3u);
+}
+
+TEST_F(ShardedContainerTest, CloseWithLeases) {
+  ShardedContainer container;
+  ASSERT_TRUE(Open(container, 1));
+  auto lease = container.Acquire();
+  ASSERT_TRUE(lease);
+
+  // A thread waiting for the only shard gives up when the container closes.
+  std::atomic<bool> gaveUp(false);
+  std::thread waiter([&]() { gaveUp = !container.Acquire(); });
+  while (container.Contended() == 0) Sleep(1);
+
+  std::atomic<bool> closed(false);
+  std::thread closer([&]() {
+    container.Close();
+    closed = true;
+  });
+  waiter.join();
+  EXPECT_TRUE(gaveUp);
+
+  // Close waits for the lease, whose handles stay usable until then.
+  EXPECT_FALSE(closed);
+  const BYTE digest[32] = {4, 5, 6};
+  Hash hash;
+  ASSERT_TRUE(hash.Create(lease.Provider(), CALG_SHA_256));
+  ASSERT_TRUE(hash.SetHashValue(digest, sizeof(digest)));
+  const Blob signature = hash.Sign(AT_SIGNATURE);
+  EXPECT_TRUE(Verify(digest, signature));
+  EXPECT_NE(lease.UserKey().Export(PUBLICKEYBLOB).Size(), 0u);
+  EXPECT_FALSE(closed);
+
+  lease = ShardedContainer::Lease();
+  closer.join();
+  EXPECT_TRUE(closed);
+  EXPECT_EQ(container.Size(), 0u);
+  EXPECT_FALSE(container.Acquire());
+
+  // It can be opened again.
+  ASSERT_TRUE(Open(container, 1));
+  EXPECT_TRUE(container.TryAcquire());
+}
+
+TEST_F(ShardedContainerTest, Concurrency) {
+  constexpr DWORD Shards = 4;
+  constexpr DWORD Threads = 8;
+  constexpr DWORD PerThread = 10;
+  ShardedContainer container;
+  ASSERT_TRUE(Open(container, Shards));
+
+  // Every shard can be held at the same time, each by one thread.
+  {
+    std::latch holding(Shards);
+    std::mutex lock;
+    std::set<DWORD> indices;
+    std::vector<std::thread> threads;
+    for (DWORD i = 0; i < Shards; ++i) {
+      threads.emplace_back([&]() {
+        auto lease = container.Acquire();
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          if (lease) indices.insert(lease.Index());
+        }
+        holding.arrive_and_wait();
+      });
+    }
+    for (auto &t : threads) t.join();
+    EXPECT_EQ(indices.size(), size_t(Shards));
+  }
+
+  // More threads than shards all get correct signatures.
+  std::vector<Blob> signatures(Threads * PerThread);
+  std::vector<std::thread> threads;
+  for (DWORD i = 0; i < Threads; ++i) {
+    threads.emplace_back([&, i]() {
+      for (DWORD j = 0; j < PerThread; ++j) {
+        BYTE digest[32] = {static_cast<BYTE>(i), static_cast<BYTE>(j)};
+        signatures[i * PerThread + j] =
+          container.Sign(CALG_SHA_256, digest, sizeof(digest));
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  for (DWORD i = 0; i < Threads; ++i) {
+    for (DWORD j = 0; j < PerThread; ++j) {
+      const BYTE digest[32] = {static_cast<BYTE>(i), static_cast<BYTE>(j)};
+      EXPECT_TRUE(Verify(digest, signatures[i * PerThread + j])) << i << j;
+    }
+  }
+
+  ULONGLONG uses = 0;
+  for (DWORD i = 0; i < Shards; ++i) uses += container.Uses(i);
+  EXPECT_EQ(uses, ULONGLONG(Shards + Threads * PerThread));
+}
@@ -0,0 +1,341 @@
+#include <windows.h>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <condition_variable>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+#include "testutil.h"
+
+#include <executor.h>
+#include <keyindex.h>
+#include <latency.h>
+#include <signcache.h>
+#include <signsvc.h>
+
+static KeyFingerprint FakeFingerprint(BYTE seed) {
+  KeyFingerprint fingerprint;
+  fingerprint.fill(seed);
+  return fingerprint;
+}
+
+static std::vector<BYTE> Bytes(BYTE value, size_t size) {
+  return std::vector<BYTE>(size, value);
+}
+
+TEST(SignatureCache, LookupAndInsert) {
+  SignatureCache cache{SignatureCacheConfig()};
+  const auto key = FakeFingerprint(1);
+  const auto digest = Bytes(0xdd, 32);
+  const auto signature = Bytes(0x55, 256);
+
+  Blob out;
+  EXPECT_FALSE(cache.Lookup(key, CALG_SHA_256, digest.data(), 32, out));
+  cache.Insert(key, CALG_SHA_256, digest.data(), 32, signature.data(), 256);
+  ASSERT_TRUE(cache.Lookup(key, CALG_SHA_256, digest.data(), 32, out));
+  ASSERT_EQ(out.Size(), 256u);
+  EXPECT_EQ(memcmp(LPCBYTE(out), signature.data(), 256), 0);
+
+  // Every part of the key matters.
+  Blob miss;
+  EXPECT_FALSE(cache.Lookup(FakeFingerprint(2),
+                            CALG_SHA_256,
+                            digest.data(),
+                            32,
+                            miss));
+  EXPECT_FALSE(cache.Lookup(key, CALG_SHA1, digest.data(), 20, miss));
+  const auto other = Bytes(0xde, 32);
+  EXPECT_FALSE(cache.Lookup(key, CALG_SHA_256, other.data(), 32, miss));
+  // Digests longer than SHA-512 are not cached.
+  const auto sha1024 = Bytes(1, 65);
+  cache.Insert(key, CALG_SHA_256, sha1024.data(), 65, signature.data(), 256);
+
+  const auto m = cache.GetMetrics();
+  EXPECT_EQ(m.hits, 1u);
+  EXPECT_EQ(m.misses, 4u);
+  EXPECT_EQ(m.insertions, 1u);
+  EXPECT_EQ(m.entries, 1u);
+  EXPECT_EQ(m.bytes, 256u);
+  EXPECT_DOUBLE_EQ(m.HitRate(), 0.2);
+}
+
+TEST(SignatureCache, EvictsLeastRecentlyUsed) {
+  SignatureCacheConfig config;
+  config.shards = 1;
+  config.maxEntries = 3;
+  SignatureCache cache(config);
+  const auto key = FakeFingerprint(1);
+  const auto signature = Bytes(0x55, 64);
+  const auto add = [&](SignatureCache &c, BYTE i) {
+    c.Insert(key, CALG_SHA1, Bytes(i, 20).data(), 20, signature.data(), 64);
+  };
+  for (BYTE i = 0; i < 3; ++i) add(cache, i);
+  Blob out;
+  ASSERT_TRUE(cache.Lookup(key, CALG_SHA1, Bytes(0, 20).data(), 20, out));
+  add(cache, 3);
+
+  EXPECT_TRUE(cache.Lookup(key, CALG_SHA1, Bytes(0, 20).data(), 20, out));
+  EXPECT_FALSE(cache.Lookup(key, CALG_SHA1, Bytes(1, 20).data(), 20, out));
+  EXPECT_TRUE(cache.Lookup(key, CALG_SHA1, Bytes(2, 20).data(), 20, out));
+  EXPECT_TRUE(cache.Lookup(key, CALG_SHA1, Bytes(3, 20).data(), 20, out));
+  EXPECT_EQ(cache.GetMetrics().evictions, 1u);
+
+  // The byte budget applies as well.
+  config.maxEntries = 100;
+  config.maxBytes = 200;
+  SignatureCache small(config);
+  for (BYTE i = 0; i < 4; ++i) add(small, i);
+  const auto m = small.GetMetrics();
+  EXPECT_EQ(m.entries, 3u);
+  EXPECT_EQ(m.bytes, 192u);
+}
+
+TEST(SignatureCache, Fingerprint) {
+  RsaKey rsa;
+  std::mt19937 random(1);
+  ASSERT_TRUE(rsa.Generate(512, 65537, [&random](LPBYTE p, DWORD n) {
+    for (DWORD i = 0; i < n; ++i) p[i] = static_cast<BYTE>(random());
+  }));
+  DWORD publicSize = 0, privateSize = 0;
+  ASSERT_TRUE(rsa.ToBlob(PUBLICKEYBLOB, CALG_RSA_SIGN, nullptr, &publicSize));
+  ASSERT_TRUE(rsa.ToBlob(PRIVATEKEYBLOB,
+                         CALG_RSA_SIGN,
+                         nullptr,
+                         &privateSize));
+  std::vector<BYTE> publicBlob(publicSize), privateBlob(privateSize);
+  ASSERT_TRUE(rsa.ToBlob(PUBLICKEYBLOB,
+                         CALG_RSA_SIGN,
+                         publicBlob.data(),
+                         &publicSize));
+  ASSERT_TRUE(rsa.ToBlob(PRIVATEKEYBLOB,
+                         CALG_RSA_SIGN,
+                         privateBlob.data(),
+                         &privateSize));
+
+  KeyFingerprint a, b;
+  ASSERT_TRUE(SignatureCache::Fingerprint(publicBlob.data(), publicSize, a));
+  ASSERT_TRUE(SignatureCache::Fingerprint(privateBlob.data(),
+                                          privateSize,
+                                          b));
+  EXPECT_EQ(a, b);
+
+  // DSS signatures are randomized and must never be cached.
+  BYTE dss[sizeof(PUBLICKEYSTRUC) + 8 + 64] = {};
+  auto header = reinterpret_cast<PUBLICKEYSTRUC*>(dss);
+  header->bType = PUBLICKEYBLOB;
+  header->bVersion = CUR_BLOB_VERSION;
+  header->aiKeyAlg = CALG_DSS_SIGN;
+  memcpy(header + 1, "DSS1", 4);
+  EXPECT_FALSE(SignatureCache::Fingerprint(dss, sizeof(dss), a));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_ALGID));
+}
+
+TEST(SignatureCache, SaveAndLoad) {
+  SignatureCache cache{SignatureCacheConfig()};
+  for (BYTE i = 0; i < 50; ++i) {
+    cache.Insert(FakeFingerprint(i % 3),
+                 CALG_SHA_256,
+                 Bytes(i, 32).data(),
+                 32,
+                 Bytes(i, 128 + i).data(),
+                 128 + i);
+  }
+  ASSERT_TRUE(cache.Save(L"signcache-test.bin"));
+
+  SignatureCache loaded{SignatureCacheConfig()};
+  ASSERT_TRUE(loaded.Load(L"signcache-test.bin"));
+  EXPECT_EQ(loaded.GetMetrics().entries, 50u);
+
+  // Loaded signatures are checked on their first hit, and only then.
+  int checks = 0;
+  const auto accept = [&checks](LPCBYTE, DWORD size) {
+    ++checks;
+    return size == 135;
+  };
+  Blob out;
+  ASSERT_TRUE(loaded.Lookup(FakeFingerprint(7 % 3),
+                            CALG_SHA_256,
+                            Bytes(7, 32).data(),
+                            32,
+                            out,
+                            accept));
+  EXPECT_EQ(out.Size(), 135u);
+  ASSERT_TRUE(loaded.Lookup(FakeFingerprint(7 % 3),
+                            CALG_SHA_256,
+                            Bytes(7, 32).data(),
+                            32,
+                            out));
+  EXPECT_EQ(checks, 1);
+
+  // One that fails the check, or that nobody can check, is dropped.
+  EXPECT_FALSE(loaded.Lookup(FakeFingerprint(8 % 3),
+                             CALG_SHA_256,
+                             Bytes(8, 32).data(),
+                             32,
+                             out,
+                             accept));
+  EXPECT_FALSE(loaded.Lookup(FakeFingerprint(9 % 3),
+                             CALG_SHA_256,
+                             Bytes(9, 32).data(),
+                             32,
+                             out));
+  EXPECT_EQ(checks, 2);
+  EXPECT_EQ(loaded.GetMetrics().entries, 48u);
+  EXPECT_EQ(loaded.GetMetrics().misses, 2u);
+
+  // Flip one byte in the middle.
+  HANDLE file = CreateFile(L"signcache-test.bin",
+                           GENERIC_READ | GENERIC_WRITE,
+                           0,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+  ASSERT_NE(file, INVALID_HANDLE_VALUE);
+  BYTE buffer[4096];
+  DWORD bytesRead = 0;
+  ASSERT_TRUE(ReadFile(file, buffer, sizeof(buffer), &bytesRead, nullptr));
+  buffer[bytesRead / 2] ^= 1;
+  LARGE_INTEGER start = {};
+  SetFilePointerEx(file, start, nullptr, FILE_BEGIN);
+  DWORD bytesWritten = 0;
+  ASSERT_TRUE(WriteFile(file, buffer, bytesRead, &bytesWritten, nullptr));
+  CloseHandle(file);
+
+  SignatureCache rejected{SignatureCacheConfig()};
+  EXPECT_FALSE(rejected.Load(L"signcache-test.bin"));
+  EXPECT_EQ(rejected.GetMetrics().entries, 0u);
+  DeleteFile(L"signcache-test.bin");
+}
+
+class SignatureCacheBackendTest : public SoftProviderTest {
+protected:
+  std::unique_ptr<LatencyProvider> token_;
+
+  void SetUp() override {
+    SoftProviderTest::SetUp();
+    // No latency; it only counts the calls that reach the token.
+    token_ = std::make_unique<LatencyProvider>(*provider_, LatencyProfile());
+    CryptoProvider::Install(token_.get());
+
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"cached",
+                            nullptr,
+                            PROV_RSA_AES,
+                            CRYPT_NEWKEYSET));
+    Key key(csp.GenKey(AT_SIGNATURE, 0));
+    ASSERT_NE(HCRYPTKEY(key), HCRYPTKEY(NULL));
+  }
+
+  static std::vector<SignRequest> Batch(BYTE digestByte, int count) {
+    std::vector<SignRequest> batch(count);
+    for (auto &request : batch) {
+      request.algo = CALG_SHA_256;
+      request.digest.Alloc(SHA256Traits::DigestSize);
+      memset(request.digest, digestByte, request.digest.Size());
+    }
+    return batch;
+  }
+};
+
+TEST_F(SignatureCacheBackendTest, SkipsTheToken) {
+  SignatureCache cache{SignatureCacheConfig()};
+  CapiSignBackend backend(&cache);
+  SignKey key;
+  key.container = L"cached";
+  key.providerType = PROV_RSA_AES;
+  key.keySpec = AT_SIGNATURE;
+
+  auto first = Batch(1, 1);
+  backend.SignBatch(key, first);
+  ASSERT_EQ(first[0].status, DWORD(ERROR_SUCCESS));
+  EXPECT_EQ(token_->GetMetrics().calls[LatencySign], 1u);
+
+  auto again = Batch(1, 3);
+  backend.SignBatch(key, again);
+  for (auto &request : again) {
+    ASSERT_EQ(request.status, DWORD(ERROR_SUCCESS));
+    ASSERT_EQ(request.signature.Size(), first[0].signature.Size());
+    EXPECT_EQ(memcmp(LPCBYTE(request.signature),
+                     LPCBYTE(first[0].signature),
+                     first[0].signature.Size()),
+              0);
+  }
+  EXPECT_EQ(token_->GetMetrics().calls[LatencySign], 1u);
+
+  auto other = Batch(2, 1);
+  backend.SignBatch(key, other);
+  EXPECT_EQ(token_->GetMetrics().calls[LatencySign], 2u);
+
+  const auto m = cache.GetMetrics();
+  EXPECT_EQ(m.hits, 3u);
+  EXPECT_EQ(m.misses, 2u);
+  EXPECT_EQ(m.entries, 2u);
+}
+
+TEST_F(SignatureCacheBackendTest, ChecksLoadedSignatures) {
+  const LPCWSTR filename = L"signcache-backend-test.bin";
+  SignKey key;
+  key.container = L"cached";
+  key.providerType = PROV_RSA_AES;
+  key.keySpec = AT_SIGNATURE;
+
+  SignatureCache cache{SignatureCacheConfig()};
+  CapiSignBackend backend(&cache);
+  auto good = Batch(1, 1);
+  backend.SignBatch(key, good);
+  ASSERT_EQ(good[0].status, DWORD(ERROR_SUCCESS));
+  EXPECT_EQ(token_->GetMetrics().calls[LatencySign], 1u);
+
+  // Anyone who can write the file can put a signature of their own in it.
+  KeyFingerprint fingerprint;
+  {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"cached", nullptr, PROV_RSA_AES, 0));
+    Key user(csp.GetUserKey(AT_SIGNATURE));
+    const Blob publicKey = user.Export(PUBLICKEYBLOB);
+    ASSERT_TRUE(SignatureCache::Fingerprint(publicKey,
+                                            publicKey.Size(),
+                                            fingerprint));
+  }
+  auto forged = Batch(2, 1);
+  const std::vector<BYTE> bogus(good[0].signature.Size(), 0x42);
+  cache.Insert(fingerprint,
+               CALG_SHA_256,
+               forged[0].digest,
+               forged[0].digest.Size(),
+               bogus.data(),
+               static_cast<DWORD>(bogus.size()));
+  ASSERT_TRUE(cache.Save(filename));
+
+  SignatureCache loaded{SignatureCacheConfig()};
+  ASSERT_TRUE(loaded.Load(filename));
+  CapiSignBackend restarted(&loaded);
+  auto again = Batch(1, 2);
+  restarted.SignBatch(key, again);
+  for (auto &request : again) {
+    ASSERT_EQ(request.status, DWORD(ERROR_SUCCESS));
+    ASSERT_EQ(request.signature.Size(), good[0].signature.Size());
+    EXPECT_EQ(memcmp(LPCBYTE(request.signature),
+                     LPCBYTE(good[0].signature),
+                     good[0].signature.Size()),
+              0);
+  }
+  EXPECT_EQ(token_->GetMetrics().calls[LatencySign], 1u);
+
+  // The forged one fails the check and is signed again.
+  restarted.SignBatch(key, forged);
+  ASSERT_EQ(forged[0].status, DWORD(ERROR_SUCCESS));
+  ASSERT_EQ(forged[0].signature.Size(), bogus.size());
+  EXPECT_NE(memcmp(LPCBYTE(forged[0].signature), bogus.data(), bogus.size()),
+            0);
+  EXPECT_EQ(token_->GetMetrics().calls[LatencySign], 2u);
+
+  const auto m = loaded.GetMetrics();
+  EXPECT_EQ(m.hits, 2u);
+  EXPECT_EQ(m.misses, 1u);
+  DeleteFile(filename);
+}
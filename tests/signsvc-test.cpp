@@ -0,0 +1,379 @@
+#include <windows.h>
+#include <optional>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
+#include <latch>
+#include <random>
+#include <thread>
+
+#include "testutil.h"
+
+#include <executor.h>
+#include <keyindex.h>
+#include <latency.h>
+#include <signsvc.h>
+
+namespace {
+
+// Signs by reversing the digest.  The first batch can be held at a gate
+// so that later requests pile up behind it.
+class FakeBackend : public SignBackend {
+public:
+  std::mutex gate;
+  std::atomic<int> entered;
+  std::mutex lock;
+  std::vector<size_t> batchSizes;
+  DWORD concurrency;
+
+  FakeBackend() : entered(0), concurrency(1) {}
+
+  DWORD Concurrency(const SignKey &) {
+    return concurrency;
+  }
+
+  void SignBatch(const SignKey &, std::vector<SignRequest> &batch) {
+    ++entered;
+    { std::lock_guard<std::mutex> wait(gate); }
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      batchSizes.push_back(batch.size());
+    }
+    for (auto &request : batch) {
+      request.signature = Blob(request.digest.Size());
+      memcpy(request.signature, request.digest, request.digest.Size());
+      request.signature.Reverse();
+      request.status = ERROR_SUCCESS;
+    }
+  }
+};
+
+// Signs like FakeBackend, after holding each batch until |expected|
+// batches are inside SignBatch at the same time.
+class LatchBackend : public SignBackend {
+public:
+  std::latch inside;
+  std::atomic<int> together;
+  std::mutex lock;
+  std::vector<SignKey> keys;
+
+  LatchBackend(int expected) : inside(expected), together(0) {}
+
+  void SignBatch(const SignKey &key, std::vector<SignRequest> &batch) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      keys.push_back(key);
+    }
+    inside.count_down();
+    // Only a guard against hanging; a run that gets here in order has
+    // every batch inside at once.
+    for (int i = 0; i < 5000 && !inside.try_wait(); ++i) Sleep(1);
+    if (inside.try_wait()) ++together;
+    for (auto &request : batch) {
+      if (key.keySpec != AT_SIGNATURE) {
+        request.status = NTE_NO_KEY;
+        continue;
+      }
+      request.signature = Blob(request.digest.Size());
+      memcpy(request.signature, request.digest, request.digest.Size());
+      request.signature.Reverse();
+      LPBYTE(request.signature)[0] ^= static_cast<BYTE>(key.container[0]);
+      request.status = ERROR_SUCCESS;
+    }
+  }
+};
+
+SignKey MakeKey(LPCWSTR container, DWORD keySpec) {
+  SignKey key;
+  key.container = container;
+  key.providerType = PROV_RSA_FULL;
+  key.keySpec = keySpec;
+  return key;
+}
+
+SignRequest MakeRequest(DWORD clientId,
+                        DWORD requestId,
+                        std::atomic<int> *done) {
+  SignRequest request;
+  request.clientId = clientId;
+  request.requestId = requestId;
+  request.key.container = L"test";
+  request.key.keySpec = AT_SIGNATURE;
+  request.algo = CALG_SHA_256;
+  request.digest = Blob(32);
+  memset(request.digest, static_cast<int>(requestId), 32);
+  request.completion = [done](SignRequest &r) {
+    if (r.status == ERROR_SUCCESS
+        && r.signature.Size() == 32
+        && LPCBYTE(r.signature)[0] == static_cast<BYTE>(r.requestId)) {
+      ++*done;
+    }
+  };
+  return request;
+}
+
+}
+
+TEST(SignService, Coalesce) {
+  FakeBackend backend;
+  SignServiceConfig config;
+  config.workers = 2;
+  SignService service(backend, config);
+  service.Start();
+
+  std::atomic<int> done(0);
+  backend.gate.lock();
+  ASSERT_TRUE(service.Submit(MakeRequest(1, 0, &done)));
+  while (backend.entered == 0) Sleep(1);
+  for (DWORD i = 1; i <= 10; ++i) {
+    ASSERT_TRUE(service.Submit(MakeRequest(1 + i % 2, i, &done)));
+  }
+  backend.gate.unlock();
+  service.Stop();
+
+  EXPECT_EQ(done, 11);
+  ASSERT_EQ(backend.batchSizes.size(), 2);
+  EXPECT_EQ(backend.batchSizes[0], 1);
+  EXPECT_EQ(backend.batchSizes[1], 10);
+
+  SignMetrics m;
+  ASSERT_TRUE(service.GetClientMetrics(1, m));
+  EXPECT_EQ(m.submitted, 6);
+  EXPECT_EQ(m.completed, 6);
+  EXPECT_EQ(m.batches, 2);
+  EXPECT_EQ(m.pending, 0);
+  EXPECT_EQ(service.GetTotalMetrics().batches, 2);
+}
+
+TEST(SignService, Backpressure) {
+  FakeBackend backend;
+  SignServiceConfig config;
+  config.workers = 1;
+  config.maxPending = 3;
+  config.maxPendingPerClient = 2;
+  SignService service(backend, config);
+  service.Start();
+
+  std::atomic<int> done(0);
+  backend.gate.lock();
+  EXPECT_TRUE(service.Submit(MakeRequest(1, 1, &done)));
+  EXPECT_TRUE(service.Submit(MakeRequest(1, 2, &done)));
+  EXPECT_FALSE(service.Submit(MakeRequest(1, 3, &done)));
+  EXPECT_TRUE(service.Submit(MakeRequest(2, 4, &done)));
+  EXPECT_FALSE(service.Submit(MakeRequest(3, 5, &done)));
+  backend.gate.unlock();
+  service.Stop();
+
+  EXPECT_EQ(done, 3);
+  SignMetrics m;
+  ASSERT_TRUE(service.GetClientMetrics(1, m));
+  EXPECT_EQ(m.rejected, 1);
+  EXPECT_EQ(service.GetTotalMetrics().rejected, 2);
+  EXPECT_FALSE(service.Submit(MakeRequest(1, 6, &done)));
+}
+
+TEST(SignService, ParallelBatches) {
+  // Queued before the workers start, so the batches are cut the same way
+  // every time.
+  FakeBackend backend;
+  backend.concurrency = 2;
+  SignServiceConfig config;
+  config.workers = 4;
+  config.maxBatch = 2;
+  SignService service(backend, config);
+  std::atomic<int> done(0);
+  for (DWORD i = 0; i < 6; ++i) {
+    ASSERT_TRUE(service.Submit(MakeRequest(1, i, &done)));
+  }
+
+  // Two batches of the key are signed at once, and no more.
+  backend.gate.lock();
+  service.Start();
+  while (backend.entered < 2) Sleep(1);
+  Sleep(20);
+  EXPECT_EQ(backend.entered, 2);
+  backend.gate.unlock();
+  service.Stop();
+
+  EXPECT_EQ(done, 6);
+  EXPECT_THAT(backend.batchSizes, ::testing::ElementsAre(2, 2, 2));
+  EXPECT_EQ(service.GetTotalMetrics().pending, 0u);
+}
+
+TEST(SignService, Protocol) {
+  SignKey key;
+  key.container = L"container";
+  key.provider = L"provider";
+  key.providerType = PROV_RSA_AES;
+  key.flags = CRYPT_MACHINE_KEYSET;
+  key.keySpec = AT_KEYEXCHANGE;
+  const BYTE digest[] = {1, 2, 3, 4, 5};
+
+  auto frame = SignProtocol::EncodeRequest(42, key, CALG_SHA1,
+                                           digest, sizeof(digest));
+  ASSERT_GT(frame.Size(), sizeof(SignFrameHeader));
+  const SignFrameHeader *header = reinterpret_cast<const SignFrameHeader*>(LPCBYTE(frame));
+  EXPECT_EQ(header->magic, SignProtocol::Magic);
+  EXPECT_EQ(header->size, frame.Size() - sizeof(SignFrameHeader));
+
+  SignRequest request;
+  ASSERT_TRUE(SignProtocol::DecodeRequest(LPCBYTE(frame) + sizeof(SignFrameHeader),
+                                          header->size,
+                                          request));
+  EXPECT_EQ(request.requestId, 42);
+  EXPECT_EQ(request.algo, CALG_SHA1);
+  EXPECT_FALSE(key < request.key || request.key < key);
+  ASSERT_EQ(request.digest.Size(), sizeof(digest));
+  EXPECT_EQ(memcmp(request.digest, digest, sizeof(digest)), 0);
+  EXPECT_FALSE(SignProtocol::DecodeRequest(LPCBYTE(frame) + sizeof(SignFrameHeader),
+                                           header->size - 1,
+                                           request));
+
+  frame = SignProtocol::EncodeResponse(7, NTE_BAD_KEYSET, nullptr, 0);
+  DWORD requestId, status;
+  Blob signature;
+  ASSERT_TRUE(SignProtocol::DecodeResponse(LPCBYTE(frame) + sizeof(SignFrameHeader),
+                                           frame.Size() - sizeof(SignFrameHeader),
+                                           requestId,
+                                           status,
+                                           signature));
+  EXPECT_EQ(requestId, 7);
+  EXPECT_EQ(status, static_cast<DWORD>(NTE_BAD_KEYSET));
+  EXPECT_EQ(signature.Size(), 0);
+}
+
+class SignProtocolTest : public SoftProviderTest {};
+
+TEST_F(SignProtocolTest, KeysetFlags) {
+  {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"kept", nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+    Key key(csp.GenKey(AT_SIGNATURE, 0));
+    ASSERT_NE(HCRYPTKEY(key), HCRYPTKEY(NULL));
+  }
+  SignKey key;
+  key.container = L"kept";
+  key.providerType = PROV_RSA_FULL;
+  key.keySpec = AT_SIGNATURE;
+  const BYTE digest[32] = {9};
+
+  // What the daemon does with a frame from the pipe.
+  auto Receive = [&digest](const SignKey &key, SignRequest &request) {
+    const Blob frame = SignProtocol::EncodeRequest(1, key, CALG_SHA_256,
+                                                   digest, sizeof(digest));
+    EXPECT_TRUE(SignProtocol::DecodeRequest(
+      LPCBYTE(frame) + sizeof(SignFrameHeader),
+      frame.Size() - sizeof(SignFrameHeader),
+      request));
+    return SignProtocol::ValidateRequest(request);
+  };
+  for (DWORD flags : {DWORD(CRYPT_DELETEKEYSET),
+                      DWORD(CRYPT_NEWKEYSET),
+                      DWORD(CRYPT_VERIFYCONTEXT | CRYPT_MACHINE_KEYSET)}) {
+    key.flags = flags;
+    SignRequest request;
+    EXPECT_EQ(Receive(key, request), DWORD(ERROR_INVALID_PARAMETER)) << flags;
+  }
+  CSP csp;
+  EXPECT_TRUE(csp.Acquire(L"kept", nullptr, PROV_RSA_FULL, 0));
+
+  // An allowed request is made silent and signs as before.
+  key.flags = 0;
+  std::vector<SignRequest> batch(1);
+  ASSERT_EQ(Receive(key, batch[0]), DWORD(ERROR_SUCCESS));
+  EXPECT_EQ(batch[0].key.flags, DWORD(CRYPT_SILENT));
+  CapiSignBackend backend;
+  backend.SignBatch(batch[0].key, batch);
+  EXPECT_EQ(batch[0].status, DWORD(ERROR_SUCCESS));
+  EXPECT_GT(batch[0].signature.Size(), 0u);
+}
+
+TEST(FanOutSigner, AllKeysAtOnce) {
+  // Three keys, the first one twice, and one that cannot sign.
+  const std::vector<SignKey> targets = {
+    MakeKey(L"a", AT_SIGNATURE),
+    MakeKey(L"b", AT_SIGNATURE),
+    MakeKey(L"c", AT_SIGNATURE),
+    MakeKey(L"a", AT_SIGNATURE),
+    MakeKey(L"b", AT_KEYEXCHANGE),
+  };
+  // Each distinct key is one batch, and all four are signed together.
+  LatchBackend backend(4);
+  FanOutSigner signer(backend, /*threads*/4);
+  BYTE digest[32];
+  memset(digest, 0x11, sizeof(digest));
+  auto results = signer.SignDigest(targets,
+                                   CALG_SHA_256,
+                                   digest,
+                                   sizeof(digest));
+  EXPECT_EQ(backend.together, 4);
+  EXPECT_EQ(backend.keys.size(), 4u);
+
+  ASSERT_EQ(results.size(), targets.size());
+  for (size_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(results[i].key.container, targets[i].container);
+    ASSERT_EQ(results[i].status, DWORD(ERROR_SUCCESS));
+    ASSERT_EQ(results[i].signature.Size(), sizeof(digest));
+    EXPECT_EQ(LPCBYTE(results[i].signature)[0],
+              0x11 ^ static_cast<BYTE>(targets[i].container[0]));
+  }
+  // The duplicate gets its own copy of the one signature.
+  EXPECT_EQ(memcmp(results[0].signature,
+                   results[3].signature,
+                   sizeof(digest)),
+            0);
+  EXPECT_NE(LPCBYTE(results[0].signature), LPCBYTE(results[3].signature));
+  EXPECT_EQ(results[4].status, DWORD(NTE_NO_KEY));
+  EXPECT_EQ(results[4].signature.Size(), 0u);
+}
+
+class FanOutSignerTest : public SoftProviderTest {};
+
+TEST_F(FanOutSignerTest, CapiBackend) {
+  std::vector<SignKey> targets;
+  for (LPCWSTR name : {L"release1", L"release2", L"release3"}) {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(name, nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+    Key key(csp.GenKey(AT_SIGNATURE, 0));
+    ASSERT_NE(HCRYPTKEY(key), HCRYPTKEY(NULL));
+    targets.push_back(MakeKey(name, AT_SIGNATURE));
+  }
+  targets.push_back(targets[0]);
+  targets.push_back(MakeKey(L"release2", AT_KEYEXCHANGE));
+
+  // No latency; it only counts the calls that reach the token.
+  LatencyProvider token(*provider_, LatencyProfile());
+  CryptoProvider::Install(&token);
+  CapiSignBackend backend;
+  FanOutSigner signer(backend, /*threads*/4);
+  const BYTE artifact[] = "release artifact";
+  auto results = signer.Sign(targets, CALG_SHA_256, artifact, sizeof(artifact));
+  // Once per key: the duplicate is not signed again, and the key that does
+  // not exist fails before it reaches the token.
+  EXPECT_EQ(token.GetMetrics().calls[LatencySign], 3u);
+
+  ASSERT_EQ(results.size(), targets.size());
+  Digest<SHA256Traits> digest;
+  auto digester = Digester::Create(CALG_SHA_256);
+  digester->Update(artifact, sizeof(artifact));
+  digester->Final(digest.data());
+  for (size_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(results[i].key.container, targets[i].container);
+    ASSERT_EQ(results[i].status, DWORD(ERROR_SUCCESS));
+
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(targets[i].container.c_str(),
+                            nullptr,
+                            PROV_RSA_FULL,
+                            0));
+    Key key(csp.GetUserKey(AT_SIGNATURE));
+    EXPECT_TRUE(Signer<SHA256Traits>(csp, AT_SIGNATURE).Verify(
+      digest,
+      results[i].signature,
+      results[i].signature.Size(),
+      key));
+  }
+  EXPECT_NE(results[4].status, DWORD(ERROR_SUCCESS));
+  EXPECT_EQ(results[4].signature.Size(), 0u);
+  CryptoProvider::Install(provider_.get());
+}
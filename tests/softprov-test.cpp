@@ -0,0 +1,397 @@
+#include <windows.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "testutil.h"
+
+#include <keyindex.h>
+
+static std::vector<BYTE> DigestOf(ALG_ID algo, const std::string &message) {
+  auto digester = Digester::Create(algo);
+  std::vector<BYTE> digest(digester->DigestSize());
+  digester->Update(reinterpret_cast<LPCBYTE>(message.data()), message.size());
+  digester->Final(digest.data());
+  return digest;
+}
+
+TEST(Digester, KnownAnswers) {
+  const std::string abc = "abc";
+  const std::string twoBlocks =
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ(DigestOf(CALG_MD5, abc),
+            FromHex("900150983cd24fb0d6963f7d28e17f72"));
+  EXPECT_EQ(DigestOf(CALG_MD5, ""),
+            FromHex("d41d8cd98f00b204e9800998ecf8427e"));
+  EXPECT_EQ(DigestOf(CALG_SHA1, abc),
+            FromHex("a9993e364706816aba3e25717850c26c9cd0d89d"));
+  EXPECT_EQ(DigestOf(CALG_SHA1, twoBlocks),
+            FromHex("84983e441c3bd26ebaae4aa1f95129e5e54670f1"));
+  EXPECT_EQ(DigestOf(CALG_SHA_256, abc),
+            FromHex("ba7816bf8f01cfea414140de5dae2223"
+                    "b00361a396177a9cb410ff61f20015ad"));
+  EXPECT_EQ(DigestOf(CALG_SHA_256, twoBlocks),
+            FromHex("248d6a61d20638b8e5c026930c3e6039"
+                    "a33ce45964ff2167f6ecedd419db06c1"));
+  EXPECT_EQ(Digester::Create(CALG_SHA_512), nullptr);
+
+  // Feeding the input in odd pieces must not change the result.
+  auto sha = Digester::Create(CALG_SHA_256);
+  const std::string million(1000000, 'a');
+  for (size_t i = 0; i < million.size(); i += 997) {
+    sha->Update(reinterpret_cast<LPCBYTE>(million.data()) + i,
+                min(size_t(997), million.size() - i));
+  }
+  std::vector<BYTE> digest(32);
+  sha->Final(digest.data());
+  EXPECT_EQ(digest, FromHex("cdc76e5c9914fb9281a1c7e284d73e67"
+                            "f1809a48a497200e046d39ccc7112cd0"));
+}
+
+TEST(BigNum, Arithmetic) {
+  const auto a = FromHex("f3a1c2b4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f7081"
+                         "92a3b4c5d6e7f80");
+  const auto b = FromHex("0123456789abcdef0fedcba987654321");
+  const BigNum x = BigNum::FromBigEndian(a.data(), a.size());
+  const BigNum y = BigNum::FromBigEndian(b.data(), b.size());
+
+  BigNum q, r;
+  BigNum::DivMod(x, y, &q, &r);
+  EXPECT_LT(BigNum::Compare(r, y), 0);
+  EXPECT_EQ(BigNum::Add(BigNum::Mul(q, y), r), x);
+  EXPECT_EQ(BigNum::Sub(BigNum::Add(x, y), y), x);
+  EXPECT_EQ(BigNum::ShiftRight(BigNum::ShiftLeft(x, 77), 77), x);
+  EXPECT_EQ(BigNum::Mod(BigNum(1000), BigNum(7)), BigNum(6));
+
+  std::vector<BYTE> out(a.size());
+  ASSERT_TRUE(x.ToBigEndian(out.data(), out.size()));
+  EXPECT_EQ(out, a);
+  EXPECT_FALSE(x.ToBigEndian(out.data(), out.size() - 1));
+
+  // Montgomery and plain square-and-multiply must agree.
+  const BigNum m = BigNum::Add(BigNum::ShiftLeft(y, 64), BigNum(0x1234567));
+  ASSERT_TRUE(m.IsOdd());
+  const BigNum viaMontgomery = BigNum::ModExp(x, y, m);
+  BigNum plain(1);
+  for (DWORD i = y.Bits(); i > 0; --i) {
+    plain = BigNum::Mod(BigNum::Mul(plain, plain), m);
+    if (y.Bit(i - 1)) plain = BigNum::Mod(BigNum::Mul(plain, x), m);
+  }
+  EXPECT_EQ(viaMontgomery, plain);
+
+  const BigNum inverse = BigNum::ModInverse(x, m);
+  EXPECT_EQ(BigNum::Mod(BigNum::Mul(inverse, x), m), BigNum(1));
+  EXPECT_TRUE(BigNum::ModInverse(BigNum(6), BigNum(9)).IsZero());
+}
+
+TEST(RsaKey, BlobLayout) {
+  ULONGLONG counter = 0;
+  const RsaKey::RandomSource random = [&counter](LPBYTE buffer,
+                                                 DWORD length) {
+    for (DWORD i = 0; i < length; ++i) {
+      buffer[i] = static_cast<BYTE>((++counter * 0x9e3779b97f4a7c15ull) >> 56);
+    }
+  };
+  RsaKey key;
+  ASSERT_TRUE(key.Generate(512, 65537, random));
+  EXPECT_EQ(key.Bits(), 512u);
+  EXPECT_EQ(key.Modulus().Bits(), 512u);
+  EXPECT_FALSE(key.Generate(500, 65537, random));
+
+  DWORD size = 0;
+  ASSERT_TRUE(key.ToBlob(PRIVATEKEYBLOB, CALG_RSA_SIGN, nullptr, &size));
+  EXPECT_EQ(size, 20u + 64 * 2 + 32 * 5);
+  std::vector<BYTE> privateBlob(size);
+  ASSERT_TRUE(key.ToBlob(PRIVATEKEYBLOB,
+                         CALG_RSA_SIGN,
+                         privateBlob.data(),
+                         &size));
+  const auto header = reinterpret_cast<const BLOBHEADER*>(privateBlob.data());
+  const auto rsa = reinterpret_cast<const RSAPUBKEY*>(header + 1);
+  EXPECT_EQ(header->bType, PRIVATEKEYBLOB);
+  EXPECT_EQ(header->bVersion, CUR_BLOB_VERSION);
+  EXPECT_EQ(header->aiKeyAlg, ALG_ID(CALG_RSA_SIGN));
+  EXPECT_EQ(rsa->magic, 0x32415352u);
+  EXPECT_EQ(rsa->bitlen, 512u);
+  EXPECT_EQ(rsa->pubexp, 65537u);
+
+  size = 0;
+  ASSERT_TRUE(key.ToBlob(PUBLICKEYBLOB, CALG_RSA_SIGN, nullptr, &size));
+  EXPECT_EQ(size, 20u + 64);
+  std::vector<BYTE> publicBlob(size);
+  size = 10;
+  EXPECT_FALSE(key.ToBlob(PUBLICKEYBLOB,
+                          CALG_RSA_SIGN,
+                          publicBlob.data(),
+                          &size));
+  EXPECT_EQ(GetLastError(), DWORD(ERROR_MORE_DATA));
+  ASSERT_TRUE(key.ToBlob(PUBLICKEYBLOB,
+                         CALG_RSA_SIGN,
+                         publicBlob.data(),
+                         &size));
+  // The modulus of both blobs is the same little-endian bytes.
+  EXPECT_TRUE(std::equal(publicBlob.begin() + 20,
+                         publicBlob.end(),
+                         privateBlob.begin() + 20));
+  // And it is what KeyIndex fingerprints.
+  std::vector<BYTE> a, b;
+  ASSERT_TRUE(KeyIndex::Normalize(publicBlob.data(),
+                                  DWORD(publicBlob.size()),
+                                  a));
+  ASSERT_TRUE(KeyIndex::Normalize(privateBlob.data(),
+                                  DWORD(privateBlob.size()),
+                                  b));
+  EXPECT_EQ(a, b);
+
+  RsaKey restored, publicOnly;
+  ASSERT_TRUE(restored.FromBlob(privateBlob.data(), DWORD(privateBlob.size())));
+  ASSERT_TRUE(publicOnly.FromBlob(publicBlob.data(), DWORD(publicBlob.size())));
+  EXPECT_FALSE(publicOnly.HasPrivate());
+  EXPECT_FALSE(restored.FromBlob(privateBlob.data(), 100));
+
+  const auto digest = DigestOf(CALG_SHA1, "message");
+  std::vector<BYTE> signature(key.SignatureSize()), again(64);
+  ASSERT_TRUE(key.Sign(CALG_SHA1, digest.data(), 20, 0, signature.data()));
+  ASSERT_TRUE(restored.Sign(CALG_SHA1, digest.data(), 20, 0, again.data()));
+  EXPECT_EQ(signature, again);
+  EXPECT_TRUE(publicOnly.Verify(CALG_SHA1,
+                                digest.data(),
+                                20,
+                                0,
+                                signature.data(),
+                                64));
+  EXPECT_FALSE(publicOnly.Verify(CALG_SHA1,
+                                 digest.data(),
+                                 20,
+                                 CRYPT_NOHASHOID,
+                                 signature.data(),
+                                 64));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_SIGNATURE));
+  EXPECT_FALSE(publicOnly.Sign(CALG_SHA1, digest.data(), 20, 0, again.data()));
+
+  // PKCS#1 v1.5 is deterministic: the signature is little-endian, and its
+  // public operation reveals 00 01 FF .. FF 00 DigestInfo H.
+  std::reverse(signature.begin(), signature.end());
+  const BigNum em = BigNum::ModExp(
+    BigNum::FromBigEndian(signature.data(), signature.size()),
+    BigNum(65537),
+    key.Modulus());
+  std::vector<BYTE> encoded(64);
+  ASSERT_TRUE(em.ToBigEndian(encoded.data(), encoded.size()));
+  EXPECT_EQ(encoded[0], 0);
+  EXPECT_EQ(encoded[1], 1);
+  EXPECT_EQ(encoded[64 - 20 - 15 - 1], 0);
+  EXPECT_TRUE(std::equal(digest.begin(), digest.end(), encoded.end() - 20));
+}
+
+TEST_F(SoftProviderTest, SignAndVerify) {
+  CSP csp;
+  EXPECT_FALSE(csp.Acquire(L"signer", nullptr, PROV_RSA_AES, 0));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_KEYSET));
+  ASSERT_TRUE(csp.Acquire(L"signer", nullptr, PROV_RSA_AES, CRYPT_NEWKEYSET));
+  EXPECT_EQ(csp.GetUserKey(AT_SIGNATURE), HCRYPTKEY(NULL));
+  Key generated(csp.GenKey(AT_SIGNATURE, CRYPT_EXPORTABLE));
+  ASSERT_NE(HCRYPTKEY(generated), HCRYPTKEY(NULL));
+
+  Key user(csp.GetUserKey(AT_SIGNATURE));
+  auto publicBlob = user.Export(PUBLICKEYBLOB);
+  ASSERT_EQ(publicBlob.Size(), 20u + 64);
+  EXPECT_EQ(user.Export(PRIVATEKEYBLOB).Size(), 20u + 64 * 2 + 32 * 5);
+
+  Digest<SHA256Traits> digest = {1, 2, 3};
+  Signer<SHA256Traits> signer(csp, AT_SIGNATURE);
+  auto signature = signer.Sign(digest);
+  ASSERT_EQ(signature.Size(), 64u);
+
+  // Verify with the public key imported into a verification context.
+  CSP verifier;
+  ASSERT_TRUE(verifier.Acquire(nullptr,
+                               nullptr,
+                               PROV_RSA_AES,
+                               CRYPT_VERIFYCONTEXT));
+  HCRYPTKEY imported = NULL;
+  ASSERT_TRUE(CryptoProvider::Current().ImportKey(verifier,
+                                                  publicBlob,
+                                                  publicBlob.Size(),
+                                                  NULL,
+                                                  0,
+                                                  &imported));
+  Key publicKey(imported);
+  EXPECT_TRUE(signer.Verify(digest, signature, signature.Size(), publicKey));
+  digest[0] ^= 1;
+  EXPECT_FALSE(signer.Verify(digest, signature, signature.Size(), publicKey));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_SIGNATURE));
+
+  // Hashing the data through the provider gives the same digest as the
+  // portable digester.
+  const BYTE abc[] = {'a', 'b', 'c'};
+  Hash hash;
+  ASSERT_TRUE(hash.Create(csp, CALG_SHA1));
+  ASSERT_TRUE(hash.AddData(abc, sizeof(abc)));
+  auto value = hash.GetHashValue();
+  EXPECT_EQ(std::vector<BYTE>(LPBYTE(value), LPBYTE(value) + value.Size()),
+            DigestOf(CALG_SHA1, "abc"));
+  EXPECT_FALSE(hash.AddData(abc, sizeof(abc)));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_HASH_STATE));
+  EXPECT_FALSE(CryptoProvider::Current().SetHashParam(hash,
+                                                      HP_HASHVAL,
+                                                      nullptr,
+                                                      0));
+  EXPECT_EQ(GetLastError(), DWORD(ERROR_INVALID_PARAMETER));
+  EXPECT_FALSE(CryptoProvider::Current().SetHashParam(hash,
+                                                      HP_HASHVAL,
+                                                      value,
+                                                      1));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_FLAGS));
+  EXPECT_FALSE(hash.Create(csp, CALG_SHA_512));
+}
+
+TEST_F(SoftProviderTest, KeyState) {
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(L"fixed", nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+  Key generated(csp.GenKey(AT_KEYEXCHANGE, 768 << 16));
+  Key user(csp.GetUserKey(AT_KEYEXCHANGE));
+  auto publicBlob = user.Export(PUBLICKEYBLOB);
+  ASSERT_EQ(publicBlob.Size(), 20u + 96);
+  EXPECT_EQ(reinterpret_cast<const BLOBHEADER*>(LPBYTE(publicBlob))->aiKeyAlg,
+            ALG_ID(CALG_RSA_KEYX));
+  EXPECT_EQ(user.Export(PRIVATEKEYBLOB).Size(), 0u);
+  EXPECT_EQ(GetLastError(), DWORD(NTE_BAD_KEY_STATE));
+  EXPECT_EQ(csp.GetUserKey(AT_SIGNATURE), HCRYPTKEY(NULL));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_NO_KEY));
+
+  CSP again;
+  EXPECT_FALSE(again.Acquire(L"fixed", nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+  EXPECT_EQ(GetLastError(), DWORD(NTE_EXISTS));
+  ASSERT_TRUE(again.Acquire(L"fixed",
+                            nullptr,
+                            PROV_RSA_FULL,
+                            CRYPT_DELETEKEYSET));
+  EXPECT_FALSE(again.Acquire(L"fixed", nullptr, PROV_RSA_FULL, 0));
+}
+
+TEST_F(SoftProviderTest, Enumerate) {
+  const std::vector<std::wstring> names = {L"alpha", L"a-much-longer-name", L"b"};
+  for (const auto &name : names) {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(name.c_str(),
+                            nullptr,
+                            PROV_RSA_FULL,
+                            CRYPT_NEWKEYSET));
+    Key key(csp.GenKey(AT_SIGNATURE, 0));
+  }
+  CSP machine;
+  ASSERT_TRUE(machine.Acquire(L"machine-only",
+                              nullptr,
+                              PROV_RSA_FULL,
+                              CRYPT_NEWKEYSET | CRYPT_MACHINE_KEYSET));
+
+  CSP csp;
+  ASSERT_TRUE(csp.Acquire(nullptr, nullptr, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT));
+  auto &provider = CryptoProvider::Current();
+  DWORD maxLength = 0;
+  ASSERT_TRUE(provider.GetProvParam(csp,
+                                    PP_ENUMCONTAINERS,
+                                    nullptr,
+                                    &maxLength,
+                                    CRYPT_FIRST));
+  EXPECT_EQ(maxLength, 19u);
+
+  char name[32];
+  DWORD size = 2;
+  EXPECT_FALSE(provider.GetProvParam(csp,
+                                     PP_ENUMCONTAINERS,
+                                     reinterpret_cast<LPBYTE>(name),
+                                     &size,
+                                     CRYPT_FIRST));
+  EXPECT_EQ(GetLastError(), DWORD(ERROR_MORE_DATA));
+  std::vector<std::string> found;
+  for (DWORD flags = CRYPT_FIRST;; flags = CRYPT_NEXT) {
+    size = sizeof(name);
+    if (!provider.GetProvParam(csp,
+                               PP_ENUMCONTAINERS,
+                               reinterpret_cast<LPBYTE>(name),
+                               &size,
+                               flags)) {
+      EXPECT_EQ(GetLastError(), DWORD(ERROR_NO_MORE_ITEMS));
+      break;
+    }
+    found.push_back(name);
+  }
+  std::sort(found.begin(), found.end());
+  EXPECT_EQ(found, std::vector<std::string>({"a-much-longer-name",
+                                             "alpha",
+                                             "b"}));
+
+  KeyIndex index;
+  ASSERT_TRUE(index.Scan(nullptr, PROV_RSA_FULL, 0));
+  EXPECT_EQ(index.Size(), 3u);
+  EXPECT_EQ(index.ContainerCount(), 3u);
+}
+
+TEST_F(SoftProviderTest, DirectoryStore) {
+  const auto directory =
+    (std::filesystem::temp_directory_path() / "softprov-test").wstring();
+  std::filesystem::remove_all(directory);
+
+  SoftProviderConfig config = TestConfig();
+  config.directory = directory;
+  config.seed = 42;
+  Install(config);
+
+  Digest<SHA1Traits> digest = {9, 8, 7};
+  Blob signature, publicBlob;
+  {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"stored", nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+    Key key(csp.GenKey(AT_SIGNATURE, CRYPT_EXPORTABLE));
+    publicBlob = key.Export(PUBLICKEYBLOB);
+    signature = Signer<SHA1Traits>(csp, AT_SIGNATURE).Sign(digest);
+    ASSERT_EQ(signature.Size(), 64u);
+  }
+
+  // A new instance over the same directory sees the same key, and the same
+  // seed generates the same key again.
+  Install(config);
+  {
+    CSP csp;
+    ASSERT_TRUE(csp.Acquire(L"stored", nullptr, PROV_RSA_FULL, 0));
+    Key key(csp.GetUserKey(AT_SIGNATURE));
+    auto exported = key.Export(PUBLICKEYBLOB);
+    ASSERT_EQ(exported.Size(), publicBlob.Size());
+    EXPECT_EQ(memcmp(exported, publicBlob, exported.Size()), 0);
+    auto again = Signer<SHA1Traits>(csp, AT_SIGNATURE).Sign(digest);
+    EXPECT_EQ(memcmp(again, signature, signature.Size()), 0);
+
+    CSP other;
+    ASSERT_TRUE(other.Acquire(L"other", nullptr, PROV_RSA_FULL, CRYPT_NEWKEYSET));
+    Key same(other.GenKey(AT_SIGNATURE, 0));
+    auto sameBlob = same.Export(PUBLICKEYBLOB);
+    EXPECT_EQ(memcmp(sameBlob, publicBlob, sameBlob.Size()), 0);
+    ASSERT_TRUE(other.Acquire(L"other",
+                              nullptr,
+                              PROV_RSA_FULL,
+                              CRYPT_DELETEKEYSET));
+  }
+
+  // Files that only look like key files are skipped rather than decoded.
+  for (const wchar_t *stray : {L"u-zzzz.key", L"m-00g1.key", L"u-.key"}) {
+    std::ofstream(std::filesystem::path(directory) / stray) << "stray";
+  }
+  // A record claiming an impossible size is dropped before it is read.
+  {
+    const DWORD huge[] = {0x53505343, 1, AT_SIGNATURE, 0, 0xfffffff0};
+    std::ofstream out(std::filesystem::path(directory) / L"u-0062.key",
+                      std::ios::binary);
+    out.write(reinterpret_cast<const char*>(huge), sizeof(huge));
+  }
+  Install(config);
+  CSP csp;
+  EXPECT_TRUE(csp.Acquire(L"stored", nullptr, PROV_RSA_FULL, 0));
+  EXPECT_FALSE(csp.Acquire(L"other", nullptr, PROV_RSA_FULL, 0));
+  CSP huge;
+  ASSERT_TRUE(huge.Acquire(L"b", nullptr, PROV_RSA_FULL, 0));
+  HCRYPTKEY key = 0;
+  EXPECT_FALSE(CryptGetUserKey(huge, AT_SIGNATURE, &key));
+  std::filesystem::remove_all(directory);
+}
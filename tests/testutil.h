@@ -0,0 +1,71 @@
+// Shared by the tests: the headers that any test of the provider layer
+// needs, hex decoding for known-answer vectors, and a fixture that installs
+// an in-memory SoftProvider for the length of each test.
+//
+// Include it after the standard headers a test needs for itself and before
+// the headers of the module under test.
+
+#include <windows.h>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <bignum.h>
+#include <blob.h>
+#include <blobbuilder.h>
+#include <csp.h>
+#include <digest.h>
+#include <hash.h>
+#include <key.h>
+#include <provider.h>
+#include <rsa.h>
+#include <softprov.h>
+
+// "0a1b.." to bytes.  Vectors are written in lower case without separators.
+inline std::vector<BYTE> FromHex(const char *hex) {
+  std::vector<BYTE> bytes;
+  for (; hex[0] && hex[1]; hex += 2) {
+    bytes.push_back(static_cast<BYTE>(std::stoi(std::string(hex, 2),
+                                                nullptr,
+                                                16)));
+  }
+  return bytes;
+}
+
+// Installs a SoftProvider with 512-bit keys, which are quick to generate,
+// and puts back whatever was installed before when the test ends.
+class SoftProviderTest : public ::testing::Test {
+protected:
+  std::unique_ptr<SoftProvider> provider_;
+  CryptoProvider *previous_ = nullptr;
+
+  static SoftProviderConfig TestConfig() {
+    SoftProviderConfig config;
+    config.keyBits = 512;
+    return config;
+  }
+
+  // Replaces the installed SoftProvider with a new one over |config|.
+  void Install(const SoftProviderConfig &config) {
+    auto provider = std::make_unique<SoftProvider>(config);
+    CryptoProvider *replaced = CryptoProvider::Install(provider.get());
+    if (!provider_) previous_ = replaced;
+    provider_ = std::move(provider);
+  }
+
+  void SetUp() override {
+    Install(TestConfig());
+  }
+
+  void TearDown() override {
+    CryptoProvider::Install(previous_);
+  }
+};